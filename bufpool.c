@@ -0,0 +1,139 @@
+//=============================================================================
+//
+// This is the buffer pool module of the Interactive Endpoint project.
+// It holds the buffers that messages too large for the receive buffer of a connection are
+// received into. The buffers come in power of 2 size classes, and a few free buffers of each
+// class are kept for reuse, so a connection only holds a buffer the size of a large message
+// while it is receiving it, and a stream of large messages does not allocate each one.
+// The pool is shared by the reactor threads, so it is protected by a mutex (it is only used
+// for the large messages).
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "userio.h"     // for logmsg
+#include "bufpool.h"
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char * pool_free[BUFPOOL_CLASSES][BUFPOOL_KEEP]; // the free buffers of each size class
+static int    pool_count[BUFPOOL_CLASSES];              // number of free buffers of each size class
+static tBufPoolStatsStc pool_stats;
+
+/*
+ * Description:
+ * Returns the size class of the buffers that hold the given size.
+ *
+ * Inputs:
+ *   size - the number of bytes the buffer must hold
+ *
+ * *Returns:
+ *   the size class (-1 if too large for the pool)
+ */
+static int bufpool_class ( int size )
+{
+    int cls = 0;
+    while (cls < BUFPOOL_CLASSES && (1L << (BUFPOOL_MIN_SHIFT + cls)) < (long)size)
+        cls++;
+    return (cls < BUFPOOL_CLASSES) ? cls : -1;
+}
+
+/*
+ * Description:
+ * Gets a buffer that holds at least the given size, reusing a free buffer of its size class
+ * if one is kept.
+ *
+ * Inputs:
+ *   size - the number of bytes the buffer must hold
+ *
+ * *Returns:
+ *   the buffer (NULL if error)
+ */
+char * bufpool_get ( int size )
+{
+    int cls = bufpool_class (size);
+    if (cls < 0)
+        return NULL;
+    long bytes = 1L << (BUFPOOL_MIN_SHIFT + cls);
+
+    char * buffer = NULL;
+    pthread_mutex_lock (&pool_mutex);
+    pool_stats.gets++;
+    pool_stats.in_use += bytes;
+    if (pool_count[cls])
+    {
+        buffer = pool_free[cls][--pool_count[cls]];
+        pool_stats.kept -= bytes;
+    }
+    else
+    {
+        pool_stats.allocs++;
+    }
+    pthread_mutex_unlock (&pool_mutex);
+
+    if (buffer == NULL)
+    {
+        buffer = (char *)malloc (bytes);
+        if (buffer == NULL)
+        {
+            logmsg(PRINT_ERROR, "memory allocation for %ld byte message buffer\n", bytes);
+            pthread_mutex_lock (&pool_mutex);
+            pool_stats.in_use -= bytes;
+            pthread_mutex_unlock (&pool_mutex);
+        }
+    }
+    return buffer;
+}
+
+/*
+ * Description:
+ * Returns a buffer to the pool. It is kept for reuse, unless enough buffers of its size
+ * class are kept already.
+ *
+ * Inputs:
+ *   buffer - the buffer (from bufpool_get)
+ *   size   - the size the buffer was asked for with
+ *
+ * *Returns:
+ *   <none>
+ */
+void bufpool_put ( char * buffer, int size )
+{
+    if (buffer == NULL)
+        return;
+    int cls = bufpool_class (size);
+    long bytes = 1L << (BUFPOOL_MIN_SHIFT + cls);
+
+    pthread_mutex_lock (&pool_mutex);
+    pool_stats.in_use -= bytes;
+    if (pool_count[cls] < BUFPOOL_KEEP)
+    {
+        pool_free[cls][pool_count[cls]++] = buffer;
+        pool_stats.kept += bytes;
+        buffer = NULL;
+    }
+    pthread_mutex_unlock (&pool_mutex);
+
+    free (buffer);
+}
+
+/*
+ * Description:
+ * Returns the counts of the use of the buffer pool.
+ *
+ * Inputs:
+ *   stats - ptr to location to return the counts in
+ *
+ * *Returns:
+ *   <none>
+ */
+void bufpool_stats ( tBufPoolStatsStc * stats )
+{
+    pthread_mutex_lock (&pool_mutex);
+    *stats = pool_stats;
+    pthread_mutex_unlock (&pool_mutex);
+}
@@ -0,0 +1,25 @@
+//=============================================================================
+//
+// This contains the definitions, structures and function prototypes defined by the
+// buffer pool module of the Interactive Endpoint project.
+//
+//=============================================================================
+
+#define BUFPOOL_MIN_SHIFT   ( 16 )      // the smallest buffer is 64 KB (smaller messages fit in the receive buffers)
+#define BUFPOOL_CLASSES     ( 16 )      // buffer sizes 64 KB - 2 GB, each a power of 2
+#define BUFPOOL_KEEP        ( 4 )       // max number of free buffers kept in each size class
+
+// this counts the use of the buffer pool
+typedef struct
+{
+    unsigned long gets;     // number of buffers handed out
+    unsigned long allocs;   // number of buffers allocated (the rest were reused)
+    unsigned long in_use;   // number of bytes in the buffers handed out
+    unsigned long kept;     // number of bytes in the free buffers kept
+
+} tBufPoolStatsStc;
+
+// function prototypes:
+char * bufpool_get   ( int size );
+void   bufpool_put   ( char * buffer, int size );
+void   bufpool_stats ( tBufPoolStatsStc * stats );
@@ -0,0 +1,385 @@
+//=============================================================================
+//
+// This is the bulk throughput module of the Interactive Endpoint project.
+// A bulk test (started with the #b command) streams large messages to a server as fast as the
+// socket takes them, and the server sinks them without echoing them. Both sides measure the
+// goodput, the messages and the socket system calls per second and the CPU time of the thread
+// doing the work, and report them every interval, like iperf.
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+
+#include "userio.h"     // for logmsg
+#include "netio.h"
+#include "crc32c.h"
+#include "bulk.h"
+
+/*
+ * Description:
+ * Returns the number of seconds from one time to another.
+ *
+ * Inputs:
+ *   from - the earlier time
+ *   to   - the later time
+ *
+ * *Returns:
+ *   the time between them in seconds
+ */
+static double bulk_seconds ( const struct timespec * from, const struct timespec * to )
+{
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/*
+ * Description:
+ * Starts measuring one side of a bulk test (the totals are cleared). The CPU time is that of
+ * the calling thread, which must be the one streaming or sinking the messages.
+ *
+ * Inputs:
+ *   meter    - ptr to the meter
+ *   side     - "client" or "server", for the reports
+ *   port     - the port of the other endpoint, for the reports
+ *   interval - the reporting interval (msec)
+ *
+ * *Returns:
+ *   <none>
+ */
+void bulk_meter_start ( tBulkMeterStc * meter, const char * side, int port, int interval )
+{
+    memset (meter, 0, sizeof(tBulkMeterStc));
+    meter->side     = side;
+    meter->port     = port;
+    meter->interval = interval;
+    clock_gettime (CLOCK_MONOTONIC, &meter->start);
+    clock_gettime (CLOCK_THREAD_CPUTIME_ID, &meter->cpu_start);
+    meter->last     = meter->start;
+    meter->cpu_last = meter->cpu_start;
+}
+
+/*
+ * Description:
+ * Returns true if the reporting interval has passed since the last report (for the side that
+ * has no timer, and checks as the messages arrive).
+ *
+ * Inputs:
+ *   meter - ptr to the meter
+ *
+ * *Returns:
+ *   true if a report is due
+ */
+bool bulk_meter_due ( tBulkMeterStc * meter )
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (bulk_seconds (&meter->last, &now) * 1000.0 >= meter->interval);
+}
+
+/*
+ * Description:
+ * Displays the throughput since the last report (or, for the total, since the start): the
+ * goodput (payload bits per second), the messages and the socket system calls per second, and
+ * the CPU utilization of the thread (100% is one core busy the whole time).
+ *
+ * Inputs:
+ *   meter - ptr to the meter
+ *   total - true to display the totals of the test (the last report)
+ *
+ * *Returns:
+ *   <none>
+ */
+void bulk_meter_show ( tBulkMeterStc * meter, bool total )
+{
+    struct timespec now, cpu;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    clock_gettime (CLOCK_THREAD_CPUTIME_ID, &cpu);
+
+    const struct timespec * from     = total ? &meter->start : &meter->last;
+    const struct timespec * cpu_from = total ? &meter->cpu_start : &meter->cpu_last;
+    double secs  = bulk_seconds (from, &now);
+    double busy  = bulk_seconds (cpu_from, &cpu);
+    unsigned long msgs  = meter->msgs  - (total ? 0 : meter->last_msgs);
+    unsigned long bytes = meter->bytes - (total ? 0 : meter->last_bytes);
+    unsigned long calls = meter->calls - (total ? 0 : meter->last_calls);
+    if (secs <= 0) secs = 1e-9;
+
+    if (total)
+        logmsg(PRINT_QUERY, "bulk %s [port %u] total: %lu msgs, %lu bytes in %.2f sec = %.3f Gbps, %.0f msgs/s, %.0f syscalls/s, cpu %.0f%%\n",
+                meter->side, meter->port, msgs, bytes, secs, bytes * 8.0 / secs / 1e9, msgs / secs, calls / secs,
+                busy * 100.0 / secs);
+    else
+        logmsg(PRINT_QUERY, "bulk %s [port %u] %6.2f-%6.2f sec: %.3f Gbps, %.0f msgs/s, %.0f syscalls/s, cpu %.0f%%\n",
+                meter->side, meter->port, bulk_seconds (&meter->start, &meter->last), bulk_seconds (&meter->start, &now),
+                bytes * 8.0 / secs / 1e9, msgs / secs, calls / secs, busy * 100.0 / secs);
+
+    if (!total)
+    {
+        meter->last       = now;
+        meter->cpu_last   = cpu;
+        meter->last_msgs  = meter->msgs;
+        meter->last_bytes = meter->bytes;
+        meter->last_calls = meter->calls;
+    }
+}
+
+/*
+ * Description:
+ * Parses the parameters of the #b command:
+ *   #b[0] [s=<payload>] [d=<secs>] [i=<msec>]
+ * The payload is 1 MB and the interval 1 sec unless given, and a test with no duration runs
+ * until stopped. "#b" or "#b0" alone stops the running test.
+ *
+ * Inputs:
+ *   args - the command text following the "#b"
+ *   cfg  - ptr to location to return the parameters in
+ *
+ * *Returns:
+ *   0 if a test is to be started, 1 if the running test is to be stopped, -1 if error
+ */
+int bulk_parse ( const char * args, tBulkCfgStc * cfg )
+{
+    memset (cfg, 0, sizeof(tBulkCfgStc));
+    cfg->payload  = BULK_PAYLOAD_DEFAULT;
+    cfg->interval = BULK_INTERVAL_DEFAULT;
+
+    const char * cp = args;
+    while (*cp == ' ') cp++;
+    if (*cp == 0 || (cp[0] == '0' && cp[1] <= ' '))
+        return 1;
+
+    while (*cp)
+    {
+        char * end = (char *)cp;
+        if (cp[0] && cp[1] == '=')
+        {
+            const char * val = &cp[2];
+            switch (cp[0])
+            {
+                case 's': cfg->payload  = strtol (val, &end, 10); break;
+                case 'd': cfg->duration = strtod (val, &end);     break;
+                case 'i': cfg->interval = strtol (val, &end, 10); break;
+                default:
+                    logmsg(PRINT_ERROR, "invalid bulk test parameter: %c (must be s, d or i)\n", cp[0]);
+                    return -1;
+            }
+        }
+
+        if (end == cp || (*end != ' ' && *end != 0))
+        {
+            logmsg(PRINT_ERROR, "invalid bulk test parameters: %s\n", cp);
+            return -1;
+        }
+        cp = end;
+        while (*cp == ' ') cp++;
+    }
+
+    if (cfg->payload < 1 || cfg->payload > tcp_msg_limit)
+    {
+        logmsg(PRINT_ERROR, "bulk test payload must be within 1-%d bytes\n", tcp_msg_limit);
+        return -1;
+    }
+    if (cfg->duration < 0 || cfg->interval < BULK_MIN_INTERVAL)
+    {
+        logmsg(PRINT_ERROR, "bulk test duration can't be negative, and the interval must be at least %d msec\n", BULK_MIN_INTERVAL);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Description:
+ * Sets up a bulk test on a connection: builds the batch of frames and creates the reporting
+ * timer (it runs once the stream starts). The caller registers the timer with its event loop,
+ * sends the offer, and calls bulk_stream once the server has taken it.
+ *
+ * Inputs:
+ *   bulk - ptr to the bulk test
+ *   cfg  - the parameters of the test
+ *   port - the destination port of the connection
+ *   wire - the wire format of the connection (WIRE_xxx)
+ *   crc  - true if the connection sends the CRC32C of each message
+ *
+ * *Returns:
+ *   the timer descriptor, -1 if error
+ */
+int bulk_start ( tBulkStc * bulk, const tBulkCfgStc * cfg, int port, int wire, bool crc )
+{
+    memset (bulk, 0, sizeof(tBulkStc));
+    bulk->cfg  = *cfg;
+    bulk->port = port;
+    bulk->timerfd = -1;
+
+    // the payload is the same in every frame, so its CRC32C and the header are worked out once
+    char * payload = (char *)malloc (cfg->payload);
+    if (payload == NULL)
+    {
+        logmsg(PRINT_ERROR, "memory allocation for bulk test payload\n");
+        return -1;
+    }
+    for (int pos = 0; pos < cfg->payload; pos++)
+        payload[pos] = 'a' + pos % 26;
+    int  flags = crc ? WIRE_FLAG_CRC : 0;
+    char header[WIRE_HDR_MAX];
+    int  headlen = tcp_header_encode (wire, flags, cfg->payload, 0, crc ? crc32c (0, payload, cfg->payload) : 0, header);
+
+    bulk->frame_len = headlen + cfg->payload;
+    int frames = (BULK_BATCH_BYTES + bulk->frame_len - 1) / bulk->frame_len;
+    bulk->batch_len = frames * bulk->frame_len;
+    bulk->batch = (char *)malloc (bulk->batch_len);
+    if (bulk->batch == NULL)
+    {
+        logmsg(PRINT_ERROR, "memory allocation for bulk test frames\n");
+        free (payload);
+        return -1;
+    }
+    for (int ix = 0; ix < frames; ix++)
+    {
+        memcpy (&bulk->batch[ix * bulk->frame_len], header, headlen);
+        memcpy (&bulk->batch[ix * bulk->frame_len + headlen], payload, cfg->payload);
+    }
+    free (payload);
+
+    bulk->timerfd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (bulk->timerfd < 0)
+    {
+        logmsg(PRINT_ERROR, "timerfd_create: %s\n", strerror(errno));
+        free (bulk->batch);
+        bulk->batch = NULL;
+        return -1;
+    }
+
+    bulk->state = BULK_OFFERED;
+    logmsg(PRINT_QUERY, "bulk test offered (port %u): payload %d bytes (%d frames of %d bytes per batch), duration %.1f sec, interval %d msec\n",
+            port, cfg->payload, frames, bulk->frame_len, cfg->duration, cfg->interval);
+    return bulk->timerfd;
+}
+
+/*
+ * Description:
+ * Starts the stream of a bulk test, once the server has taken the offer: the throughput is
+ * measured from now, and the reporting timer is started.
+ *
+ * Inputs:
+ *   bulk - ptr to the bulk test
+ *
+ * *Returns:
+ *   <none>
+ */
+void bulk_stream ( tBulkStc * bulk )
+{
+    bulk_meter_start (&bulk->meter, "client", bulk->port, bulk->cfg.interval);
+    bulk->state = bulk->stopping ? BULK_ENDING : BULK_STREAMING;
+
+    struct itimerspec period;
+    period.it_interval.tv_sec  = bulk->cfg.interval / 1000;
+    period.it_interval.tv_nsec = (bulk->cfg.interval % 1000) * 1000000L;
+    period.it_value = period.it_interval;
+    timerfd_settime (bulk->timerfd, 0, &period, NULL);
+}
+
+/*
+ * Description:
+ * Sends the frames of a bulk test until the socket is full (or BULK_BURST_BYTES have been
+ * sent), continuing from where the last send stopped. Each send takes as much of the batch as
+ * the socket buffer has room for, so it usually ends partway through a frame; once the test is
+ * ending, only the rest of that frame is sent.
+ *
+ * Inputs:
+ *   bulk   - ptr to the bulk test (streaming or ending)
+ *   sockfd - the socket of the connection
+ *
+ * *Returns:
+ *   SEND_BLOCKED if the socket is full, SEND_COMPLETE if it may take more (writable is set) or,
+ *   when ending, the last frame is sent, SEND_FAILURE if error
+ */
+tSendMsgTyp bulk_send ( tBulkStc * bulk, int sockfd )
+{
+    long burst = 0;
+    bulk->writable = false;
+    while (burst < BULK_BURST_BYTES)
+    {
+        int len = bulk->batch_len - bulk->offset;
+        if (bulk->state == BULK_ENDING)
+        {
+            int partial = (int)(bulk->streamed % bulk->frame_len);
+            if (partial == 0)
+                return SEND_COMPLETE;
+            len = bulk->frame_len - partial; // (the batch holds whole frames, so it is all at offset)
+        }
+
+        bulk->meter.calls++;
+        tcp_syscall_count++;
+        ssize_t n = send (sockfd, &bulk->batch[bulk->offset], len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return SEND_BLOCKED;
+            return SEND_FAILURE;
+        }
+
+        bulk->offset += n;
+        if (bulk->offset == bulk->batch_len)
+            bulk->offset = 0;
+        bulk->streamed += n;
+        bulk->meter.msgs  = bulk->streamed / bulk->frame_len;
+        bulk->meter.bytes = bulk->meter.msgs * bulk->cfg.payload;
+        burst += n;
+
+        // a short write means the socket buffer is full
+        if (n < len) return SEND_BLOCKED;
+    }
+    bulk->writable = true;
+    return SEND_COMPLETE;
+}
+
+/*
+ * Description:
+ * Returns true if the duration of the bulk test has passed since the stream started.
+ *
+ * Inputs:
+ *   bulk - ptr to the bulk test
+ *
+ * *Returns:
+ *   true if the test is to end
+ */
+bool bulk_time_up ( tBulkStc * bulk )
+{
+    if (bulk->cfg.duration <= 0)
+        return false;
+
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (bulk_seconds (&bulk->meter.start, &now) >= bulk->cfg.duration);
+}
+
+/*
+ * Description:
+ * Stops the bulk test and displays its totals (if the stream was started). The caller removes
+ * the timer from its event loop first.
+ *
+ * Inputs:
+ *   bulk - ptr to the bulk test
+ *
+ * *Returns:
+ *   <none>
+ */
+void bulk_stop ( tBulkStc * bulk )
+{
+    if (bulk->state == BULK_IDLE) return;
+
+    if (bulk->state != BULK_OFFERED)
+        bulk_meter_show (&bulk->meter, true);
+    bulk->state = BULK_IDLE;
+    close (bulk->timerfd);
+    bulk->timerfd = -1;
+    free (bulk->batch);
+    bulk->batch = NULL;
+}
@@ -0,0 +1,93 @@
+//=============================================================================
+//
+// This contains the definitions, structures and function prototypes defined by the
+// bulk throughput module of the Interactive Endpoint project.
+//
+//=============================================================================
+
+#include <stdbool.h>
+#include <time.h>
+
+#define BULK_PAYLOAD_DEFAULT    ( 1 << 20 )     // default payload of the frames streamed (1 MB)
+#define BULK_INTERVAL_DEFAULT   ( 1000 )        // default reporting interval (msec)
+#define BULK_BATCH_BYTES        ( 256 * 1024 )  // the frames are sent from a batch of at least this many bytes
+#define BULK_BURST_BYTES        ( 16 << 20 )    // max bytes sent per call, so a socket that never fills does not starve the event loop
+#define BULK_MIN_INTERVAL       ( 10 )          // the shortest reporting interval (msec)
+
+// the client offers to stream a bulk test (sent with msgix BULK_MSGIX in the wire format of the
+// connection, with the reporting interval in msec). a server that takes the offer answers it,
+// and sinks the messages that follow without echoing them until the client ends the stream,
+// then answers with its totals. a server that does not know the offer echoes it, which declines it.
+#define BULK_MSGIX          ( -4 )
+#define BULK_OFFER          "bulk "     // client: "bulk <interval>", the messages after this one are to be sunk
+#define BULK_ACCEPT         "bulk ok"   // server: the messages are sunk
+#define BULK_END            "bulk end"  // client: the stream is over (the messages after this one are echoed)
+#define BULK_DONE           "bulk done" // server: "bulk done <msgs> <bytes> <recv calls>", the totals sunk
+
+// the states of a bulk test
+#define BULK_IDLE           ( 0 )       // no test
+#define BULK_OFFERED        ( 1 )       // the offer was sent, waiting for the answer of the server
+#define BULK_STREAMING      ( 2 )       // the frames are streamed
+#define BULK_ENDING         ( 3 )       // stopping: the frame being sent is finished, then the end is sent
+#define BULK_DRAINING       ( 4 )       // the end was sent, waiting for the totals of the server
+
+// this holds the parameters of a bulk test, given with the #b command:
+//   #b[0] [s=<payload>] [d=<secs>] [i=<msec>]
+typedef struct
+{
+    int    payload;         // the length of the messages streamed
+    double duration;        // number of seconds to stream for (0 for no limit)
+    int    interval;        // the reporting interval (msec)
+
+} tBulkCfgStc;
+
+// this measures the throughput of one side of a bulk test: the totals are updated by the
+// side streaming or sinking the messages, and shown each interval as rates over the interval
+typedef struct
+{
+    const char * side;      // "client" or "server", for the reports
+    int    port;            // the port of the other endpoint, for the reports
+    int    interval;        // the reporting interval (msec)
+    struct timespec start;  // when the test started
+    struct timespec last;   // when the last report was shown
+    struct timespec cpu_start; // the CPU time of the thread when the test started
+    struct timespec cpu_last;  // the CPU time of the thread at the last report
+    unsigned long msgs;     // number of messages streamed or sunk
+    unsigned long bytes;    // number of payload bytes streamed or sunk
+    unsigned long calls;    // number of socket system calls used
+    unsigned long last_msgs;  // the totals at the last report
+    unsigned long last_bytes;
+    unsigned long last_calls;
+
+} tBulkMeterStc;
+
+// this holds the bulk test streamed by the client. the frames (header and payload, in the wire
+// format of the connection) are built once, back to back in a batch, and the batch is sent
+// over and over, from where the last send stopped.
+typedef struct
+{
+    tBulkCfgStc cfg;        // the parameters of the test
+    int    state;           // the state of the test (BULK_xxx)
+    int    port;            // the destination port of the connection streamed on
+    int    timerfd;         // the reporting timer (-1 if not running)
+    char * batch;           // the frames
+    int    batch_len;       // the length of the batch (a whole number of frames)
+    int    frame_len;       // the length of each frame
+    int    offset;          // the position in the batch of the next byte to send
+    bool   stopping;        // true if the test was stopped before the server answered (it ends as soon as it does)
+    bool   writable;        // true if the last bulk_send did not fill the socket (the stream goes on without waiting for it)
+    unsigned long streamed; // number of bytes of the frames sent
+    tBulkMeterStc meter;    // the throughput of the stream
+
+} tBulkStc;
+
+// function prototypes:
+void bulk_meter_start ( tBulkMeterStc * meter, const char * side, int port, int interval );
+bool bulk_meter_due   ( tBulkMeterStc * meter );
+void bulk_meter_show  ( tBulkMeterStc * meter, bool total );
+int  bulk_parse ( const char * args, tBulkCfgStc * cfg );
+int  bulk_start ( tBulkStc * bulk, const tBulkCfgStc * cfg, int port, int wire, bool crc );
+void bulk_stream ( tBulkStc * bulk );
+tSendMsgTyp bulk_send ( tBulkStc * bulk, int sockfd );
+bool bulk_time_up ( tBulkStc * bulk );
+void bulk_stop  ( tBulkStc * bulk );
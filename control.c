@@ -0,0 +1,395 @@
+//=============================================================================
+//
+// This is the control socket module of the Interactive Endpoint project. A headless endpoint
+// (one run without the ncurses windows) takes its commands from the clients of a UNIX-domain
+// stream socket: each client sends command lines, and gets back one result line for each.
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "userio.h"     // for logmsg
+#include "control.h"
+
+/*
+ * Description:
+ * Initializes the control socket (none open, and no clients).
+ *
+ * Inputs:
+ *   control - the control socket
+ *
+ * *Returns:
+ *   <none>
+ */
+void control_init ( tControlStc * control )
+{
+    memset (control, 0, sizeof(tControlStc));
+    control->listenfd = -1;
+    for (int ix = 0; ix < CONTROL_MAX_CLIENTS; ix++)
+        control->clients[ix].fd = -1;
+}
+
+/*
+ * Description:
+ * Creates the (non-blocking) control socket, bound to a path. A socket file left at the path
+ * by an endpoint that did not exit cleanly is replaced.
+ *
+ * Inputs:
+ *   control - the control socket
+ *   path    - the path to bind it to
+ *
+ * *Returns:
+ *   the listen socket, -1 if error
+ */
+int control_listen ( tControlStc * control, const char * path )
+{
+    struct sockaddr_un addr;
+    memset (&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen (path) >= sizeof(addr.sun_path))
+    {
+        logmsg(PRINT_ERROR, "control socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy (addr.sun_path, path);
+    unlink (path);
+
+    int listenfd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenfd < 0 ||
+        bind (listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen (listenfd, CONTROL_MAX_CLIENTS) < 0)
+    {
+        logmsg(PRINT_ERROR, "control socket %s: %s\n", path, strerror(errno));
+        if (listenfd >= 0) close (listenfd);
+        return -1;
+    }
+
+    control->listenfd = listenfd;
+    strcpy (control->path, path);
+    return listenfd;
+}
+
+/*
+ * Description:
+ * Closes the control socket and its clients, and removes its path.
+ *
+ * Inputs:
+ *   control - the control socket
+ *
+ * *Returns:
+ *   <none>
+ */
+void control_close ( tControlStc * control )
+{
+    for (int ix = 0; ix < CONTROL_MAX_CLIENTS; ix++)
+        control_drop (&control->clients[ix]);
+    if (control->listenfd >= 0)
+    {
+        close (control->listenfd);
+        unlink (control->path);
+        control->listenfd = -1;
+    }
+}
+
+/*
+ * Description:
+ * Accepts the next client connecting to the control socket. A client beyond CONTROL_MAX_CLIENTS
+ * is closed as soon as it is accepted.
+ *
+ * Inputs:
+ *   control - the control socket
+ *
+ * *Returns:
+ *   the client (its socket non-blocking), NULL if no more are pending
+ */
+tControlClientStc * control_accept ( tControlStc * control )
+{
+    while (true)
+    {
+        int fd = accept4 (control->listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                logmsg(PRINT_ERROR, "control socket accept: %s\n", strerror(errno));
+            return NULL;
+        }
+
+        for (int ix = 0; ix < CONTROL_MAX_CLIENTS; ix++)
+        {
+            tControlClientStc * client = &control->clients[ix];
+            if (client->fd < 0)
+            {
+                client->fd       = fd;
+                client->events   = 0;
+                client->closed   = false;
+                client->failed   = false;
+                client->head     = 0;
+                client->used     = 0;
+                client->commands = 0;
+                client->out_used = 0;
+                logmsg(PRINT_SOCKET, "control client %d connected\n", ix);
+                return client;
+            }
+        }
+        logmsg(PRINT_WARNING, "control socket: more than %d clients, one refused\n", CONTROL_MAX_CLIENTS);
+        close (fd);
+    }
+}
+
+/*
+ * Description:
+ * Receives the bytes a control client has sent (as many as fit in its buffer). The lines are
+ * then taken with control_next_line. When the client has closed its end, it is marked closed.
+ *
+ * Inputs:
+ *   client - the control client (readable)
+ *
+ * *Returns:
+ *   <none>
+ */
+void control_recv ( tControlClientStc * client )
+{
+    // move the partial line left to the start of the buffer
+    if (client->head > 0)
+    {
+        memmove (client->buffer, &client->buffer[client->head], client->used - client->head);
+        client->used -= client->head;
+        client->head  = 0;
+    }
+    if (client->used == CONTROL_BUFSIZE)
+        return; // (the line is cut by control_next_line)
+
+    ssize_t count = recv (client->fd, &client->buffer[client->used], CONTROL_BUFSIZE - client->used, 0);
+    if (count > 0)
+    {
+        client->used += count;
+    }
+    else if (count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+    {
+        if (count < 0)
+            logmsg(PRINT_SOCKET, "control client recv: %s\n", strerror(errno));
+        client->closed = true;
+    }
+}
+
+/*
+ * Description:
+ * Takes the next complete command line received from a control client (without its newline).
+ * A line longer than the line buffer is cut, and one filling the whole receive buffer is taken
+ * as is.
+ *
+ * Inputs:
+ *   client - the control client
+ *   line   - ptr to location to return the line in
+ *   size   - the size of line
+ *
+ * *Returns:
+ *   true if a line was taken, false if no complete line is waiting
+ */
+bool control_next_line ( tControlClientStc * client, char * line, int size )
+{
+    char * start = &client->buffer[client->head];
+    int    avail = client->used - client->head;
+    char * end   = (char *)memchr (start, '\n', avail);
+    int    len;
+
+    if (end != NULL)
+        len = end - start;
+    else if (client->head == 0 && client->used == CONTROL_BUFSIZE)
+        len = avail;
+    else if (client->closed && avail > 0)
+        len = avail; // (the last line was not ended)
+    else
+        return false;
+
+    client->head += (end != NULL) ? len + 1 : len;
+    if (len > 0 && start[len - 1] == '\r') len--;
+    if (len > size - 1) len = size - 1;
+    memcpy (line, start, len);
+    line[len] = 0;
+    client->commands++;
+    return true;
+}
+
+/*
+ * Description:
+ * Closes the connection of a control client, and frees its entry. The client must have been
+ * removed from the event loop.
+ *
+ * Inputs:
+ *   client - the control client
+ *
+ * *Returns:
+ *   <none>
+ */
+void control_drop ( tControlClientStc * client )
+{
+    if (client->fd < 0) return;
+
+    logmsg(PRINT_SOCKET, "control client disconnected after %lu commands\n", client->commands);
+    close (client->fd);
+    client->fd = -1;
+}
+
+/*
+ * Description:
+ * Returns true if a control client has too many results waiting to be sent to take another
+ * command line (its lines are taken again once it has taken enough of its results).
+ *
+ * Inputs:
+ *   client - the control client
+ *
+ * *Returns:
+ *   true if no more lines can be taken from the client for now
+ */
+bool control_busy ( tControlClientStc * client )
+{
+    return (CONTROL_OUTSIZE - client->out_used < CONTROL_RESULT_MAX);
+}
+
+/*
+ * Description:
+ * Sends a result line to a control client (what it does not take now is kept, to be sent when
+ * its socket is writable). It must not be busy (see control_busy).
+ *
+ * Inputs:
+ *   client - the control client
+ *   text   - the result line (ended by a newline)
+ *   len    - the length of text (up to CONTROL_RESULT_MAX)
+ *
+ * *Returns:
+ *   <none>
+ */
+void control_reply ( tControlClientStc * client, const char * text, int len )
+{
+    if (len > CONTROL_OUTSIZE - client->out_used)
+        len = CONTROL_OUTSIZE - client->out_used; // (not busy, so it fits)
+    memcpy (&client->out[client->out_used], text, len);
+    client->out_used += len;
+    control_flush (client);
+}
+
+/*
+ * Description:
+ * Sends as many of the results waiting for a control client as its socket takes. If they
+ * can't be sent, the client is marked failed.
+ *
+ * Inputs:
+ *   client - the control client
+ *
+ * *Returns:
+ *   <none>
+ */
+void control_flush ( tControlClientStc * client )
+{
+    int sent = 0;
+    while (sent < client->out_used)
+    {
+        ssize_t count = send (client->fd, &client->out[sent], client->out_used - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (count > 0)
+        {
+            sent += count;
+            continue;
+        }
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            logmsg(PRINT_SOCKET, "control client send: %s\n", strerror(errno));
+            client->failed = true;
+        }
+        break;
+    }
+
+    if (sent > 0)
+    {
+        memmove (client->out, &client->out[sent], client->out_used - sent);
+        client->out_used -= sent;
+    }
+}
+
+/*
+ * Description:
+ * Writes a result line to the output of the command file (waiting until it is all written).
+ *
+ * Inputs:
+ *   fd   - the descriptor of the output
+ *   text - the result line (ended by a newline)
+ *   len  - the length of text
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+int control_write ( int fd, const char * text, int len )
+{
+    while (len > 0)
+    {
+        ssize_t count = write (fd, text, len);
+        if (count > 0)
+        {
+            text += count;
+            len  -= count;
+            continue;
+        }
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            struct pollfd pfd = { fd, POLLOUT, 0 };
+            poll (&pfd, 1, -1);
+            continue;
+        }
+        logmsg(PRINT_ERROR, "command result write: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Description:
+ * Formats a string as a JSON string value (quoted, with the quotes, backslashes and control
+ * chars escaped), for the result lines.
+ *
+ * Inputs:
+ *   text - ptr to location to format the value in
+ *   size - the size of text
+ *   str  - the string
+ *
+ * *Returns:
+ *   the length of the value formatted (cut to fit in text)
+ */
+int control_json_string ( char * text, int size, const char * str )
+{
+    int used = 0;
+    if (size < 3) return 0;
+
+    text[used++] = '"';
+    for (; *str && used < size - 8; str++)
+    {
+        unsigned char ch = (unsigned char)*str;
+        if (ch == '"' || ch == '\\')
+        {
+            text[used++] = '\\';
+            text[used++] = ch;
+        }
+        else if (ch < ' ')
+        {
+            used += snprintf (&text[used], size - used, "\\u%04x", ch);
+        }
+        else
+        {
+            text[used++] = ch;
+        }
+    }
+    text[used++] = '"';
+    text[used] = 0;
+    return used;
+}
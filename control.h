@@ -0,0 +1,60 @@
+//=============================================================================
+//
+// This contains the definitions, structures and function prototypes defined by the
+// control socket module of the Interactive Endpoint project.
+//
+//=============================================================================
+
+#include <stdbool.h>
+#include <sys/un.h>
+
+#define CONTROL_MAX_CLIENTS ( 8 )       // max number of control clients connected at once
+#define CONTROL_BUFSIZE     ( 16384 )   // size of the receive buffer of a client (many command lines)
+#define CONTROL_RESULT_MAX  ( 65536 )   // max length of a result line
+#define CONTROL_OUTSIZE     ( 2 * CONTROL_RESULT_MAX ) // size of the buffer of the results a client has not taken yet
+
+// this is a client connected to the control socket. the command lines it sends are taken from
+// its buffer as they are completed, and the result of each is sent back to it. the results it
+// has not taken yet are kept, and its lines are not taken while they could not be kept (so a
+// client sending its lines faster than it takes the results is slowed down, not dropped).
+typedef struct
+{
+    int  fd;                // the connected socket (-1 if the entry is free)
+    int  events;            // the events it is registered for with the event loop (EVLOOP_xxx)
+    bool closed;            // true when the client has closed its end (it is dropped once its results are sent)
+    bool failed;            // true if its results could not be sent (it is dropped)
+    int  head;              // position in buffer of the next line
+    int  used;              // number of bytes in buffer
+    unsigned long commands; // number of command lines taken from the client
+    int  out_used;          // number of bytes in out
+    char buffer[CONTROL_BUFSIZE];
+    char out[CONTROL_OUTSIZE];
+
+} tControlClientStc;
+
+// this is the UNIX-domain control socket of a headless endpoint, and its clients
+typedef struct
+{
+    int  listenfd;          // the listen socket (-1 if none)
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)]; // the path it is bound to (removed when closed)
+    tControlClientStc clients[CONTROL_MAX_CLIENTS];
+
+} tControlStc;
+
+// true if the event loop data is one of the control clients
+#define CONTROL_IS_CLIENT(control, data) \
+    ( (char *)(data) >= (char *)&(control)->clients[0] && (char *)(data) < (char *)&(control)->clients[CONTROL_MAX_CLIENTS] )
+
+// function prototypes:
+void control_init   ( tControlStc * control );
+int  control_listen ( tControlStc * control, const char * path );
+void control_close  ( tControlStc * control );
+tControlClientStc * control_accept ( tControlStc * control );
+void control_recv   ( tControlClientStc * client );
+bool control_next_line ( tControlClientStc * client, char * line, int size );
+void control_drop   ( tControlClientStc * client );
+bool control_busy   ( tControlClientStc * client );
+void control_reply  ( tControlClientStc * client, const char * text, int len );
+void control_flush  ( tControlClientStc * client );
+int  control_write  ( int fd, const char * text, int len );
+int  control_json_string ( char * text, int size, const char * str );
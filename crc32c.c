@@ -0,0 +1,178 @@
+//=============================================================================
+//
+// This is the CRC32C module of the Interactive Endpoint project.
+// It computes the CRC32C (Castagnoli) of the messages, which is sent with each message when
+// the integrity checks are on. On x86 processors with SSE4.2 the crc32 instruction does it 8
+// bytes at a time, and elsewhere the slicing-by-8 tables do it 8 bytes per table round.
+// The implementation is picked once, by crc32c_init().
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "crc32c.h"
+
+static uint32_t crc32c_table[8][256];   // the slicing-by-8 tables
+static uint32_t (*crc32c_impl) ( uint32_t crc, const void * data, size_t len ) = crc32c_sw;
+
+/*
+ * Description:
+ * Builds the slicing-by-8 tables, and picks the SSE4.2 implementation if the processor has
+ * it. This must be called before any thread computes a CRC.
+ *
+ * Inputs:
+ *   <none>
+ *
+ * *Returns:
+ *   <none>
+ */
+void crc32c_init ( void )
+{
+    uint32_t ix;
+    for (ix = 0; ix < 256; ix++)
+    {
+        uint32_t crc = ix;
+        int bit;
+        for (bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc32c_table[0][ix] = crc;
+    }
+    for (ix = 0; ix < 256; ix++)
+    {
+        int slice;
+        for (slice = 1; slice < 8; slice++)
+            crc32c_table[slice][ix] = (crc32c_table[slice - 1][ix] >> 8) ^ crc32c_table[0][crc32c_table[slice - 1][ix] & 0xFF];
+    }
+
+    crc32c_impl = crc32c_hw_available () ? crc32c_hw : crc32c_sw;
+}
+
+/*
+ * Description:
+ * Determines if the processor has the SSE4.2 crc32 instruction.
+ *
+ * Inputs:
+ *   <none>
+ *
+ * *Returns:
+ *   true if crc32c_hw can be used
+ */
+bool crc32c_hw_available ( void )
+{
+#if defined(__x86_64__)
+    return __builtin_cpu_supports ("sse4.2");
+#else
+    return false;
+#endif
+}
+
+/*
+ * Description:
+ * Computes the CRC32C of a block of data (or continues it), with the implementation picked
+ * by crc32c_init().
+ *
+ * Inputs:
+ *   crc  - the CRC32C of the data before this block (0 to start)
+ *   data - the data
+ *   len  - the number of bytes of data
+ *
+ * *Returns:
+ *   the CRC32C
+ */
+uint32_t crc32c ( uint32_t crc, const void * data, size_t len )
+{
+    return crc32c_impl (crc, data, len);
+}
+
+/*
+ * Description:
+ * Computes the CRC32C of a block of data with the slicing-by-8 tables: each round looks up the
+ * 8 bytes of a 64 bit word in the 8 tables, so the bytes don't depend on each other.
+ *
+ * Inputs:
+ *   crc  - the CRC32C of the data before this block (0 to start)
+ *   data - the data
+ *   len  - the number of bytes of data
+ *
+ * *Returns:
+ *   the CRC32C
+ */
+uint32_t crc32c_sw ( uint32_t crc, const void * data, size_t len )
+{
+    const unsigned char * bytes = (const unsigned char *)data;
+    crc = ~crc;
+
+    // the bytes up to a 64 bit boundary, then 8 bytes per round
+    while (len && ((uintptr_t)bytes & 7))
+    {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *bytes++) & 0xFF];
+        len--;
+    }
+    while (len >= 8)
+    {
+        uint64_t word;
+        memcpy (&word, bytes, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64 (word);
+#endif
+        word ^= crc;
+        crc = crc32c_table[7][ word        & 0xFF] ^ crc32c_table[6][(word >>  8) & 0xFF] ^
+              crc32c_table[5][(word >> 16) & 0xFF] ^ crc32c_table[4][(word >> 24) & 0xFF] ^
+              crc32c_table[3][(word >> 32) & 0xFF] ^ crc32c_table[2][(word >> 40) & 0xFF] ^
+              crc32c_table[1][(word >> 48) & 0xFF] ^ crc32c_table[0][ word >> 56];
+        bytes += 8;
+        len   -= 8;
+    }
+    while (len--)
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *bytes++) & 0xFF];
+
+    return ~crc;
+}
+
+/*
+ * Description:
+ * Computes the CRC32C of a block of data with the SSE4.2 crc32 instruction, 8 bytes at a time.
+ * It must only be used if crc32c_hw_available() (on other processors, it is crc32c_sw).
+ *
+ * Inputs:
+ *   crc  - the CRC32C of the data before this block (0 to start)
+ *   data - the data
+ *   len  - the number of bytes of data
+ *
+ * *Returns:
+ *   the CRC32C
+ */
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hw ( uint32_t crc, const void * data, size_t len )
+{
+    const unsigned char * bytes = (const unsigned char *)data;
+    uint64_t crc64 = ~crc;
+
+    while (len && ((uintptr_t)bytes & 7))
+    {
+        crc64 = __builtin_ia32_crc32qi ((uint32_t)crc64, *bytes++);
+        len--;
+    }
+    while (len >= 8)
+    {
+        uint64_t word;
+        memcpy (&word, bytes, 8);
+        crc64 = __builtin_ia32_crc32di (crc64, word);
+        bytes += 8;
+        len   -= 8;
+    }
+    while (len--)
+        crc64 = __builtin_ia32_crc32qi ((uint32_t)crc64, *bytes++);
+
+    return ~(uint32_t)crc64;
+}
+#else
+uint32_t crc32c_hw ( uint32_t crc, const void * data, size_t len )
+{
+    return crc32c_sw (crc, data, len);
+}
+#endif
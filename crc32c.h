@@ -0,0 +1,19 @@
+//=============================================================================
+//
+// This contains the definitions, structures and function prototypes defined by the
+// CRC32C module of the Interactive Endpoint project.
+//
+//=============================================================================
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define CRC32C_POLY         ( 0x82F63B78 )  // the Castagnoli polynomial (bit reversed)
+
+// function prototypes:
+void     crc32c_init ( void );
+uint32_t crc32c      ( uint32_t crc, const void * data, size_t len );
+uint32_t crc32c_sw   ( uint32_t crc, const void * data, size_t len );
+uint32_t crc32c_hw   ( uint32_t crc, const void * data, size_t len );
+bool     crc32c_hw_available ( void );
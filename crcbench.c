@@ -0,0 +1,190 @@
+//=============================================================================
+//
+// This is the CRC32C benchmark of the Interactive Endpoint project.
+// It checks the CRC32C implementations against the standard check value, then measures the
+// cost per byte of each of them (the SSE4.2 crc32 instruction and the slicing-by-8 tables)
+// over a range of message sizes, the cost of the integrity check of a received message.
+//
+// The command is issued as: "crcbench [-t <msec>]"
+//  -t  the time to spend on each implementation and size (default 200 msec)
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "crc32c.h"
+
+#define BENCH_CHECK_VALUE   ( 0xE3069283 )  // the CRC32C of "123456789"
+#define BENCH_MAX_SIZE      ( 1 << 20 )
+
+typedef uint32_t (*tCrcFn) ( uint32_t crc, const void * data, size_t len );
+
+/*
+ * Description:
+ * Returns the current time, for timing the CRC computations.
+ *
+ * Inputs:
+ *   <none>
+ *
+ * *Returns:
+ *   the CLOCK_MONOTONIC time in nsec
+ */
+static double bench_now ( void )
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/*
+ * Description:
+ * Checks an implementation against the standard check value, and against the bitwise
+ * definition for blocks of every alignment and length up to 64 bytes (split in two parts,
+ * to check that a CRC can be continued).
+ *
+ * Inputs:
+ *   name - the name of the implementation
+ *   fn   - the implementation
+ *   data - data to compute the CRCs of (at least 128 bytes)
+ *
+ * *Returns:
+ *   true if all the CRCs are correct
+ */
+static bool bench_verify ( const char * name, tCrcFn fn, const unsigned char * data )
+{
+    if (fn (0, "123456789", 9) != BENCH_CHECK_VALUE)
+    {
+        printf ("  %-8s wrong check value 0x%08X\n", name, fn (0, "123456789", 9));
+        return false;
+    }
+
+    int offset, len;
+    for (offset = 0; offset < 8; offset++)
+    {
+        for (len = 0; len <= 64; len++)
+        {
+            uint32_t crc = 0xFFFFFFFF;
+            int ix, bit;
+            for (ix = 0; ix < len; ix++)
+            {
+                crc ^= data[offset + ix];
+                for (bit = 0; bit < 8; bit++)
+                    crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+            }
+            crc = ~crc;
+            if (fn (0, &data[offset], len) != crc || fn (fn (0, &data[offset], len / 3), &data[offset + len / 3], len - len / 3) != crc)
+            {
+                printf ("  %-8s wrong CRC at offset %d, length %d\n", name, offset, len);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Description:
+ * Measures the cost of an implementation for a message size.
+ *
+ * Inputs:
+ *   fn    - the implementation
+ *   data  - the message
+ *   size  - the size of the message
+ *   msec  - the time to run for
+ *
+ * *Returns:
+ *   the time per byte (nsec)
+ */
+static double bench_run ( tCrcFn fn, const unsigned char * data, int size, int msec )
+{
+    volatile uint32_t sink = 0;
+    long   bytes = 0;
+    double start = bench_now ();
+    double elapsed;
+    do
+    {
+        int ix;
+        for (ix = 0; ix < 64; ix++)
+            sink += fn (0, data, size);
+        bytes += 64L * size;
+        elapsed = bench_now () - start;
+    }
+    while (elapsed < msec * 1e6);
+
+    return elapsed / bytes;
+}
+
+int main ( int argc, char * argv[] )
+{
+    int msec = 200;
+    int option;
+    while ((option = getopt(argc, argv, "t:")) != -1)
+    {
+        switch (option)
+        {
+            case 't' : msec = atoi(optarg); break;
+            default :
+                fprintf(stderr," ! ERROR, usage: %s [-t <msec>]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (msec <= 0)
+    {
+        fprintf(stderr," ! ERROR, invalid time\n");
+        exit(1);
+    }
+
+    unsigned char * data = (unsigned char *)malloc (BENCH_MAX_SIZE);
+    if (data == NULL)
+    {
+        fprintf(stderr," ! ERROR, memory allocation for the messages\n");
+        exit(1);
+    }
+    unsigned seed = 12345;
+    int ix;
+    for (ix = 0; ix < BENCH_MAX_SIZE; ix++)
+    {
+        seed = seed * 1103515245 + 12345;
+        data[ix] = (unsigned char)(seed >> 16);
+    }
+
+    crc32c_init ();
+    const char * names[2] = { "sse4.2", "slice-8" };
+    tCrcFn fns[2] = { crc32c_hw, crc32c_sw };
+    int first = crc32c_hw_available () ? 0 : 1;
+    if (first)
+        printf ("the processor has no SSE4.2 crc32 instruction: the slicing-by-8 tables are used\n");
+
+    bool verified = true;
+    for (ix = first; ix < 2; ix++)
+        verified = bench_verify (names[ix], fns[ix], data) && verified;
+    if (!verified)
+        return 1;
+
+    printf ("CRC32C cost per byte in nsec (and GB/sec), %d msec per result:\n", msec);
+    printf ("  %8s", "size");
+    for (ix = first; ix < 2; ix++)
+        printf ("  %18s", names[ix]);
+    printf ("\n");
+
+    int size;
+    for (size = 64; size <= BENCH_MAX_SIZE; size *= 4)
+    {
+        printf ("  %8d", size);
+        for (ix = first; ix < 2; ix++)
+        {
+            double ns = bench_run (fns[ix], data, size, msec);
+            printf ("  %7.3f (%6.2f GB/s)", ns, 1.0 / ns);
+        }
+        printf ("\n");
+        fflush (stdout);
+    }
+
+    free (data);
+    return 0;
+}
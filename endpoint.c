@@ -1,13 +1,53 @@
 // A simple server using non-blocking TCP sockets.
 //
-// The command is issued as: "endpoint <port>"
+// The command is issued as: "endpoint [-e] [-u] [-f] [-p <workers>] [-t <threads>] [-l] [-r] [-b <backlog>] [-m] [-s <bytes>] [-w <version>] [-c] [-z] [-B <bytes>] [-S <usec>] [-x <file>] [-k <path>] <port>"
 // where <port> is the port to use for the server connection.
+//  -e  register sockets edge-triggered with the event engine (default is level-triggered)
+//  -u  use the io_uring I/O backend for accepting and serving client connections (implies -f)
+//  -f  fork a child process to serve each client connection
+//  -p  pre-fork this many worker processes at startup, each running an event loop serving many
+//      client connections. the main thread accepts the connections and passes each one to the
+//      worker with the fewest connections over a UNIX socketpair (SCM_RIGHTS). not with -f, -u or -r.
+//  -t  the number of reactor threads serving the client connections (default is one per core)
+//  -l  assign each client connection to the reactor thread with the fewest connections
+//      (default is round robin)
+//  -r  each reactor thread accepts connections on its own SO_REUSEPORT listen socket, and the
+//      kernel balances the connections across them (default is the main thread accepting them)
+//  -b  the listen backlog of the server sockets (default is SOMAXCONN)
+//  -m  offer a shared memory link to each endpoint this endpoint connects to, so the messages
+//      to an endpoint on the same host bypass TCP (the server takes the offer unless it uses
+//      -u, and the connection stays on TCP if it does not)
+//  -s  the largest message accepted (default 16 MB). the messages typed in are up to 255 chars,
+//      but the load test and the other endpoints may send messages up to this size
+//  -w  the wire format offered to each endpoint this endpoint connects to (default 2). the
+//      v2 headers are compact and independent of the byte order, and a corrupted one is
+//      skipped rather than closing the connection. a server that does not take the offer
+//      (one using -u, or not knowing v2) stays on v1, and so does a shared memory link.
+//  -c  with the v2 wire format, send the CRC32C of each message and ask the server to send
+//      the CRC32C of each response. the messages that fail the check are counted and dropped.
+//  -z  echo the byte stream of each client connection with splice(), so it never enters user
+//      space (the messages are not parsed, so the clients stay on v1 and on TCP). not with -u.
+//  -B  the send and receive buffer sizes asked for on the sockets (default is the system's, which
+//      autotunes them). the client connections take them from the server listen socket.
+//  -S  busy-poll the sockets for the lowest latency: the event loops are polled without sleeping,
+//      a forked child spins on non-blocking reads of its socket, and the main thread spins on the
+//      connection of the ping-pong test. TCP_NODELAY is set on the sockets, and SO_BUSY_POLL for
+//      the time given (usec, 0 for none). each spinning thread takes a core, so use -t to limit
+//      the reactor threads (the io_uring children of -u still wait for their completions).
+//  -x  run headless (without the ncurses windows), running the commands in the file ("-" for
+//      stdin) as fast as they can be read. the endpoint exits at the end of the file (unless -k).
+//  -k  run headless, taking the commands of the clients connecting to the UNIX-domain socket
+//      at the path (each client sends command lines and gets back a result for each)
+//
+// Unless -f or -p is specified, the client connections are served by a fixed pool of reactor
+// threads, each running its own event loop over its share of the connections.
 //
 // Connections may be added and removed by specifying the appropriate command
 // listed below, and messages can be sent to those connections. When a new
 // connection is specified, an additional socket is opened up for communicating
 // with the other endpoint server. The server always echoes the message back to
-// the sender, pre-pended with the message count received from that connection.
+// the sender, with the message index the sender gave it, so the sender can match the
+// responses to its messages and measure their round-trip times.
 //
 // The commands are:
 //      #+<port>   create a socket for connecting to the specified server port & connect to it.
@@ -16,9 +56,41 @@
 //      #q         terminate the server
 //      #d         display connection list
 //      #p<flags>  select the messages the terminal displays
+//      #l         display the round-trip time percentiles of the client connections (#l0 also clears them)
+//      #t[<count>] [r=<rate>] [s=<size>[-<max>]] [n=<count>] [d=<secs>] [c=<endpoints>]
+//                 start a load test: send messages open-loop at the rate (msgs/sec, default as fast
+//                 as possible) with payloads of the size (or uniformly within the size range,
+//                 default 100 bytes), until the count or duration is reached (default until
+//                 stopped with #t0), spread over the active endpoint and the next c-1 connections
+//      #b[0] [s=<payload>] [d=<secs>] [i=<msec>]
+//                 start a bulk test on the active connection: stream messages of the payload size
+//                 (default 1 MB) as fast as the socket takes them, for the duration (default until
+//                 stopped with #b0). the server sinks them without echoing them, and both sides
+//                 report the goodput (Gbps), messages/sec, socket syscalls/sec and CPU use of the
+//                 thread doing the work every interval (default 1000 msec), then the totals.
+//                 not on a shared memory link (the server must not be using -u or -z).
+//      #r[<count>] [s=<size>]
+//                 start a ping-pong test on the active connection: send one message of the size
+//                 (default 64 bytes), and the next as soon as its echo is back, for the count of
+//                 round trips (default 10000, #r0 stops it), then show the round trips per second
+//                 and the distribution of the round-trip times. TCP_NODELAY is set on the connection.
+//      #w[<msec>] stop taking the lines of the command file for the time, or until the load, bulk or
+//                 ping-pong test is done
+//      #j         return the statistics of the connections and the load test (in the result)
 //
 // Any other text will attempt to be sent to the current active port.
 //
+// Headless, the log messages are written to stderr, and the result of each command to stdout
+// (for the command file) or to the control client, as one JSON line, e.g.
+//      {"seq":3,"cmd":"#s5102","ok":false,"error":"connection not found"}
+// where seq counts the commands of the file or client. A command succeeds once it is started
+// (the connection of #+ may still be pending, see #j). The lines of a control client are not
+// taken while it has too many results waiting, so a client must read its results.
+//
+// With ncurses, the status window shows each client connection's responses and response bytes
+// per second, send queue depth, blocked sends and round-trip time percentiles (p50/p99), updated
+// twice a second. The windows are redrawn at most 20 times a second, however busy the endpoint is.
+//
 // TODO:
 // - the main thread needs to determine when the child process has terminated to remove its connections.
 // - allow selection of protocol (TCP, SCTP, UDP)
@@ -33,7 +105,10 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/wait.h>
+#include <sys/timerfd.h>
 #include <sys/types.h> 
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -42,19 +117,29 @@
 
 #include "userio.h"
 #include "netio.h"
-
-// max message to be sent/received
-#define MAX_MESSAGE_LEN     ( 255 )
-
-// this is the linked list entry for a connection for this server
-typedef struct t_BufferStc
-{
-    struct t_BufferStc * next;
-    int    msgix;       // the messages index for this endpoint
-    int    msglen;      // length of message in bytes
-    char * buffer;      // message contents
-
-} tBufferStc;
+#include "msgqueue.h"
+#include "bufpool.h"
+#include "evloop.h"
+#include "uring.h"
+#include "shmlink.h"
+#include "bulk.h"
+#include "reactor.h"
+#include "workers.h"
+#include "hashidx.h"
+#include "loadgen.h"
+#include "rtthist.h"
+#include "pingpong.h"
+#include "crc32c.h"
+#include "control.h"
+
+// the keys of the server connections in their index: the process id of the child serving the
+// connection, or the reactor thread or worker process and session index (above the range of process ids)
+#define SERVER_KEY_PID(pid)             ( (unsigned long)(pid) )
+#define SERVER_KEY_SLOT(thread, slot)   ( (1UL << 40) | ((unsigned long)(thread) << 20) | (unsigned long)(slot) )
+#define SERVER_KEY_WORKER(worker, slot) ( (2UL << 40) | ((unsigned long)(worker) << 20) | (unsigned long)(slot) )
+
+// the status window is updated this often (its text is drawn at the next frame of the display)
+#define STATUS_PERIOD_MSEC              ( 500 )
 
 // this is the linked list entry for a connection for this server
 typedef struct t_ServerStc
@@ -62,7 +147,10 @@ typedef struct t_ServerStc
     struct t_ServerStc * next;
     struct t_ServerStc * prev;
     bool   valid;       // true if entry is valid
-    pid_t  pid;         // the process id handling the connection
+    pid_t  pid;         // the process id handling the connection (0 if served by a reactor thread or a worker)
+    int    thread;      // the reactor thread serving the connection (-1 if not)
+    int    worker;      // the pre-forked worker process serving the connection (-1 if not)
+    int    slot;        // the session index within the reactor thread or worker
     int    port;        // the client port it is connected to
 
 } tServerStc;
@@ -80,22 +168,51 @@ typedef struct t_ConnectStc
     int  sntix;         // the number of messages sent     by this endpoint
     int  rspix;         // the number of messages received by this endpoint
     int  pndix;         // the number of times a message send would have blocked
-    tBufferStc msglast; // 'next' contains ptr to the last message in send queue (to add messages to)
-    tBufferStc msgfirst; // 'next' contains ptr to the first message in send queue (next msg to send)
+    bool wr_armed;      // true if the event loop is reporting write readiness for the socket
+    tRecvBufStc rbuf;   // the responses received from the server
+    tSendStatsStc send_stats; // the messages sent and the sendmsg calls used
+    tMsgQueueStc sendq; // the messages waiting to be sent
+    tRttHistStc rtt;    // the round-trip times of the messages (matched to the responses by msgix)
+    tShmLinkStc shm;    // the shared memory link to the server (if offered with -m)
+    bool wire_offered;  // true while the v2 wire format is offered to the server (messages are held)
+    unsigned long rsp_bytes;    // the number of bytes of the responses received
+    int  status_rspix;  // rspix at the last status update (for the rates)
+    unsigned long status_bytes; // rsp_bytes at the last status update
 
 } tConnectStc;
 
 // globals
 tServerStc   first_conn_srv;  // this is the ptr to the 1st & last entries of the linked list of received connections
 tConnectStc  first_conn_req;  // this is the ptr to the 1st & last entries of the linked list of requested connections
-int print_flag = PRINT_ALL;   // this holds the log message selections for printing to the user
+tHashIdxStc  conn_srv_index;  // the received connections by SERVER_KEY_xxx
+tHashIdxStc  conn_req_index;  // the requested connections by destination port
+tEvLoopStc   main_loop;       // the event loop for the keyboard, server listen and endpoint sockets
+tUringStc    accept_ring;     // the io_uring instance accepting client connections (io_uring backend only)
+tReactorPoolStc reactor_pool; // the reactor threads serving the client connections (unless forking a child per connection)
+tWorkerPoolStc worker_pool;   // the pre-forked worker processes serving the client connections (-p)
+tLoadGenStc  load_gen;        // the load test started with the #t command
+tBulkStc     bulk_test;       // the bulk test started with the #b command
+tPingPongStc ping_test;       // the ping-pong test started with the #r command
+bool         use_shm;         // true if the connections offer a shared memory link (-m)
+int          wire_version = WIRE_V2; // the wire format the connections offer (-w)
+bool         use_crc;         // true if the connections send and ask for the CRC32C of the messages (-c)
+int          shm_listenfd = -1; // the socket the servers take the shared memory links from (-m only)
+int          spare_fd = -1;   // held in reserve to drop the pending connections when out of descriptors
+uint64_t     status_time;     // when the status was last updated (nsec)
+tControlStc  control;         // the control socket taking the commands of a headless endpoint (-k)
+char evtag_input, evtag_server, evtag_uring, evtag_reactor, evtag_loadgen, evtag_shm, evtag_status, evtag_control, evtag_hold, evtag_bulk, evtag_backoff;
+                                        // event data tags identifying the keyboard, server listen, io_uring, reactor notification,
+                                        // load test timer, shared memory, status timer, control socket, #w wait timer and bulk
+                                        // test timer descriptors
 
 // function prototypes:
-void remove_term (char * buffer, int size );
 const char * show_state ( int state );
 void init_all_connections  ( void );
 void close_all_connections ( void );
 void show_all_connections  ( void );
+void show_latency ( bool clear );
+void show_status ( void );
+int  show_stats_json ( char * text, int size );
 
 // these maintain the linked list of connections this endpoint makes to other endpoints (servers)
 void init_connections ( void );
@@ -103,49 +220,62 @@ void fini_connections ( void );
 tConnectStc * find_connection ( int destport );
 tConnectStc * add_connection  ( int destport, struct hostent * server );
 void rem_connection ( int destport );
-void set_connection_select ( fd_set * psock_set, int * descriptor );
+void set_connection_events ( tConnectStc * connection );
+void close_connection ( tConnectStc * connection );
+
+// these negotiate the shared memory links and the wire format with the servers
+bool start_shm_link ( tConnectStc * connection );
+bool start_wire_offer ( tConnectStc * connection );
+void give_shm_links ( void );
+static bool take_shm_answer ( tConnectStc * connection, const char * answer, int answer_len );
+static bool take_wire_answer ( tConnectStc * connection, const char * answer, int answer_len );
 
 // these maintain the linked list of connections to this server
 void init_server_links ( void );
 void fini_server_links ( void );
-void add_server_link  ( pid_t pid, int port );
+void add_server_link  ( pid_t pid, int thread, int worker, int slot, int port );
 void stop_server_link ( pid_t pid );
 void rem_server_link  ( pid_t pid );
+void rem_server_slot  ( int thread, int slot );
+void rem_server_worker ( int worker, int slot );
+static void unlink_server_link ( tServerStc * connection );
 
 // buffer queue functions
-int  send_message ( tConnectStc * connection, char * buffer );
-int  add_message ( tBufferStc * firstptr, tBufferStc * lastptr, int msgix, const char * buffer );
-void rem_message ( tBufferStc * firstptr, tBufferStc * lastptr );
-tBufferStc * get_message ( tBufferStc * firstptr, tBufferStc * lastptr );
+int  send_message ( tConnectStc * connection, const char * buffer, int msglen, uint64_t sched );
+bool receive_responses ( tConnectStc * connection, bool shm );
+
+// these run the load test
+bool start_load_test ( tConnectStc * current, const char * args );
+void run_load_test   ( tConnectStc ** current );
+void stop_load_test  ( void );
+
+// these run the bulk test
+bool start_bulk_test ( tConnectStc ** current, const char * args );
+bool run_bulk_test   ( tConnectStc * connection );
+void check_bulk_test ( bool expired, tConnectStc ** current );
+void stop_bulk_test  ( void );
+static bool bulk_sending ( tConnectStc * connection );
+static bool take_bulk_answer ( tConnectStc * connection, const char * answer, int answer_len );
+
+// these run the ping-pong test
+bool start_pingpong_test ( tConnectStc ** current, const char * args );
+void spin_pingpong_test  ( tConnectStc ** current );
+void stop_pingpong_test  ( void );
+static bool send_ping ( tConnectStc * connection );
+
+// these run the commands (typed in, read from the command file or received on the control socket)
+const char * run_command ( int command, int value, const char * buffer, tConnectStc ** current,
+                           struct hostent * server, int * recv_delay, bool * running );
+void report_result ( int fd, tControlClientStc * client, unsigned long seq, const char * line, int command, const char * error );
 
 // the server's child thread(s) for handling client endpoints
-void child_handle_client ( int clientsock, int client_port, bool recv_delay );
+void fork_client_handler ( int serversock, int clientsock, int client_port, bool recv_delay, bool edge, bool uring );
+void child_handle_client ( int clientsock, int client_port, bool recv_delay, bool edge );
+void child_handle_client_uring ( int clientsock, int client_port, bool recv_delay );
 
 // signal handler for processing the child's death
 void sigchld_handler (int sig);
 
-/*
- * Description:
- * NULL-terminates the string at the first control char in the string.
- * Guarantees that the string is terminated for the specified array size.
- *
- * Inputs:
- *   buffer - ptr to string to NULL-terminate & remove line termination chars from
- *   size   - the size of the string array (including NULL-term allocation)
- *
- * *Returns:
- *   <none>
- */
-void remove_term (char * buffer, int size )
-{
-    if (buffer == NULL) return;
-    if (size < 2) return;
-    int ix;
-    for (ix = 0; ix < size - 1; ix++)
-        if (buffer[ix] < ' ') break;
-    buffer[ix] = 0; // remove any termination chars
-}
-
 /*
  * Description:
  * Converts the connection state parameter into a string.
@@ -223,9 +353,23 @@ void show_all_connections ( void )
         logmsg(PRINT_QUERY, "  destport %d, sendport %d, sockfd %d, state %s, msgs (%d:%d:%d) blocked %d\n",
                 endpt->destport, endpt->sendport, endpt->sockfd, show_state(endpt->state),
                 endpt->msgix, endpt->sntix, endpt->rspix, endpt->pndix);
-        tBufferStc * qentry = &endpt->msgfirst;
-        for (qentry = qentry->next; qentry != NULL; qentry = qentry->next)
-            logmsg(PRINT_QUERY, "      %d : %s\n", qentry->msgix, qentry->buffer);
+        logmsg(PRINT_QUERY, "    sendmsg calls %lu (%ld saved by batching), queue depth %u (high %u)\n",
+                endpt->send_stats.calls, (long)endpt->send_stats.msgs - (long)endpt->send_stats.calls,
+                msgqueue_depth(&endpt->sendq), endpt->sendq.high_water);
+        logmsg(PRINT_QUERY, "    wire v%d%s, %.1f header bytes/msg sent, %lu resyncs (%lu bytes skipped)\n",
+                endpt->sendq.wire, endpt->wire_offered ? " (v2 offered)" : "",
+                endpt->send_stats.msgs ? (double)endpt->sendq.header_bytes / endpt->send_stats.msgs : 0.0,
+                endpt->rbuf.resyncs, endpt->rbuf.resync_bytes);
+        if (endpt->sendq.crc || endpt->rbuf.crc_checked)
+            logmsg(PRINT_QUERY, "    CRC32C: %s, %lu responses checked, %lu mismatches (dropped)\n",
+                    endpt->sendq.crc ? "sent" : "not sent", endpt->rbuf.crc_checked, endpt->rbuf.crc_errors);
+        if (endpt->shm.state != SHM_NONE)
+            logmsg(PRINT_QUERY, "    shared memory link %s, server woken %lu times\n",
+                    (endpt->shm.state == SHM_ACTIVE) ? "active" : "offered", endpt->shm.wakeups);
+        tMsgDescStc * qentry;
+        unsigned qix;
+        for (qix = 0; (qentry = get_message (&endpt->sendq, qix)) != NULL; qix++)
+            logmsg(PRINT_QUERY, "      %d : %.*s\n", qentry->msgix, qentry->msglen, msgqueue_data (&endpt->sendq, qentry));
     }
 
     logmsg(PRINT_QUERY, "server connections:\n");
@@ -234,12 +378,217 @@ void show_all_connections ( void )
     {
         if (connection->valid)
         {
-            logmsg(PRINT_QUERY, "  client port %d, pid %d\n", connection->port, (int)connection->pid);
-//            tBufferStc * qentry = &connection->msgfirst;
-//            for (qentry = qentry->next; qentry != NULL; qentry = qentry->next)
-//                logmsg(PRINT_QUERY, "      %d : %s\n", qentry->msgix, qentry->buffer);
+            if (connection->pid)
+                logmsg(PRINT_QUERY, "  client port %d, pid %d\n", connection->port, (int)connection->pid);
+            else if (connection->worker >= 0)
+                logmsg(PRINT_QUERY, "  client port %d, worker %d (pid %d) slot %d\n", connection->port, connection->worker,
+                        (int)worker_pool.workers[connection->worker].pid, connection->slot);
+            else
+                logmsg(PRINT_QUERY, "  client port %d, thread %d slot %d\n", connection->port, connection->thread, connection->slot);
+        }
+    }
+
+    if (reactor_pool.count)
+    {
+        logmsg(PRINT_QUERY, "reactor threads:\n");
+        reactor_pool_show (&reactor_pool);
+    }
+
+    if (worker_pool.count)
+    {
+        logmsg(PRINT_QUERY, "worker processes:\n");
+        worker_pool_show (&worker_pool);
+    }
+
+    if (load_gen.running)
+        loadgen_show (&load_gen);
+
+    tBufPoolStatsStc pool_stats;
+    bufpool_stats (&pool_stats);
+    if (pool_stats.gets)
+        logmsg(PRINT_QUERY, "large message buffers: %lu used (%lu allocated), %lu KB in use, %lu KB kept\n",
+                pool_stats.gets, pool_stats.allocs, pool_stats.in_use / 1024, pool_stats.kept / 1024);
+
+    tLogStatsStc log_stats;
+    logmsg_stats (&log_stats);
+    logmsg(PRINT_QUERY, "log: %lu messages displayed, %lu dropped, max delay %.3f msec\n",
+            log_stats.records, log_stats.dropped, log_stats.max_lag);
+}
+
+/*
+ * Description:
+ * Formats a rate compactly (with a k, M or G multiplier), for the status window.
+ *
+ * Inputs:
+ *   value  - the rate
+ *   text   - ptr to location to format the rate in
+ *   size   - the size of text
+ *
+ * *Returns:
+ *   text
+ */
+static const char * show_rate ( double value, char * text, int size )
+{
+    const char * scale = " kMG";
+    while (value >= 1000.0 && scale[1])
+    {
+        value /= 1000.0;
+        scale++;
+    }
+    if (*scale == ' ')
+        snprintf (text, size, "%.0f", value);
+    else
+        snprintf (text, size, "%.*f%c", (value < 100.0) ? 1 : 0, value, *scale);
+    return text;
+}
+
+/*
+ * Description:
+ * Updates the status window (called every STATUS_PERIOD_MSEC): for each client connection,
+ * the responses and response bytes per second since the last update, the send queue depth,
+ * the number of sends that would have blocked, and the round-trip time percentiles (p50/p99).
+ * The lines are kept short, since the status window is narrow.
+ *
+ * Inputs:
+ *   <none>
+ *
+ * *Returns:
+ *   <none>
+ */
+void show_status ( void )
+{
+    char text[STATUS_TEXT_MAX], rate[16], bytes[16];
+    int used = 0;
+
+    uint64_t now = rtthist_now ();
+    double secs = status_time ? (now - status_time) / 1e9 : 0.0;
+    status_time = now;
+
+    int conns = 0, servers = 0;
+    tConnectStc * endpt;
+    tServerStc * link;
+    for (endpt = first_conn_req.next; endpt != NULL; endpt = endpt->next) conns++;
+    for (link = first_conn_srv.next; link != NULL; link = link->next) servers += link->valid;
+    used += snprintf (&text[used], sizeof(text) - used, "clients %d srv %d\n", conns, servers);
+    if (load_gen.running)
+        used += snprintf (&text[used], sizeof(text) - used, "load test running\n");
+
+    for (endpt = first_conn_req.next; endpt != NULL && used < (int)sizeof(text) - 128; endpt = endpt->next)
+    {
+        double msgs = secs > 0.0 ? (endpt->rspix - endpt->status_rspix) / secs : 0.0;
+        double size = secs > 0.0 ? (endpt->rsp_bytes - endpt->status_bytes) / secs : 0.0;
+        endpt->status_rspix = endpt->rspix;
+        endpt->status_bytes = endpt->rsp_bytes;
+
+        used += snprintf (&text[used], sizeof(text) - used, "\nport %d %s\n", endpt->destport, show_state(endpt->state));
+        used += snprintf (&text[used], sizeof(text) - used, " %s msg/s %sB/s\n",
+                show_rate (msgs, rate, sizeof(rate)), show_rate (size, bytes, sizeof(bytes)));
+        used += snprintf (&text[used], sizeof(text) - used, " queue %u blk %d\n", msgqueue_depth(&endpt->sendq), endpt->pndix);
+        if (endpt->rtt.samples)
+            used += snprintf (&text[used], sizeof(text) - used, " rtt %.0f/%.0f us\n",
+                    rtthist_percentile (&endpt->rtt, 50.0) / 1000.0, rtthist_percentile (&endpt->rtt, 99.0) / 1000.0);
+    }
+
+    userio_set_status (text);
+}
+
+/*
+ * Description:
+ * Displays the round-trip time percentiles of the client connections, along with their
+ * message counts.
+ *
+ * Inputs:
+ *   clear - true to clear the round-trip times recorded after displaying them
+ *
+ * *Returns:
+ *   <none>
+ */
+void show_latency ( bool clear )
+{
+    logmsg(PRINT_QUERY, "client round-trip times:\n");
+    tConnectStc * endpt;
+    for (endpt = first_conn_req.next; endpt != NULL; endpt = endpt->next)
+    {
+        logmsg(PRINT_QUERY, "  destport %d, state %s, msgs (%d:%d:%d) blocked %d\n",
+                endpt->destport, show_state(endpt->state), endpt->msgix, endpt->sntix, endpt->rspix, endpt->pndix);
+        rtthist_show (&endpt->rtt);
+        if (clear)
+            rtthist_reset (&endpt->rtt);
+    }
+}
+
+/*
+ * Description:
+ * Formats the statistics of the endpoint as JSON members, for the result of the #j command:
+ * the counts of each client connection with its round-trip time percentiles (nsec), the number
+ * of server connections, and the progress of the load test (the last one, if none is running).
+ * The client connections that don't fit in text are left out (and "truncated" is set).
+ *
+ * Inputs:
+ *   text - ptr to location to format the members in (starting with a ',')
+ *   size - the size of text
+ *
+ * *Returns:
+ *   the length of the members formatted
+ */
+int show_stats_json ( char * text, int size )
+{
+    int used = 0;
+    bool truncated = false;
+
+    used += snprintf (&text[used], size - used, ",\"connections\":[");
+    tConnectStc * endpt;
+    for (endpt = first_conn_req.next; endpt != NULL; endpt = endpt->next)
+    {
+        if (used > size - 1024)
+        {
+            truncated = true;
+            break;
         }
+        used += snprintf (&text[used], size - used,
+                "%s{\"port\":%d,\"state\":\"%s\",\"created\":%d,\"sent\":%d,\"responses\":%d,\"blocked\":%d,"
+                "\"queue\":%u,\"response_bytes\":%lu,\"wire\":%d,\"shm\":%s,\"crc_errors\":%lu,\"resyncs\":%lu,",
+                (endpt == first_conn_req.next) ? "" : ",", endpt->destport, show_state(endpt->state),
+                endpt->msgix, endpt->sntix, endpt->rspix, endpt->pndix, msgqueue_depth(&endpt->sendq), endpt->rsp_bytes,
+                endpt->sendq.wire, (endpt->shm.state == SHM_ACTIVE) ? "true" : "false", endpt->rbuf.crc_errors, endpt->rbuf.resyncs);
+        tRttHistStc * rtt = &endpt->rtt;
+        if (rtt->samples)
+            used += snprintf (&text[used], size - used,
+                    "\"rtt\":{\"samples\":%lu,\"min\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}}",
+                    rtt->samples, (unsigned long long)rtt->min,
+                    (unsigned long long)rtthist_percentile (rtt, 50.0), (unsigned long long)rtthist_percentile (rtt, 90.0),
+                    (unsigned long long)rtthist_percentile (rtt, 99.0), (unsigned long long)rtthist_percentile (rtt, 99.9),
+                    (unsigned long long)rtt->max);
+        else
+            used += snprintf (&text[used], size - used, "\"rtt\":{\"samples\":0}}");
+    }
+
+    int servers = 0;
+    tServerStc * link;
+    for (link = first_conn_srv.next; link != NULL; link = link->next) servers += link->valid;
+    used += snprintf (&text[used], size - used,
+            "],\"truncated\":%s,\"servers\":%d,\"load_test\":{\"running\":%s,\"sent\":%lu,\"skipped\":%lu,\"bytes\":%lu},"
+            "\"bulk_test\":{\"running\":%s,\"port\":%d,\"msgs\":%lu,\"bytes\":%lu},"
+            "\"pingpong\":{\"running\":%s,\"port\":%d,\"round_trips\":%ld,\"min\":%llu,\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}",
+            truncated ? "true" : "false", servers, load_gen.running ? "true" : "false",
+            load_gen.sent, load_gen.skipped, load_gen.bytes, (bulk_test.state != BULK_IDLE) ? "true" : "false",
+            bulk_test.port, bulk_test.meter.msgs, bulk_test.meter.bytes, ping_test.running ? "true" : "false",
+            ping_test.port, ping_test.replies, (unsigned long long)ping_test.rtt.min,
+            (unsigned long long)rtthist_percentile (&ping_test.rtt, 50.0), (unsigned long long)rtthist_percentile (&ping_test.rtt, 99.0),
+            (unsigned long long)rtthist_percentile (&ping_test.rtt, 99.9), (unsigned long long)ping_test.rtt.max);
+
+    // the connections of each worker process (-p)
+    used += snprintf (&text[used], size - used, ",\"workers\":[");
+    int ix;
+    for (ix = 0; ix < worker_pool.count && used < size - 128; ix++)
+    {
+        tWorkerStc * worker = &worker_pool.workers[ix];
+        used += snprintf (&text[used], size - used, "%s{\"pid\":%d,\"lost\":%s,\"connections\":%d,\"reported\":%d,\"accepts\":%lu,\"msgs\":%lu}",
+                ix ? "," : "", (int)worker->pid, worker->lost ? "true" : "false", worker->load, worker->sessions,
+                worker->accepts, worker->msgs);
     }
+    used += snprintf (&text[used], size - used, "]");
+    return (used < size) ? used : size - 1;
 }
 
 /*
@@ -256,6 +605,7 @@ void init_connections ( void )
 {
     first_conn_req.next = NULL;
     first_conn_req.prev = NULL;
+    hashidx_init (&conn_req_index);
 }
 
 /*
@@ -276,18 +626,18 @@ void fini_connections ( void )
     {
         logmsg(PRINT_OTHER, "closing and removing connection to port %u\n", connection->destport);
         tConnectStc * prev = connection;
-        close (connection->sockfd);
         connection = connection->next;
-        free(prev);
+        close_connection (prev);
     }
 
     first_conn_req.next = NULL;
     first_conn_req.prev = NULL;
+    hashidx_fini (&conn_req_index);
 }
 
 /*
  * Description:
- * Finds the endpoint connection from the linked list that has the specified destination port.
+ * Finds the endpoint connection that has the specified destination port.
  *
  * Inputs:
  *   destport - the destination port for the connection
@@ -297,14 +647,7 @@ void fini_connections ( void )
  */
 tConnectStc * find_connection ( int destport )
 {
-    tConnectStc * endpt;
-    for (endpt = first_conn_req.next; endpt != NULL; endpt = endpt->next)
-    {
-        if (endpt->destport == destport)
-            return endpt;
-    }
-
-    return NULL;
+    return (tConnectStc *)hashidx_find (&conn_req_index, (unsigned long)destport);
 }
 
 /*
@@ -340,7 +683,7 @@ tConnectStc * add_connection ( int destport, struct hostent * server )
     int sockfd, retcode, state;
 
     // create a sending socket
-    sockfd = tcp_create_socket(0); // make this a client socket
+    sockfd = tcp_create_socket(0, 0, false); // make this a client socket
     if (sockfd < 0)
     {
         free(connection);
@@ -359,12 +702,46 @@ tConnectStc * add_connection ( int destport, struct hostent * server )
     connection->sockfd   = sockfd;
     connection->destport = destport;
     connection->state    = state;
-    connection->msgfirst.next = NULL;
-    connection->msglast.next  = NULL;
+    msgqueue_init (&connection->sendq);
+    connection->sendq.crc = use_crc && wire_version == WIRE_V2; // (until the server declines v2)
+    rtthist_init (&connection->rtt);
+    shm_link_init (&connection->shm);
+    connection->wire_offered = false;
+    connection->sendport = 0;
     connection->msgix    = 0;
     connection->sntix    = 0;
     connection->rspix    = 0;
     connection->pndix    = 0;
+    connection->rsp_bytes    = 0;
+    connection->status_rspix = 0;
+    connection->status_bytes = 0;
+    connection->send_stats.msgs  = 0;
+    connection->send_stats.calls = 0;
+    if (tcp_recvbuf_init (&connection->rbuf, TCP_RECV_BUFSIZE) < 0)
+    {
+        free(connection);
+        close(sockfd);
+        return NULL;
+    }
+
+    // register with the event loop. write readiness signals completion of a pending connect.
+    connection->wr_armed = (state == STATE_PENDING);
+    if (evloop_add (&main_loop, sockfd, EVLOOP_READ | (connection->wr_armed ? EVLOOP_WRITE : 0), connection) < 0)
+    {
+        tcp_recvbuf_fini (&connection->rbuf);
+        free(connection);
+        close(sockfd);
+        return NULL;
+    }
+
+    if (hashidx_insert (&conn_req_index, (unsigned long)destport, connection) != 0)
+    {
+        evloop_del (&main_loop, sockfd);
+        tcp_recvbuf_fini (&connection->rbuf);
+        free(connection);
+        close(sockfd);
+        return NULL;
+    }
 
     // Now for the linked list maintenance...
     // we add the entry to the end of the list
@@ -386,6 +763,10 @@ tConnectStc * add_connection ( int destport, struct hostent * server )
         connection->prev = 0;  // this indicates there are no entries before this
     }
 
+    // a connection completed at once offers the shared memory link now (otherwise when the connect completes)
+    if (connection->state == STATE_READY && !start_shm_link (connection))
+        return NULL;
+
     return connection;
 }
 
@@ -402,68 +783,97 @@ tConnectStc * add_connection ( int destport, struct hostent * server )
  */
 void rem_connection ( int destport )
 {
-    tConnectStc * connection;
-    for (connection = first_conn_req.next; connection != NULL; connection = connection->next)
+    tConnectStc * connection = (tConnectStc *)hashidx_remove (&conn_req_index, (unsigned long)destport);
+    if (connection == NULL)
     {
-        if (connection->destport == destport)
-        {
-            logmsg(PRINT_OTHER, "closing and removing connection to port %u\n", connection->destport);
-            if (connection->sockfd >= 0)
-                close (connection->sockfd);
-
-            tConnectStc * next = connection->next;
-            tConnectStc * prev = connection->prev;
-            if ((next == 0) && (prev == 0)) // removing only entry in list
-            {
-                first_conn_req.next = 0;
-                first_conn_req.prev = 0;
-            }
-            else if (prev == 0) // removing 1st entry in list
-            {
-                first_conn_req.next = next;
-                next->prev = 0;
-            }
-            else if (next == 0) // removing last entry in list
-            {
-                first_conn_req.prev = prev;
-                prev->next = 0;
-            }
-            else // removing entry in the middle
-            {
-                next->prev = prev;
-                prev->next = next;
-            }
-            free(connection);
-            return;
-        }
+        logmsg(PRINT_ERROR, "Connection to %u not found\n", destport);
+        return;
     }
 
-    logmsg(PRINT_ERROR, "Connection to %u not found\n", destport);
+    logmsg(PRINT_OTHER, "closing and removing connection to port %u\n", connection->destport);
+    tConnectStc * next = connection->next;
+    tConnectStc * prev = connection->prev;
+    if ((next == 0) && (prev == 0)) // removing only entry in list
+    {
+        first_conn_req.next = 0;
+        first_conn_req.prev = 0;
+    }
+    else if (prev == 0) // removing 1st entry in list
+    {
+        first_conn_req.next = next;
+        next->prev = 0;
+    }
+    else if (next == 0) // removing last entry in list
+    {
+        first_conn_req.prev = prev;
+        prev->next = 0;
+    }
+    else // removing entry in the middle
+    {
+        next->prev = prev;
+        prev->next = next;
+    }
+    close_connection (connection);
 }
 
 /*
  * Description:
- * Traverses the active endpoint connection linked list and adds the socket descriptor to the
- * specified 'select' descriptor set. It also updates the max descriptor value if necessary,
- * so 'select' function will be monitoring all necessary sockets.
+ * Closes the endpoint client socket (and its shared memory link) and frees the connection
+ * entry, which must already be removed from the linked list. A bulk or ping-pong test on it
+ * is stopped. Any events for the connection still in the ready list of the main loop are
+ * cleared.
  *
  * Inputs:
- *   psock_set - ptr to the 'select' descriptor set of all descriptors it is monitoring
- *   maxfd     - ptr to the max descriptor value
+ *   connection - ptr to the connection info
  *
  * *Returns:
  *   <none>
  */
-void set_connection_select ( fd_set * psock_set, int * maxfd )
+void close_connection ( tConnectStc * connection )
 {
-    // recurse through all connections and add the active connections to the socket set to scan
-    tConnectStc * connection;
-    for (connection = first_conn_req.next; connection != NULL; connection = connection->next)
+    if (bulk_test.state != BULK_IDLE && bulk_test.port == connection->destport)
+        stop_bulk_test ();
+    if (ping_test.running && ping_test.port == connection->destport)
+        stop_pingpong_test ();
+    if (connection->shm.state == SHM_ACTIVE)
+        evloop_del (&main_loop, connection->shm.wakefd);
+    shm_link_close (&connection->shm);
+    if (connection->sockfd >= 0)
     {
-        FD_SET (connection->sockfd, psock_set); // add endpoint socket to vector if valid
-        if (*maxfd < connection->sockfd)   // make sure descriptor has the largest value
-            *maxfd = connection->sockfd;
+        evloop_del (&main_loop, connection->sockfd);
+        close (connection->sockfd);
     }
+    msgqueue_fini (&connection->sendq);
+    rtthist_fini (&connection->rtt);
+    tcp_recvbuf_fini (&connection->rbuf);
+    evloop_forget (&main_loop, connection);
+    evloop_forget (&main_loop, SHM_DOORBELL_TAG(connection));
+    free(connection);
+}
+
+/*
+ * Description:
+ * Updates the events the event loop reports for the endpoint socket. Write readiness is only
+ * armed while a connect is pending, messages are waiting in the send queue for the socket or
+ * a bulk test is streamed on it, so a writable socket with nothing to send does not keep
+ * waking the main loop (messages waiting for the shared memory link are sent when the server
+ * rings its doorbell).
+ *
+ * Inputs:
+ *   connection - ptr to the connection info
+ *
+ * *Returns:
+ *   <none>
+ */
+void set_connection_events ( tConnectStc * connection )
+{
+    bool want_write = (connection->state == STATE_PENDING) || bulk_sending (connection) ||
+                      (connection->shm.state == SHM_NONE && msgqueue_depth(&connection->sendq) != 0);
+    if (want_write == connection->wr_armed)
+        return; // no change needed
+
+    if (evloop_mod (&main_loop, connection->sockfd, EVLOOP_READ | (want_write ? EVLOOP_WRITE : 0), connection) == 0)
+        connection->wr_armed = want_write;
 }
 
 /*
@@ -480,6 +890,7 @@ void init_server_links ( void )
 {
     first_conn_srv.next = NULL;
     first_conn_srv.prev = NULL;
+    hashidx_init (&conn_srv_index);
 }
 
 /*
@@ -497,7 +908,7 @@ void fini_server_links ( void )
     tServerStc * server = first_conn_srv.next;
     while (server != NULL)
     {
-        if (server->valid)
+        if (server->valid && server->pid)
         {
             logmsg(PRINT_OTHER, "removing child pid %d (port %u)\n", (int)server->pid, server->port);
             kill(server->pid, SIGKILL);
@@ -510,6 +921,45 @@ void fini_server_links ( void )
 
     first_conn_srv.next = NULL;
     first_conn_srv.prev = NULL;
+    hashidx_fini (&conn_srv_index);
+}
+
+/*
+ * Description:
+ * Returns the key of a server connection in the server connection index.
+ *
+ * Inputs:
+ *   connection - the server connection entry
+ *
+ * *Returns:
+ *   the key
+ */
+static unsigned long server_key ( tServerStc * connection )
+{
+    if (connection->pid)
+        return SERVER_KEY_PID(connection->pid);
+    if (connection->worker >= 0)
+        return SERVER_KEY_WORKER(connection->worker, connection->slot);
+    return SERVER_KEY_SLOT(connection->thread, connection->slot);
+}
+
+/*
+ * Description:
+ * Blocks or unblocks the SIGCHLD handler while the server connection index is changed, since
+ * the handler looks up the children in the index.
+ *
+ * Inputs:
+ *   block - true to block the signal, false to unblock it
+ *
+ * *Returns:
+ *   <none>
+ */
+static void block_sigchld ( bool block )
+{
+    sigset_t mask;
+    sigemptyset (&mask);
+    sigaddset (&mask, SIGCHLD);
+    sigprocmask (block ? SIG_BLOCK : SIG_UNBLOCK, &mask, NULL);
 }
 
 /*
@@ -517,24 +967,45 @@ void fini_server_links ( void )
  * Adds the server connection link to the linked list of server connections.
  *
  * Inputs:
- *   pid  - process id of the child handling the server data connection
- *   port - client port that connected to the server
+ *   pid    - process id of the child handling the server data connection (0 if a reactor thread or a worker)
+ *   thread - the reactor thread serving the connection (-1 if not)
+ *   worker - the pre-forked worker process serving the connection (-1 if not)
+ *   slot   - the session index within the reactor thread or worker
+ *   port   - client port that connected to the server
  *
  * *Returns:
  *   <none>
  */
-void add_server_link ( pid_t pid, int port )
+void add_server_link ( pid_t pid, int thread, int worker, int slot, int port )
 {
-    tServerStc * last = first_conn_srv.prev;
     tServerStc * connection = (tServerStc *)malloc (sizeof(tServerStc));
     if (connection)
     {
         connection->port = port;
         connection->pid  = pid;
+        connection->thread = thread;
+        connection->worker = worker;
+        connection->slot = slot;
         connection->valid = true;
 
+        // (only children are looked up by the SIGCHLD handler)
+        if (pid) block_sigchld (true);
+
+        // an entry left for a child that was stopped has the same key if its process id was reused
+        tServerStc * stale = (tServerStc *)hashidx_find (&conn_srv_index, server_key (connection));
+        if (stale)
+            unlink_server_link (stale);
+
+        if (hashidx_insert (&conn_srv_index, server_key (connection), connection) != 0)
+        {
+            if (pid) block_sigchld (false);
+            free(connection);
+            return;
+        }
+
         // Now for the linked list maintenance...
         // we add the entry to the end of the list
+        tServerStc * last = first_conn_srv.prev;
         first_conn_srv.prev = connection;  // this points to the last entry
         connection->next = 0;  // this indicates there are no entries after this
 
@@ -552,6 +1023,7 @@ void add_server_link ( pid_t pid, int port )
             first_conn_srv.next = connection;  // this points to the 1st entry
             connection->prev = 0;  // this indicates there are no entries before this
         }
+        if (pid) block_sigchld (false);
     }
     else
     {
@@ -571,264 +1043,1255 @@ void add_server_link ( pid_t pid, int port )
  */
 void stop_server_link ( pid_t pid )
 {
-    tServerStc * connection;
-    for (connection = first_conn_srv.next; connection != NULL; connection = connection->next)
+    tServerStc * connection = (tServerStc *)hashidx_find (&conn_srv_index, SERVER_KEY_PID(pid));
+    if (connection)
     {
-        if (connection->pid == pid)
-        {
-            logmsg(PRINT_OTHER, "pid %d connection stopped\n", pid);
-            connection->valid = false;
-        }
+        logmsg(PRINT_OTHER, "pid %d connection stopped\n", pid);
+        connection->valid = false;
     }
 }
 
 /*
  * Description:
- * Removes the specified server connection from the linked list of server connections.
+ * Unlinks the server connection entry from the linked list and the index of server connections
+ * and frees it.
  *
  * Inputs:
- *   pid  - process id of the child handling the server data connection
+ *   connection - the entry to remove
  *
  * *Returns:
  *   <none>
  */
-void rem_server_link ( pid_t pid )
+static void unlink_server_link ( tServerStc * connection )
 {
-    tServerStc * connection;
-    for (connection = first_conn_srv.next; connection != NULL; connection = connection->next)
+    hashidx_remove (&conn_srv_index, server_key (connection));
+
+    tServerStc * next = connection->next;
+    tServerStc * prev = connection->prev;
+    if ((next == 0) && (prev == 0)) // removing only entry in list
     {
-        if (connection->pid == pid)
-        {
-            tServerStc * next = connection->next;
-            tServerStc * prev = connection->prev;
-            if ((next == 0) && (prev == 0)) // removing only entry in list
-            {
-                first_conn_srv.next = 0;
-                first_conn_srv.prev = 0;
-            }
-            else if (prev == 0) // removing 1st entry in list
-            {
-                first_conn_srv.next = next;
-                next->prev = 0;
-            }
-            else if (next == 0) // removing last entry in list
-            {
-                first_conn_srv.prev = prev;
-                prev->next = 0;
-            }
-            else // removing entry in the middle
-            {
-                next->prev = prev;
-                prev->next = next;
-            }
-            free(connection);
-            return;
-        }
+        first_conn_srv.next = 0;
+        first_conn_srv.prev = 0;
     }
-
-    logmsg(PRINT_ERROR, "pid %d connection not found in server list\n", pid);
+    else if (prev == 0) // removing 1st entry in list
+    {
+        first_conn_srv.next = next;
+        next->prev = 0;
+    }
+    else if (next == 0) // removing last entry in list
+    {
+        first_conn_srv.prev = prev;
+        prev->next = 0;
+    }
+    else // removing entry in the middle
+    {
+        next->prev = prev;
+        prev->next = next;
+    }
+    free(connection);
 }
 
 /*
  * Description:
- * Sends a message to the specified endpoint connection
+ * Removes the specified server connection from the linked list of server connections.
  *
  * Inputs:
- *   connection - ptr to the connection info
- *   buffer     - the message to sned
+ *   pid  - process id of the child handling the server data connection
  *
  * *Returns:
- *   0 if successful, -1 if error
+ *   <none>
  */
-int send_message ( tConnectStc * connection, char * buffer )
+void rem_server_link ( pid_t pid )
 {
-    int retcode = 0;
-    tBufferStc * pending = get_message (&connection->msgfirst, &connection->msglast); // check if messages are pending in the send queue
-    if (pending)
-    {
-        // If a message is pending in the queue, we must always attempt to send it first.
-        // If a new message was requested to be sent (buffer), add it to the end of the queue.
-        if (buffer)
-        {
-            retcode = add_message(&connection->msgfirst, &connection->msglast, connection->msgix, buffer);
-            if (retcode != 0)
-                rem_connection (connection->destport);
-        }
-
-        // set the pending message as the buffer to send
-        buffer = pending->buffer;
-    }
-    else if (buffer)
-    {
-        // no pending message, but a new message is being sent. everything's cool - no action needed.
-    }
-    else
-    {
-        return -1;  // no buffer specified and none pending in queue - indicate no message to send
-    }
-
-    int msglen = strlen(buffer);
-
-    // send the message
-    tSendMsgTyp send_error = tcp_send_message ( connection->sockfd, buffer, msglen, connection->msgix );
-    if (send_error == SEND_BLOCKED)
-    {
-        // if message can't be sent & this is a new message, append it to queue
-        logmsg(PRINT_ERROR, "socket sendmsg (port %u): blocked\n", connection->destport);
-        if (!pending) add_message(&connection->msgfirst, &connection->msglast, connection->msgix, buffer);
-        connection->pndix++; // pend on write
-        return -1;
-    }
-    else if (send_error == SEND_FAILURE)
-    {
-        logmsg(PRINT_ERROR, "socket sendmsg (port %u): %s", connection->destport, strerror(errno));
-        rem_connection (connection->destport);
-        return -1;
-    }
-    else // if (send_error == SEND_COMPLETE)
-    {
-        // message was successfully sent - if entry was pulled from queue, remove it from queue
-        connection->sntix++;  // increment the # of messages successfully sent
-        if (pending) rem_message (&connection->msgfirst, &connection->msglast);
-    }
+    block_sigchld (true);
+    tServerStc * connection = (tServerStc *)hashidx_find (&conn_srv_index, SERVER_KEY_PID(pid));
+    if (connection)
+        unlink_server_link (connection);
+    block_sigchld (false);
 
-    return 0;
+    if (connection == NULL)
+        logmsg(PRINT_ERROR, "pid %d connection not found in server list\n", pid);
 }
 
 /*
  * Description:
- * Adds a message to the send queue linked list. Performs all memory allocation needed.
- *
- * This queue is a FIFO, where:
- *   firstptr points to the oldest message, which is the next to be sent
- *   lastptr  points to the last entry added, where new messages are to be added
+ * Removes the server connection served by the specified reactor session from the linked list
+ * of server connections.
  *
  * Inputs:
- *   firstptr - ptr to the location that holds the link to the first entry in the queue
- *   lastptr  - ptr to the location that holds the link to the last  entry in the queue
- *   msgix    - message counter to identify the message being queued
- *   buffer   - ptr to the message to queue
+ *   thread - the reactor thread that served the connection
+ *   slot   - the session index within the reactor thread
  *
  * *Returns:
- *   0 on success, -1 on failure (memory allocation)
+ *   <none>
  */
-int add_message ( tBufferStc * firstptr, tBufferStc * lastptr, int msgix, const char * buffer )
+void rem_server_slot ( int thread, int slot )
 {
-    if (buffer == NULL || firstptr == NULL || lastptr == NULL)
-        return -1;
-    int msglen = strlen(buffer);
-
-    // allocate an entry to add
-    tBufferStc * msg_buff = (tBufferStc*)malloc(sizeof(tBufferStc));
-    if (msg_buff == NULL)
+    tServerStc * connection = (tServerStc *)hashidx_find (&conn_srv_index, SERVER_KEY_SLOT(thread, slot));
+    if (connection == NULL)
     {
-        logmsg(PRINT_ERROR, "memory allocation for send queue\n");
-        return -1;
+        logmsg(PRINT_ERROR, "thread %d slot %d connection not found in server list\n", thread, slot);
+        return;
     }
-    // now allocate a block to hold the message data
-    msg_buff->buffer = (char*)malloc(msglen + 1);
-    if (msg_buff->buffer == NULL)
+
+    logmsg(PRINT_OTHER, "thread %d slot %d connection (port %u) closed\n", thread, slot, connection->port);
+    unlink_server_link (connection);
+}
+
+/*
+ * Description:
+ * Removes the server connection served by the specified worker session from the linked list
+ * of server connections.
+ *
+ * Inputs:
+ *   worker - the worker process that served the connection
+ *   slot   - the session index within the worker
+ *
+ * *Returns:
+ *   <none>
+ */
+void rem_server_worker ( int worker, int slot )
+{
+    tServerStc * connection = (tServerStc *)hashidx_find (&conn_srv_index, SERVER_KEY_WORKER(worker, slot));
+    if (connection == NULL)
     {
-        logmsg(PRINT_ERROR, "memory allocation for message\n");
-        free(msg_buff);
+        logmsg(PRINT_ERROR, "worker %d slot %d connection not found in server list\n", worker, slot);
+        return;
+    }
+
+    logmsg(PRINT_OTHER, "worker %d slot %d connection (port %u) closed\n", worker, slot, connection->port);
+    unlink_server_link (connection);
+}
+
+/*
+ * Description:
+ * Sends a message to the specified endpoint connection. The message is added to the end of
+ * the send queue and as much of the queue as the socket takes is sent, gathering the queued
+ * messages into as few sendmsg calls as possible (or as the shared memory link takes, once
+ * the server has taken it).
+ *
+ * Inputs:
+ *   connection - ptr to the connection info
+ *   buffer     - the message to send (NULL to only send the messages already queued)
+ *   msglen     - the length of the message (its bytes are sent as they are)
+ *   sched      - the time the message was scheduled to be sent, which its round-trip time is
+ *                measured from (0 to measure it from now)
+ *
+ * *Returns:
+ *   0 if the queue was emptied, -1 if messages remain queued, -2 if the connection was closed
+ *   (and the entry removed)
+ */
+int send_message ( tConnectStc * connection, const char * buffer, int msglen, uint64_t sched )
+{
+    // pending messages must always be sent first, so the new message goes to the end of the queue
+    if (buffer)
+    {
+        if (add_message (&connection->sendq, connection->msgix, buffer, msglen) != 0)
+        {
+            rem_connection (connection->destport);
+            return -2;
+        }
+        rtthist_sent (&connection->rtt, connection->msgix, sched ? sched : rtthist_now ());
+    }
+
+    // send the queue (while connecting, wait until the connection completes, while the
+    // shared memory link or the wire format is offered, wait for the answer of the server, and
+    // while a bulk test is streamed, wait until the frame being sent is finished)
+    if (connection->state != STATE_READY || connection->shm.state == SHM_OFFERED || connection->wire_offered ||
+        (bulk_sending (connection) && bulk_test.streamed % bulk_test.frame_len != 0))
         return -1;
+    unsigned long sent = connection->send_stats.msgs;
+    bool shm = (connection->shm.state == SHM_ACTIVE);
+    tSendMsgTyp send_error = shm ? shm_send_queue (&connection->shm, &connection->sendq, &connection->send_stats)
+                                 : send_queue (connection->sockfd, &connection->sendq, &connection->send_stats);
+    connection->sntix += connection->send_stats.msgs - sent;  // increment the # of messages successfully sent
+    if (send_error == SEND_BLOCKED)
+    {
+        logmsg(PRINT_ERROR, "%s (port %u): blocked\n", shm ? "shared memory send" : "socket sendmsg", connection->destport);
+        connection->pndix++; // pend on write
+        set_connection_events (connection); // wait for the socket to become writable
+        return -1;
+    }
+    else if (send_error == SEND_FAILURE)
+    {
+        logmsg(PRINT_ERROR, "socket sendmsg (port %u): %s\n", connection->destport, strerror(errno));
+        rem_connection (connection->destport);
+        return -2;
     }
 
-    // save the message contents in it
-    strncpy (msg_buff->buffer, buffer, msglen);
-    msg_buff->buffer[msglen] = 0;
-    msg_buff->msgix = msgix; // save the message index for this connection
-    msg_buff->next = 0;  // this indicates there are no entries after this
+    set_connection_events (connection); // stop monitoring write readiness once the queue drains
+    return 0;
+}
 
-    // we add the entry to the end of the list
-    if (lastptr->next)
-        lastptr->next->next = msg_buff;  // not 1st entry, set prev last entry to point to this
+/*
+ * Description:
+ * Receives all the responses available from the server, on the connection socket or on the
+ * shared memory link.
+ *
+ * Inputs:
+ *   connection - ptr to the connection info
+ *   shm        - true to receive from the shared memory link, false from the socket
+ *
+ * *Returns:
+ *   true if the connection is still open, false if it was closed (and the entry removed)
+ */
+bool receive_responses ( tConnectStc * connection, bool shm )
+{
+    while (true)
+    {
+        // read response from server
+        MessageHeaderStc header;
+        char * message;
+        tRecvMsgTyp recv_error = shm ? shm_recv_frame (&connection->shm, &header, &message)
+                                     : tcp_recv_frame (connection->sockfd, &connection->rbuf, &header, &message);
+        if (recv_error == RECV_COMPLETE)
+        {
+            if (header.msgix == SHM_MSGIX && connection->shm.state == SHM_OFFERED)
+            {
+                // the answer to the shared memory link offer (not a response)
+                if (!take_shm_answer (connection, message, header.msglen))
+                    return false;
+                continue;
+            }
+            if (header.msgix == WIRE_MSGIX && connection->wire_offered)
+            {
+                // the answer to the wire format offer (not a response)
+                if (!take_wire_answer (connection, message, header.msglen))
+                    return false;
+                continue;
+            }
+            if (header.msgix == BULK_MSGIX && bulk_test.state != BULK_IDLE && bulk_test.port == connection->destport)
+            {
+                // the answer to the bulk test offer, or the totals of the server (not a response)
+                if (!take_bulk_answer (connection, message, header.msglen))
+                    return false;
+                continue;
+            }
+            logmsg(PRINT_RCVD, "%.*s\n", log_peek(header.msglen), message);
+            connection->rspix++; // increment the # of messages received
+            connection->rsp_bytes += header.msglen;
+            uint64_t now = rtthist_now ();
+            rtthist_reply (&connection->rtt, header.msgix, now);
+
+            // the echo of the ping outstanding: send the next one, or end the ping-pong test
+            if (ping_test.running && ping_test.port == connection->destport && pingpong_reply (&ping_test, header.msgix, now))
+            {
+                if (ping_test.replies >= ping_test.cfg.count)
+                    stop_pingpong_test ();
+                else if (!send_ping (connection))
+                    return false;
+            }
+        }
+        else if (recv_error == RECV_BLOCKED)
+        {
+            return true;
+        }
+        else if (recv_error == RECV_TERMINATED)
+        {
+            logmsg(PRINT_SOCKET, "socket recvmsg (port %u) terminated connection\n", connection->destport);
+            rem_connection (connection->destport);
+            return false;
+        }
+        else // if (recv_error == RECV_FAILURE)
+        {
+            logmsg(PRINT_ERROR, "%s (port %u): %s\n", shm ? "shared memory receive" : "socket recvmsg",
+                    connection->destport, strerror(errno));
+            rem_connection (connection->destport);
+            return false;
+        }
+    }
+}
+
+/*
+ * Description:
+ * Offers a shared memory link to the server of a connection that has just completed (if -m
+ * was specified). The messages are held in the send queue until the server answers. Without
+ * a link, the v2 wire format is offered instead.
+ *
+ * Inputs:
+ *   connection - ptr to the connection info
+ *
+ * *Returns:
+ *   true if the connection is still open, false if the offer failed part way and the
+ *   connection was closed (and the entry removed)
+ */
+bool start_shm_link ( tConnectStc * connection )
+{
+    if (!use_shm)
+        return start_wire_offer (connection);
+
+    // the server finds the link by the client port of the connection
+    struct sockaddr_in my_addr;
+    socklen_t addr_size = sizeof(my_addr);
+    if (getsockname (connection->sockfd, (struct sockaddr*)&my_addr, &addr_size) == 0)
+        connection->sendport = ntohs(my_addr.sin_port);
+
+    if (shm_link_create (&connection->shm) < 0)
+        return start_wire_offer (connection); // stay on TCP
+
+    int retcode = shm_offer (connection->sockfd);
+    if (retcode == -2)
+    {
+        rem_connection (connection->destport); // (the stream is broken)
+        return false;
+    }
+    if (retcode < 0)
+    {
+        shm_link_close (&connection->shm);
+        return start_wire_offer (connection);
+    }
+
+    connection->shm.state = SHM_OFFERED;
+    logmsg(PRINT_SOCKET, "shared memory link offered (port %u)\n", connection->destport);
+    return true;
+}
+
+/*
+ * Description:
+ * Handles the answer of the server to the shared memory link offer. If the server took the
+ * link, the messages go on the link from now on, otherwise the connection stays on TCP (and
+ * the v2 wire format is offered). Either way, the messages held while waiting for the answer
+ * are sent (once there is no offer left to answer).
+ *
+ * Inputs:
+ *   connection - ptr to the connection info
+ *   answer     - the answer message (not NULL-terminated)
+ *   answer_len - the length of the answer message
+ *
+ * *Returns:
+ *   true if the connection is still open, false if it was closed (and the entry removed)
+ */
+static bool take_shm_answer ( tConnectStc * connection, const char * answer, int answer_len )
+{
+    if (answer_len == (int)strlen(SHM_ACCEPT) && memcmp (answer, SHM_ACCEPT, answer_len) == 0)
+    {
+        if (evloop_add (&main_loop, connection->shm.wakefd, EVLOOP_READ, SHM_DOORBELL_TAG(connection)) < 0)
+        {
+            rem_connection (connection->destport); // (the server has switched to the link)
+            return false;
+        }
+        connection->shm.state = SHM_ACTIVE;
+        connection->sendq.crc = false; // (the link stays on the v1 format)
+        logmsg(PRINT_SOCKET, "shared memory link taken (port %u)\n", connection->destport);
+    }
     else
-        firstptr->next = msg_buff;  // this is 1st entry in list, set first ptr
+    {
+        logmsg(PRINT_WARNING, "shared memory link declined (port %u), staying on TCP\n", connection->destport);
+        shm_link_close (&connection->shm);
+        if (!start_wire_offer (connection))
+            return false;
+    }
 
-    lastptr->next = msg_buff; // this must always point to last entry in list
+    return (send_message (connection, NULL, 0, 0) != -2);
+}
 
-    return 0;
+/*
+ * Description:
+ * Offers the v2 wire format to the server of a connection that has just completed (unless
+ * -w 1 was specified). The offer is sent in v1 directly, ahead of the queued messages, which
+ * are held until the server answers.
+ *
+ * Inputs:
+ *   connection - ptr to the connection info
+ *
+ * *Returns:
+ *   true if the connection is still open, false if the offer failed part way and the
+ *   connection was closed (and the entry removed)
+ */
+bool start_wire_offer ( tConnectStc * connection )
+{
+    if (wire_version < WIRE_V2)
+        return true;
+
+    const char * offer = use_crc ? WIRE_OFFER_CRC : WIRE_OFFER;
+    int retcode = tcp_send_frame (connection->sockfd, WIRE_MSGIX, offer, strlen(offer));
+    if (retcode == -2)
+    {
+        logmsg(PRINT_ERROR, "wire format offer (port %u): only part of it was sent\n", connection->destport);
+        rem_connection (connection->destport); // (the stream is broken)
+        return false;
+    }
+    if (retcode < 0)
+    {
+        logmsg(PRINT_ERROR, "wire format offer (port %u): %s\n", connection->destport, strerror(errno));
+        return true; // stay on v1
+    }
+
+    connection->wire_offered = true;
+    logmsg(PRINT_SOCKET, "wire format v2 offered (port %u)\n", connection->destport);
+    return true;
 }
 
 /*
  * Description:
- * Removes the 1st entry from send queue linked list. Frees all memory allocation used.
+ * Handles the answer of the server to the wire format offer. If the server took it, the
+ * messages are in v2 both ways from now on (the responses following the answer already are),
+ * otherwise the connection stays on v1. Either way, the messages held while waiting for the
+ * answer are sent.
  *
- * This queue is a FIFO, where:
- *   firstptr points to the oldest message, which is the next to be sent
- *   lastptr  points to the last entry added, where new messages are to be added
+ * Inputs:
+ *   connection - ptr to the connection info
+ *   answer     - the answer message (not NULL-terminated)
+ *   answer_len - the length of the answer message
+ *
+ * *Returns:
+ *   true if the connection is still open, false if it was closed (and the entry removed)
+ */
+static bool take_wire_answer ( tConnectStc * connection, const char * answer, int answer_len )
+{
+    connection->wire_offered = false;
+    if (answer_len == (int)strlen(WIRE_ACCEPT) && memcmp (answer, WIRE_ACCEPT, answer_len) == 0)
+    {
+        connection->sendq.wire = WIRE_V2;
+        connection->rbuf.wire  = WIRE_V2;
+        logmsg(PRINT_SOCKET, "wire format v2 taken (port %u)\n", connection->destport);
+    }
+    else
+    {
+        logmsg(PRINT_WARNING, "wire format v2 declined (port %u), staying on v1\n", connection->destport);
+        connection->sendq.crc = false;
+    }
+
+    return (send_message (connection, NULL, 0, 0) != -2);
+}
+
+/*
+ * Description:
+ * Passes the shared memory links to the servers that have asked for them (the servers
+ * connect to the shared memory listen socket, and give the client port of the connection
+ * the link was offered on).
  *
  * Inputs:
- *   firstptr - ptr to the location that holds the link to the first entry in the queue
- *   lastptr  - ptr to the location that holds the link to the last  entry in the queue
+ *   <none>
  *
  * *Returns:
  *   <none>
  */
-void rem_message ( tBufferStc * firstptr, tBufferStc * lastptr )
+void give_shm_links ( void )
 {
-    if (firstptr == NULL || lastptr == NULL) return; // invalid connection
+    while (true)
+    {
+        int client_port;
+        int sockfd = shm_serve (shm_listenfd, &client_port);
+        if (sockfd < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break; // no more requests
+            if (errno == ECONNABORTED || errno == EPROTO || errno == EINTR) continue; // (only that request failed)
+            break; // (e.g. out of descriptors) retry on the next event
+        }
 
-    // we remove the entry from the begining of the list
-    tBufferStc * pending = firstptr->next;
-    if (pending == 0) return; // send queue is empty
+        tConnectStc * endpt;
+        for (endpt = first_conn_req.next; endpt != NULL; endpt = endpt->next)
+        {
+            if (endpt->shm.state == SHM_OFFERED && endpt->sendport == client_port)
+                break;
+        }
+        if (endpt == NULL)
+            logmsg(PRINT_ERROR, "shared memory link request for unknown port %d\n", client_port);
+        else
+            shm_give (sockfd, &endpt->shm);
+        close (sockfd);
+    }
+}
 
-    // disconnect entry from linked list
-    firstptr->next = pending->next;
-    if (pending->next == 0) lastptr->next = 0;  // removed last entry in queue
+/*
+ * Description:
+ * Starts a load test on the active endpoint connection and the next connections in the list
+ * (as many as the test parameters ask for), replacing any test already running.
+ *
+ * Inputs:
+ *   current - the active endpoint connection
+ *   args    - the parameters of the #t command
+ *
+ * *Returns:
+ *   true if successful (the test was started, or only stopped), false if error
+ */
+bool start_load_test ( tConnectStc * current, const char * args )
+{
+    tLoadCfgStc cfg;
+    int parsed = loadgen_parse (args, &cfg);
+    if (parsed < 0)
+        return false;
+    stop_load_test ();
+    if (parsed > 0)
+        return true; // only stopping the test
+
+    if (current == NULL || current->state == STATE_IDLE)
+    {
+        logmsg(PRINT_ERROR, "No active connection specified. Either create or select a connection to use\n");
+        return false;
+    }
 
-    // free entry buffers
-    free(pending->buffer);
-    free(pending);
+    // the active endpoint first, then the other connections in the list
+    int ports[LOADGEN_MAX_ENDPOINTS], port_count = 0;
+    ports[port_count++] = current->destport;
+    tConnectStc * endpt;
+    for (endpt = first_conn_req.next; endpt != NULL && port_count < cfg.endpoints; endpt = endpt->next)
+    {
+        if (endpt != current && endpt->state != STATE_IDLE)
+            ports[port_count++] = endpt->destport;
+    }
+    if (port_count < cfg.endpoints)
+        logmsg(PRINT_WARNING, "only %d endpoint connections for the load test\n", port_count);
+
+    int timerfd = loadgen_start (&load_gen, &cfg, ports, port_count);
+    if (timerfd < 0)
+        return false;
+    if (evloop_add (&main_loop, timerfd, EVLOOP_READ | EVLOOP_LEVEL, &evtag_loadgen) < 0)
+    {
+        loadgen_stop (&load_gen);
+        return false;
+    }
+    return true;
 }
 
 /*
  * Description:
- * Returns the 1st entry from send queue linked list. Does not remove the link or
- * free any allocations (unless the entry was invalid). If the entry is invalid
- * (that is, no buffer specified) it does remove that link and frees the buffer and
- * moves to the next buffer until a valid one is found.
+ * Sends the messages of the load test that are due, when its pacing timer expires. With a
+ * target rate, the messages are queued on their connections even if the socket is blocked
+ * (up to a limit, beyond which they are skipped), so the offered load does not depend on
+ * how fast the other endpoint responds, and the round-trip times are measured from when each
+ * message was scheduled (so the time a message waits behind a stalled send is not left out
+ * of its latency). Without one, a connection only gets messages while its socket keeps up.
  *
- * This queue is a FIFO, where:
- *   firstptr points to the oldest message, which is the next to be sent
- *   lastptr  points to the last entry added, where new messages are to be added
+ * Inputs:
+ *   current - ptr to the active endpoint connection (cleared if it is closed)
+ *
+ * *Returns:
+ *   <none>
+ */
+void run_load_test ( tConnectStc ** current )
+{
+    long due = loadgen_due (&load_gen);
+    int  idle = 0; // number of connections in a row that could not take a message
+
+    while (due > 0 && idle < load_gen.port_count)
+    {
+        int port, length;
+        const char * payload = loadgen_next (&load_gen, &port, &length);
+        tConnectStc * connection = find_connection (port);
+        bool usable = (connection != NULL && connection->state == STATE_READY);
+        if (usable)
+        {
+            unsigned depth = msgqueue_depth(&connection->sendq);
+            usable = load_gen.cfg.rate ? (depth < LOADGEN_MAX_QUEUED && msgqueue_bytes(&connection->sendq) < LOADGEN_MAX_QUEUED_BYTES)
+                                       : (depth == 0);
+        }
+
+        if (!usable)
+        {
+            idle++;
+            if (load_gen.cfg.rate)
+            {
+                loadgen_sent (&load_gen, -1); // skipped: the schedule does not wait
+                due--;
+            }
+            continue;
+        }
+
+        idle = 0;
+        connection->msgix++; // increment the # of messages produced
+        if (send_message (connection, payload, length, loadgen_sched (&load_gen)) == -2)
+        {
+            if (*current == connection) *current = NULL; // connection was closed
+            loadgen_sent (&load_gen, -1);
+        }
+        else
+        {
+            loadgen_sent (&load_gen, length);
+        }
+        due--;
+    }
+
+    // stop when done, or when none of the connections are left
+    bool connected = false;
+    int ix;
+    for (ix = 0; ix < load_gen.port_count && !connected; ix++)
+        connected = (find_connection (load_gen.ports[ix]) != NULL);
+    if (!connected)
+        logmsg(PRINT_ERROR, "load test connections closed\n");
+    if (load_gen.finished || !connected)
+        stop_load_test ();
+}
+
+/*
+ * Description:
+ * Stops the load test (if one is running) and displays its results.
  *
  * Inputs:
- *   firstptr - ptr to the location that holds the link to the first entry in the queue
- *   lastptr  - ptr to the location that holds the link to the last  entry in the queue
+ *   <none>
  *
  * *Returns:
  *   <none>
  */
-tBufferStc * get_message ( tBufferStc * firstptr, tBufferStc * lastptr )
+void stop_load_test ( void )
+{
+    if (!load_gen.running)
+        return;
+
+    evloop_del (&main_loop, load_gen.timerfd);
+    loadgen_stop (&load_gen);
+}
+
+/*
+ * Description:
+ * Returns true if a bulk test is streamed on the endpoint connection (its frames are being sent).
+ *
+ * Inputs:
+ *   connection - ptr to the connection info
+ *
+ * *Returns:
+ *   true if the connection is streaming
+ */
+static bool bulk_sending ( tConnectStc * connection )
+{
+    return (bulk_test.state == BULK_STREAMING || bulk_test.state == BULK_ENDING) && bulk_test.port == connection->destport;
+}
+
+/*
+ * Description:
+ * Starts a bulk test on the active endpoint connection: the test is offered to the server,
+ * and the stream starts once the server has taken it. Only one bulk test runs at a time, and
+ * it streams on a TCP connection with nothing waiting to be sent. "#b0" ends the running test
+ * (the frame being sent is finished first, and the server answers with its totals).
+ *
+ * Inputs:
+ *   current - ptr to the active endpoint connection (cleared if it is closed)
+ *   args    - the parameters of the #b command
+ *
+ * *Returns:
+ *   true if successful (the test was offered, or is ending), false if error
+ */
+bool start_bulk_test ( tConnectStc ** current, const char * args )
 {
-    if (firstptr == NULL || lastptr == NULL) return NULL; // invalid connection
+    tBulkCfgStc cfg;
+    int parsed = bulk_parse (args, &cfg);
+    if (parsed < 0)
+        return false;
+    if (parsed > 0)
+    {
+        if (bulk_test.state == BULK_OFFERED)
+        {
+            bulk_test.stopping = true;
+        }
+        else if (bulk_test.state == BULK_STREAMING)
+        {
+            bulk_test.state = BULK_ENDING;
+            tConnectStc * connection = find_connection (bulk_test.port);
+            if (connection != NULL && !run_bulk_test (connection) && *current == connection)
+                *current = NULL; // connection was closed
+        }
+        return true;
+    }
+
+    tConnectStc * connection = *current;
+    if (bulk_test.state != BULK_IDLE)
+    {
+        logmsg(PRINT_ERROR, "a bulk test is already running (port %u), stop it with #b0\n", bulk_test.port);
+        return false;
+    }
+    if (connection == NULL || connection->state != STATE_READY)
+    {
+        logmsg(PRINT_ERROR, "No active connection specified. Either create or select a connection to use\n");
+        return false;
+    }
+    if (connection->shm.state != SHM_NONE || connection->wire_offered || msgqueue_depth(&connection->sendq) != 0)
+    {
+        logmsg(PRINT_ERROR, "bulk test (port %u): the connection must be on TCP, with nothing waiting to be sent\n",
+                connection->destport);
+        return false;
+    }
+
+    int timerfd = bulk_start (&bulk_test, &cfg, connection->destport, connection->sendq.wire, connection->sendq.crc);
+    if (timerfd < 0)
+        return false;
+    if (evloop_add (&main_loop, timerfd, EVLOOP_READ | EVLOOP_LEVEL, &evtag_bulk) < 0)
+    {
+        bulk_stop (&bulk_test);
+        return false;
+    }
+
+    char offer[32];
+    int  offer_len = snprintf (offer, sizeof(offer), "%s%d", BULK_OFFER, cfg.interval);
+    if (add_message (&connection->sendq, BULK_MSGIX, offer, offer_len) != 0 || send_message (connection, NULL, 0, 0) == -2)
+    {
+        if (find_connection (bulk_test.port) != NULL) // (closing the connection stops the test)
+            stop_bulk_test ();
+        else
+            *current = NULL;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Description:
+ * Streams the bulk test on its connection, until the socket is full. The messages queued on the
+ * connection are sent first, between two frames. Once the test is ending and its last frame is
+ * sent, the end of the stream is sent, and the totals of the server are its answer.
+ *
+ * Inputs:
+ *   connection - ptr to the connection streamed on
+ *
+ * *Returns:
+ *   true if the connection is still open, false if it was closed
+ */
+bool run_bulk_test ( tConnectStc * connection )
+{
+    if (msgqueue_depth(&connection->sendq) != 0)
+    {
+        if (send_message (connection, NULL, 0, 0) == -2)
+            return false;
+        if (msgqueue_depth(&connection->sendq) != 0)
+            return true; // (blocked)
+    }
+
+    tSendMsgTyp send_error = bulk_send (&bulk_test, connection->sockfd);
+    if (send_error == SEND_FAILURE)
+    {
+        logmsg(PRINT_ERROR, "bulk test send (port %u): %s\n", connection->destport, strerror(errno));
+        rem_connection (connection->destport);
+        return false;
+    }
+    if (bulk_test.state == BULK_ENDING && send_error == SEND_COMPLETE)
+    {
+        bulk_test.state = BULK_DRAINING;
+        if (add_message (&connection->sendq, BULK_MSGIX, BULK_END, strlen(BULK_END)) != 0)
+        {
+            rem_connection (connection->destport);
+            return false;
+        }
+        return (send_message (connection, NULL, 0, 0) != -2);
+    }
+
+    set_connection_events (connection);
+    return true;
+}
+
+/*
+ * Description:
+ * Takes the answer of the server to the bulk test offer (the stream is started if it took it),
+ * or the totals of the server once the stream has ended (the test is then over).
+ *
+ * Inputs:
+ *   connection - the connection the answer was received on
+ *   answer     - the answer message (not NULL-terminated)
+ *   answer_len - the length of the answer message
+ *
+ * *Returns:
+ *   true if the connection is still open, false if it was closed
+ */
+static bool take_bulk_answer ( tConnectStc * connection, const char * answer, int answer_len )
+{
+    if (bulk_test.state == BULK_OFFERED)
+    {
+        if (answer_len == (int)strlen(BULK_ACCEPT) && memcmp (answer, BULK_ACCEPT, answer_len) == 0)
+        {
+            logmsg(PRINT_SOCKET, "bulk test taken (port %u)\n", connection->destport);
+            bulk_stream (&bulk_test);
+            return run_bulk_test (connection);
+        }
+        logmsg(PRINT_WARNING, "bulk test declined (port %u)\n", connection->destport);
+        stop_bulk_test ();
+        return true;
+    }
+
+    char text[128];
+    int  len = (answer_len < (int)sizeof(text)) ? answer_len : (int)sizeof(text) - 1;
+    memcpy (text, answer, len);
+    text[len] = 0;
+    unsigned long msgs, bytes, calls;
+    if (bulk_test.state == BULK_DRAINING && sscanf (text, BULK_DONE " %lu %lu %lu", &msgs, &bytes, &calls) == 3)
+    {
+        stop_bulk_test ();
+        logmsg(PRINT_QUERY, "bulk server [port %u] sunk %lu msgs, %lu bytes in %lu recv calls\n",
+                connection->destport, msgs, bytes, calls);
+    }
+    else
+    {
+        logmsg(PRINT_WARNING, "unexpected bulk test message (port %u): %s\n", connection->destport, text);
+    }
+    return true;
+}
+
+/*
+ * Description:
+ * Reports the bulk test when its timer expires, and ends it once its duration is up. The stream
+ * is also continued from here while the socket takes all that is sent (without waiting for a
+ * write event, see BULK_BURST_BYTES).
+ *
+ * Inputs:
+ *   expired - true if the timer expired
+ *   current - ptr to the active endpoint connection (cleared if it is closed)
+ *
+ * *Returns:
+ *   <none>
+ */
+void check_bulk_test ( bool expired, tConnectStc ** current )
+{
+    bool streaming = (bulk_test.state == BULK_STREAMING || bulk_test.state == BULK_ENDING);
+    if (expired)
+    {
+        uint64_t expirations;
+        if (read (bulk_test.timerfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+            logmsg(PRINT_ERROR, "timerfd read: %s\n", strerror(errno));
+        if (streaming)
+            bulk_meter_show (&bulk_test.meter, false);
+        if (bulk_test.state == BULK_STREAMING && bulk_time_up (&bulk_test))
+            bulk_test.state = BULK_ENDING;
+    }
+
+    if (streaming && (bulk_test.writable || bulk_test.state == BULK_ENDING))
+    {
+        tConnectStc * connection = find_connection (bulk_test.port);
+        if (connection != NULL && !run_bulk_test (connection) && *current == connection)
+            *current = NULL; // connection was closed
+    }
+}
+
+/*
+ * Description:
+ * Stops the bulk test (if one is running) and displays its totals.
+ *
+ * Inputs:
+ *   <none>
+ *
+ * *Returns:
+ *   <none>
+ */
+void stop_bulk_test ( void )
+{
+    if (bulk_test.state == BULK_IDLE)
+        return;
+
+    evloop_del (&main_loop, bulk_test.timerfd);
+    bulk_stop (&bulk_test);
+}
+
+/*
+ * Description:
+ * Starts a ping-pong test on the active endpoint connection: the first ping is sent now, and
+ * each of the others as soon as the echo of the one before it is received (see
+ * receive_responses). TCP_NODELAY is set on the connection, so no ping is held back by the
+ * socket. Only one ping-pong test runs at a time, on a connection with nothing waiting to be
+ * sent. "#r0" stops the running test.
+ *
+ * Inputs:
+ *   current - ptr to the active endpoint connection (cleared if it is closed)
+ *   args    - the parameters of the #r command
+ *
+ * *Returns:
+ *   true if successful (the test was started, or stopped), false if error
+ */
+bool start_pingpong_test ( tConnectStc ** current, const char * args )
+{
+    tPingCfgStc cfg;
+    int parsed = pingpong_parse (args, &cfg);
+    if (parsed < 0)
+        return false;
+    if (parsed > 0)
+    {
+        stop_pingpong_test ();
+        return true;
+    }
+
+    tConnectStc * connection = *current;
+    if (ping_test.running)
+    {
+        logmsg(PRINT_ERROR, "a ping-pong test is already running (port %u), stop it with #r0\n", ping_test.port);
+        return false;
+    }
+    if (connection == NULL || connection->state != STATE_READY)
+    {
+        logmsg(PRINT_ERROR, "No active connection specified. Either create or select a connection to use\n");
+        return false;
+    }
+    if (msgqueue_depth(&connection->sendq) != 0 || (bulk_test.state != BULK_IDLE && bulk_test.port == connection->destport))
+    {
+        logmsg(PRINT_ERROR, "ping-pong test (port %u): the connection must have nothing waiting to be sent, and no bulk test\n",
+                connection->destport);
+        return false;
+    }
+
+    if (pingpong_start (&ping_test, &cfg, connection->destport) < 0)
+        return false;
+    tcp_set_latency (connection->sockfd, true, 0);
+    if (!send_ping (connection))
+    {
+        *current = NULL; // connection was closed (which stopped the test)
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Description:
+ * Sends the next ping of the ping-pong test on its connection. Its round-trip time is
+ * measured from just before it is written to the socket.
+ *
+ * Inputs:
+ *   connection - ptr to the connection info
+ *
+ * *Returns:
+ *   true if the connection is still open, false if it was closed (and the entry removed)
+ */
+static bool send_ping ( tConnectStc * connection )
+{
+    uint64_t now = rtthist_now ();
+    connection->msgix++; // increment the # of messages produced
+    pingpong_sent (&ping_test, connection->msgix, now);
+    return (send_message (connection, ping_test.payload, ping_test.cfg.size, now) != -2);
+}
+
+/*
+ * Description:
+ * Busy-polls the connection of the ping-pong test (-S): its socket (or shared memory link) is
+ * read over and over without waiting for the event loop, for up to PINGPONG_SPIN_NSEC, so each
+ * echo is taken as soon as it arrives and the next ping goes straight out. The main loop then
+ * polls its event loop without sleeping, and spins again.
+ *
+ * Inputs:
+ *   current - ptr to the active endpoint connection (cleared if it is closed)
+ *
+ * *Returns:
+ *   <none>
+ */
+void spin_pingpong_test ( tConnectStc ** current )
+{
+    uint64_t until = rtthist_now () + PINGPONG_SPIN_NSEC;
+    while (ping_test.running)
+    {
+        tConnectStc * connection = find_connection (ping_test.port);
+        if (connection == NULL || connection->state != STATE_READY)
+            break;
+        if (!receive_responses (connection, connection->shm.state == SHM_ACTIVE))
+        {
+            if (*current == connection)
+                *current = NULL; // connection was closed
+            break;
+        }
+        if (rtthist_now () >= until)
+            break;
+    }
+}
+
+/*
+ * Description:
+ * Stops the ping-pong test (if one is running) and displays its results.
+ *
+ * Inputs:
+ *   <none>
+ *
+ * *Returns:
+ *   <none>
+ */
+void stop_pingpong_test ( void )
+{
+    pingpong_stop (&ping_test);
+}
+
+/*
+ * Description:
+ * Runs a command (typed in, read from the command file or received on the control socket).
+ * The reasons the commands fail are displayed as they always were, and returned for the results
+ * of a headless endpoint.
+ *
+ * Inputs:
+ *   command    - the command (ACTION_xxx)
+ *   value      - the value of the command
+ *   buffer     - the command line
+ *   current    - ptr to the active endpoint connection (changed by the commands selecting it)
+ *   server     - the host the endpoints are connected on
+ *   recv_delay - ptr to the setting slowing down the reads of the client connections (#z)
+ *   running    - ptr to the setting keeping the endpoint running (cleared by #q)
+ *
+ * *Returns:
+ *   NULL if successful, otherwise why the command failed
+ */
+const char * run_command ( int command, int value, const char * buffer, tConnectStc ** current,
+                           struct hostent * server, int * recv_delay, bool * running )
+{
+    const char * error = NULL;
+
+    switch (command)
+    {
+        case ACTION_QUIT :
+            logmsg(PRINT_QUERY, "endpoint exiting...\n");
+            *running = false;
+            break;
+        case ACTION_SEND_MESSAGE :
+            // check if we have a server connection yet
+            if (*current == NULL || (*current)->state == STATE_IDLE)
+            {
+                logmsg(PRINT_ERROR, "No active connection specified. Either create or select a connection to use\n");
+                error = "no active connection";
+            }
+            else
+            {
+                // attempt to send the message
+                (*current)->msgix++; // increment the # of messages produced
+                if (send_message (*current, buffer, strlen(buffer), 0) == -2)
+                {
+                    *current = NULL; // connection was closed
+                    error = "connection closed";
+                }
+            }
+            break;
+        case ACTION_ADD_ENDPOINT :
+            *current = add_connection (value, server);
+            // if successful, new connection becomes active socket
+            if (*current == NULL)
+                error = "connection not created";
+            break;
+        case ACTION_REM_ENDPOINT :
+            // if current endpoint is the one we delete, set selection to NULL
+            if (find_connection (value) == NULL)
+                error = "connection not found";
+            if (*current != NULL && (*current)->destport == value)
+                *current = NULL;
+            rem_connection (value);
+            break;
+        case ACTION_SEL_ENDPOINT :
+            *current = find_connection (value);
+            if (*current == NULL)
+            {
+                logmsg(PRINT_ERROR, "connection to port %u not found\n", value);
+                error = "connection not found";
+            }
+            break;
+        case ACTION_DELAY :
+            *recv_delay = true;
+            reactor_pool.recv_delay = true;
+            break;
+        case ACTION_TEST :
+            if (!start_load_test (*current, &buffer[2]))
+                error = "load test not started";
+            break;
+        case ACTION_BULK :
+            if (!start_bulk_test (current, &buffer[2]))
+                error = "bulk test not started";
+            break;
+        case ACTION_PINGPONG :
+            if (!start_pingpong_test (current, &buffer[2]))
+                error = "ping-pong test not started";
+            break;
+        case ACTION_SET_PRINT_FLAG :
+            print_flag = value;
+            break;
+        case ACTION_SHOW_CONNECTIONS :
+            show_all_connections ();
+            break;
+        case ACTION_SHOW_LATENCY :
+            show_latency (value);
+            break;
+        case ACTION_SHOW_STATS :
+            break; // (the statistics are in its result)
+        case ACTION_WAIT :
+            error = "only the command file waits"; // (a control client waits for the results itself)
+            break;
+        default :
+        case ACTION_INVALID :
+            logmsg(PRINT_ERROR, "Unknown command received: %d\n", command);
+            error = "invalid command";
+            break;
+    }
+
+    return error;
+}
+
+/*
+ * Description:
+ * Reports the result of a command as a JSON line: the sequence number of the command (counted
+ * for each source of commands), the command line, and whether it succeeded (with why not, if
+ * not), followed by the statistics for #j. The results of a headless endpoint are written to
+ * stdout (for the command file) or sent to the control client. The commands typed in have no
+ * results, but the statistics of #j are displayed.
+ *
+ * Inputs:
+ *   fd      - the output of the command file (-1 if the command was not read from it)
+ *   client  - the control client the command was received from (NULL if none)
+ *   seq     - the sequence number of the command
+ *   line    - the command line
+ *   command - the command (ACTION_xxx)
+ *   error   - why the command failed (NULL if it succeeded)
+ *
+ * *Returns:
+ *   <none>
+ */
+void report_result ( int fd, tControlClientStc * client, unsigned long seq, const char * line, int command, const char * error )
+{
+    static char text[CONTROL_RESULT_MAX];
+    int size = sizeof(text) - 2, used = 0; // (room is kept for the end of the line)
+
+    if (fd < 0 && client == NULL && (command != ACTION_SHOW_STATS || error))
+        return;
+
+    used += snprintf (&text[used], size - used, "{\"seq\":%lu,\"cmd\":", seq);
+    used += control_json_string (&text[used], size - used, line);
+    if (error)
+    {
+        used += snprintf (&text[used], size - used, ",\"ok\":false,\"error\":");
+        used += control_json_string (&text[used], size - used, error);
+    }
+    else
+    {
+        used += snprintf (&text[used], size - used, ",\"ok\":true");
+        if (command == ACTION_SHOW_STATS)
+            used += show_stats_json (&text[used], size - used);
+    }
+    if (used > size - 1) used = size - 1;
+    used += snprintf (&text[used], sizeof(text) - used, "}\n");
+
+    if (client != NULL)
+    {
+        control_reply (client, text, used);
+    }
+    else if (fd >= 0)
+    {
+        control_write (fd, text, used);
+    }
+    else
+    {
+        // (in pieces, since a log message holds a limited length of string)
+        int off;
+        for (off = 0; off < used; off += LOG_STR_SPACE / 2)
+            logmsg(PRINT_QUERY, "%.*s", LOG_STR_SPACE / 2, &text[off]);
+    }
+}
+
+/*
+ * Description:
+ * Creates the child process that handles the data socket of a newly accepted client connection.
+ *
+ * Inputs:
+ *   serversock  - the server listen socket (closed by the child)
+ *   clientsock  - the data socket of the accepted connection (closed by the parent)
+ *   client_port - the port of the client that connected
+ *   recv_delay  - true if the read process is to be slowed down
+ *   edge        - true if the child registers its socket edge-triggered
+ *   uring       - true if the child uses the io_uring backend
+ *
+ * *Returns:
+ *   <none>
+ */
+void fork_client_handler ( int serversock, int clientsock, int client_port, bool recv_delay, bool edge, bool uring )
+{
+    pid_t process_id = fork();
+    if (process_id < 0)
+    {
+        logmsg(PRINT_ERROR, "fork: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    // the child process (it handles the data socket)...
+    else if (process_id == 0)
+    {
+        close (serversock); // close parent socket
+        if (shm_listenfd >= 0) close (shm_listenfd);
+        if (spare_fd >= 0) close (spare_fd);
+        evloop_fini (&main_loop); // close parent's event loop
+        if (uring)
+        {
+            uring_fini (&accept_ring); // close parent's io_uring instance
+            child_handle_client_uring (clientsock, client_port, recv_delay);
+        }
+        else
+        {
+            child_handle_client (clientsock, client_port, recv_delay, edge); // child handles data on client socket
+        }
+        exit (0); // terminate the child process
+    }
+
+    // the parent process (it handles the connection socket)...
+    logmsg(PRINT_OTHER, "spawned child process pid: %d to handle port %u (recv delay = %d)\n",
+            (int)process_id, client_port, recv_delay);
+    add_server_link (process_id, -1, -1, -1, client_port);
+    close (clientsock); // close the child socket
+}
+
+/*
+ * Description:
+ * This is the child thread created by the server for handling incoming connections.
+ * It serves the connection as a session, which waits for messages and echoes them back
+ * to the client that sent them. When busy-polling (-S), it spins on non-blocking reads of the
+ * socket instead of sleeping in the event loop.
+ *
+ * Inputs:
+ *   clientsock  - the socket this thread will communicate to the client with
+ *   client_port - the port of the client this thread is monitoring
+ *   recv_delay  - true if the read process is to be slowed down
+ *   edge        - true if the socket is to be registered edge-triggered
+ *
+ * *Returns:
+ *   <none>
+ */
+void child_handle_client ( int clientsock, int client_port, bool recv_delay, bool edge )
+{
+    pid_t procid = getpid();
+    tEvLoopStc loop;
+
+    // the child gets its own event loop (the parent's epoll instance is shared across the fork)
+    if (evloop_init (&loop, edge) < 0)
+    {
+        close(clientsock);
+        return;
+    }
+    tSessionStc * session = session_open (&loop, clientsock, client_port, "pid", (int)procid, -1);
+    if (session == NULL)
+    {
+        evloop_fini(&loop);
+        return;
+    }
+
+    bool running = true;
+    unsigned spins = 0;
+    while (running)
+    {
+        // when busy-polling, the socket (and the shared memory link) is read directly, without
+        // waiting for it to become readable, and the event loop is only polled now and then (for
+        // write readiness, and the doorbell of the link)
+        if (session_busy_poll && ++spins % SESSION_SPIN_POLLS != 0)
+        {
+            running = session_handle (session, EPOLLIN, recv_delay);
+            continue;
+        }
 
-    // we remove the entry from the begining of the list
-    tBufferStc * pending = firstptr->next;
-    if (pending == 0) return NULL; // send queue is empty
+        // wait for the socket to become readable (or writable, if responses are queued)
+        int retcode = evloop_wait (&loop, session_busy_poll ? 0 : 1000);
+        if (retcode < 0)
+        {
+            if (errno == EINTR) continue;
+            logmsg(PRINT_ERROR, "epoll_wait: %s\n", strerror(errno));
+            break;
+        }
+        if (retcode == 0)  // ignore timeout condition
+            continue;
 
-    // check for NULL buffer in send queue
-    while (pending->buffer == NULL)
-    {
-        // if so, remove entry (free allocation) and move on to next entry
-        logmsg(PRINT_ERROR, "NULL buffer in sending queue list (msgix %d)\n", pending->msgix);
-        // remove invalid entry from queue
-        firstptr->next = pending->next;
-        if (pending->next == 0) lastptr->next = 0;  // removed last entry in queue
-        free(pending);
-        pending = firstptr->next;
-        if (pending == 0) break;
+        // the events are for the socket, or the doorbell of the shared memory link
+        int evix;
+        for (evix = 0; running && evix < retcode; evix++)
+        {
+            bool doorbell = SHM_IS_DOORBELL(loop.events[evix].data.ptr);
+            running = session_handle (session, doorbell ? 0 : loop.events[evix].events, recv_delay);
+        }
     }
 
-    return (pending);
+    int send_count = session->send_count;
+    session_close(session);
+    evloop_fini(&loop);
+    logmsg(PRINT_OTHER, "pid %d terminating (%d msgs, %lu syscalls)\n", (int)procid, send_count,
+            loop.calls + tcp_syscall_count);
 }
 
 /*
  * Description:
- * This is the child thread created by the server for handling incoming connections.
- * It waits for messages and echoes them back to the client that sent them.
+ * This is the child thread created by the server for handling incoming connections when the
+ * io_uring backend is selected. It does the same as child_handle_client, but the socket is
+ * registered with an io_uring instance: a multishot receive fills buffers from the provided
+ * buffer ring, and the queued responses are gathered into a single sendmsg submission, so
+ * one io_uring_enter call can submit the sends and collect the receives for many messages.
+ * A shared memory link offered by the client is not taken (the offer is echoed back like any
+ * message, which the client takes as declined).
  *
  * Inputs:
  *   clientsock  - the socket this thread will communicate to the client with
@@ -836,162 +2299,161 @@ tBufferStc * get_message ( tBufferStc * firstptr, tBufferStc * lastptr )
  *   recv_delay  - true if the read process is to be slowed down
  *
  * *Returns:
- *   the new connection structure (NULL if error)
+ *   <none>
  */
-void child_handle_client ( int clientsock, int client_port, bool recv_delay )
+void child_handle_client_uring ( int clientsock, int client_port, bool recv_delay )
 {
-    int retcode, send_count, recv_count;
+    int retcode, send_count, recv_count, slot;
     pid_t procid = getpid();
-    tBufferStc firstmsg, lastmsg;
-    char buffer[MAX_MESSAGE_LEN + 1];
-
-    firstmsg.next = NULL;
-    lastmsg.next = NULL;
+    tMsgQueueStc sendq;
+    char buffer[MAX_MESSAGE_LEN];
+    tFrameStc frame;
+    tUringStc ring;
+
+    // the batched send in progress (only one is outstanding at a time, to keep the stream in order)
+    tWireHdrStc      send_hdrs[URING_SEND_BATCH];
+    struct iovec     send_iov[URING_SEND_BATCH * 2];
+    struct msghdr    send_msg;
+    bool send_busy = false; // true while a sendmsg is outstanding (the queue is pinned)
+
+    msgqueue_init (&sendq);
     send_count = 0;
     recv_count = 0;
     bzero(buffer, sizeof(buffer));
+    memset(&frame, 0, sizeof(frame));
+    frame.buffer = buffer;
+    frame.size   = sizeof(buffer); // (larger messages are collected in pooled buffers)
+
+    if (uring_init (&ring) < 0)
+    {
+        close(clientsock);
+        return;
+    }
+    slot = uring_register_file (&ring, clientsock);
+    if (slot < 0 || uring_recv_multishot (&ring, slot, URING_USER_DATA(URING_OP_RECV, slot)) < 0)
+    {
+        uring_fini(&ring);
+        close(clientsock);
+        return;
+    }
 
     bool running = true;
     while (running)
     {
-        // zero the socket descriptor vector and set for server sockets
-        // (NOTE: this must be reset every time select() is called)
-        fd_set  read_set, write_set;
-        FD_ZERO (&read_set);
-        FD_ZERO (&write_set);
-        FD_SET (clientsock, &read_set);     // add server socket to read vector
-        int max_descriptor = clientsock;
-
-        // set the timeout for events and wait
-        struct timeval  sel_timeout;
-        sel_timeout.tv_sec = 1;
-        sel_timeout.tv_usec = 0;
-        retcode = select (max_descriptor+1, &read_set, &write_set, NULL, &sel_timeout);
+        // submit the prepared operations and wait for a completion (a single system call)
+        retcode = uring_submit (&ring, 1);
         if (retcode < 0)
         {
-//            if (errno == EINTR) continue;
-            logmsg(PRINT_ERROR, "select: %s\n", strerror(errno));
+            if (errno == EINTR) continue;
+            logmsg(PRINT_ERROR, "io_uring_enter: %s\n", strerror(errno));
             running = false;
             break;
         }
-        if (retcode == 0)  // ignore timeout condition
-            continue;
 
-        if (FD_ISSET (clientsock, &read_set))
+        struct io_uring_cqe * cqe;
+        while (running && (cqe = uring_peek_cqe (&ring)) != NULL)
         {
-            // read response from server
-            bzero(buffer, sizeof(buffer));
-            tRecvMsgTyp recv_error = tcp_recv_message (clientsock, buffer, sizeof(buffer));
-            if (recv_error == RECV_TERMINATED)
-            {
-                logmsg(PRINT_SOCKET, "socket recvmsg (port %u) pid %d terminated connection\n", client_port, (int)procid);
-                running = false;
-                break;
-            }
-            else if (recv_error == RECV_BLOCKED)
-            {
-                logmsg(PRINT_ERROR, "socket recvmsg (port %u): blocked\n", client_port);
-            }
-            else if (recv_error == RECV_FAILURE)
-            {
-                logmsg(PRINT_ERROR, "socket recvmsg (port %u): %s\n", client_port, strerror(errno));
-                running = false;
-                break;
-            }
-            else // if (recv_error == RECV_COMPLETE)
+            int res = cqe->res;
+            if (URING_USER_OP(cqe->user_data) == URING_OP_RECV)
             {
-                // success - echo response back to the client
-                recv_count++;
-                remove_term (buffer, sizeof(buffer)); // remove any terminator chars
-                logmsg(PRINT_SENT, "pid %d [port %u msg %u] : %.30s\n", (int)procid, client_port, recv_count, buffer);
-                int msglen = strlen(buffer);
-
-                // allocate a block to hold the received message
-                char * response = (char*)malloc(msglen + 1);
-                if (response == NULL)
+                if (res == 0)
                 {
-                    logmsg(PRINT_ERROR, "memory allocation for message\n");
+                    logmsg(PRINT_SOCKET, "socket recv (port %u) pid %d terminated connection\n", client_port, (int)procid);
                     running = false;
-                    break;
                 }
-
-                // place response in send queue
-                // allocate a message queue entry to add
-                tBufferStc * qentry = (tBufferStc*)malloc(sizeof(tBufferStc));
-                if (qentry == NULL)
+                else if (res == -ENOBUFS)
                 {
-                    logmsg(PRINT_ERROR, "memory allocation for send queue\n");
-                    free(response);
-                    running = false;
-                    break;
+                    // all the provided buffers are in use - the receive is re-armed below
                 }
-
-                // save the message contents in it
-                memcpy (response, buffer, msglen + 1);
-                bzero(buffer, sizeof(buffer)); // reset the receive buffer
-                qentry->buffer = response;
-                qentry->msglen = msglen;
-                qentry->msgix  = recv_count; // save the message index for this connection
-                qentry->next   = 0;       // this indicates there are no entries after this
-
-                // we add the entry to the end of the list
-                if (lastmsg.next) lastmsg.next->next = qentry;  // not 1st entry, set last entry to point to this
-                else              firstmsg.next      = qentry;  // adding 1st entry to list, set first ptr
-                lastmsg.next = qentry; // this must always point to new last entry
-            }
-
-            // if we are trying to slow down the response of the server, let's insert a short delay here
-            if (recv_delay) sleep(1);
-
-        } // end: if (FD_ISSET (clientsock, &read_set))
-
-        // NOTE: always attempt to send, since we may not get notified when we first add an entry to the queue.
-        //if (FD_ISSET (clientsock, &write_set))
-        {
-            // attempt to send messages from queue
-            tBufferStc * pending = firstmsg.next;
-            while (pending)
-            {
-                tBufferStc * next = pending->next;
-                if (pending->buffer == NULL)
+                else if (res < 0)
                 {
-                    //rem_message (&firstmsg, &lastmsg); // invalid NULL buffer
-                    firstmsg.next = next;
-                    if (next == 0) lastmsg.next = 0;  // removed last entry in queue
-                    free(pending);
-                    pending = next;
-                    continue;
+                    logmsg(PRINT_ERROR, "socket recv (port %u): %s\n", client_port, strerror(-res));
+                    running = false;
                 }
-
-                // send the message
-                tSendMsgTyp send_error = tcp_send_message ( clientsock, pending->buffer, strlen(pending->buffer), send_count+1 );
-                if (send_error == SEND_BLOCKED)
+                else
                 {
-                    logmsg(PRINT_ERROR, "socket sendmsg (port %u): blocked\n", client_port);
+                    // collect all the messages in the received data
+                    char * data = uring_buffer (&ring, cqe);
+                    int used = 0;
+                    while (running && used < res)
+                    {
+                        int n = tcp_frame_collect (&frame, &data[used], res - used);
+                        if (n < 0)
+                        {
+                            running = false;
+                            break;
+                        }
+                        used += n;
+                        if (!tcp_frame_complete (&frame))
+                            continue;
+
+                        // success - echo response back to the client (the start of it is displayed)
+                        // (place the whole response in send queue, with the message index of the client)
+                        char * message = tcp_frame_message (&frame);
+                        recv_count++;
+                        logmsg(PRINT_SENT, "pid %d [port %u msg %u] : %.*s\n", (int)procid, client_port, recv_count,
+                                log_peek(frame.header.msglen), message);
+                        if (add_message (&sendq, frame.header.msgix, message, frame.header.msglen) != 0)
+                        {
+                            running = false;
+                            break;
+                        }
+                        tcp_frame_reset (&frame); // start collecting the next message
+
+                        // if we are trying to slow down the response of the server, let's insert a short delay here
+                        if (recv_delay) sleep(1);
+                    }
                 }
-                else if (send_error == SEND_FAILURE)
+
+                uring_recycle_buffer (&ring, cqe);
+                if (running && !(cqe->flags & IORING_CQE_F_MORE))
+                    uring_recv_multishot (&ring, slot, URING_USER_DATA(URING_OP_RECV, slot)); // re-arm the receive
+            }
+            else // if (URING_USER_OP(cqe->user_data) == URING_OP_SEND)
+            {
+                send_busy = false;
+                if (res < 0)
                 {
-                    logmsg(PRINT_ERROR, "socket sendmsg (port %u): %s\n", client_port, strerror(errno));
+                    logmsg(PRINT_ERROR, "socket sendmsg (port %u): %s\n", client_port, strerror(-res));
                     running = false;
-                    break;
-                }
-                else // if (send_error == SEND_COMPLETE)
-                {
-                    // message was successfully sent - remove it from queue
-                    firstmsg.next = pending->next;
-                    if (pending->next == 0) lastmsg.next = 0;  // removed last entry in queue
-                    free(pending->buffer);
-                    free(pending);
-                    send_count++;
                 }
 
-                pending = next;
+                // remove the messages that were completely sent from the queue (the queue
+                // remembers how much of the next one was sent if the send was short)
+                if (res > 0)
+                    send_count += msgqueue_consume (&sendq, res);
+                msgqueue_pin (&sendq, false);
+            }
+
+            uring_cqe_seen (&ring);
+        }
+
+        // gather the queued responses into one sendmsg
+        if (running && !send_busy && msgqueue_depth(&sendq))
+        {
+            size_t total;
+            int iovs = msgqueue_gather (&sendq, send_hdrs, send_iov, URING_SEND_BATCH, &total);
+
+            memset (&send_msg, 0, sizeof(send_msg));
+            send_msg.msg_iov    = send_iov;
+            send_msg.msg_iovlen = iovs;
+            if (uring_sendmsg (&ring, slot, &send_msg, URING_USER_DATA(URING_OP_SEND, slot)) == 0)
+            {
+                msgqueue_pin (&sendq, true); // the kernel reads the queued messages until the send completes
+                send_busy = true;
             }
-        } // end: if (FD_ISSET (clientsock, &write_set))
+        }
     }
 
+    // discard any responses that were not sent (and any message partly received)
+    msgqueue_fini (&sendq);
+    tcp_frame_reset (&frame);
+
+    logmsg(PRINT_OTHER, "pid %d terminating (%d msgs, %lu syscalls, %lu io_uring ops)\n", (int)procid, send_count,
+            ring.enters, ring.submitted);
+    uring_unregister_file (&ring, slot);
+    uring_fini (&ring);
     close(clientsock);
-    logmsg(PRINT_OTHER, "pid %d terminating\n", (int)procid);
 }
 
 /*
@@ -1037,28 +2499,107 @@ int main(int argc, char *argv[])
 {
     int  serversock, clientsock;
     int  portno, destport, setport, retcode;
-    int  recv_delay, testcount;
+    int  recv_delay;
+    bool edge_trigger, use_uring, use_fork, least_load, reuseport;
+    int  thread_count, worker_count, backlog;
     tConnectStc * current_endpt;
     unsigned int  child_count = 0;
-    pid_t  process_id;
     struct hostent *server;
+    const char * command_path = NULL;   // the command file of a headless endpoint (-x)
+    const char * control_path = NULL;   // the control socket of a headless endpoint (-k)
+
+    crc32c_init();
+
+    // parse the command line options
+    edge_trigger = false;
+    use_uring = false;
+    use_fork = false;
+    least_load = false;
+    thread_count = 0;
+    worker_count = 0;
+    reuseport = false;
+    backlog = TCP_LISTEN_BACKLOG;
+    use_shm = false;
+    int option;
+    while ((option = getopt(argc, argv, "eufp:t:lrb:ms:w:czB:S:x:k:")) != -1)
+    {
+        switch (option)
+        {
+            case 'e' : edge_trigger = true; break;
+            case 'u' : use_uring = true;    break;
+            case 'f' : use_fork = true;     break;
+            case 'p' : worker_count = atoi(optarg); break;
+            case 't' : thread_count = atoi(optarg); break;
+            case 'l' : least_load = true;   break;
+            case 'r' : reuseport = true;    break;
+            case 'b' : backlog = atoi(optarg); break;
+            case 'm' : use_shm = true;      break;
+            case 's' : tcp_msg_limit = atoi(optarg); break;
+            case 'w' : wire_version = atoi(optarg); break;
+            case 'c' : use_crc = true;      break;
+            case 'z' : session_splice = true; break;
+            case 'B' : tcp_sock_bufsize = atoi(optarg); break;
+            case 'S' : session_busy_poll = true; tcp_nodelay = true; tcp_busy_poll = atoi(optarg); break;
+            case 'x' : command_path = optarg; break;
+            case 'k' : control_path = optarg; break;
+            default :
+                fprintf(stderr," ! ERROR, usage: %s [-e] [-u] [-f] [-p <workers>] [-t <threads>] [-l] [-r] [-b <backlog>] [-m] [-s <bytes>] [-w <version>] [-c] [-z] [-B <bytes>] [-S <usec>] [-x <file>] [-k <path>] <port>\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (use_uring) use_fork = true; // the io_uring backend serves each connection in a child process
+    if (reuseport && use_fork)
+    {
+        fprintf(stderr," ! ERROR, -r requires the reactor threads (not -f or -u)\n");
+        exit(1);
+    }
+    if (worker_count < 0 || worker_count > WORKER_MAX_PROCS || (worker_count > 0 && (use_fork || reuseport)))
+    {
+        fprintf(stderr," ! ERROR, -p takes 1-%d workers, and not with -f, -u or -r\n", WORKER_MAX_PROCS);
+        exit(1);
+    }
+    bool use_workers = (worker_count > 0);
+    if (backlog <= 0)
+    {
+        fprintf(stderr," ! ERROR, invalid backlog\n");
+        exit(1);
+    }
+    if (tcp_msg_limit < MAX_MESSAGE_LEN)
+    {
+        fprintf(stderr," ! ERROR, the largest message must be at least %d bytes\n", MAX_MESSAGE_LEN);
+        exit(1);
+    }
+    if (tcp_sock_bufsize < 0)
+    {
+        fprintf(stderr," ! ERROR, invalid socket buffer size\n");
+        exit(1);
+    }
+    if (tcp_busy_poll < 0)
+    {
+        fprintf(stderr," ! ERROR, invalid busy-poll time\n");
+        exit(1);
+    }
+    if (wire_version != WIRE_V1 && wire_version != WIRE_V2)
+    {
+        fprintf(stderr," ! ERROR, the wire format must be %d or %d\n", WIRE_V1, WIRE_V2);
+        exit(1);
+    }
 
-    // initialize any user interface setup
-    userio_init();
-
-    if (argc < 2)
+    if (optind >= argc)
     {
         fprintf(stderr," ! ERROR, no port provided\n");
         exit(1);
     }
 
-    portno = atoi(argv[1]);
+    // initialize any user interface setup (headless with a command file or a control socket)
+    bool headless = (command_path != NULL || control_path != NULL);
+    userio_init(headless, command_path);
+
+    portno = atoi(argv[optind]);
     recv_delay = 0;
-    process_id = 0;
     destport = -1;
     serversock = -1;
     clientsock = -1;
-    testcount = 0;
     current_endpt = NULL;
     init_all_connections();
 
@@ -1069,10 +2610,105 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
+    // pre-fork the worker processes, before the descriptors of the main thread are opened
+    // (so the workers do not inherit them)
+    if (use_workers && worker_pool_init (&worker_pool, worker_count, edge_trigger) < 0)
+        exit(1);
+
     // create the server socket for accepting incoming connections
-    serversock = tcp_create_socket (portno);
-    if (serversock < 0)
+    // (unless the reactor threads each create their own)
+    if (!reuseport)
+    {
+        serversock = tcp_create_socket (portno, backlog, false);
+        if (serversock < 0)
+            exit(1);
+        spare_fd = tcp_spare_open ();
+    }
+
+    // create the event loop and register the keyboard input and server listen socket with it.
+    // (the lines typed in are read by the input thread, which signals its eventfd for each one)
+    if (evloop_init (&main_loop, edge_trigger) < 0)
+        exit(1);
+    if (evloop_add (&main_loop, userio_input_fd(), EVLOOP_READ | EVLOOP_LEVEL, &evtag_input) < 0)
+        exit(1);
+    if (use_uring)
+    {
+        // connections are accepted by a multishot accept. the io_uring descriptor is readable
+        // while completions are waiting, so it is monitored by the event loop in place of the listen socket.
+        if (uring_init (&accept_ring) < 0 ||
+            uring_accept_multishot (&accept_ring, serversock, URING_USER_DATA(URING_OP_ACCEPT, 0)) < 0 ||
+            uring_submit (&accept_ring, 0) < 0 ||
+            evloop_add (&main_loop, accept_ring.ringfd, EVLOOP_READ | EVLOOP_LEVEL, &evtag_uring) < 0)
+            exit(1);
+    }
+    else if (!reuseport && evloop_add (&main_loop, serversock, EVLOOP_READ, &evtag_server) < 0)
+    {
+        exit(1);
+    }
+
+    // the servers this endpoint offers shared memory links to take them from this socket
+    if (use_shm)
+    {
+        shm_listenfd = shm_listen ();
+        if (shm_listenfd < 0 || evloop_add (&main_loop, shm_listenfd, EVLOOP_READ, &evtag_shm) < 0)
+            exit(1);
+    }
+
+    // a headless endpoint takes the commands of the clients of its control socket
+    control_init (&control);
+    if (control_path != NULL &&
+        (control_listen (&control, control_path) < 0 ||
+         evloop_add (&main_loop, control.listenfd, EVLOOP_READ, &evtag_control) < 0))
+        exit(1);
+
+    // the #w command stops taking the command lines until this timer expires (or the load test is done)
+    int hold_timerfd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (hold_timerfd < 0 || evloop_add (&main_loop, hold_timerfd, EVLOOP_READ | EVLOOP_LEVEL, &evtag_hold) < 0)
+    {
+        logmsg(PRINT_ERROR, "wait timer: %s\n", strerror(errno));
+        exit(1);
+    }
+    // out of descriptors with no spare one, the listen socket is not monitored until this timer expires
+    int backoff_timerfd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (backoff_timerfd < 0 || evloop_add (&main_loop, backoff_timerfd, EVLOOP_READ | EVLOOP_LEVEL, &evtag_backoff) < 0)
+    {
+        logmsg(PRINT_ERROR, "accept backoff timer: %s\n", strerror(errno));
+        exit(1);
+    }
+    bool input_held = false;            // true while the command lines are not taken (#w)
+    bool hold_for_test = false;         // true if they are held until the load test is done
+    unsigned long input_seq = 0;        // number of command lines taken from the input
+    int input_reply_fd = headless ? STDOUT_FILENO : -1; // where their results are written
+
+    // start the reactor threads. the main thread is signalled when they close connections.
+    // (or, with the worker processes, the workers report on their channels when they do)
+    if (use_workers)
+    {
+        int ix;
+        for (ix = 0; ix < worker_pool.count; ix++)
+            if (evloop_add (&main_loop, worker_pool.workers[ix].chanfd, EVLOOP_READ | EVLOOP_LEVEL, &worker_pool.workers[ix]) < 0)
+                exit(1);
+    }
+    else if (!use_fork)
+    {
+        if (reactor_pool_init (&reactor_pool, thread_count, least_load, edge_trigger, reuseport ? portno : 0, backlog) < 0 ||
+            evloop_add (&main_loop, reactor_pool.notify_fd, EVLOOP_READ | EVLOOP_LEVEL, &evtag_reactor) < 0)
+            exit(1);
+    }
+
+    // update the status window periodically
+    int status_timerfd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (status_timerfd < 0 || evloop_add (&main_loop, status_timerfd, EVLOOP_READ | EVLOOP_LEVEL, &evtag_status) < 0)
+    {
+        logmsg(PRINT_ERROR, "status timer: %s\n", strerror(errno));
         exit(1);
+    }
+    struct itimerspec status_period;
+    status_period.it_interval.tv_sec  = STATUS_PERIOD_MSEC / 1000;
+    status_period.it_interval.tv_nsec = (STATUS_PERIOD_MSEC % 1000) * 1000000L;
+    status_period.it_value = status_period.it_interval;
+    if (!headless)
+        timerfd_settime (status_timerfd, 0, &status_period, NULL);
 
     // setup handler for SIGCHLD signal to handle the death of a child
     //(the children processes handle the server responses for each server connection)
@@ -1084,262 +2720,433 @@ int main(int argc, char *argv[])
     bool running = true;
     while (running)
     {
-        // zero the socket descriptor vector and set for server sockets
-        // (NOTE: this must be reset every time select() is called)
-        fd_set  read_set, write_set;
-        FD_ZERO (&read_set);
-        FD_ZERO (&write_set);
-        FD_SET (STDIN_FILENO, &read_set);   // add keyboard to read vector
-        FD_SET (serversock, &read_set);     // add server socket to read vector
-        int max_descriptor = serversock;
-        set_connection_select (&read_set, &max_descriptor);  // add active endpoints to read vector
-        set_connection_select (&write_set, &max_descriptor); // add active endpoints to write vector
-
-        // set the timeout for events and wait
-        struct timeval  sel_timeout;
-        sel_timeout.tv_sec = 1;
-        sel_timeout.tv_usec = 0;
-        retcode = select (max_descriptor+1, &read_set, &write_set, NULL, &sel_timeout);
+        // wait for events on the registered descriptors
+        // (don't wait if the bulk test stream can go on without waiting for the socket, or
+        // while the ping-pong test is busy-polled)
+        bool spinning = session_busy_poll && ping_test.running;
+        retcode = evloop_wait (&main_loop, ((bulk_test.state == BULK_STREAMING && bulk_test.writable) || spinning) ? 0 : 1000);
         if (retcode < 0)
         {
             if (errno == EINTR)
             {
-                logmsg(PRINT_OTHER, "select [main] interrupted, restarting\n");
+                logmsg(PRINT_OTHER, "epoll_wait [main] interrupted, restarting\n");
                 continue;
             }
-            logmsg(PRINT_ERROR, "select [main]: %s\n", strerror(errno));
+            logmsg(PRINT_ERROR, "epoll_wait [main]: %s\n", strerror(errno));
             exit(1);
         }
-        else if (retcode == 0)
-        {
-            // timeout
-        }
-        else
+
+        // the keyboard input and the load test are handled after the socket events, since a
+        // command or a failed send may remove a connection that still has an entry in the ready list
+        bool input_ready = false;
+        bool load_due = false;
+        bool bulk_due = false;
+        bool control_ready = false;
+
+        int evix;
+        for (evix = 0; evix < retcode; evix++)
         {
-            if (FD_ISSET (STDIN_FILENO, &read_set))
+            uint32_t events = main_loop.events[evix].events;
+            void *   evdata = main_loop.events[evix].data.ptr;
+
+            if (evdata == &evtag_input)
+            {
+                input_ready = true;
+            }
+            else if (evdata == &evtag_loadgen)
+            {
+                load_due = true;
+            }
+            else if (evdata == &evtag_bulk)
+            {
+                bulk_due = true;
+            }
+            else if (evdata == &evtag_shm)
+            {
+                give_shm_links ();
+            }
+            else if (evdata == &evtag_status)
+            {
+                uint64_t expirations;
+                if (read (status_timerfd, &expirations, sizeof(expirations)) > 0)
+                    show_status ();
+            }
+            else if (evdata == &evtag_control)
+            {
+                // the clients connecting to the control socket send their command lines on their connections
+                tControlClientStc * client;
+                while ((client = control_accept (&control)) != NULL)
+                {
+                    client->events = EVLOOP_READ | EVLOOP_LEVEL;
+                    if (evloop_add (&main_loop, client->fd, client->events, client) < 0)
+                        control_drop (client);
+                }
+            }
+            else if (CONTROL_IS_CLIENT(&control, evdata))
+            {
+                // (the lines are run after the socket events, like the keyboard input)
+                tControlClientStc * client = (tControlClientStc *)evdata;
+                if (events & EPOLLOUT)
+                    control_flush (client);
+                if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                    control_recv (client);
+                control_ready = true;
+            }
+            else if (evdata == &evtag_hold)
+            {
+                // the #w wait is over: take the command lines again
+                uint64_t expirations;
+                if (read (hold_timerfd, &expirations, sizeof(expirations)) > 0 && input_held && !hold_for_test &&
+                    evloop_add (&main_loop, userio_input_fd(), EVLOOP_READ | EVLOOP_LEVEL, &evtag_input) == 0)
+                    input_held = false;
+            }
+            else if (evdata == &evtag_server)
             {
                 //=====================================================================
-                // THIS SECTION HANDLES THE KEYBOARD INPUT FROM THE USER, WHICH IS USED
-                // TO HANDLE COMMANDS (SUCH AS OPENING AND CLOSING CONNECTIONS TO OTHER
-                // ENDPOINTS AND TERMINATING) AS WELL AS SPECIFYING MESSAGES TO SEND TO
-                // THE ENDPOINTS IT IS CONNECTED TO.
+                // THIS SECTION HANDLES THE SERVER LISTEN SOCKET, WHICH:
+                // - RECEIVES CONNECTION REQUESTS FROM NEW CLIENTS (MAIN THREAD)
+                // - RECEIVES MESSAGES FROM THE EXTERNAL ENDPOINT CLIENTS (REACTOR THREAD)
+                //
+                // NOTE THAT EACH ENDPOINT CONNECTION IS HANDED OFF TO ONE OF THE REACTOR
+                // THREADS (OR TO A CHILD PROCESS CREATED FOR IT, IF FORKING).
                 //=====================================================================
 
-                // read the keyboard input
-                testcount = 0; // any keyboard input automatically stops the message test mode
-                int value = 0;
-                char buffer[MAX_MESSAGE_LEN + 1];
-                bzero(buffer, sizeof(buffer));
-                int command = userio_get_command (&value, buffer, sizeof(buffer));
-                switch (command)
+                // accept all the pending connections (a failed accept only drops that connection)
+                while (true)
                 {
-                    case ACTION_QUIT :
-                        logmsg(PRINT_QUERY, "endpoint exiting...\n");
-                        running = false;
-                        break;
-                    case ACTION_SEND_MESSAGE :
-                        // check if we have a server connection yet
-                        if (current_endpt == NULL || current_endpt->state == STATE_IDLE)
+                    int client_port;
+                    clientsock = tcp_accept_connection (serversock, &client_port);
+                    if (clientsock < 0)
+                    {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) break; // no more pending connections
+                        if (errno == ECONNABORTED || errno == EPROTO || errno == EINTR) continue;
+                        if ((errno == EMFILE || errno == ENFILE) && tcp_shed_connection (serversock, &spare_fd)) continue;
+                        if (errno == EMFILE || errno == ENFILE)
                         {
-                            logmsg(PRINT_ERROR, "No active connection specified. Either create or select a connection to use\n");
+                            // no spare descriptor: stop monitoring the listen socket for a while
+                            // (the loop would spin on it, or never hear of it again if edge-triggered)
+                            struct itimerspec backoff;
+                            memset (&backoff, 0, sizeof(backoff));
+                            backoff.it_value.tv_nsec = TCP_ACCEPT_BACKOFF_MSEC * 1000000L;
+                            if (evloop_del (&main_loop, serversock) == 0)
+                                timerfd_settime (backoff_timerfd, 0, &backoff, NULL);
                         }
-                        else
+                        break; // retry on the next event
+                    }
+                    if (use_fork)
+                    {
+                        fork_client_handler (serversock, clientsock, client_port, recv_delay, edge_trigger, false);
+                    }
+                    else if (use_workers)
+                    {
+                        int slot;
+                        int worker = worker_pool_assign (&worker_pool, clientsock, client_port, recv_delay, &slot);
+                        if (worker >= 0)
                         {
-                            // attempt to send the message
-                            current_endpt->msgix++; // increment the # of messages produced
-                            send_message (current_endpt, buffer);
+                            logmsg(PRINT_OTHER, "worker %d slot %d handling port %u\n", worker, slot, client_port);
+                            add_server_link (0, -1, worker, slot, client_port);
                         }
-                        break;
-                    case ACTION_ADD_ENDPOINT :
-                        current_endpt = add_connection (value, server);
-                        // if successful, new connection becomes active socket
-                        break;
-                    case ACTION_REM_ENDPOINT :
-                        rem_connection (value);
-                        // if current endpoint is the one we deleted, set selection to NULL
-                        if (current_endpt != NULL && current_endpt->destport == value)
-                            current_endpt = NULL;
-                        break;
-                    case ACTION_SEL_ENDPOINT :
-                        current_endpt = find_connection (value);
-                        if (current_endpt == NULL)
-                            logmsg(PRINT_ERROR, "connection to port %u not found\n", value);
-                        break;
-                    case ACTION_DELAY :
-                        recv_delay = true;
-                        break;
-                    case ACTION_TEST :
-                        if (current_endpt == NULL || current_endpt->state == STATE_IDLE)
-                            logmsg(PRINT_ERROR, "No active connection specified. Either create or select a connection to use\n");
-                        else
+                    }
+                    else
+                    {
+                        int slot;
+                        int thread = reactor_pool_assign (&reactor_pool, clientsock, client_port, &slot);
+                        if (thread >= 0)
                         {
-                            testcount = value;
-                            if (testcount > 99999) testcount = 99999;
-                            if (testcount < 0)     testcount = 0;
+                            logmsg(PRINT_OTHER, "thread %d slot %d handling port %u\n", thread, slot, client_port);
+                            add_server_link (0, thread, -1, slot, client_port);
                         }
-                        break;
-                    case ACTION_SET_PRINT_FLAG :
-                        print_flag = value;
-                        break;
-                    case ACTION_SHOW_CONNECTIONS :
-                        show_all_connections ();
-                        break;
-                    default :
-                    case ACTION_INVALID :
-                        logmsg(PRINT_ERROR, "Unknown command received: %d\n", command);
-                        break;
+                    }
                 }
-            } // end: if (FD_ISSET (STDIN_FILENO, &read_set))
-
-            // check if message test is running
-            if (testcount)
+            }
+            else if (evdata == &evtag_backoff)
+            {
+                // take the connections again (a new spare descriptor is opened first, if it was lost)
+                uint64_t expirations;
+                if (read (backoff_timerfd, &expirations, sizeof(expirations)) > 0)
+                {
+                    if (spare_fd < 0)
+                        spare_fd = tcp_spare_open ();
+                    if (evloop_add (&main_loop, serversock, EVLOOP_READ, &evtag_server) < 0)
+                        exit(1);
+                }
+            }
+            else if (evdata == &evtag_reactor)
             {
-                char tempbuf[101];
-                sprintf(tempbuf, "%5.5d: This is a test message to determine if the send process gets blocked. 01234567890123456789...", testcount);
-                current_endpt->msgix++; // increment the # of messages produced
-                send_message (current_endpt, tempbuf);
-                testcount--;
+                // the reactor threads closed connections - release their sessions
+                uint64_t count;
+                if (read (reactor_pool.notify_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                    logmsg(PRINT_ERROR, "eventfd read [main]: %s\n", strerror(errno));
+                int thread, slot;
+                while (reactor_pool_closed (&reactor_pool, &thread, &slot))
+                    rem_server_slot (thread, slot);
             }
-
-            if (running)
+            else if (WORKER_IS_CHANNEL(&worker_pool, evdata))
             {
-                if (FD_ISSET (serversock, &read_set))
+                // a worker reported connections closed - release their sessions (all of
+                // them if the worker has gone, and stop monitoring its channel)
+                tWorkerStc * worker = (tWorkerStc *)evdata;
+                int slot;
+                while (worker_pool_closed (worker, &slot))
+                    rem_server_worker (worker->index, slot);
+                if (worker->lost && worker->chanfd >= 0)
                 {
-                    //=====================================================================
-                    // THIS SECTION HANDLES THE SERVER LISTEN SOCKET, WHICH:
-                    // - RECEIVES CONNECTION REQUESTS FROM NEW CLIENTS (MAIN THREAD)
-                    // - RECEIVES MESSAGES FROM THE EXTERNAL ENDPOINT CLIENTS (CHILD THREAD)
-                    //
-                    // NOTE THAT THERE IS ONE CHILD THREAD CREATED FOR EACH ENDPOINT CONNECTION.
-                    //=====================================================================
+                    evloop_del (&main_loop, worker->chanfd);
+                    worker_pool_drop (worker);
+                }
+            }
+            else if (evdata == &evtag_uring)
+            {
+                // same as above, for the connections accepted by the io_uring backend
+                struct io_uring_cqe * cqe;
+                while ((cqe = uring_peek_cqe (&accept_ring)) != NULL)
+                {
+                    int  res  = cqe->res;
+                    bool more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+                    uring_cqe_seen (&accept_ring);
 
-                    // wait for connections
-                    int client_port;
-                    clientsock = tcp_accept_connection (serversock, &client_port);
-                    if (clientsock < 0) exit(1);
-                    if ((process_id = fork()) < 0)
+                    if (res < 0)
                     {
-                        logmsg(PRINT_ERROR, "fork: %s\n", strerror(errno));
-                        exit(1);
+                        logmsg(PRINT_ERROR, "socket accept (io_uring): %s\n", strerror(-res));
                     }
-
-                    // the child process (it handles the data socket)...
-                    else if (process_id == 0)
+                    else
                     {
-                        close (serversock); // close parent socket
-                        child_handle_client (clientsock, client_port, recv_delay); // child handles data on client socket
-                        exit (0); // terminate the child process
+                        clientsock = res;
+                        fork_client_handler (serversock, clientsock, tcp_get_peer_port (clientsock), recv_delay, edge_trigger, true);
                     }
 
-                    // the parent process (it handles the connection socket)...
-                    logmsg(PRINT_OTHER, "spawned child process pid: %d to handle port %u (recv delay = %d)\n",
-                            (int)process_id, client_port, recv_delay);
-                    add_server_link (process_id, client_port);
-                    close (clientsock); // close the child socket
-                } // end: if (FD_ISSET (serversock, &read_set))
-
+                    // re-arm the accept if the kernel stopped it
+                    if (!more)
+                    {
+                        uring_accept_multishot (&accept_ring, serversock, URING_USER_DATA(URING_OP_ACCEPT, 0));
+                        uring_submit (&accept_ring, 0);
+                    }
+                }
+            }
+            else if (evdata == &evloop_forgotten)
+            {
+                continue; // (the connection was closed)
+            }
+            else if (SHM_IS_DOORBELL(evdata))
+            {
+                //=====================================================================
+                // THIS SECTION HANDLES THE DOORBELL OF A SHARED MEMORY LINK, RUNG BY THE
+                // SERVER WHEN IT ADDS RESPONSES TO THE LINK, OR MAKES ROOM FOR MESSAGES.
+                //=====================================================================
+                // (this is tested after the event tags above, which may be at odd addresses)
+                tConnectStc * connection = (tConnectStc *)SHM_DOORBELL_OWNER(evdata);
+                shm_link_drain (&connection->shm);
+                if (!receive_responses (connection, true) || send_message (connection, NULL, 0, 0) == -2)
+                {
+                    if (current_endpt == connection) current_endpt = NULL; // connection was closed
+                }
+            }
+            else
+            {
                 //=====================================================================
-                // THIS SECTION HANDLES EACH OF THE ENDPOINT SOCKETS
-                // (HOWEVER MANY ACTIVE CONNECTIONS THERE ARE)
+                // THIS SECTION HANDLES EACH OF THE ENDPOINT SOCKETS THAT ARE READY
                 //=====================================================================
-                tConnectStc * connection;
-                for (connection = first_conn_req.next; connection != NULL; connection = connection->next)
+                tConnectStc * connection = (tConnectStc *)evdata;
+                if (events & (EPOLLOUT | EPOLLERR))
                 {
-                    if (FD_ISSET (connection->sockfd, &write_set))
+                    //=====================================================================
+                    // THIS SECTION HANDLES THE ENDPOINT WRITE EVENTS, WHICH:
+                    // - HANDLE COMPLETION OF THE CONNECTION TO ANOTHER ENDPOINT (STARTED
+                    //   WHEN THE CONNECTION COMMAND WAS INITIATED BY THE KEYBOARD INPUT).
+                    // - HANDLE SENDING NEXT QUEUED MESSAGE THAT WAS PREVIOUSLY BLOCKED.
+                    //=====================================================================
+                    if (connection->state == STATE_PENDING)
                     {
-                        //=====================================================================
-                        // THIS SECTION HANDLES THE ENDPOINT WRITE EVENTS, WHICH:
-                        // - HANDLE COMPLETION OF THE CONNECTION TO ANOTHER ENDPOINT (STARTED
-                        //   WHEN THE CONNECTION COMMAND WAS INITIATED BY THE KEYBOARD INPUT).
-                        // - HANDLE SENDING NEXT QUEUED MESSAGE THAT WAS PREVIOUSLY BLOCKED.
-                        //=====================================================================
-                        if (connection->state == STATE_PENDING)
+                        // determine if connection to server has completed successfully
+                        int sock_error;
+                        socklen_t sopt_size;
+                        sopt_size = sizeof(sock_error);
+                        retcode = getsockopt(connection->sockfd, SOL_SOCKET, SO_ERROR, &sock_error, &sopt_size);
+                        if (retcode < 0)
                         {
-                            // determine if connection to server has completed successfully
-                            int sock_error;
-                            socklen_t sopt_size;
-                            sopt_size = sizeof(sock_error);
-                            retcode = getsockopt(connection->sockfd, SOL_SOCKET, SO_ERROR, &sock_error, &sopt_size);
-                            if (retcode < 0)
-                            {
-                                logmsg(PRINT_SOCKET, "socket getsockopt failed (port %u): %s\n", connection->destport, strerror(errno));
-                                rem_connection (connection->destport);
-                                continue; // exit processing of this connection
-                            }
-                            else if (sock_error != 0)
-                            {
-                                logmsg(PRINT_SOCKET, "socket getsockopt connect failure (port %u): %s\n", connection->destport, strerror(sock_error));
-                                rem_connection (connection->destport);
-                                continue; // exit processing of this connection
-                            }
-                            else
+                            logmsg(PRINT_SOCKET, "socket getsockopt failed (port %u): %s\n", connection->destport, strerror(errno));
+                            if (current_endpt == connection) current_endpt = NULL;
+                            rem_connection (connection->destport);
+                            continue; // exit processing of this connection
+                        }
+                        else if (sock_error != 0)
+                        {
+                            logmsg(PRINT_SOCKET, "socket getsockopt connect failure (port %u): %s\n", connection->destport, strerror(sock_error));
+                            if (current_endpt == connection) current_endpt = NULL;
+                            rem_connection (connection->destport);
+                            continue; // exit processing of this connection
+                        }
+                        else
+                        {
+                            // get the assigned port for the endpoint
+                            struct sockaddr_in my_addr;
+                            socklen_t addr_size = sizeof(my_addr);
+                            getsockname(connection->sockfd, (struct sockaddr*)&my_addr, &addr_size);
+                            connection->sendport = ntohs(my_addr.sin_port);
+                            connection->state = STATE_READY;
+                            logmsg(PRINT_SOCKET, "socket getsockopt connect complete (port %u) - sending on port: %u\n", connection->destport, connection->sendport);
+                            set_connection_events (connection); // connect done, only need write events for queued messages
+                            if (!start_shm_link (connection))
                             {
-                                // get the assigned port for the endpoint
-                                struct sockaddr_in my_addr;
-                                socklen_t addr_size = sizeof(my_addr);
-                                getsockname(connection->sockfd, (struct sockaddr*)&my_addr, &addr_size);
-                                connection->sendport = ntohs(my_addr.sin_port);
-                                connection->state = STATE_READY;
-                                logmsg(PRINT_SOCKET, "socket getsockopt connect complete (port %u) - sending on port: %u\n", connection->destport, connection->sendport);
+                                if (current_endpt == connection) current_endpt = NULL;
+                                continue; // connection was closed
                             }
                         }
+                    }
 
-                        // if messages are pending in the queue, send them now
-                        while (! send_message (connection, 0)) { } // terminates when queue is empty or send fails
-                    } // end: if (FD_ISSET (endsock, &write_set))
+                    // if messages are pending in the queue, send them now (or the bulk test stream)
+                    if (bulk_sending (connection) ? !run_bulk_test (connection) : send_message (connection, NULL, 0, 0) == -2)
+                    {
+                        if (current_endpt == connection) current_endpt = NULL;
+                        continue; // connection was closed
+                    }
+                } // end: if (events & EPOLLOUT)
 
-                    if (FD_ISSET (connection->sockfd, &read_set))
+                if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                {
+                    //=====================================================================
+                    // THIS SECTION HANDLES THE ENDPOINT READ EVENTS, WHICH:
+                    // - RECEIVES MESSAGES FROM THE EXTERNAL ENDPOINT'S SERVER, WHICH ARE
+                    //   THE RESPONSES TO THE MESSAGES SENT TO IT FROM THIS ENDPOINT.
+                    //=====================================================================
+                    if (connection->state == STATE_READY && !receive_responses (connection, false))
                     {
-                        //=====================================================================
-                        // THIS SECTION HANDLES THE ENDPOINT READ EVENTS, WHICH:
-                        // - RECEIVES MESSAGES FROM THE EXTERNAL ENDPOINT'S SERVER, WHICH ARE
-                        //   THE RESPONSES TO THE MESSAGES SENT TO IT FROM THIS ENDPOINT.
-                        //=====================================================================
-                        if (connection->state == STATE_READY)
-                        {
-                            char response[MAX_MESSAGE_LEN + 1];
-                            bzero(response, sizeof(response));
-                            while (true)
-                            {
-                                // read response from server
-                                tRecvMsgTyp recv_error = tcp_recv_message (connection->sockfd, response, sizeof(response));
-                                if (recv_error == RECV_COMPLETE)
-                                {
-                                    remove_term (response, sizeof(response));
-                                    logmsg(PRINT_RCVD, "%.30s\n",response);
-                                    connection->rspix++; // increment the # of messages received
-                                }
-                                else if (recv_error == RECV_BLOCKED)
-                                {
-                                    break;
-                                }
-                                else if (recv_error == RECV_TERMINATED)
-                                {
-                                    logmsg(PRINT_SOCKET, "socket recvmsg (port %u) terminated connection\n", connection->destport);
-                                    rem_connection (connection->destport);
-                                    break;
-                                }
-                                else // if (recv_error == RECV_FAILURE)
-                                {
-                                    logmsg(PRINT_ERROR, "socket recvmsg (port %u): %s\n", connection->destport, strerror(errno));
-                                    rem_connection (connection->destport);
-                                    break;
-                                }
-                            }
-                        }
-                    }  // end: if (FD_ISSET (endsock, &read_set))
+                        if (current_endpt == connection) current_endpt = NULL; // connection was closed
+                    }
+                }  // end: if (events & EPOLLIN)
+            }
+        } // end: for (evix =...
+
+        while (input_ready && running)
+        {
+            //=====================================================================
+            // THIS SECTION HANDLES THE KEYBOARD INPUT FROM THE USER, WHICH IS USED
+            // TO HANDLE COMMANDS (SUCH AS OPENING AND CLOSING CONNECTIONS TO OTHER
+            // ENDPOINTS AND TERMINATING) AS WELL AS SPECIFYING MESSAGES TO SEND TO
+            // THE ENDPOINTS IT IS CONNECTED TO.
+            //=====================================================================
+
+            // take the next line typed in (all the lines waiting are handled)
+            int value = 0;
+            char buffer[MAX_MESSAGE_LEN + 1];
+            bzero(buffer, sizeof(buffer));
+            int command = userio_get_command (&value, buffer, sizeof(buffer));
+            if (command == ACTION_NONE)
+                break;
+            if (command == ACTION_END_INPUT)
+            {
+                // the command file is done (the endpoint keeps running for its control socket)
+                if (control.listenfd < 0)
+                {
+                    logmsg(PRINT_QUERY, "end of the command file, endpoint exiting...\n");
+                    running = false;
+                }
+                break;
+            }
+            input_seq++;
+
+            if (command == ACTION_WAIT)
+            {
+                // stop taking the command lines for the time given, or until the load, bulk or
+                // ping-pong test is done (the lines already read wait in the input ring)
+                if (value > 0 || load_gen.running || bulk_test.state != BULK_IDLE || ping_test.running)
+                {
+                    struct itimerspec hold;
+                    memset (&hold, 0, sizeof(hold));
+                    hold.it_value.tv_sec  = value / 1000;
+                    hold.it_value.tv_nsec = (value % 1000) * 1000000L;
+                    hold_for_test = (value <= 0);
+                    if (!hold_for_test)
+                        timerfd_settime (hold_timerfd, 0, &hold, NULL);
+                    input_held = (evloop_del (&main_loop, userio_input_fd()) == 0);
+                }
+                report_result (input_reply_fd, NULL, input_seq, buffer, command, NULL);
+                if (input_held)
+                    break;
+                continue;
+            }
+
+            const char * error = run_command (command, value, buffer, &current_endpt, server, &recv_delay, &running);
+            report_result (input_reply_fd, NULL, input_seq, buffer, command, error);
+        } // end: while (input_ready)
 
-                } // end: for (connection =...
+        //=====================================================================
+        // THIS SECTION RUNS THE COMMAND LINES RECEIVED ON THE CONTROL SOCKET
+        // (ALL THE COMPLETE LINES WAITING), AND RETURNS THEIR RESULTS.
+        //=====================================================================
+        int cix;
+        for (cix = 0; control_ready && cix < CONTROL_MAX_CLIENTS; cix++)
+        {
+            tControlClientStc * client = &control.clients[cix];
+            if (client->fd < 0)
+                continue;
+
+            // (no more lines are taken while the client has too many results waiting)
+            char line[INPUT_LINE_MAX];
+            while (running && !client->failed && !control_busy (client) && control_next_line (client, line, sizeof(line)))
+            {
+                int value = 0;
+                int command = userio_parse_command (&value, line);
+                const char * error = run_command (command, value, line, &current_endpt, server, &recv_delay, &running);
+                report_result (-1, client, client->commands, line, command, error);
+            }
 
-            } // end: if(running)
+            // drop the client once it has closed its end and taken its results. until it has
+            // taken them, it is only monitored for writing (so its lines wait in the socket).
+            if (client->failed || (client->closed && client->out_used == 0))
+            {
+                evloop_del (&main_loop, client->fd);
+                control_drop (client);
+                continue;
+            }
+            int flags = (client->out_used || client->closed) ? EVLOOP_WRITE | EVLOOP_LEVEL : EVLOOP_READ | EVLOOP_LEVEL;
+            if (flags != client->events && evloop_mod (&main_loop, client->fd, flags, client) == 0)
+                client->events = flags;
         }
+
+        // send the load test messages that are due
+        if (load_due && load_gen.running)
+            run_load_test (&current_endpt);
+
+        // report the bulk test, and continue its stream
+        if (bulk_test.state != BULK_IDLE)
+            check_bulk_test (bulk_due, &current_endpt);
+
+        // busy-poll the connection of the ping-pong test
+        if (session_busy_poll && ping_test.running)
+            spin_pingpong_test (&current_endpt);
+
+        // the #w wait for the load, bulk or ping-pong test is over: take the command lines again
+        if (input_held && hold_for_test && !load_gen.running && bulk_test.state == BULK_IDLE && !ping_test.running &&
+            evloop_add (&main_loop, userio_input_fd(), EVLOOP_READ | EVLOOP_LEVEL, &evtag_input) == 0)
+            input_held = false;
     }
 
+    stop_load_test ();
+    stop_bulk_test ();
+    stop_pingpong_test ();
+    rtthist_fini (&ping_test.rtt);
     signal(SIGCHLD, SIG_IGN); // Silently (and portably) reap children
     close(serversock);
     close(clientsock);
     close_all_connections();
+    if (shm_listenfd >= 0) close(shm_listenfd);
+    if (spare_fd >= 0) close(spare_fd);
+    close(status_timerfd);
+    close(hold_timerfd);
+    close(backoff_timerfd);
+    control_close(&control);
+    if (use_workers)
+    {
+        int ix;
+        for (ix = 0; ix < worker_pool.count; ix++)
+            if (worker_pool.workers[ix].chanfd >= 0)
+                evloop_del (&main_loop, worker_pool.workers[ix].chanfd);
+        worker_pool_fini(&worker_pool);
+    }
+    else if (!use_fork) reactor_pool_fini(&reactor_pool);
+    if (use_uring) uring_fini(&accept_ring);
+    evloop_fini(&main_loop);
     userio_exit();
     return 0;
 }
-
@@ -0,0 +1,218 @@
+//=============================================================================
+//
+// This is the event engine module of the Interactive Endpoint project.
+// It wraps an epoll instance so that each descriptor is registered once when it is
+// created and only the descriptors that are ready are returned to the caller.
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "userio.h"     // for logmsg
+#include "evloop.h"
+
+/*
+ * Description:
+ * Builds the epoll event mask for a descriptor.
+ *
+ * Inputs:
+ *   loop  - the event loop the descriptor belongs to
+ *   flags - the EVLOOP_xxx flags selecting the events to report
+ *
+ * *Returns:
+ *   the event mask
+ */
+static uint32_t evloop_mask ( tEvLoopStc * loop, int flags )
+{
+    uint32_t events = 0;
+    if (flags & EVLOOP_READ)  events |= EPOLLIN | EPOLLRDHUP;
+    if (flags & EVLOOP_WRITE) events |= EPOLLOUT;
+    if (loop->edge && !(flags & EVLOOP_LEVEL)) events |= EPOLLET;
+    return events;
+}
+
+/*
+ * Description:
+ * Creates the epoll instance for an event loop.
+ *
+ * Inputs:
+ *   loop - ptr to the event loop to initialize
+ *   edge - true to register descriptors edge-triggered, false for level-triggered
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+int evloop_init ( tEvLoopStc * loop, bool edge )
+{
+    if (loop == NULL) return -1;
+
+    loop->edge  = edge;
+    loop->count = 0;
+    loop->calls = 0;
+    loop->ready = 0;
+    loop->epfd  = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0)
+    {
+        logmsg(PRINT_ERROR, "epoll_create1: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Description:
+ * Closes the epoll instance for an event loop. The registered descriptors are not closed.
+ *
+ * Inputs:
+ *   loop - ptr to the event loop to close
+ *
+ * *Returns:
+ *   <none>
+ */
+void evloop_fini ( tEvLoopStc * loop )
+{
+    if (loop == NULL || loop->epfd < 0) return;
+
+    close(loop->epfd);
+    loop->epfd  = -1;
+    loop->count = 0;
+}
+
+/*
+ * Description:
+ * Registers a descriptor with the event loop.
+ *
+ * Inputs:
+ *   loop  - the event loop to register with
+ *   fd    - the descriptor to monitor
+ *   flags - the EVLOOP_xxx flags selecting the events to report
+ *   data  - ptr returned in the event when the descriptor is ready
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+int evloop_add ( tEvLoopStc * loop, int fd, int flags, void * data )
+{
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events   = evloop_mask(loop, flags);
+    event.data.ptr = data;
+    loop->calls++;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        logmsg(PRINT_ERROR, "epoll_ctl add (fd %d): %s\n", fd, strerror(errno));
+        return -1;
+    }
+
+    loop->count++;
+    return 0;
+}
+
+/*
+ * Description:
+ * Changes the events reported for a registered descriptor (e.g. arming write readiness).
+ *
+ * Inputs:
+ *   loop  - the event loop the descriptor is registered with
+ *   fd    - the descriptor to modify
+ *   flags - the EVLOOP_xxx flags selecting the events to report
+ *   data  - ptr returned in the event when the descriptor is ready
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+int evloop_mod ( tEvLoopStc * loop, int fd, int flags, void * data )
+{
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events   = evloop_mask(loop, flags);
+    event.data.ptr = data;
+    loop->calls++;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &event) < 0)
+    {
+        logmsg(PRINT_ERROR, "epoll_ctl mod (fd %d): %s\n", fd, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Description:
+ * Unregisters a descriptor from the event loop. Must be called before the descriptor is closed.
+ *
+ * Inputs:
+ *   loop - the event loop the descriptor is registered with
+ *   fd   - the descriptor to remove
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+int evloop_del ( tEvLoopStc * loop, int fd )
+{
+    struct epoll_event event; // (not used, but required by kernels before 2.6.9)
+
+    memset(&event, 0, sizeof(event));
+    loop->calls++;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, &event) < 0)
+    {
+        logmsg(PRINT_ERROR, "epoll_ctl del (fd %d): %s\n", fd, strerror(errno));
+        return -1;
+    }
+
+    loop->count--;
+    return 0;
+}
+
+/*
+ * Description:
+ * Waits for registered descriptors to become ready. The ready events are placed in loop->events.
+ *
+ * Inputs:
+ *   loop       - the event loop to wait on
+ *   timeout_ms - max time to wait in msec (0 to poll, -1 to wait forever)
+ *
+ * *Returns:
+ *   the number of ready events, 0 on timeout, -1 on error (errno is set)
+ */
+int evloop_wait ( tEvLoopStc * loop, int timeout_ms )
+{
+    loop->calls++;
+    loop->ready = epoll_wait(loop->epfd, loop->events, EVLOOP_MAX_EVENTS, timeout_ms);
+    return loop->ready;
+}
+
+char evloop_forgotten;
+
+/*
+ * Description:
+ * Clears the entries of the ready list that carry the given data ptr, replacing it with
+ * &evloop_forgotten. This is used when the object the data refers to is freed while the
+ * ready list is being processed, and it may have other descriptors with events still to
+ * be handled.
+ *
+ * Inputs:
+ *   loop - the event loop
+ *   data - the data ptr of the entries to clear
+ *
+ * *Returns:
+ *   <none>
+ */
+void evloop_forget ( tEvLoopStc * loop, void * data )
+{
+    int evix;
+    for (evix = 0; evix < loop->ready; evix++)
+    {
+        if (loop->events[evix].data.ptr == data)
+            loop->events[evix].data.ptr = &evloop_forgotten;
+    }
+}
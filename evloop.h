@@ -0,0 +1,42 @@
+//=============================================================================
+//
+// This contains the definitions, structures and function prototypes defined by the
+// event engine module of the Interactive Endpoint project.
+//
+//=============================================================================
+
+#include <stdbool.h>
+#include <sys/epoll.h>
+
+// max number of ready events returned from a single wait
+#define EVLOOP_MAX_EVENTS   ( 256 )
+
+// these are the bit flags that select the events a descriptor is monitored for
+#define EVLOOP_READ     0x0001      // report read readiness (and hangup/error)
+#define EVLOOP_WRITE    0x0002      // report write readiness (only arm while there is data to send)
+#define EVLOOP_LEVEL    0x0004      // always level-triggered, even if the loop is edge-triggered
+
+// this holds an epoll reactor instance
+// (NOTE: a forked child must create its own instance, the epoll descriptor is shared across fork)
+typedef struct
+{
+    int  epfd;          // the epoll instance descriptor
+    bool edge;          // true if descriptors are registered edge-triggered, false for level-triggered
+    int  count;         // the number of descriptors currently registered
+    unsigned long calls; // the number of epoll system calls made (for comparing I/O backends)
+    int  ready;         // the number of entries in events from the last wait
+    struct epoll_event events[EVLOOP_MAX_EVENTS]; // the ready list filled in by evloop_wait
+
+} tEvLoopStc;
+
+// the data ptr that evloop_forget puts in the ready list entries it clears (the caller skips them)
+extern char evloop_forgotten;
+
+// function prototypes:
+int  evloop_init ( tEvLoopStc * loop, bool edge );
+void evloop_fini ( tEvLoopStc * loop );
+int  evloop_add  ( tEvLoopStc * loop, int fd, int flags, void * data );
+int  evloop_mod  ( tEvLoopStc * loop, int fd, int flags, void * data );
+int  evloop_del  ( tEvLoopStc * loop, int fd );
+int  evloop_wait ( tEvLoopStc * loop, int timeout_ms );
+void evloop_forget ( tEvLoopStc * loop, void * data );
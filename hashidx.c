@@ -0,0 +1,203 @@
+//=============================================================================
+//
+// This is the hash index module of the Interactive Endpoint project.
+// It indexes the connection lists by their keys (destination port, process id or reactor
+// session), so connections are found, added and removed without walking the lists.
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "userio.h"     // for logmsg
+#include "hashidx.h"
+
+/*
+ * Description:
+ * Returns the home position of a key in a table (Fibonacci hashing: the top bits of the
+ * key times 2^64 / golden ratio, which spreads out consecutive ports and process ids).
+ *
+ * Inputs:
+ *   key  - the key
+ *   size - the number of entries in the table (a power of 2)
+ *
+ * *Returns:
+ *   the index of the entry the key is first looked for in
+ */
+static unsigned hashidx_home ( unsigned long key, unsigned size )
+{
+    unsigned long long hash = (unsigned long long)key * 0x9E3779B97F4A7C15ULL;
+    return (unsigned)(hash >> 32) & (size - 1);
+}
+
+/*
+ * Description:
+ * Initializes an empty index. Nothing is allocated until an entry is inserted.
+ *
+ * Inputs:
+ *   index - ptr to the index
+ *
+ * *Returns:
+ *   <none>
+ */
+void hashidx_init ( tHashIdxStc * index )
+{
+    memset (index, 0, sizeof(tHashIdxStc));
+}
+
+/*
+ * Description:
+ * Frees the index table. The values indexed are not freed.
+ *
+ * Inputs:
+ *   index - ptr to the index
+ *
+ * *Returns:
+ *   <none>
+ */
+void hashidx_fini ( tHashIdxStc * index )
+{
+    free (index->table);
+    memset (index, 0, sizeof(tHashIdxStc));
+}
+
+/*
+ * Description:
+ * Finds the value indexed by a key.
+ *
+ * Inputs:
+ *   index - ptr to the index
+ *   key   - the key to look for
+ *
+ * *Returns:
+ *   the value (NULL if the key is not in the index)
+ */
+void * hashidx_find ( tHashIdxStc * index, unsigned long key )
+{
+    if (index->count == 0) return NULL;
+
+    unsigned mask = index->size - 1;
+    unsigned ix;
+    for (ix = hashidx_home (key, index->size); index->table[ix].value != NULL; ix = (ix + 1) & mask)
+    {
+        if (index->table[ix].key == key)
+            return index->table[ix].value;
+    }
+
+    return NULL;
+}
+
+/*
+ * Description:
+ * Doubles the size of the index table and re-inserts the entries.
+ *
+ * Inputs:
+ *   index - ptr to the index
+ *
+ * *Returns:
+ *   0 on success, -1 on failure (memory allocation)
+ */
+static int hashidx_grow ( tHashIdxStc * index )
+{
+    unsigned size = index->size ? index->size * 2 : HASHIDX_MIN_SIZE;
+    tHashEntStc * table = (tHashEntStc *)calloc (size, sizeof(tHashEntStc));
+    if (table == NULL) return -1;
+
+    unsigned ix;
+    for (ix = 0; ix < index->size; ix++)
+    {
+        if (index->table[ix].value == NULL) continue;
+        unsigned newix = hashidx_home (index->table[ix].key, size);
+        while (table[newix].value != NULL)
+            newix = (newix + 1) & (size - 1);
+        table[newix] = index->table[ix];
+    }
+
+    if (index->table) index->grows++;
+    free (index->table);
+    index->table = table;
+    index->size  = size;
+    return 0;
+}
+
+/*
+ * Description:
+ * Adds a key to the index. If the key is already in the index, its value is replaced.
+ *
+ * Inputs:
+ *   index - ptr to the index
+ *   key   - the key
+ *   value - the value to find by the key (must not be NULL)
+ *
+ * *Returns:
+ *   0 on success, -1 on failure (memory allocation)
+ */
+int hashidx_insert ( tHashIdxStc * index, unsigned long key, void * value )
+{
+    // keep the table at most half full
+    if ((index->count + 1) * 2 > index->size && hashidx_grow (index) != 0)
+    {
+        logmsg(PRINT_ERROR, "memory allocation for hash index\n");
+        return -1;
+    }
+
+    unsigned mask = index->size - 1;
+    unsigned ix;
+    for (ix = hashidx_home (key, index->size); index->table[ix].value != NULL; ix = (ix + 1) & mask)
+    {
+        if (index->table[ix].key == key)
+        {
+            index->table[ix].value = value;
+            return 0;
+        }
+    }
+
+    index->table[ix].key   = key;
+    index->table[ix].value = value;
+    index->count++;
+    return 0;
+}
+
+/*
+ * Description:
+ * Removes a key from the index. The entries following it in its probe run are shifted back
+ * to fill the hole, so every key stays reachable from its home position.
+ *
+ * Inputs:
+ *   index - ptr to the index
+ *   key   - the key to remove
+ *
+ * *Returns:
+ *   the value that was indexed by the key (NULL if the key is not in the index)
+ */
+void * hashidx_remove ( tHashIdxStc * index, unsigned long key )
+{
+    if (index->count == 0) return NULL;
+
+    unsigned mask = index->size - 1;
+    unsigned hole;
+    for (hole = hashidx_home (key, index->size); index->table[hole].value != NULL; hole = (hole + 1) & mask)
+    {
+        if (index->table[hole].key == key) break;
+    }
+    void * value = index->table[hole].value;
+    if (value == NULL) return NULL; // not found
+
+    // move back any later entry in the run whose home position is not between the hole and it
+    unsigned ix;
+    for (ix = (hole + 1) & mask; index->table[ix].value != NULL; ix = (ix + 1) & mask)
+    {
+        unsigned home = hashidx_home (index->table[ix].key, index->size);
+        if (((ix - home) & mask) >= ((ix - hole) & mask))
+        {
+            index->table[hole] = index->table[ix];
+            hole = ix;
+        }
+    }
+
+    index->table[hole].value = NULL;
+    index->count--;
+    return value;
+}
@@ -0,0 +1,38 @@
+//=============================================================================
+//
+// This contains the definitions, structures and function prototypes defined by the
+// hash index module of the Interactive Endpoint project.
+//
+//=============================================================================
+
+#include <stdbool.h>
+
+// initial number of entries in an index table (must be a power of 2, doubled as needed)
+#define HASHIDX_MIN_SIZE    ( 64 )
+
+// this is an entry in an index table (an empty entry has a NULL value)
+typedef struct
+{
+    unsigned long key;      // the key the value is found by
+    void *        value;    // the value indexed (NULL if the entry is empty)
+
+} tHashEntStc;
+
+// this is an open-addressing (linear probing) hash index from an integer key to a ptr.
+// the table is kept at most half full, so lookups stay short as it grows, and removals
+// shift the following entries back rather than leaving deleted markers behind.
+typedef struct
+{
+    tHashEntStc * table;    // the entries (NULL until the first insert)
+    unsigned size;          // number of entries in table (a power of 2)
+    unsigned count;         // number of entries in use
+    unsigned long grows;    // the number of times the table was enlarged
+
+} tHashIdxStc;
+
+// function prototypes:
+void   hashidx_init   ( tHashIdxStc * index );
+void   hashidx_fini   ( tHashIdxStc * index );
+void * hashidx_find   ( tHashIdxStc * index, unsigned long key );
+int    hashidx_insert ( tHashIdxStc * index, unsigned long key, void * value );
+void * hashidx_remove ( tHashIdxStc * index, unsigned long key );
@@ -0,0 +1,365 @@
+//=============================================================================
+//
+// This is the load generator module of the Interactive Endpoint project.
+// It paces the messages of a load test (started with the #t command) with a timer, so the
+// endpoint sends them at the target rate from its event loop, using payloads built when the
+// test starts.
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "userio.h"     // for logmsg
+#include "netio.h"
+#include "msgqueue.h"
+#include "loadgen.h"
+
+/*
+ * Description:
+ * Returns the number of seconds since the start of the load test.
+ *
+ * Inputs:
+ *   gen - ptr to the load test
+ *
+ * *Returns:
+ *   the elapsed time in seconds
+ */
+static double loadgen_elapsed ( tLoadGenStc * gen )
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - gen->start.tv_sec) + (now.tv_nsec - gen->start.tv_nsec) / 1e9;
+}
+
+/*
+ * Description:
+ * Parses the parameters of the #t command:
+ *   #t[<count>] [r=<rate>] [s=<size>[-<max size>]] [n=<count>] [d=<secs>] [c=<endpoints>]
+ * A test with no rate sends as fast as the sockets take the messages, and a test with no
+ * count or duration runs until stopped. "#t" or "#t0" alone stops the running test.
+ *
+ * Inputs:
+ *   args - the command text following the "#t"
+ *   cfg  - ptr to location to return the parameters in
+ *
+ * *Returns:
+ *   0 if a test is to be started, 1 if the running test is to be stopped, -1 if error
+ */
+int loadgen_parse ( const char * args, tLoadCfgStc * cfg )
+{
+    memset (cfg, 0, sizeof(tLoadCfgStc));
+    cfg->min_size  = 100;
+    cfg->max_size  = 100;
+    cfg->endpoints = 1;
+
+    const char * cp = args;
+    while (*cp == ' ') cp++;
+    if (*cp == 0 || (cp[0] == '0' && cp[1] <= ' '))
+        return 1;
+
+    while (*cp)
+    {
+        char * end;
+        if (*cp >= '0' && *cp <= '9')
+        {
+            cfg->count = strtol (cp, &end, 10);
+        }
+        else if (cp[0] && cp[1] == '=')
+        {
+            const char * val = &cp[2];
+            switch (cp[0])
+            {
+                case 'r': cfg->rate     = strtol (val, &end, 10);  break;
+                case 'n': cfg->count    = strtol (val, &end, 10);  break;
+                case 'd': cfg->duration = strtod (val, &end);      break;
+                case 'c': cfg->endpoints = strtol (val, &end, 10); break;
+                case 's':
+                    cfg->min_size = cfg->max_size = strtol (val, &end, 10);
+                    if (*end == '-')
+                        cfg->max_size = strtol (end + 1, &end, 10);
+                    break;
+                default:
+                    logmsg(PRINT_ERROR, "invalid load test parameter: %c (must be r, s, n, d or c)\n", cp[0]);
+                    return -1;
+            }
+        }
+        else
+        {
+            end = (char *)cp;
+        }
+
+        if (end == cp || (*end != ' ' && *end != 0))
+        {
+            logmsg(PRINT_ERROR, "invalid load test parameters: %s\n", cp);
+            return -1;
+        }
+        cp = end;
+        while (*cp == ' ') cp++;
+    }
+
+    if (cfg->rate < 0 || cfg->count < 0 || cfg->duration < 0)
+    {
+        logmsg(PRINT_ERROR, "load test rate, count and duration can't be negative\n");
+        return -1;
+    }
+    if (cfg->min_size < 1 || cfg->max_size > tcp_msg_limit || cfg->min_size > cfg->max_size)
+    {
+        logmsg(PRINT_ERROR, "load test message size must be within 1-%d bytes\n", tcp_msg_limit);
+        return -1;
+    }
+    if (cfg->endpoints < 1 || cfg->endpoints > LOADGEN_MAX_ENDPOINTS)
+    {
+        logmsg(PRINT_ERROR, "load test endpoint count must be within 1-%d\n", LOADGEN_MAX_ENDPOINTS);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Description:
+ * Starts a load test: builds the payloads and starts the pacing timer. The caller registers
+ * the timer with its event loop, and calls loadgen_due each time it expires.
+ *
+ * Inputs:
+ *   gen        - ptr to the load test
+ *   cfg        - the parameters of the test
+ *   ports      - the destination ports of the endpoint connections to send on
+ *   port_count - number of entries in ports
+ *
+ * *Returns:
+ *   the timer descriptor, -1 if error
+ */
+int loadgen_start ( tLoadGenStc * gen, const tLoadCfgStc * cfg, const int * ports, int port_count )
+{
+    memset (gen, 0, sizeof(tLoadGenStc));
+    gen->cfg = *cfg;
+    gen->timerfd = -1;
+    gen->port_count = (port_count < LOADGEN_MAX_ENDPOINTS) ? port_count : LOADGEN_MAX_ENDPOINTS;
+    memcpy (gen->ports, ports, gen->port_count * sizeof(int));
+
+    // use fewer payloads if they are large, to bound the memory they take
+    gen->payload_count = LOADGEN_PAYLOADS;
+    while (gen->payload_count > 1 && (long)gen->payload_count * cfg->max_size > LOADGEN_PAYLOAD_BYTES)
+        gen->payload_count /= 2;
+
+    // pick the payload sizes (a fixed seed, so tests are repeatable) and fill in the payloads.
+    // (splitmix64: all 64 bits are mixed, so any size range is covered, and the bias of the
+    // modulo is negligible)
+    uint64_t seed = 12345;
+    unsigned total = 0;
+    int ix;
+    for (ix = 0; ix < gen->payload_count; ix++)
+    {
+        uint64_t draw = (seed += 0x9e3779b97f4a7c15ULL);
+        draw = (draw ^ (draw >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        draw = (draw ^ (draw >> 27)) * 0x94d049bb133111ebULL;
+        draw ^= draw >> 31;
+        gen->sizes[ix]   = cfg->min_size + (int)(draw % (uint64_t)(cfg->max_size - cfg->min_size + 1));
+        gen->offsets[ix] = total;
+        total += gen->sizes[ix];
+    }
+    gen->payloads = (char *)malloc (total);
+    if (gen->payloads == NULL)
+    {
+        logmsg(PRINT_ERROR, "memory allocation for load test payloads\n");
+        return -1;
+    }
+    for (ix = 0; ix < gen->payload_count; ix++)
+    {
+        // (the payloads are sent by length, so they are not NULL-terminated)
+        char * payload = &gen->payloads[gen->offsets[ix]];
+        char   number[16];
+        int    pos = snprintf (number, sizeof(number), "%3.3d:", ix);
+        if (pos > gen->sizes[ix]) pos = gen->sizes[ix];
+        memcpy (payload, number, pos);
+        for (; pos < gen->sizes[ix]; pos++)
+            payload[pos] = 'a' + (ix + pos) % 26;
+    }
+
+    gen->timerfd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (gen->timerfd < 0)
+    {
+        logmsg(PRINT_ERROR, "timerfd_create: %s\n", strerror(errno));
+        free (gen->payloads);
+        gen->payloads = NULL;
+        return -1;
+    }
+    struct itimerspec period;
+    period.it_interval.tv_sec  = 0;
+    period.it_interval.tv_nsec = LOADGEN_TICK_NSEC;
+    period.it_value = period.it_interval;
+    timerfd_settime (gen->timerfd, 0, &period, NULL);
+
+    clock_gettime (CLOCK_MONOTONIC, &gen->start);
+    gen->running = true;
+    logmsg(PRINT_QUERY, "load test started: rate %ld msgs/sec, size %d-%d, count %ld, duration %.1f sec, %d endpoints\n",
+            cfg->rate, cfg->min_size, cfg->max_size, cfg->count, cfg->duration, gen->port_count);
+    return gen->timerfd;
+}
+
+/*
+ * Description:
+ * Returns the number of messages to send now, when the pacing timer expires. With a target
+ * rate, it is the number of messages scheduled since the start that were not sent yet (so
+ * the rate is kept up even if the ticks are late), otherwise it is the max burst.
+ * This sets finished once the count or the duration of the test is reached.
+ *
+ * Inputs:
+ *   gen - ptr to the load test
+ *
+ * *Returns:
+ *   the number of messages due
+ */
+long loadgen_due ( tLoadGenStc * gen )
+{
+    uint64_t expirations;
+    if (read (gen->timerfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        logmsg(PRINT_ERROR, "timerfd read: %s\n", strerror(errno));
+    if (!gen->running)
+        return 0;
+
+    double elapsed = loadgen_elapsed (gen);
+    bool   time_up = (gen->cfg.duration > 0 && elapsed >= gen->cfg.duration);
+    if (time_up) elapsed = gen->cfg.duration;
+
+    unsigned long target;
+    if (gen->cfg.rate)
+        target = (unsigned long)(gen->cfg.rate * elapsed);
+    else
+        target = time_up ? gen->attempted : gen->attempted + LOADGEN_MAX_BURST;
+    if (gen->cfg.count && target > (unsigned long)gen->cfg.count)
+        target = gen->cfg.count;
+
+    long due = (target > gen->attempted) ? (long)(target - gen->attempted) : 0;
+    if (due > LOADGEN_MAX_BURST)
+    {
+        if ((unsigned long)(due - LOADGEN_MAX_BURST) > gen->behind)
+            gen->behind = due - LOADGEN_MAX_BURST;
+        due = LOADGEN_MAX_BURST;
+    }
+    if (due == 0 && time_up)
+        gen->finished = true;
+    return due;
+}
+
+/*
+ * Description:
+ * Returns the next payload to send and the endpoint to send it on (in turn).
+ *
+ * Inputs:
+ *   gen    - ptr to the load test
+ *   port   - ptr to location to return the destination port of the endpoint connection in
+ *   length - ptr to location to return the length of the payload in
+ *
+ * *Returns:
+ *   the payload (length chars, not NULL-terminated)
+ */
+const char * loadgen_next ( tLoadGenStc * gen, int * port, int * length )
+{
+    int ix = gen->next_payload;
+    gen->next_payload = (ix + 1) & (gen->payload_count - 1);
+    *port = gen->ports[gen->next_port];
+    gen->next_port = (gen->next_port + 1) % gen->port_count;
+    *length = gen->sizes[ix];
+    return &gen->payloads[gen->offsets[ix]];
+}
+
+/*
+ * Description:
+ * Returns the time the next message was scheduled for. With a target rate, the schedule is
+ * fixed when the test starts, so the round-trip times measured from it include any time the
+ * message was held back (by a late tick or a blocked socket). That is the latency a client
+ * sending at that rate would see, rather than only that of the messages that got out on time.
+ *
+ * Inputs:
+ *   gen - ptr to the load test
+ *
+ * *Returns:
+ *   the scheduled time (CLOCK_MONOTONIC nsec), 0 if the test has no target rate
+ */
+uint64_t loadgen_sched ( tLoadGenStc * gen )
+{
+    if (gen->cfg.rate == 0)
+        return 0;
+
+    uint64_t start = (uint64_t)gen->start.tv_sec * 1000000000ULL + gen->start.tv_nsec;
+    return start + (uint64_t)((double)(gen->attempted + 1) * 1e9 / gen->cfg.rate);
+}
+
+/*
+ * Description:
+ * Accounts for a message that was due: sent, or skipped.
+ *
+ * Inputs:
+ *   gen    - ptr to the load test
+ *   length - the length of the payload sent (-1 if the message was skipped)
+ *
+ * *Returns:
+ *   <none>
+ */
+void loadgen_sent ( tLoadGenStc * gen, int length )
+{
+    gen->attempted++;
+    if (length >= 0)
+    {
+        gen->sent++;
+        gen->bytes += length;
+    }
+    else
+    {
+        gen->skipped++;
+    }
+    if (gen->cfg.count && gen->attempted >= (unsigned long)gen->cfg.count)
+        gen->finished = true;
+}
+
+/*
+ * Description:
+ * Displays the progress of the load test.
+ *
+ * Inputs:
+ *   gen - ptr to the load test
+ *
+ * *Returns:
+ *   <none>
+ */
+void loadgen_show ( tLoadGenStc * gen )
+{
+    double elapsed = loadgen_elapsed (gen);
+    char target[32];
+    if (gen->cfg.rate) snprintf (target, sizeof(target), "%ld", gen->cfg.rate);
+    else               snprintf (target, sizeof(target), "max");
+    logmsg(PRINT_QUERY, "load test %s: %lu msgs (%lu bytes) in %.3f sec = %.0f msgs/sec (target %s, %.2f usec/msg), %lu skipped, up to %lu behind\n",
+            gen->running ? "running" : "done", gen->sent, gen->bytes, elapsed, elapsed > 0 ? gen->sent / elapsed : 0.0,
+            target, gen->sent ? elapsed * 1000000.0 / gen->sent : 0.0, gen->skipped, gen->behind);
+}
+
+/*
+ * Description:
+ * Stops the load test and displays its results. The caller removes the timer from its event
+ * loop first.
+ *
+ * Inputs:
+ *   gen - ptr to the load test
+ *
+ * *Returns:
+ *   <none>
+ */
+void loadgen_stop ( tLoadGenStc * gen )
+{
+    if (!gen->running) return;
+
+    gen->running = false;
+    loadgen_show (gen);
+    close (gen->timerfd);
+    gen->timerfd = -1;
+    free (gen->payloads);
+    gen->payloads = NULL;
+}
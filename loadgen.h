@@ -0,0 +1,66 @@
+//=============================================================================
+//
+// This contains the definitions, structures and function prototypes defined by the
+// load generator module of the Interactive Endpoint project.
+//
+//=============================================================================
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define LOADGEN_MAX_ENDPOINTS   ( 64 )          // max number of endpoint connections to send on
+#define LOADGEN_PAYLOADS        ( 256 )         // number of precomputed payloads (sent in turn)
+#define LOADGEN_PAYLOAD_BYTES   ( 64 << 20 )    // max size of the payloads (fewer of them are used if they are large)
+#define LOADGEN_TICK_NSEC       ( 1000000 )     // period of the pacing timer (1 msec)
+#define LOADGEN_MAX_BURST       ( 4096 )        // max messages sent per tick (the rest are sent on later ticks)
+#define LOADGEN_MAX_QUEUED      ( 16384 )       // max messages queued on an endpoint before messages are skipped
+#define LOADGEN_MAX_QUEUED_BYTES ( 64 << 20 )   // max bytes queued on an endpoint before messages are skipped
+
+// this holds the parameters of a load test, given with the #t command:
+//   #t[<count>] [r=<rate>] [s=<size>[-<max size>]] [n=<count>] [d=<secs>] [c=<endpoints>]
+typedef struct
+{
+    long   rate;            // the target rate in messages/sec (0 to send as fast as the sockets take them)
+    int    min_size;        // the payload sizes are uniformly distributed over min_size..max_size bytes
+    int    max_size;
+    long   count;           // number of messages to send (0 for no limit)
+    double duration;        // number of seconds to send for (0 for no limit)
+    int    endpoints;       // number of endpoint connections to spread the messages over
+
+} tLoadCfgStc;
+
+// this holds a running load test. the messages are sent open-loop: the number due is set by
+// the time since the start and the rate, not by how fast the responses come back.
+typedef struct
+{
+    tLoadCfgStc cfg;        // the parameters of the test
+    bool   running;         // true while the test is running
+    bool   finished;        // true when the count or duration has been reached
+    int    timerfd;         // the pacing timer (-1 if not running)
+    char * payloads;        // the precomputed payloads (back to back, not NULL-terminated)
+    int    offsets[LOADGEN_PAYLOADS]; // the position of each payload in payloads
+    int    sizes[LOADGEN_PAYLOADS];   // the length of each payload
+    int    payload_count;   // number of payloads in use (a power of 2)
+    int    next_payload;    // the payload to send next
+    int    ports[LOADGEN_MAX_ENDPOINTS]; // the destination ports of the endpoint connections to send on
+    int    port_count;      // number of entries in ports
+    int    next_port;       // the entry in ports to send the next message on
+    struct timespec start;  // when the test started
+    unsigned long attempted; // number of messages scheduled so far (sent or skipped)
+    unsigned long sent;     // number of messages sent (queued on a connection)
+    unsigned long bytes;    // number of payload bytes sent
+    unsigned long skipped;  // number of messages skipped (connection gone or too far behind)
+    unsigned long behind;   // the most messages that were due but left for a later tick
+
+} tLoadGenStc;
+
+// function prototypes:
+int  loadgen_parse ( const char * args, tLoadCfgStc * cfg );
+int  loadgen_start ( tLoadGenStc * gen, const tLoadCfgStc * cfg, const int * ports, int port_count );
+long loadgen_due   ( tLoadGenStc * gen );
+const char * loadgen_next ( tLoadGenStc * gen, int * port, int * length );
+uint64_t loadgen_sched ( tLoadGenStc * gen );
+void loadgen_sent  ( tLoadGenStc * gen, int length );
+void loadgen_stop  ( tLoadGenStc * gen );
+void loadgen_show  ( tLoadGenStc * gen );
@@ -0,0 +1,450 @@
+//=============================================================================
+//
+// This is the message queue module of the Interactive Endpoint project.
+// It maintains the FIFO of messages waiting to be sent on a connection, and sends them.
+// The queue is a ring of message descriptors with the message contents stored in one
+// arena, so queuing a message does not allocate memory once the queue has grown to the
+// backlog of the connection. A received message being echoed is not copied to the arena:
+// it is queued by reference, and sent from the receive buffer it arrived in.
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "userio.h"     // for logmsg
+#include "netio.h"
+#include "msgqueue.h"
+#include "crc32c.h"
+
+/*
+ * Description:
+ * Initializes an empty send queue. Nothing is allocated until a message is queued.
+ *
+ * Inputs:
+ *   queue - ptr to the queue
+ *
+ * *Returns:
+ *   <none>
+ */
+void msgqueue_init ( tMsgQueueStc * queue )
+{
+    memset (queue, 0, sizeof(tMsgQueueStc));
+    queue->wire = WIRE_V1;
+}
+
+/*
+ * Description:
+ * Discards any messages in the send queue and frees its memory.
+ *
+ * Inputs:
+ *   queue - ptr to the queue
+ *
+ * *Returns:
+ *   <none>
+ */
+void msgqueue_fini ( tMsgQueueStc * queue )
+{
+    while (msgqueue_depth(queue))
+        rem_message (queue);
+    free (queue->ring);
+    free (queue->arena);
+    free (queue->retired);
+    memset (queue, 0, sizeof(tMsgQueueStc));
+}
+
+/*
+ * Description:
+ * Pins or unpins the contents of the queued messages. While pinned (an asynchronous send
+ * of the queued messages is outstanding), the contents already queued are not moved: the
+ * arena is not compacted, and if it must grow, the old one is kept until unpinned.
+ *
+ * Inputs:
+ *   queue  - ptr to the queue
+ *   pinned - true to pin, false to unpin
+ *
+ * *Returns:
+ *   <none>
+ */
+void msgqueue_pin ( tMsgQueueStc * queue, bool pinned )
+{
+    queue->pinned = pinned;
+    if (!pinned && queue->retired)
+    {
+        free (queue->retired);
+        queue->retired = NULL;
+    }
+}
+
+/*
+ * Description:
+ * Makes room in the queue for one more message. The ring is doubled when it is full. The
+ * arena is compacted if the messages still queued take up less than half of it, otherwise
+ * it is doubled (until the message fits), so the cost of either is amortized over the
+ * messages queued. The arena is not grown beyond MSGQUEUE_MAX_ARENA (the logical positions
+ * in it are 32 bits).
+ *
+ * Inputs:
+ *   queue  - ptr to the queue
+ *   msglen - length of the message to be added
+ *
+ * *Returns:
+ *   0 on success, -1 on failure (memory allocation, or the arena limit reached)
+ */
+static int msgqueue_reserve ( tMsgQueueStc * queue, int msglen )
+{
+    unsigned depth = msgqueue_depth(queue);
+
+    // make room for the descriptor
+    if (queue->ring == NULL || depth == queue->ring_size)
+    {
+        unsigned size = queue->ring ? queue->ring_size * 2 : MSGQUEUE_MIN_MSGS;
+        tMsgDescStc * ring = (tMsgDescStc *)malloc (size * sizeof(tMsgDescStc));
+        if (ring == NULL) return -1;
+
+        // copy the descriptors in order, to their positions in the larger ring
+        unsigned ix;
+        for (ix = queue->head; ix != queue->tail; ix++)
+            ring[ix & (size - 1)] = queue->ring[ix & (queue->ring_size - 1)];
+        free (queue->ring);
+        queue->ring      = ring;
+        queue->ring_size = size;
+        if (depth) queue->grows++;
+    }
+
+    // make room for the contents
+    unsigned used = queue->arena_tail - queue->arena_base;
+    if ((size_t)used + msglen <= queue->arena_size)
+        return 0;
+
+    unsigned first = depth ? queue->ring[queue->head & (queue->ring_size - 1)].offset : queue->arena_tail;
+    unsigned live  = queue->arena_tail - first;
+    if (!queue->pinned && (size_t)live + msglen <= queue->arena_size / 2)
+    {
+        memmove (queue->arena, &queue->arena[first - queue->arena_base], live);
+        queue->arena_base = first;
+        return 0;
+    }
+
+    size_t need = (size_t)live + msglen;
+    size_t size = queue->arena_size ? (size_t)queue->arena_size * 2 : MSGQUEUE_MIN_ARENA;
+    while (size < need)
+        size *= 2;
+    if (size > MSGQUEUE_MAX_ARENA)
+    {
+        if (need > MSGQUEUE_MAX_ARENA)
+            return -1;
+        size = MSGQUEUE_MAX_ARENA;
+    }
+    char * arena = (char *)malloc (size);
+    if (arena == NULL) return -1;
+    if (live)
+        memcpy (arena, &queue->arena[first - queue->arena_base], live);
+
+    // the kernel may still be reading the arena that was pinned (the one retired first)
+    if (queue->pinned && queue->retired == NULL)
+        queue->retired = queue->arena;
+    else
+        free (queue->arena);
+    if (queue->arena) queue->grows++;
+    queue->arena      = arena;
+    queue->arena_size = size;
+    queue->arena_base = first;
+    return 0;
+}
+
+/*
+ * Description:
+ * Adds a message to the end of the send queue. The message is opaque bytes of the given
+ * length (it may hold any byte values, and may be larger than MAX_MESSAGE_LEN, e.g. a large
+ * message being echoed). If the queue sends the CRC32C of the messages, it is computed here,
+ * once, however many sends the message takes.
+ *
+ * Inputs:
+ *   queue  - ptr to the queue
+ *   msgix  - message counter to identify the message being queued
+ *   data   - ptr to the message to queue
+ *   msglen - the length of the message
+ *
+ * *Returns:
+ *   0 on success, -1 on failure (memory allocation, or the queue is full)
+ */
+int add_message ( tMsgQueueStc * queue, int msgix, const char * data, int msglen )
+{
+    if (data == NULL || queue == NULL || msglen < 0)
+        return -1;
+
+    if (msgqueue_reserve (queue, msglen) != 0)
+    {
+        logmsg(PRINT_ERROR, "no room for a %d byte message in send queue (%u bytes queued)\n", msglen, msgqueue_bytes(queue));
+        return -1;
+    }
+
+    // save the message contents in the arena and describe it in the ring
+    memcpy (&queue->arena[queue->arena_tail - queue->arena_base], data, msglen);
+    tMsgDescStc * desc = &queue->ring[queue->tail & (queue->ring_size - 1)];
+    desc->offset = queue->arena_tail;
+    desc->msglen = msglen;
+    desc->msgix  = msgix; // save the message index for this connection
+    desc->crc    = queue->crc ? crc32c (0, data, msglen) : 0;
+    desc->ref    = NULL;
+    desc->ref_head = 0;
+    desc->slice.block = NULL;
+    desc->slice.large = NULL;
+    queue->arena_tail += msglen;
+    queue->tail++;
+
+    if (msgqueue_depth(queue) > queue->high_water)
+        queue->high_water = msgqueue_depth(queue);
+    return 0;
+}
+
+/*
+ * Description:
+ * Adds the message just received on a connection to the end of the send queue, by reference:
+ * the message is not copied, it is sent from the receive buffer it is in (which holds on to
+ * it until then, see tcp_recv_hold), with the same message index. If the header it was
+ * received with is the size of the header it is sent with, the header is rewritten in place,
+ * so the message and its header are sent as one piece. A CRC32C received with the message
+ * (already checked) is not computed again.
+ *
+ * Inputs:
+ *   queue   - ptr to the queue
+ *   rbuf    - the receive buffer the message was returned from
+ *   header  - the header of the message
+ *   message - the message (as returned by tcp_recv_frame)
+ *
+ * *Returns:
+ *   0 on success, -1 on failure (memory allocation)
+ */
+int add_message_ref ( tMsgQueueStc * queue, tRecvBufStc * rbuf, MessageHeaderStc * header, char * message )
+{
+    if (msgqueue_reserve (queue, 0) != 0)
+    {
+        logmsg(PRINT_ERROR, "memory allocation for send queue\n");
+        return -1;
+    }
+
+    tMsgDescStc * desc = &queue->ring[queue->tail & (queue->ring_size - 1)];
+    desc->offset = queue->arena_tail; // (takes no room in the arena)
+    desc->msglen = header->msglen;
+    desc->msgix  = header->msgix;
+    desc->crc    = 0;
+    if (queue->crc)
+        desc->crc = (rbuf->msg_flags & WIRE_FLAG_CRC) ? rbuf->msg_crc : crc32c (0, message, header->msglen);
+    desc->ref    = message;
+    desc->ref_head = 0;
+
+    int flags = queue->crc ? WIRE_FLAG_CRC : 0;
+    if (rbuf->msg_headlen > 0 &&
+        rbuf->msg_headlen == tcp_header_size (queue->wire, flags, desc->msglen, desc->msgix))
+    {
+        tcp_header_encode (queue->wire, flags, desc->msglen, desc->msgix, desc->crc, message - rbuf->msg_headlen);
+        desc->ref_head = rbuf->msg_headlen;
+    }
+    tcp_recv_hold (rbuf, &desc->slice);
+    queue->tail++;
+    queue->by_ref++;
+
+    if (msgqueue_depth(queue) > queue->high_water)
+        queue->high_water = msgqueue_depth(queue);
+    return 0;
+}
+
+/*
+ * Description:
+ * Removes the first message from the send queue.
+ *
+ * Inputs:
+ *   queue - ptr to the queue
+ *
+ * *Returns:
+ *   <none>
+ */
+void rem_message ( tMsgQueueStc * queue )
+{
+    if (msgqueue_depth(queue) == 0) return; // send queue is empty
+
+    tcp_slice_release (&queue->ring[queue->head & (queue->ring_size - 1)].slice);
+    queue->head++;
+    queue->sent = 0;
+    if (msgqueue_depth(queue) == 0)
+        queue->arena_base = queue->arena_tail; // start filling the arena from the beginning again
+}
+
+/*
+ * Description:
+ * Returns a message in the send queue, without removing it.
+ *
+ * Inputs:
+ *   queue - ptr to the queue
+ *   index - the position of the message in the queue (0 is the next message to send)
+ *
+ * *Returns:
+ *   the message descriptor (NULL if there is no such message)
+ */
+tMsgDescStc * get_message ( tMsgQueueStc * queue, unsigned index )
+{
+    if (index >= msgqueue_depth(queue)) return NULL;
+    return &queue->ring[(queue->head + index) & (queue->ring_size - 1)];
+}
+
+/*
+ * Description:
+ * Returns the contents of a queued message. They are not NULL-terminated.
+ *
+ * Inputs:
+ *   queue - ptr to the queue
+ *   desc  - the message descriptor
+ *
+ * *Returns:
+ *   ptr to the message contents (valid until the next message is added)
+ */
+char * msgqueue_data ( tMsgQueueStc * queue, tMsgDescStc * desc )
+{
+    if (desc->ref)
+        return desc->ref;
+    return &queue->arena[desc->offset - queue->arena_base];
+}
+
+/*
+ * Description:
+ * Builds the scatter-gather array to send the queued messages, each preceded by its header
+ * (in the wire format of the queue). A message with its header rewritten in place is gathered
+ * with its header as one piece. The part of the first message that was already sent is skipped.
+ *
+ * Inputs:
+ *   queue    - ptr to the queue
+ *   headers  - array of max_msgs locations to format the message headers in
+ *   msg_iov  - array of 2 * max_msgs entries to return the scatter-gather array in
+ *   max_msgs - the max number of messages to gather
+ *   total    - ptr to location to return the number of bytes gathered
+ *
+ * *Returns:
+ *   the number of entries used in msg_iov
+ */
+int msgqueue_gather ( tMsgQueueStc * queue, tWireHdrStc * headers, struct iovec * msg_iov, int max_msgs, size_t * total )
+{
+    int count, array_cnt = 0;
+    tMsgDescStc * desc;
+
+    int flags = queue->crc ? WIRE_FLAG_CRC : 0;
+    *total = 0;
+    for (count = 0; count < max_msgs && (desc = get_message (queue, count)) != NULL; count++)
+    {
+        int skip = (count == 0) ? queue->sent : 0;
+        if (desc->ref_head)
+        {
+            msg_iov[array_cnt].iov_base = desc->ref - desc->ref_head + skip;
+            msg_iov[array_cnt].iov_len  = desc->ref_head + desc->msglen - skip;
+            *total += msg_iov[array_cnt++].iov_len;
+            continue;
+        }
+        int headlen = tcp_header_encode (queue->wire, flags, desc->msglen, desc->msgix, desc->crc, headers[count].bytes);
+        if (skip < headlen)
+        {
+            msg_iov[array_cnt].iov_base = headers[count].bytes + skip;
+            msg_iov[array_cnt].iov_len  = headlen - skip;
+            *total += msg_iov[array_cnt++].iov_len;
+            skip = 0;
+        }
+        else
+        {
+            skip -= headlen;
+        }
+        if (desc->msglen > skip)
+        {
+            msg_iov[array_cnt].iov_base = msgqueue_data (queue, desc) + skip;
+            msg_iov[array_cnt].iov_len  = desc->msglen - skip;
+            *total += msg_iov[array_cnt++].iov_len;
+        }
+    }
+
+    return array_cnt;
+}
+
+/*
+ * Description:
+ * Accounts for bytes of the queued messages that were sent: the messages that were completely
+ * sent are removed, and how far the next one got is remembered.
+ *
+ * Inputs:
+ *   queue - ptr to the queue
+ *   count - the number of bytes sent (as gathered by msgqueue_gather)
+ *
+ * *Returns:
+ *   the number of messages completely sent
+ */
+int msgqueue_consume ( tMsgQueueStc * queue, size_t count )
+{
+    int msgs = 0;
+    tMsgDescStc * desc;
+
+    while (count > 0 && (desc = get_message (queue, 0)) != NULL)
+    {
+        int headlen = tcp_header_size (queue->wire, queue->crc ? WIRE_FLAG_CRC : 0, desc->msglen, desc->msgix);
+        size_t remain = headlen + desc->msglen - queue->sent;
+        if (count < remain)
+        {
+            queue->sent += count;
+            break;
+        }
+        count -= remain;
+        queue->header_bytes += headlen;
+        rem_message (queue);
+        msgs++;
+    }
+
+    return msgs;
+}
+
+/*
+ * Description:
+ * Sends the messages in the send queue. The headers and contents of as many queued messages
+ * as possible are gathered into each sendmsg call, and the messages are removed from the
+ * queue as they are sent. A short write leaves the rest of the message that was cut at the
+ * front of the queue, to be continued from where it stopped on the next call.
+ *
+ * Inputs:
+ *   sockfd   - the socket to send the messages on
+ *   queue    - ptr to the queue
+ *   stats    - ptr to the send statistics of the connection, which are updated
+ *
+ * *Returns:
+ *   SEND_COMPLETE if the queue was emptied, SEND_BLOCKED if the socket can't take any more
+ *   (messages remain queued), SEND_FAILURE if error
+ */
+tSendMsgTyp send_queue ( int sockfd, tMsgQueueStc * queue, tSendStatsStc * stats )
+{
+    tWireHdrStc headers[SEND_QUEUE_BATCH];
+    struct iovec msg_iov[SEND_QUEUE_BATCH * 2];
+    struct msghdr msg_header;
+
+    while (msgqueue_depth(queue))
+    {
+        size_t total;
+        memset (&msg_header, 0, sizeof(msg_header));
+        msg_header.msg_iov = msg_iov;       // scatter-gather array
+        msg_header.msg_iovlen = msgqueue_gather (queue, headers, msg_iov, SEND_QUEUE_BATCH, &total);
+
+        stats->calls++;
+        tcp_syscall_count++;
+        ssize_t n = sendmsg (sockfd, &msg_header, MSG_NOSIGNAL);  // if connection broken, don't issue signal
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return SEND_BLOCKED;
+            return SEND_FAILURE;
+        }
+        stats->msgs += msgqueue_consume (queue, n);
+
+        // a short write means the socket buffer is full
+        if ((size_t)n < total) return SEND_BLOCKED;
+    }
+
+    return SEND_COMPLETE; // send queue is empty
+}
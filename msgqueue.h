@@ -0,0 +1,89 @@
+//=============================================================================
+//
+// This contains the definitions, structures and function prototypes defined by the
+// message queue module of the Interactive Endpoint project.
+//
+//=============================================================================
+
+#include <limits.h>
+#include <sys/uio.h>
+
+// max message typed in (and displayed) - the messages sent and received can be up to tcp_msg_limit
+#define MAX_MESSAGE_LEN     ( 255 )
+
+// max number of queued messages gathered into one sendmsg (a header and a message iovec each)
+#define SEND_QUEUE_BATCH    ( IOV_MAX / 2 )
+
+// initial capacities of a send queue (both are doubled as needed)
+#define MSGQUEUE_MIN_MSGS   ( 16 )      // number of message descriptors (must be a power of 2)
+#define MSGQUEUE_MIN_ARENA  ( 4096 )    // size of the message arena in bytes
+#define MSGQUEUE_MAX_ARENA  ( 1U << 30 ) // largest message arena (the messages beyond it are not queued)
+
+// this describes a message in a send queue. the message contents are kept in the queue's arena,
+// or, for a received message queued by reference (add_message_ref), where it was received.
+typedef struct
+{
+    unsigned offset;    // position of the message in the arena (logical, see tMsgQueueStc)
+    int      msglen;    // length of message in bytes
+    int      msgix;     // the messages index for this endpoint
+    unsigned crc;       // the CRC32C of the message (if the queue sends them)
+    char *   ref;       // the message if it is queued by reference (NULL if it is in the arena)
+    int      ref_head;  // the length of the header rewritten in place before ref (0 if the header is sent separately)
+    tRecvSliceStc slice; // keeps the message queued by reference valid until it is sent
+
+} tMsgDescStc;
+
+// this is the FIFO of messages waiting to be sent on a connection: a power of 2 ring of
+// message descriptors, and one arena holding the contents of all the queued messages.
+// the arena is filled like a stream: the offsets in the descriptors are logical positions
+// in the stream, and arena[0] is at position arena_base, so the contents can be moved to
+// the start of the arena without updating the descriptors.
+typedef struct
+{
+    tMsgDescStc * ring;         // the message descriptors (NULL until the first message is queued)
+    unsigned ring_size;         // number of descriptors in ring (a power of 2)
+    unsigned head;              // the index of the next message to send (free running)
+    unsigned tail;              // the index where the next message is added (free running)
+    char *   arena;             // the message contents
+    unsigned arena_size;        // allocation size of arena
+    unsigned arena_base;        // logical position of arena[0]
+    unsigned arena_tail;        // logical position where the next message is stored
+    int      sent;              // number of bytes of the header and first message already sent
+    bool     pinned;            // true while the kernel may still be reading the queued messages
+    char *   retired;           // arena replaced while pinned (freed when unpinned)
+    unsigned high_water;        // the largest number of messages queued at once
+    unsigned long grows;        // the number of times the ring or the arena was enlarged
+    int      wire;              // the wire format the headers are sent in (WIRE_xxx)
+    bool     crc;               // true to send the CRC32C of each message (v2 only, set before any message is queued)
+    unsigned long header_bytes; // the number of header bytes of the messages sent
+    unsigned long by_ref;       // the number of messages queued by reference
+
+} tMsgQueueStc;
+
+// this counts the messages sent from a queue and the system calls used to send them
+typedef struct
+{
+    unsigned long msgs;     // number of messages sent
+    unsigned long calls;    // number of sendmsg calls made
+
+} tSendStatsStc;
+
+// the number of messages in the queue
+#define msgqueue_depth(queue)   ( (queue)->tail - (queue)->head )
+
+// the number of bytes of the messages in the queue's arena
+#define msgqueue_bytes(queue)   ( msgqueue_depth(queue) ? \
+        (queue)->arena_tail - (queue)->ring[(queue)->head & ((queue)->ring_size - 1)].offset : 0 )
+
+// function prototypes:
+void msgqueue_init ( tMsgQueueStc * queue );
+void msgqueue_fini ( tMsgQueueStc * queue );
+void msgqueue_pin ( tMsgQueueStc * queue, bool pinned );
+int  add_message ( tMsgQueueStc * queue, int msgix, const char * data, int msglen );
+int  add_message_ref ( tMsgQueueStc * queue, tRecvBufStc * rbuf, MessageHeaderStc * header, char * message );
+void rem_message ( tMsgQueueStc * queue );
+tMsgDescStc * get_message ( tMsgQueueStc * queue, unsigned index );
+char * msgqueue_data ( tMsgQueueStc * queue, tMsgDescStc * desc );
+int  msgqueue_gather ( tMsgQueueStc * queue, tWireHdrStc * headers, struct iovec * msg_iov, int max_msgs, size_t * total );
+int  msgqueue_consume ( tMsgQueueStc * queue, size_t count );
+tSendMsgTyp send_queue ( int sockfd, tMsgQueueStc * queue, tSendStatsStc * stats );
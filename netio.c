@@ -16,24 +16,43 @@
 #include <sys/types.h> 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 
 #include "userio.h"     // for logmsg
 #include "netio.h"
+#include "bufpool.h"
+#include "crc32c.h"
+
+unsigned long tcp_syscall_count = 0; // number of socket system calls made by this process
+int tcp_msg_limit = TCP_MSG_LIMIT;   // the largest message accepted
+int tcp_sock_bufsize = 0;            // the socket buffer sizes asked for (0 for the system defaults)
+bool tcp_nodelay = false;            // true to send the small messages without delay (TCP_NODELAY)
+int tcp_busy_poll = 0;               // the busy-poll time of the sockets (usec, SO_BUSY_POLL, 0 for none)
+
+// the message index is zigzag encoded in a v2 header, so the small negative indexes of the
+// negotiation messages take one byte, like the small positive ones
+#define WIRE_ZIGZAG(value)      ( ((unsigned)(value) << 1) ^ (unsigned)((value) >> 31) )
+#define WIRE_UNZIGZAG(value)    ( (int)((value) >> 1) ^ -(int)((value) & 1) )
 
 /*
  * Description:
  * Creates a non-blocking TCP socket for use by the system and if a port is specified, binds it
  * to that port and sets up as a server by setting it to listen for connections.
+ * With SO_REUSEPORT, several sockets can listen on the same port and the kernel balances the
+ * incoming connections across them. The socket buffer sizes are set to tcp_sock_bufsize, if given,
+ * and the latency options to tcp_nodelay and tcp_busy_poll.
  *
  * Inputs:
- *   portno  - the server port to bind it to. If 0, it is a client socket and is not bound.
+ *   portno    - the server port to bind it to. If 0, it is a client socket and is not bound.
+ *   backlog   - the max number of pending connections for a server socket
+ *   reuseport - true to allow other sockets to listen on the same port (server socket only)
  *
  * *Returns:
  *   socket descriptor value
  */
-int tcp_create_socket ( int portno )
+int tcp_create_socket ( int portno, int backlog, bool reuseport )
 {
     int retcode, rcv_bufsize, snd_bufsize;
     int sockfd;
@@ -50,6 +69,18 @@ int tcp_create_socket ( int portno )
 
     if (portno > 0)
     {
+        if (reuseport)
+        {
+            int enable = 1;
+            retcode = setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+            if (retcode < 0)
+            {
+                logmsg(PRINT_ERROR, "socket setsockopt SO_REUSEPORT: %s\n", strerror(errno));
+                close(sockfd);
+                return -1;
+            }
+        }
+
         // assign the addr/port to the socket
         bzero((char *) &serv_addr, sizeof(serv_addr));
         serv_addr.sin_family = AF_INET;
@@ -73,6 +104,16 @@ int tcp_create_socket ( int portno )
         return -1;
     }
 
+    // set the socket buffer sizes if asked for (the sockets accepted on a server socket
+    // inherit them, and the kernel doubles the sizes asked for, up to its limits)
+    if (tcp_sock_bufsize > 0)
+    {
+        if (setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &tcp_sock_bufsize, sizeof(tcp_sock_bufsize)) < 0 ||
+            setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &tcp_sock_bufsize, sizeof(tcp_sock_bufsize)) < 0)
+            logmsg(PRINT_WARNING, "socket setsockopt SO_RCVBUF/SO_SNDBUF (%d bytes): %s\n", tcp_sock_bufsize, strerror(errno));
+    }
+    tcp_set_latency (sockfd, tcp_nodelay, tcp_busy_poll);
+
     // get info on socket buffer sizes
     sopt_size = sizeof(rcv_bufsize);
     retcode = getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcv_bufsize, &sopt_size);
@@ -94,15 +135,15 @@ int tcp_create_socket ( int portno )
     // set socket to listen for connections
     if (portno > 0)
     {
-        retcode = listen(sockfd, 5);
+        retcode = listen(sockfd, backlog);
         if (retcode < 0)
         {
             logmsg(PRINT_ERROR, "socket listen: %s\n", strerror(errno));
             close(sockfd);
             return -1;
         }
-        logmsg(PRINT_SOCKET, "server socket listening on port: %u (rcvbuf = %u, sndbuf = %u)\n",
-                portno, rcv_bufsize, snd_bufsize);
+        logmsg(PRINT_SOCKET, "server socket listening on port: %u (backlog = %d, rcvbuf = %u, sndbuf = %u)\n",
+                portno, backlog, rcv_bufsize, snd_bufsize);
     }
     else
     {
@@ -161,7 +202,8 @@ int tcp_connect_to_server ( int clientsock, int portno, struct hostent * server
 
 /*
  * Description:
- * Completes a connection request from a client by accepting it.
+ * Completes a connection request from a client by accepting it. The latency options are set
+ * on the socket accepted (tcp_nodelay and tcp_busy_poll).
  *
  * Inputs:
  *   serversock - the socket descriptor to connect
@@ -176,148 +218,867 @@ int tcp_accept_connection ( int serversock, int * portno )
     struct sockaddr_in cli_addr;
     int clientsock;
 
-    // wait for connections
+    // wait for connections (the data socket is non-blocking like the socket that accepted it)
     clilen = sizeof(cli_addr);
-    clientsock = accept(serversock, (struct sockaddr *) &cli_addr, &clilen);
+    tcp_syscall_count++;
+    clientsock = accept4(serversock, (struct sockaddr *) &cli_addr, &clilen, SOCK_NONBLOCK);
     if (clientsock < 0)
-        logmsg(PRINT_ERROR, "socket accept (port %u): %s\n", cli_addr.sin_port, strerror(errno));
-    else if (portno)
-        * portno = ntohs(cli_addr.sin_port); // return port of connected client
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) // no pending connections is not an error
+            logmsg(PRINT_ERROR, "socket accept: %s\n", strerror(errno));
+    }
+    else
+    {
+        tcp_set_latency (clientsock, tcp_nodelay, tcp_busy_poll);
+        if (portno)
+            * portno = ntohs(cli_addr.sin_port); // return port of connected client
+    }
     return clientsock;
 }
 
 /*
  * Description:
- * Sends a message to the specified socket
+ * Opens a spare descriptor, held in reserve so a listen socket can still take its pending
+ * connections off the backlog once the process is out of descriptors (see tcp_shed_connection).
  *
  * Inputs:
- *   sockfd  - the socket to send the message on
- *   buffer  - the message to send
- *   msglen  - length of the message
- *   msgix   - an index for the messages (incremented after each send, per connection)
+ *   <none>
  *
  * *Returns:
- *   the status of the send
+ *   the spare descriptor (-1 if error)
  */
-tSendMsgTyp tcp_send_message ( int sockfd, char * buffer, int msglen, int msgix )
+int tcp_spare_open ( void )
 {
-    MessageHeaderStc header;
-    struct msghdr msg_header;
-    struct iovec  msg_iov[2];
-    int array_cnt = 0;
-
-    // format message header
-    header.msglen  = msglen;
-    header.msgix   = msgix;
-    msg_iov[array_cnt].iov_base = &header;
-    msg_iov[array_cnt].iov_len  = sizeof(header);
-    array_cnt++;
-    msg_iov[array_cnt].iov_base = buffer;
-    msg_iov[array_cnt].iov_len  = msglen;
-    array_cnt++;
+    int sparefd = open ("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (sparefd < 0)
+        logmsg(PRINT_WARNING, "spare descriptor: %s\n", strerror(errno));
+    return sparefd;
+}
 
-    memset (&msg_header, 0, sizeof(msg_header));
-    msg_header.msg_iov = msg_iov;       // scatter-gather array
-    msg_header.msg_iovlen = array_cnt;  // # elements in msg_iov
-    // msg_header.msg_control     - unused
-    // msg_header.msg_controllen  - unused
-    // msg_header.msg_flags       - unused
-
-    // send message to connected server
-    int n = sendmsg (sockfd, &msg_header, MSG_NOSIGNAL);  // if connection broken, don't issue signal
-//    logmsg(PRINT_OTHER, "sendmsg: n %d, msglen %d, headlen %d, header { %d, %d }\n", n, msglen, (int)sizeof(header), header.msglen, header.msgix);
-    if (n > 0)
+/*
+ * Description:
+ * Drops a pending connection that could not be accepted for lack of descriptors (EMFILE or
+ * ENFILE). The spare descriptor is released to accept the connection, which is closed at once,
+ * and then taken again. Left in the backlog, the connection would keep the listen socket
+ * readable: a level-triggered event loop would spin on it, and an edge-triggered one would
+ * not hear of it again until another client connects.
+ *
+ * Inputs:
+ *   serversock - the listen socket
+ *   sparefd    - ptr to the spare descriptor (-1 if there is none)
+ *
+ * *Returns:
+ *   true if a connection was dropped (the next one can be accepted)
+ */
+bool tcp_shed_connection ( int serversock, int * sparefd )
+{
+    if (*sparefd < 0)
+        return false;
+
+    close (*sparefd);
+    tcp_syscall_count++;
+    int clientsock = accept4(serversock, NULL, NULL, SOCK_CLOEXEC);
+    if (clientsock >= 0)
     {
-        return SEND_COMPLETE;
+        close (clientsock);
+        logmsg(PRINT_WARNING, "out of descriptors - pending connection dropped\n");
     }
-    else if ((n < 0) && (errno == EWOULDBLOCK))
+    *sparefd = tcp_spare_open ();
+    return clientsock >= 0;
+}
+
+/*
+ * Description:
+ * Sets the latency options of a socket: TCP_NODELAY sends each message as soon as it is
+ * written (rather than holding a small one back while an earlier one is unacknowledged), and
+ * SO_BUSY_POLL has a blocking receive or poll of the socket spin on the device queue for a
+ * while before sleeping (it takes CAP_NET_ADMIN to raise it above net.core.busy_read). Only
+ * the options asked for are set, and a failure is only a warning.
+ *
+ * Inputs:
+ *   sockfd    - the socket
+ *   nodelay   - true to set TCP_NODELAY
+ *   busy_poll - the busy-poll time (usec, 0 to leave it unset)
+ *
+ * *Returns:
+ *   <none>
+ */
+void tcp_set_latency ( int sockfd, bool nodelay, int busy_poll )
+{
+    int enable = 1;
+    if (nodelay && setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable)) < 0)
+        logmsg(PRINT_WARNING, "socket setsockopt TCP_NODELAY: %s\n", strerror(errno));
+    if (busy_poll > 0 && setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) < 0)
+        logmsg(PRINT_WARNING, "socket setsockopt SO_BUSY_POLL (%d usec): %s\n", busy_poll, strerror(errno));
+}
+
+/*
+ * Description:
+ * Allocates a block of storage for a receive buffer, with one reference (the receive buffer's).
+ *
+ * Inputs:
+ *   size    - the size of the storage
+ *
+ * *Returns:
+ *   the block (NULL if error)
+ */
+static tRecvBlockStc * tcp_block_alloc ( int size )
+{
+    tRecvBlockStc * block = (tRecvBlockStc *)malloc (sizeof(tRecvBlockStc) + size);
+    if (block == NULL)
     {
-        return SEND_BLOCKED;
+        logmsg(PRINT_ERROR, "memory allocation for receive buffer\n");
+        return NULL;
     }
+    block->refs = 1;
+    block->data = (char *)(block + 1);
+    return block;
+}
 
-    return SEND_FAILURE;
+/*
+ * Description:
+ * Releases a reference to a block of a receive buffer, and frees the block if it was the last.
+ *
+ * Inputs:
+ *   block   - the block (NULL if none)
+ *
+ * *Returns:
+ *   <none>
+ */
+static void tcp_block_release ( tRecvBlockStc * block )
+{
+    if (block && --block->refs == 0)
+        free (block);
 }
 
 /*
  * Description:
- * Sends a message to the specified socket
+ * Allocates the receive buffer of a connection.
  *
  * Inputs:
- *   sockfd  - the socket to receive the message on
- *   buffer  - ptr to location to receive the message in
- *   msglen  - allocation size of the message
+ *   rbuf    - ptr to the receive buffer to initialize
+ *   size    - allocation size of the buffer (the largest message it can hold, including its header)
  *
  * *Returns:
- *   the status of the receive
+ *   0 if successful, -1 if error
  */
-tRecvMsgTyp tcp_recv_message ( int sockfd, char * buffer, int msglen )
+int tcp_recvbuf_init ( tRecvBufStc * rbuf, int size )
 {
-    MessageHeaderStc header;
-    struct msghdr msg_header;
-    struct iovec  msg_iov[1];
-    int recv_count = 0; // current number of chars received
+    rbuf->head = 0;
+    rbuf->tail = 0;
+    rbuf->size = size;
+    rbuf->large = NULL;
+    rbuf->large_count = 0;
+    rbuf->wire = WIRE_V1;
+    rbuf->resync = false;
+    rbuf->resyncs = 0;
+    rbuf->resync_bytes = 0;
+    rbuf->msg_headlen = 0;
+    rbuf->msg_flags = 0;
+    rbuf->crc_checked = 0;
+    rbuf->crc_errors = 0;
+    rbuf->reads = 0;
+    rbuf->spare = NULL;
+    rbuf->block_swaps = 0;
+    rbuf->block = tcp_block_alloc (size);
+    if (rbuf->block == NULL)
+        return -1;
+    rbuf->data = rbuf->block->data;
+    return 0;
+}
 
-    // format message header
-    memset (&header, 0, sizeof(header));
-    msg_iov[0].iov_base = &header;
-    msg_iov[0].iov_len  = sizeof(header);
+/*
+ * Description:
+ * Frees the receive buffer of a connection (and the buffer of a large message). The blocks
+ * that messages queued by reference are still in are freed when those are released.
+ *
+ * Inputs:
+ *   rbuf    - ptr to the receive buffer
+ *
+ * *Returns:
+ *   <none>
+ */
+void tcp_recvbuf_fini ( tRecvBufStc * rbuf )
+{
+    tcp_block_release (rbuf->block);
+    tcp_block_release (rbuf->spare);
+    bufpool_put (rbuf->large, rbuf->large_header.msglen);
+    rbuf->block = NULL;
+    rbuf->spare = NULL;
+    rbuf->large = NULL;
+    rbuf->data = NULL;
+    rbuf->size = 0;
+    rbuf->head = 0;
+    rbuf->tail = 0;
+}
 
-    memset (&msg_header, 0, sizeof(msg_header));
-    msg_header.msg_iov = msg_iov;       // scatter-gather array
-    msg_header.msg_iovlen = 1;  // # elements in msg_iov
-    // msg_header.msg_control     - unused
-    // msg_header.msg_controllen  - unused
-    // msg_header.msg_flags       - unused
+/*
+ * Description:
+ * Returns the number of bytes a value takes as a varint (7 bits per byte, the low bits first,
+ * with the top bit of each byte set if more bytes follow).
+ *
+ * Inputs:
+ *   value - the value
+ *
+ * *Returns:
+ *   the number of bytes (1 - 5)
+ */
+static int tcp_varint_size ( unsigned value )
+{
+    int size = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
 
-    // send message to connected server
-    while (true)
+/*
+ * Description:
+ * Encodes a value as a varint.
+ *
+ * Inputs:
+ *   value - the value
+ *   bytes - ptr to the location to encode it in (up to 5 bytes)
+ *
+ * *Returns:
+ *   the number of bytes used
+ */
+static int tcp_varint_put ( unsigned value, unsigned char * bytes )
+{
+    int used = 0;
+    while (value >= 0x80)
+    {
+        bytes[used++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[used++] = (unsigned char)value;
+    return used;
+}
+
+/*
+ * Description:
+ * Decodes a varint.
+ *
+ * Inputs:
+ *   bytes - the received bytes
+ *   len   - the number of bytes received
+ *   value - ptr to location to return the value in
+ *
+ * *Returns:
+ *   the number of bytes used, 0 if more bytes are needed, -1 if it is not a valid 32 bit varint
+ */
+static int tcp_varint_get ( const unsigned char * bytes, int len, unsigned * value )
+{
+    unsigned result = 0;
+    int ix;
+    for (ix = 0; ix < len && ix < 5; ix++)
+    {
+        result |= (unsigned)(bytes[ix] & 0x7F) << (7 * ix);
+        if ((bytes[ix] & 0x80) == 0)
+        {
+            if (ix == 4 && bytes[ix] > 0x0F)
+                return -1; // more than 32 bits
+            *value = result;
+            return ix + 1;
+        }
+    }
+    return (ix == 5) ? -1 : 0;
+}
+
+/*
+ * Description:
+ * Returns the size of the header of a message in a wire format.
+ *
+ * Inputs:
+ *   wire   - the wire format (WIRE_xxx)
+ *   flags  - the v2 flags (WIRE_FLAG_xxx)
+ *   msglen - the length of the message
+ *   msgix  - the message index
+ *
+ * *Returns:
+ *   the number of bytes of the header
+ */
+int tcp_header_size ( int wire, int flags, int msglen, int msgix )
+{
+    if (wire != WIRE_V2)
+        return sizeof(MessageHeaderStc);
+    return 2 + tcp_varint_size (msglen) + tcp_varint_size (WIRE_ZIGZAG(msgix)) + ((flags & WIRE_FLAG_CRC) ? 4 : 0);
+}
+
+/*
+ * Description:
+ * Encodes the header of a message in a wire format.
+ *
+ * Inputs:
+ *   wire   - the wire format (WIRE_xxx)
+ *   flags  - the v2 flags (WIRE_FLAG_xxx)
+ *   msglen - the length of the message
+ *   msgix  - the message index
+ *   crc    - the CRC32C of the message (if WIRE_FLAG_CRC)
+ *   bytes  - ptr to the location to encode the header in (WIRE_HDR_MAX bytes)
+ *
+ * *Returns:
+ *   the number of bytes of the header
+ */
+int tcp_header_encode ( int wire, int flags, int msglen, int msgix, unsigned crc, char * bytes )
+{
+    if (wire != WIRE_V2)
+    {
+        MessageHeaderStc header;
+        header.msglen = msglen;
+        header.msgix  = msgix;
+        memcpy (bytes, &header, sizeof(header));
+        return sizeof(header);
+    }
+
+    unsigned char * out = (unsigned char *)bytes;
+    out[0] = WIRE_MAGIC;
+    out[1] = (unsigned char)flags;
+    int used = 2 + tcp_varint_put (msglen, &out[2]);
+    used += tcp_varint_put (WIRE_ZIGZAG(msgix), &out[used]);
+    if (flags & WIRE_FLAG_CRC)
+    {
+        out[used++] = (unsigned char)crc;
+        out[used++] = (unsigned char)(crc >> 8);
+        out[used++] = (unsigned char)(crc >> 16);
+        out[used++] = (unsigned char)(crc >> 24);
+    }
+    return used;
+}
+
+/*
+ * Description:
+ * Decodes the header of a received message in a wire format, and checks it is valid.
+ *
+ * Inputs:
+ *   wire   - the wire format (WIRE_xxx)
+ *   data   - the received data, starting with the header
+ *   len    - the number of bytes of received data
+ *   header - ptr to location to return the header in (for a v1 header, even if it is invalid)
+ *   flags  - ptr to location to return the v2 flags in (WIRE_FLAG_xxx, 0 for v1)
+ *   crc    - ptr to location to return the CRC32C of the message in (if WIRE_FLAG_CRC)
+ *
+ * *Returns:
+ *   the number of bytes of the header, 0 if more bytes are needed, -1 if the header is invalid
+ */
+int tcp_header_decode ( int wire, const char * data, int len, MessageHeaderStc * header, int * flags, unsigned * crc )
+{
+    *flags = 0;
+    if (wire != WIRE_V2)
+    {
+        if (len < (int)sizeof(MessageHeaderStc))
+            return 0;
+        memcpy (header, data, sizeof(MessageHeaderStc)); // (the header may not be aligned)
+        return (header->msglen < 0 || header->msglen > tcp_msg_limit) ? -1 : (int)sizeof(MessageHeaderStc);
+    }
+
+    const unsigned char * bytes = (const unsigned char *)data;
+    if (len < 1) return 0;
+    if (bytes[0] != WIRE_MAGIC) return -1;
+    if (len < 2) return 0;
+    if (bytes[1] & ~WIRE_FLAGS_KNOWN) return -1;
+
+    unsigned msglen, msgix;
+    int n1 = tcp_varint_get (&bytes[2], len - 2, &msglen);
+    if (n1 <= 0) return n1;
+    int n2 = tcp_varint_get (&bytes[2 + n1], len - 2 - n1, &msgix);
+    if (n2 <= 0) return n2;
+    if (msglen > (unsigned)tcp_msg_limit) return -1;
+
+    int used = 2 + n1 + n2;
+    if (bytes[1] & WIRE_FLAG_CRC)
+    {
+        if (len < used + 4) return 0;
+        *crc = bytes[used] | (bytes[used + 1] << 8) | (bytes[used + 2] << 16) | ((unsigned)bytes[used + 3] << 24);
+        used += 4;
+    }
+
+    *flags = bytes[1];
+    header->msglen = (int)msglen;
+    header->msgix  = WIRE_UNZIGZAG(msgix);
+    return used;
+}
+
+/*
+ * Description:
+ * Skips a corrupted v2 header in the receive buffer: the bytes up to the next magic byte are
+ * dropped, and the header is looked for again from there.
+ *
+ * Inputs:
+ *   sockfd  - the socket the data was received on
+ *   rbuf    - the receive buffer of the connection (with the corrupted header at head)
+ *
+ * *Returns:
+ *   <none>
+ */
+static void tcp_recv_resync ( int sockfd, tRecvBufStc * rbuf )
+{
+    int skip = 1;
+    while (rbuf->head + skip < rbuf->tail && (unsigned char)rbuf->data[rbuf->head + skip] != WIRE_MAGIC)
+        skip++;
+
+    if (!rbuf->resync)
+    {
+        logmsg(PRINT_WARNING, "corrupted message header (socket %d): resynchronizing\n", sockfd);
+        rbuf->resyncs++;
+        rbuf->resync = true;
+    }
+    rbuf->resync_bytes += skip;
+    rbuf->head += skip;
+}
+
+/*
+ * Description:
+ * Moves the receive buffer to another block, with the partial message at head, because messages
+ * queued by reference are still in the block in use. The block used before is reused if its
+ * messages have all been sent, otherwise a new one is allocated (and the one used before is
+ * freed once its messages are sent).
+ *
+ * Inputs:
+ *   rbuf    - the receive buffer of the connection
+ *
+ * *Returns:
+ *   true if successful, false if error (memory allocation)
+ */
+static bool tcp_recv_swap ( tRecvBufStc * rbuf )
+{
+    tRecvBlockStc * next = rbuf->spare;
+    if (next == NULL || next->refs > 1)
+    {
+        next = tcp_block_alloc (rbuf->size);
+        if (next == NULL)
+            return false;
+        tcp_block_release (rbuf->spare);
+    }
+
+    memcpy (next->data, &rbuf->data[rbuf->head], rbuf->tail - rbuf->head);
+    rbuf->spare = rbuf->block;
+    rbuf->block = next;
+    rbuf->data  = next->data;
+    rbuf->tail -= rbuf->head;
+    rbuf->head  = 0;
+    rbuf->block_swaps++;
+    return true;
+}
+
+/*
+ * Description:
+ * Receives the rest of a large message straight into its pooled buffer. Only the bytes of the
+ * message are read, so the messages after it are read into the receive buffer as usual.
+ *
+ * Inputs:
+ *   sockfd  - the socket to receive the message on
+ *   rbuf    - the receive buffer of the connection
+ *   header  - ptr to location to return the message header
+ *   message - ptr to location to return the ptr to the message (header->msglen chars, not NULL-terminated)
+ *
+ * *Returns:
+ *   the status of the receive
+ */
+static tRecvMsgTyp tcp_recv_large ( int sockfd, tRecvBufStc * rbuf, MessageHeaderStc * header, char ** message )
+{
+    while (rbuf->large_count < rbuf->large_header.msglen)
     {
-        // keep reading until error, blocked, termination, or completed msg received
-        int n = recvmsg (sockfd, &msg_header, 0);
+        tcp_syscall_count++;
+        rbuf->reads++;
+        int n = recv (sockfd, &rbuf->large[rbuf->large_count], rbuf->large_header.msglen - rbuf->large_count, 0);
         if (n == 0) return RECV_TERMINATED; // client connection was terminated
         else if (n < 0) // error occurred
         {
-            if (errno == EWOULDBLOCK) return RECV_BLOCKED;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return RECV_BLOCKED; // the partial message is kept
+            if (errno == EINTR) continue;
             return RECV_FAILURE;
         }
+        rbuf->large_count += n;
+    }
+
+    *header  = rbuf->large_header;
+    *message = rbuf->large;
+    return RECV_COMPLETE;
+}
+
+/*
+ * Description:
+ * Receives the next message from the socket into the receive buffer (see tcp_recv_frame),
+ * and saves the v2 flags and CRC32C of the message in the receive buffer.
+ *
+ * Inputs:
+ *   sockfd  - the socket to receive the message on
+ *   rbuf    - the receive buffer of the connection
+ *   header  - ptr to location to return the message header
+ *   message - ptr to location to return the ptr to the message (header->msglen chars, not NULL-terminated)
+ *
+ * *Returns:
+ *   the status of the receive
+ */
+static tRecvMsgTyp tcp_recv_next ( int sockfd, tRecvBufStc * rbuf, MessageHeaderStc * header, char ** message )
+{
+    // finish the large message being received (or release the one returned last time)
+    if (rbuf->large)
+    {
+        if (rbuf->large_count < rbuf->large_header.msglen)
+            return tcp_recv_large (sockfd, rbuf, header, message);
+        bufpool_put (rbuf->large, rbuf->large_header.msglen);
+        rbuf->large = NULL;
+    }
 
-        // success receiving some chars of the message. check if complete.
-        recv_count += n; // increment the received char count by the number received
-//        logmsg(PRINT_OTHER, "recvmsg: n %d, count %d, headlen %d, header { %d, %d }\n", n, recv_count, (int)sizeof(header), header.msglen, header.msgix);
-        if (recv_count >= sizeof(header))
+    while (true)
+    {
+        // return the next message if it is complete in the buffer
+        int avail = rbuf->tail - rbuf->head;
+        int flags;
+        unsigned crc;
+        int headlen = avail ? tcp_header_decode (rbuf->wire, &rbuf->data[rbuf->head], avail, header, &flags, &crc) : 0;
+        if (headlen < 0)
         {
-            // check if header contents are valid
-            if (header.msglen > msglen)
+            // a v1 stream can't be resynchronized (its headers have no marker to find)
+            if (rbuf->wire != WIRE_V2)
             {
-                logmsg(PRINT_ERROR, "invalid message header: len = %d, ix = %d\n", header.msglen, header.msgix);
-                header.msglen = msglen;
+                logmsg(PRINT_ERROR, "invalid message header: len = %d, ix = %d\n", header->msglen, header->msgix);
+                errno = EBADMSG;
+                return RECV_FAILURE;
+            }
+            tcp_recv_resync (sockfd, rbuf);
+            continue;
+        }
+        if (headlen > 0)
+        {
+            rbuf->resync = false;
+            rbuf->msg_headlen = headlen;
+            rbuf->msg_flags = flags;
+            rbuf->msg_crc   = crc;
+            if (avail >= headlen + header->msglen)
+            {
+                *message = &rbuf->data[rbuf->head + headlen];
+                rbuf->head += headlen + header->msglen;
+                return RECV_COMPLETE;
             }
 
-            // header portion is complete & contains full message size. see if complete.
-            if (recv_count >= sizeof(header) + header.msglen) // should never be >
-                break;
+            // too large for the receive buffer: move the part received to a buffer of its own
+            if (header->msglen > rbuf->size - headlen)
+            {
+                rbuf->large = bufpool_get (header->msglen);
+                if (rbuf->large == NULL)
+                {
+                    errno = ENOMEM;
+                    return RECV_FAILURE;
+                }
+                rbuf->large_header = *header;
+                rbuf->large_count  = avail - headlen;
+                memcpy (rbuf->large, &rbuf->data[rbuf->head + headlen], rbuf->large_count);
+                rbuf->head = rbuf->tail;
+                rbuf->msg_headlen = 0;
+                return tcp_recv_large (sockfd, rbuf, header, message);
+            }
+        }
 
-            // if header just filled, switch to filling message
-            if (recv_count == sizeof(header))
+        // make room for the rest of the message: the buffer is empty, or the partial
+        // message is moved to the start of the buffer if it cannot fit where it is (or to
+        // another block, if messages queued by reference are still in this one)
+        if (rbuf->head > 0 &&
+            (avail == 0 || headlen == 0 || rbuf->head + headlen + header->msglen > rbuf->size))
+        {
+            if (rbuf->block->refs > 1)
             {
-                msg_iov[0].iov_base = buffer;
-                msg_iov[0].iov_len  = header.msglen;
+                if (!tcp_recv_swap (rbuf))
+                {
+                    errno = ENOMEM;
+                    return RECV_FAILURE;
+                }
             }
             else
             {
-                // adjust position and amount to fill in message buffer
-                msg_iov[0].iov_base = &buffer[recv_count-sizeof(header)];
-                msg_iov[0].iov_len  -= n;
+                memmove (rbuf->data, &rbuf->data[rbuf->head], avail);
+                rbuf->head = 0;
+                rbuf->tail = avail;
             }
         }
-        else
+
+        // read as much as the buffer can hold
+        tcp_syscall_count++;
+        rbuf->reads++;
+        int n = recv (sockfd, &rbuf->data[rbuf->tail], rbuf->size - rbuf->tail, 0);
+        if (n == 0) return RECV_TERMINATED; // client connection was terminated
+        else if (n < 0) // error occurred
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return RECV_BLOCKED; // the partial message is kept
+            if (errno == EINTR) continue;
+            return RECV_FAILURE;
+        }
+        rbuf->tail += n;
+    }
+}
+
+/*
+ * Description:
+ * Checks the CRC32C of a received message, if one was sent with it.
+ *
+ * Inputs:
+ *   sockfd  - the socket the message was received on
+ *   rbuf    - the receive buffer of the connection
+ *   header  - the header of the message
+ *   message - the message
+ *
+ * *Returns:
+ *   true if the message is intact (or was sent without a CRC32C), false if it failed the check
+ */
+static bool tcp_recv_check ( int sockfd, tRecvBufStc * rbuf, MessageHeaderStc * header, const char * message )
+{
+    if (!(rbuf->msg_flags & WIRE_FLAG_CRC))
+        return true;
+
+    rbuf->crc_checked++;
+    if (crc32c (0, message, header->msglen) == rbuf->msg_crc)
+        return true;
+
+    rbuf->crc_errors++;
+    logmsg(PRINT_WARNING, "message %d failed its CRC32C check (socket %d): dropped\n", header->msgix, sockfd);
+    return false;
+}
+
+/*
+ * Description:
+ * Receives the next message from the specified socket. The socket is read into the connection's
+ * receive buffer with as large a read as the buffer allows, so one read usually brings in many
+ * messages, and they are returned from the buffer without any further system calls. A message
+ * that is only partially received stays in the buffer until the rest of it arrives.
+ * The message is not copied: it is returned as a pointer into the receive buffer, which is
+ * only valid until the next call for this connection (unless it is held, see tcp_recv_hold).
+ * A message too large for the receive buffer (up to tcp_msg_limit) is received into a pooled
+ * buffer sized for it instead, which is returned to the pool on the next call.
+ * The headers are decoded in the wire format of the connection. A corrupted v1 header fails
+ * the receive, but a corrupted v2 header is skipped, by resynchronizing on the next magic byte.
+ * A v2 message sent with a CRC32C is checked as it is returned, and dropped if it fails.
+ *
+ * Inputs:
+ *   sockfd  - the socket to receive the message on
+ *   rbuf    - the receive buffer of the connection
+ *   header  - ptr to location to return the message header
+ *   message - ptr to location to return the ptr to the message (header->msglen chars, not NULL-terminated)
+ *
+ * *Returns:
+ *   the status of the receive
+ */
+tRecvMsgTyp tcp_recv_frame ( int sockfd, tRecvBufStc * rbuf, MessageHeaderStc * header, char ** message )
+{
+    tRecvMsgTyp status;
+    do
+        status = tcp_recv_next (sockfd, rbuf, header, message);
+    while (status == RECV_COMPLETE && !tcp_recv_check (sockfd, rbuf, header, *message));
+    return status;
+}
+
+/*
+ * Description:
+ * Keeps the message last returned by tcp_recv_frame valid after the next call, so it can be
+ * queued to be sent by reference instead of being copied. A message in the receive buffer
+ * holds a reference to its block, and the pooled buffer of a large message is handed over to
+ * the slice. The slice is released (tcp_slice_release) once the message has been sent.
+ *
+ * Inputs:
+ *   rbuf    - the receive buffer the message was returned from
+ *   slice   - ptr to location to return the reference to the message in
+ *
+ * *Returns:
+ *   <none>
+ */
+void tcp_recv_hold ( tRecvBufStc * rbuf, tRecvSliceStc * slice )
+{
+    if (rbuf->large)
+    {
+        slice->block      = NULL;
+        slice->large      = rbuf->large;
+        slice->large_size = rbuf->large_header.msglen;
+        rbuf->large = NULL; // (not returned to the pool on the next call)
+    }
+    else
+    {
+        slice->block      = rbuf->block;
+        slice->large      = NULL;
+        slice->large_size = 0;
+        rbuf->block->refs++;
+    }
+}
+
+/*
+ * Description:
+ * Releases a received message held by tcp_recv_hold.
+ *
+ * Inputs:
+ *   slice   - the reference to the message (cleared)
+ *
+ * *Returns:
+ *   <none>
+ */
+void tcp_slice_release ( tRecvSliceStc * slice )
+{
+    tcp_block_release (slice->block);
+    bufpool_put (slice->large, slice->large_size);
+    slice->block = NULL;
+    slice->large = NULL;
+}
+
+/*
+ * Description:
+ * Returns the port of the peer a connected socket is connected to.
+ *
+ * Inputs:
+ *   sockfd  - the connected socket
+ *
+ * *Returns:
+ *   the peer port (0 if unknown)
+ */
+int tcp_get_peer_port ( int sockfd )
+{
+    struct sockaddr_in peer_addr;
+    socklen_t addr_size = sizeof(peer_addr);
+
+    if (getpeername(sockfd, (struct sockaddr *)&peer_addr, &addr_size) < 0)
+        return 0;
+    return ntohs(peer_addr.sin_port);
+}
+
+/*
+ * Description:
+ * Sends a message directly on a socket in the v1 wire format, ahead of any queued messages
+ * (for the negotiation messages, which are sent before the queued messages).
+ *
+ * Inputs:
+ *   sockfd - the connected socket
+ *   msgix  - the message index
+ *   data   - the message
+ *   msglen - the length of the message
+ *
+ * *Returns:
+ *   0 if successful, -1 if it could not be sent, -2 if only part of it was sent (the
+ *   connection can't be used)
+ */
+int tcp_send_frame ( int sockfd, int msgix, const char * data, int msglen )
+{
+    MessageHeaderStc header;
+    header.msglen = msglen;
+    header.msgix  = msgix;
+
+    struct iovec msg_iov[2];
+    msg_iov[0].iov_base = &header;
+    msg_iov[0].iov_len  = sizeof(header);
+    msg_iov[1].iov_base = (void *)data;
+    msg_iov[1].iov_len  = msglen;
+    struct msghdr msg_header;
+    memset (&msg_header, 0, sizeof(msg_header));
+    msg_header.msg_iov    = msg_iov;
+    msg_header.msg_iovlen = 2;
+
+    tcp_syscall_count++;
+    ssize_t n = sendmsg (sockfd, &msg_header, MSG_NOSIGNAL);
+    if (n == (ssize_t)(sizeof(header) + msglen))
+        return 0;
+    return (n <= 0) ? -1 : -2;
+}
+
+/*
+ * Description:
+ * Collects the header and message from a chunk of received stream data. The chunk may hold
+ * any part of a message, so this is called until the frame is complete, and the remaining
+ * data in the chunk (if any) is the start of the next message. A message larger than the
+ * frame buffer (up to tcp_msg_limit) is collected in a pooled buffer, which is returned to
+ * the pool by tcp_frame_reset.
+ *
+ * Inputs:
+ *   frame   - the message being collected (count must be 0 to start a new message)
+ *   data    - the received data
+ *   len     - the number of bytes of received data
+ *
+ * *Returns:
+ *   the number of bytes of data consumed, -1 if the message header is invalid
+ */
+int tcp_frame_collect ( tFrameStc * frame, const char * data, int len )
+{
+    int used = 0;
+    int headlen = sizeof(frame->header);
+
+    // collect the header first
+    if (frame->count < headlen)
+    {
+        int n = headlen - frame->count;
+        if (n > len) n = len;
+        memcpy((char *)&frame->header + frame->count, data, n);
+        frame->count += n;
+        used += n;
+        if (frame->count < headlen)
+            return used;
+
+        // check if header contents are valid
+        if (frame->header.msglen < 0 || frame->header.msglen > tcp_msg_limit)
+        {
+            logmsg(PRINT_ERROR, "invalid message header: len = %d, ix = %d\n", frame->header.msglen, frame->header.msgix);
+            return -1;
+        }
+        if (frame->header.msglen > frame->size)
         {
-            // adjust position and amount to fill in header
-            msg_iov[0].iov_base = (char*)&header + recv_count;
-            msg_iov[0].iov_len  = sizeof(header) - recv_count;
+            frame->large = bufpool_get (frame->header.msglen);
+            if (frame->large == NULL)
+                return -1;
         }
     }
 
-    return RECV_COMPLETE; // or RECV_INPROCESS
+    // then the message contents
+    int n = headlen + frame->header.msglen - frame->count;
+    if (n > len - used) n = len - used;
+    memcpy(&tcp_frame_message (frame)[frame->count - headlen], data + used, n);
+    frame->count += n;
+    used += n;
+
+    return used;
 }
 
+/*
+ * Description:
+ * Determines if the header and message have been completely collected.
+ *
+ * Inputs:
+ *   frame   - the message being collected
+ *
+ * *Returns:
+ *   true if the message is complete
+ */
+bool tcp_frame_complete ( tFrameStc * frame )
+{
+    int headlen = sizeof(frame->header);
+    return (frame->count >= headlen) && (frame->count == headlen + frame->header.msglen);
+}
+
+/*
+ * Description:
+ * Returns the location the message of a frame is collected in.
+ *
+ * Inputs:
+ *   frame   - the message being collected
+ *
+ * *Returns:
+ *   the message (header.msglen chars once complete, not NULL-terminated)
+ */
+char * tcp_frame_message ( tFrameStc * frame )
+{
+    return frame->large ? frame->large : frame->buffer;
+}
+
+/*
+ * Description:
+ * Starts collecting the next message in a frame (returning the pooled buffer of a large
+ * message to the pool).
+ *
+ * Inputs:
+ *   frame   - the message being collected
+ *
+ * *Returns:
+ *   <none>
+ */
+void tcp_frame_reset ( tFrameStc * frame )
+{
+    bufpool_put (frame->large, frame->header.msglen);
+    frame->large = NULL;
+    frame->count = 0;
+}
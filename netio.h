@@ -7,13 +7,17 @@
 
 #include <netdb.h>
 
+#define TCP_LISTEN_BACKLOG  ( SOMAXCONN )   // default max number of pending connections on a server socket
+#define TCP_RECV_BUFSIZE    ( 65536 )       // size of the receive buffer of each connection
+#define TCP_MSG_LIMIT       ( 16 << 20 )    // default largest message accepted (larger ones are taken as a broken stream)
+#define TCP_ACCEPT_BACKOFF_MSEC ( 100 )    // out of descriptors with no spare one, a listen socket is not monitored this long
 
 // endpoint connection states
 #define STATE_IDLE         ( 0 )    // no connection attempt yet, or connection attempt failed
 #define STATE_PENDING      ( 1 )    // connection started, waiting for completion
 #define STATE_READY        ( 2 )    // connection completed
 
-// return codes for tcp_send_message
+// return codes for send_queue
 typedef enum
 {
     SEND_COMPLETE,
@@ -22,7 +26,7 @@ typedef enum
 
 } tSendMsgTyp;
 
-// return codes for tcp_recv_message
+// return codes for tcp_recv_frame
 typedef enum
 {
     RECV_COMPLETE,
@@ -33,6 +37,7 @@ typedef enum
 } tRecvMsgTyp;
 
 // this defines the header information that is added to the start of each msg sent on the sockets
+// (as is in the v1 wire format, and as the decoded form of the other wire formats)
 typedef struct
 {
     int  msglen;    // total length of message (excluding NULL term)
@@ -40,10 +45,124 @@ typedef struct
 
 } MessageHeaderStc;
 
+// the wire formats of the message headers on a TCP connection. every connection starts in v1,
+// and the client offers v2 (sent in v1 with msgix WIRE_MSGIX) before sending any messages. a
+// server that takes the offer answers in v1 and uses v2 from then on, and so does the client
+// once it has the answer. a server that does not know the offer echoes it, which declines it.
+#define WIRE_V1             ( 1 )       // MessageHeaderStc as is (native byte order)
+#define WIRE_V2             ( 2 )       // magic byte, flags byte, varint length, varint zigzag message index
+#define WIRE_MAGIC          ( 0xE2 )    // the first byte of a v2 header (the stream is resynchronized on it)
+#define WIRE_FLAG_CRC       ( 0x01 )    // the CRC32C of the message follows the varints (4 bytes, low byte first)
+#define WIRE_FLAGS_KNOWN    ( WIRE_FLAG_CRC ) // the v2 flag bits defined (a header with any other bit set is corrupted)
+#define WIRE_HDR_MAX        ( 16 )      // the largest header in any wire format
+#define WIRE_MSGIX          ( -3 )
+#define WIRE_OFFER          "wire 2"    // client: the client can use v2
+#define WIRE_OFFER_CRC      "wire 2 crc" // client: the same, and the server is to send the CRC32C of its messages
+#define WIRE_ACCEPT         "wire 2 ok" // server: the messages after this one are in v2, both ways
+
+// this holds a message header encoded in the wire format of a connection
+typedef struct
+{
+    char bytes[WIRE_HDR_MAX];
+
+} tWireHdrStc;
+
+// this holds a message while its pieces are collected from a received byte stream (in the v1
+// wire format only)
+typedef struct
+{
+    MessageHeaderStc header;    // the message header (valid once count >= sizeof(header))
+    int    count;               // number of bytes of the header and message collected so far
+    int    size;                // allocation size of buffer
+    char * buffer;              // location to collect the message in
+    char * large;               // pooled buffer the message is collected in if it is larger than size (NULL if none)
+
+} tFrameStc;
+
+// this is the storage of a receive buffer. the messages received in it can be queued to be
+// sent by reference (see tcp_recv_hold), so it is reference counted: the receive buffer holds
+// a reference while it uses the block, and each message queued from it holds one. it is freed
+// when the last reference is released.
+typedef struct
+{
+    int    refs;                // number of references to the block
+    char * data;                // the storage (allocated with the block)
+
+} tRecvBlockStc;
+
+// this keeps a received message valid while it is queued by reference: it holds a reference
+// to the block the message is in, or owns the pooled buffer of a large message.
+typedef struct
+{
+    tRecvBlockStc * block;      // the block the message is in (NULL if none)
+    char * large;               // the pooled buffer of the large message (NULL if none)
+    int    large_size;          // the size the pooled buffer was taken for
+
+} tRecvSliceStc;
+
+// this is the receive buffer of a connection. the socket is read into the free space after
+// tail, and the received messages are taken from head. a message too large for the buffer is
+// received into a pooled buffer of its own (the part already in the buffer is moved there,
+// and the rest is read straight into it). when messages queued by reference are still in the
+// buffer, the buffer moves to another block rather than reusing the one they are in.
+typedef struct
+{
+    char * data;                // the buffer (the storage of block)
+    tRecvBlockStc * block;      // the block in use
+    tRecvBlockStc * spare;      // the block used before it, reused once its messages are sent (NULL if none)
+    unsigned long block_swaps;  // number of times the buffer moved to another block
+    int    size;                // allocation size of data
+    int    head;                // offset of the next message to return
+    int    tail;                // offset of the end of the received data
+    MessageHeaderStc large_header; // the header of the large message
+    char * large;               // pooled buffer of the large message being received (NULL if none)
+    int    large_count;         // number of bytes of the large message received so far
+    int    wire;                // the wire format of the received messages (WIRE_xxx)
+    bool   resync;              // true while bytes are skipped to find the next v2 header
+    unsigned long resyncs;      // number of times a corrupted v2 header was skipped
+    unsigned long resync_bytes; // number of bytes skipped to resynchronize
+    int    msg_headlen;         // the length of the header of the message being returned (0 if not in the buffer)
+    int    msg_flags;           // the v2 flags of the message being returned (WIRE_FLAG_xxx)
+    unsigned msg_crc;           // the CRC32C sent with the message being returned (if WIRE_FLAG_CRC)
+    unsigned long crc_checked;  // number of messages received with a CRC32C
+    unsigned long crc_errors;   // number of those that failed the check (they are dropped)
+    unsigned long reads;        // number of recv calls made for the connection
+
+} tRecvBufStc;
+
+// number of socket system calls made by this process (for comparing I/O backends)
+extern unsigned long tcp_syscall_count;
+
+// the largest message accepted (TCP_MSG_LIMIT unless changed on the command line)
+extern int tcp_msg_limit;
+
+// the send and receive buffer sizes asked for on the sockets created (0 for the system defaults)
+extern int tcp_sock_bufsize;
+
+// the latency options set on the sockets created and accepted: TCP_NODELAY, and the busy-poll
+// time (usec, SO_BUSY_POLL, 0 for none)
+extern bool tcp_nodelay;
+extern int tcp_busy_poll;
+
 // function prototypes:
-int tcp_create_socket ( int portno );
+int tcp_create_socket ( int portno, int backlog, bool reuseport );
 int tcp_connect_to_server ( int clientsock, int portno, struct hostent * server );
 int tcp_accept_connection ( int serversock, int * portno );
-tSendMsgTyp tcp_send_message ( int sockfd, char * buffer, int msglen, int msgix );
-tRecvMsgTyp tcp_recv_message ( int sockfd, char * response, int size );
+int  tcp_spare_open ( void );
+bool tcp_shed_connection ( int serversock, int * sparefd );
+void tcp_set_latency ( int sockfd, bool nodelay, int busy_poll );
+int  tcp_recvbuf_init ( tRecvBufStc * rbuf, int size );
+void tcp_recvbuf_fini ( tRecvBufStc * rbuf );
+tRecvMsgTyp tcp_recv_frame ( int sockfd, tRecvBufStc * rbuf, MessageHeaderStc * header, char ** message );
+void tcp_recv_hold ( tRecvBufStc * rbuf, tRecvSliceStc * slice );
+void tcp_slice_release ( tRecvSliceStc * slice );
+int  tcp_get_peer_port ( int sockfd );
+int  tcp_send_frame ( int sockfd, int msgix, const char * data, int msglen );
+int  tcp_header_size ( int wire, int flags, int msglen, int msgix );
+int  tcp_header_encode ( int wire, int flags, int msglen, int msgix, unsigned crc, char * bytes );
+int  tcp_header_decode ( int wire, const char * data, int len, MessageHeaderStc * header, int * flags, unsigned * crc );
+int  tcp_frame_collect ( tFrameStc * frame, const char * data, int len );
+bool tcp_frame_complete ( tFrameStc * frame );
+char * tcp_frame_message ( tFrameStc * frame );
+void tcp_frame_reset ( tFrameStc * frame );
 
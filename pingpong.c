@@ -0,0 +1,203 @@
+//=============================================================================
+//
+// This is the ping-pong module of the Interactive Endpoint project.
+// A ping-pong test (started with the #r command) keeps exactly one message outstanding on a
+// connection: the server echoes it back, and the next one is sent as soon as it arrives, so
+// every round trip is taken on an otherwise idle path. The distribution of the round-trip
+// times shows the latency floor of the stack (see the -S option to busy-poll the sockets).
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "userio.h"     // for logmsg
+#include "netio.h"
+#include "rtthist.h"
+#include "pingpong.h"
+
+/*
+ * Description:
+ * Parses the parameters of the #r command:
+ *   #r[<count>] [s=<size>]
+ * The test runs PINGPONG_COUNT_DEFAULT round trips of PINGPONG_SIZE_DEFAULT bytes unless
+ * given. "#r0" stops the running test.
+ *
+ * Inputs:
+ *   args - the command text following the "#r"
+ *   cfg  - ptr to location to return the parameters in
+ *
+ * *Returns:
+ *   0 if a test is to be started, 1 if the running test is to be stopped, -1 if error
+ */
+int pingpong_parse ( const char * args, tPingCfgStc * cfg )
+{
+    cfg->count = PINGPONG_COUNT_DEFAULT;
+    cfg->size  = PINGPONG_SIZE_DEFAULT;
+
+    const char * cp = args;
+    while (*cp == ' ') cp++;
+    if (cp[0] == '0' && cp[1] <= ' ')
+        return 1;
+
+    while (*cp)
+    {
+        char * end = (char *)cp;
+        if (cp[0] == 's' && cp[1] == '=')
+            cfg->size = strtol (&cp[2], &end, 10);
+        else if (cp[0] >= '0' && cp[0] <= '9')
+            cfg->count = strtol (cp, &end, 10);
+
+        if (end == cp || (*end != ' ' && *end != 0))
+        {
+            logmsg(PRINT_ERROR, "invalid ping-pong test parameters: %s\n", cp);
+            return -1;
+        }
+        cp = end;
+        while (*cp == ' ') cp++;
+    }
+
+    if (cfg->count < 1)
+    {
+        logmsg(PRINT_ERROR, "ping-pong test count must be at least 1\n");
+        return -1;
+    }
+    if (cfg->size < 1 || cfg->size > tcp_msg_limit)
+    {
+        logmsg(PRINT_ERROR, "ping-pong test size must be within 1-%d bytes\n", tcp_msg_limit);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Description:
+ * Sets up a ping-pong test on a connection (its payload is built, and its round-trip times
+ * cleared). The caller sends the first ping.
+ *
+ * Inputs:
+ *   ping - ptr to the ping-pong test
+ *   cfg  - the parameters of the test
+ *   port - the destination port of the connection
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+int pingpong_start ( tPingPongStc * ping, const tPingCfgStc * cfg, int port )
+{
+    char * payload = (char *)malloc (cfg->size);
+    if (payload == NULL)
+    {
+        logmsg(PRINT_ERROR, "memory allocation for ping-pong test payload\n");
+        return -1;
+    }
+    for (int pos = 0; pos < cfg->size; pos++)
+        payload[pos] = 'a' + pos % 26;
+
+    rtthist_fini (&ping->rtt);
+    memset (ping, 0, sizeof(tPingPongStc));
+    rtthist_init (&ping->rtt);
+    ping->cfg     = *cfg;
+    ping->port    = port;
+    ping->payload = payload;
+    ping->running = true;
+    ping->start   = rtthist_now ();
+
+    logmsg(PRINT_QUERY, "ping-pong test started (port %u): %ld round trips of %d bytes\n", port, cfg->count, cfg->size);
+    return 0;
+}
+
+/*
+ * Description:
+ * Records a ping being sent.
+ *
+ * Inputs:
+ *   ping  - ptr to the ping-pong test
+ *   msgix - the message index of the ping
+ *   nsec  - the time it is sent (CLOCK_MONOTONIC nsec)
+ *
+ * *Returns:
+ *   <none>
+ */
+void pingpong_sent ( tPingPongStc * ping, int msgix, uint64_t nsec )
+{
+    ping->msgix = msgix;
+    ping->sent++;
+    rtthist_sent (&ping->rtt, msgix, nsec);
+}
+
+/*
+ * Description:
+ * Records the echo of a message received on the connection pinged, if it is the ping
+ * outstanding (the echoes of other messages are ignored).
+ *
+ * Inputs:
+ *   ping  - ptr to the ping-pong test
+ *   msgix - the message index of the echo
+ *   nsec  - the time it was received (CLOCK_MONOTONIC nsec)
+ *
+ * *Returns:
+ *   true if it was the ping outstanding (the next one is to be sent, or the test is over)
+ */
+bool pingpong_reply ( tPingPongStc * ping, int msgix, uint64_t nsec )
+{
+    if (!ping->running || msgix != ping->msgix || ping->replies == ping->sent)
+        return false;
+
+    rtthist_reply (&ping->rtt, msgix, nsec);
+    ping->replies++;
+    ping->end = nsec;
+    return true;
+}
+
+/*
+ * Description:
+ * Displays the results of the ping-pong test: the round trips per second, and the
+ * distribution of the round-trip times.
+ *
+ * Inputs:
+ *   ping - ptr to the ping-pong test
+ *
+ * *Returns:
+ *   <none>
+ */
+void pingpong_show ( tPingPongStc * ping )
+{
+    tRttHistStc * hist = &ping->rtt;
+    double secs = (ping->replies > 0 ? ping->end - ping->start : 0) / 1e9;
+
+    logmsg(PRINT_QUERY, "ping-pong [port %u] %s: %ld of %ld round trips of %d bytes in %.3f sec = %.0f round trips/s\n",
+            ping->port, ping->replies < ping->cfg.count ? "stopped" : "done", ping->replies, ping->cfg.count, ping->cfg.size,
+            secs, secs > 0 ? ping->replies / secs : 0.0);
+    rtthist_show (hist);
+    if (hist->samples > 0)
+        logmsg(PRINT_QUERY, "    rtt distribution usec: min %.1f | p1 %.1f | p10 %.1f | p25 %.1f | p50 %.1f | p75 %.1f | p90 %.1f | p99 %.1f | p99.99 %.1f | max %.1f\n",
+                hist->min / 1000.0, rtthist_percentile (hist, 1.0) / 1000.0,
+                rtthist_percentile (hist, 10.0) / 1000.0, rtthist_percentile (hist, 25.0) / 1000.0,
+                rtthist_percentile (hist, 50.0) / 1000.0, rtthist_percentile (hist, 75.0) / 1000.0,
+                rtthist_percentile (hist, 90.0) / 1000.0, rtthist_percentile (hist, 99.0) / 1000.0,
+                rtthist_percentile (hist, 99.99) / 1000.0, hist->max / 1000.0);
+}
+
+/*
+ * Description:
+ * Stops the ping-pong test and displays its results. The round-trip times are kept (for
+ * the #j command) until the next test starts.
+ *
+ * Inputs:
+ *   ping - ptr to the ping-pong test
+ *
+ * *Returns:
+ *   <none>
+ */
+void pingpong_stop ( tPingPongStc * ping )
+{
+    if (!ping->running) return;
+
+    ping->running = false;
+    pingpong_show (ping);
+    free (ping->payload);
+    ping->payload = NULL;
+}
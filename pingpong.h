@@ -0,0 +1,47 @@
+//=============================================================================
+//
+// This contains the definitions, structures and function prototypes defined by the
+// ping-pong module of the Interactive Endpoint project.
+//
+//=============================================================================
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PINGPONG_COUNT_DEFAULT  ( 10000 )   // default number of round trips
+#define PINGPONG_SIZE_DEFAULT   ( 64 )      // default payload of the pings
+#define PINGPONG_SPIN_NSEC      ( 1000000 ) // with busy-polling, the socket is read this long between checks of the event loop
+
+// this holds the parameters of a ping-pong test, given with the #r command:
+//   #r[<count>] [s=<size>]
+typedef struct
+{
+    long   count;           // number of round trips
+    int    size;            // the payload of the pings
+
+} tPingCfgStc;
+
+// this holds a running ping-pong test: one ping is outstanding at a time, and the next one is
+// sent as soon as the server echoes it back, so each round trip is measured on an idle path.
+typedef struct
+{
+    tPingCfgStc cfg;        // the parameters of the test
+    bool   running;         // true while the test is running
+    int    port;            // the destination port of the connection pinged
+    char * payload;         // the payload of the pings
+    int    msgix;           // the message index of the ping outstanding
+    long   sent;            // number of pings sent
+    long   replies;         // number of pings echoed back
+    uint64_t start;         // when the test started (CLOCK_MONOTONIC nsec)
+    uint64_t end;           // when the last ping was echoed back
+    tRttHistStc rtt;        // the round-trip times of the pings
+
+} tPingPongStc;
+
+// function prototypes:
+int  pingpong_parse ( const char * args, tPingCfgStc * cfg );
+int  pingpong_start ( tPingPongStc * ping, const tPingCfgStc * cfg, int port );
+void pingpong_sent  ( tPingPongStc * ping, int msgix, uint64_t nsec );
+bool pingpong_reply ( tPingPongStc * ping, int msgix, uint64_t nsec );
+void pingpong_show  ( tPingPongStc * ping );
+void pingpong_stop  ( tPingPongStc * ping );
@@ -0,0 +1,1036 @@
+//=============================================================================
+//
+// This is the server reactor module of the Interactive Endpoint project.
+// It serves the client connections accepted by the server: each connection is a session
+// that echoes the messages it receives back to the client. The sessions are either served
+// by a forked child (one session per process) or sharded across a fixed pool of reactor
+// threads, each running its own event loop. The main thread accepts the connections and
+// hands them off to the reactors through a queue, or each reactor accepts connections on
+// its own SO_REUSEPORT listen socket and the kernel balances the connections across them.
+// The messages received are echoed without being copied (they are sent from the receive buffer
+// they arrived in), or the byte stream is echoed with splice() without entering user space.
+// During a bulk test, the messages are sunk instead, and the throughput is reported.
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "userio.h"     // for logmsg
+#include "netio.h"
+#include "msgqueue.h"
+#include "evloop.h"
+#include "shmlink.h"
+#include "bulk.h"
+#include "reactor.h"
+
+// true to echo the byte stream of the sessions opened with splice() (see session_splice_echo)
+bool session_splice = false;
+
+// true to busy-poll the sockets of the sessions: the event loops are polled without sleeping,
+// and a forked child reads its socket directly between the polls (see child_handle_client)
+bool session_busy_poll = false;
+
+/*
+ * Description:
+ * Creates a session for an accepted client connection and registers its socket with the
+ * event loop. If session_splice is set, the pipe the byte stream is spliced through is
+ * created (the messages are echoed one by one if it can't be).
+ *
+ * Inputs:
+ *   loop        - the event loop to register the socket with
+ *   sockfd      - the data socket of the client connection
+ *   client_port - the port of the client
+ *   owner       - "pid" or "thread", for log messages
+ *   owner_id    - the process id or reactor thread index serving the session
+ *   slot        - the index of the session in its reactor (-1 if none)
+ *
+ * *Returns:
+ *   the new session (NULL if error, the socket is closed)
+ */
+tSessionStc * session_open ( tEvLoopStc * loop, int sockfd, int client_port, const char * owner, int owner_id, int slot )
+{
+    tSessionStc * session = (tSessionStc *)malloc (sizeof(tSessionStc));
+    if (session == NULL)
+    {
+        logmsg(PRINT_ERROR, "memory allocation for session (port %u)\n", client_port);
+        close(sockfd);
+        return NULL;
+    }
+    if (tcp_recvbuf_init (&session->rbuf, TCP_RECV_BUFSIZE) < 0)
+    {
+        close(sockfd);
+        free(session);
+        return NULL;
+    }
+
+    session->sockfd      = sockfd;
+    session->client_port = client_port;
+    session->slot        = slot;
+    session->owner       = owner;
+    session->owner_id    = owner_id;
+    session->recv_count  = 0;
+    session->send_count  = 0;
+    session->wr_armed    = false;
+    session->send_stats.msgs  = 0;
+    session->send_stats.calls = 0;
+    session->loop        = loop;
+    msgqueue_init (&session->sendq);
+    shm_link_init (&session->shm);
+    session->pipefd[0]   = -1;
+    session->pipefd[1]   = -1;
+    session->piped       = 0;
+    session->spliced     = 0;
+    session->sinking     = false;
+    if (session_splice)
+    {
+        if (pipe2 (session->pipefd, O_NONBLOCK | O_CLOEXEC) < 0)
+        {
+            logmsg(PRINT_ERROR, "splice pipe (port %u): %s\n", client_port, strerror(errno));
+            session->pipefd[0] = -1;
+            session->pipefd[1] = -1;
+        }
+        else
+        {
+            fcntl (session->pipefd[1], F_SETPIPE_SZ, SESSION_PIPE_SIZE); // (the default size if not allowed)
+        }
+    }
+
+    if (evloop_add (loop, sockfd, EVLOOP_READ, session) < 0)
+    {
+        close(sockfd);
+        if (session->pipefd[0] >= 0)
+        {
+            close(session->pipefd[0]);
+            close(session->pipefd[1]);
+        }
+        tcp_recvbuf_fini (&session->rbuf);
+        free(session);
+        return NULL;
+    }
+
+    return session;
+}
+
+/*
+ * Description:
+ * Closes the session socket and frees the session and any responses still in its queue.
+ * Any events for the session still in the ready list of its event loop are cleared.
+ *
+ * Inputs:
+ *   session - the session to close
+ *
+ * *Returns:
+ *   <none>
+ */
+void session_close ( tSessionStc * session )
+{
+    if (session->sinking)
+        bulk_meter_show (&session->bulk, true); // (the client did not end its bulk test)
+    if (session->pipefd[0] >= 0)
+    {
+        logmsg(PRINT_OTHER, "%s %d session (port %u) closed: %lu bytes echoed by splice\n",
+                session->owner, session->owner_id, session->client_port, session->spliced);
+        close (session->pipefd[0]);
+        close (session->pipefd[1]);
+    }
+    else
+    {
+        logmsg(PRINT_OTHER, "%s %d session (port %u) closed: %lu msgs echoed in %lu sendmsg calls (%ld saved), queue high %u, "
+                "%lu not copied (%lu buffer swaps), wire v%d (%.1f header bytes/msg, %lu resyncs, %lu of %lu CRC32C checks failed)\n",
+                session->owner, session->owner_id, session->client_port, session->send_stats.msgs,
+                session->send_stats.calls, (long)session->send_stats.msgs - (long)session->send_stats.calls,
+                session->sendq.high_water, session->sendq.by_ref, session->rbuf.block_swaps, session->sendq.wire,
+                session->send_stats.msgs ? (double)session->sendq.header_bytes / session->send_stats.msgs : 0.0,
+                session->rbuf.resyncs, session->rbuf.crc_errors, session->rbuf.crc_checked);
+    }
+    evloop_del (session->loop, session->sockfd);
+    close (session->sockfd);
+    if (session->shm.state == SHM_ACTIVE)
+        evloop_del (session->loop, session->shm.wakefd);
+    shm_link_close (&session->shm);
+    msgqueue_fini (&session->sendq);
+    tcp_recvbuf_fini (&session->rbuf);
+    evloop_forget (session->loop, session);
+    evloop_forget (session->loop, SHM_DOORBELL_TAG(session));
+    free (session);
+}
+
+/*
+ * Description:
+ * Sends the answer to a negotiation message of the client (after any responses queued before
+ * it). If what follows the answer is sent differently, it must be sent completely; otherwise
+ * what the socket can't take yet stays queued, and is sent when the socket is writable.
+ *
+ * Inputs:
+ *   session  - the session the negotiation message was received on
+ *   msgix    - the message index of the negotiation
+ *   answer   - the answer message
+ *   complete - true if the answer must be sent completely
+ *
+ * *Returns:
+ *   true if the answer was sent (or queued), false if not (the session can't be used)
+ */
+static bool session_answer ( tSessionStc * session, int msgix, const char * answer, bool complete )
+{
+    tSendMsgTyp send_error = SEND_FAILURE;
+    if (add_message (&session->sendq, msgix, answer, strlen(answer)) == 0)
+        send_error = send_queue (session->sockfd, &session->sendq, &session->send_stats);
+    if (send_error == SEND_FAILURE || (complete && send_error == SEND_BLOCKED))
+    {
+        logmsg(PRINT_ERROR, "negotiation answer (port %u): %s\n", session->client_port, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Description:
+ * Takes the v2 wire format the client offered: the offer is answered in v1, and from then on
+ * the messages are in v2 both ways (the client holds its messages until it has the answer,
+ * so nothing after the offer has been received yet).
+ *
+ * Inputs:
+ *   session - the session the offer was received on
+ *   crc     - true if the client asked for the CRC32C of each response
+ *
+ * *Returns:
+ *   true if the session is still running, false if the answer could not be sent
+ */
+static bool session_take_wire ( tSessionStc * session, bool crc )
+{
+    if (!session_answer (session, WIRE_MSGIX, WIRE_ACCEPT, true))
+        return false;
+    session->sendq.wire = WIRE_V2;
+    session->sendq.crc  = crc;
+    session->rbuf.wire  = WIRE_V2;
+    logmsg(PRINT_SOCKET, "%s %d [port %u] wire format v2%s\n", session->owner, session->owner_id, session->client_port,
+            crc ? " with CRC32C" : "");
+    return true;
+}
+
+/*
+ * Description:
+ * Takes the shared memory link the client offered, and answers the offer on the TCP
+ * connection. From then on the responses go on the link (the answer is the last message
+ * sent on the TCP connection, so the client gets the responses in order).
+ *
+ * Inputs:
+ *   session   - the session the offer was received on
+ *   offer     - the offer message (not NULL-terminated)
+ *   offer_len - the length of the offer message
+ *
+ * *Returns:
+ *   true if the session is still running, false if the answer could not be sent
+ */
+static bool session_take_link ( tSessionStc * session, const char * offer, int offer_len )
+{
+    bool accepted = false;
+    if (shm_take (&session->shm, offer, offer_len, session->client_port) == 0)
+    {
+        if (evloop_add (session->loop, session->shm.wakefd, EVLOOP_READ, SHM_DOORBELL_TAG(session)) == 0)
+            accepted = true;
+        else
+            shm_link_close (&session->shm);
+    }
+
+    // the answer must be sent completely before the link is used
+    session->shm.state = SHM_NONE;
+    if (!session_answer (session, SHM_MSGIX, accepted ? SHM_ACCEPT : SHM_DECLINE, true))
+        return false;
+    if (accepted)
+    {
+        session->shm.state = SHM_ACTIVE;
+        logmsg(PRINT_SOCKET, "%s %d [port %u] shared memory link taken\n", session->owner, session->owner_id, session->client_port);
+    }
+    return true;
+}
+
+/*
+ * Description:
+ * Takes the bulk test the client offered: the messages that follow are sunk until the client
+ * ends the stream, and the throughput is reported every interval (given in the offer).
+ *
+ * Inputs:
+ *   session   - the session the offer was received on
+ *   offer     - the offer message (not NULL-terminated)
+ *   offer_len - the length of the offer message
+ *
+ * *Returns:
+ *   true if the session is still running, false if the answer could not be sent
+ */
+static bool session_take_bulk ( tSessionStc * session, const char * offer, int offer_len )
+{
+    char text[32];
+    int  len = (offer_len < (int)sizeof(text)) ? offer_len : (int)sizeof(text) - 1;
+    memcpy (text, offer, len);
+    text[len] = 0;
+    int interval = atoi (&text[strlen(BULK_OFFER)]);
+    if (interval < BULK_MIN_INTERVAL) interval = BULK_INTERVAL_DEFAULT;
+
+    if (!session_answer (session, BULK_MSGIX, BULK_ACCEPT, false))
+        return false;
+    session->sinking    = true;
+    session->sink_reads = session->rbuf.reads;
+    bulk_meter_start (&session->bulk, "server", session->client_port, interval);
+    logmsg(PRINT_SOCKET, "%s %d [port %u] bulk test taken (interval %d msec)\n", session->owner, session->owner_id,
+            session->client_port, interval);
+    return true;
+}
+
+/*
+ * Description:
+ * Ends the bulk test of the session, when the client ends its stream: the totals are displayed
+ * and sent to the client, and the messages are echoed again.
+ *
+ * Inputs:
+ *   session - the session
+ *
+ * *Returns:
+ *   true if the session is still running, false if error
+ */
+static bool session_end_bulk ( tSessionStc * session )
+{
+    char answer[96];
+    session->sinking = false;
+    bulk_meter_show (&session->bulk, true);
+    int len = snprintf (answer, sizeof(answer), "%s %lu %lu %lu", BULK_DONE, session->bulk.msgs, session->bulk.bytes,
+                        session->bulk.calls);
+    return (add_message (&session->sendq, BULK_MSGIX, answer, len) == 0);
+}
+
+/*
+ * Description:
+ * Queues the echo of a message received from the client (or takes the shared memory link or
+ * the v2 wire format, if the message is the offer of one). The shared memory link is only
+ * taken on a v1 connection (its frames have v1 headers). A message received on the socket is
+ * queued by reference, so it is sent from the receive buffer without being copied. During a
+ * bulk test the messages are only counted, and the throughput is reported when it is due.
+ *
+ * Inputs:
+ *   session    - the session the message was received on
+ *   header     - the header of the message
+ *   message    - the message (header->msglen chars, not NULL-terminated)
+ *   rbuf       - the receive buffer the message is in (NULL if it is on the link, it is copied)
+ *   recv_delay - true if the read process is to be slowed down
+ *
+ * *Returns:
+ *   true if the session is still running, false if error
+ */
+static bool session_echo ( tSessionStc * session, MessageHeaderStc * header, char * message, tRecvBufStc * rbuf,
+                           bool recv_delay )
+{
+    if (header->msgix == SHM_MSGIX && session->shm.state == SHM_NONE && session->sendq.wire == WIRE_V1 &&
+        header->msglen > (int)strlen(SHM_OFFER) && memcmp (message, SHM_OFFER, strlen(SHM_OFFER)) == 0)
+        return session_take_link (session, message, header->msglen);
+    if (header->msgix == WIRE_MSGIX && session->rbuf.wire == WIRE_V1)
+    {
+        if (header->msglen == (int)strlen(WIRE_OFFER) && memcmp (message, WIRE_OFFER, header->msglen) == 0)
+            return session_take_wire (session, false);
+        if (header->msglen == (int)strlen(WIRE_OFFER_CRC) && memcmp (message, WIRE_OFFER_CRC, header->msglen) == 0)
+            return session_take_wire (session, true);
+    }
+    if (header->msgix == BULK_MSGIX && rbuf != NULL)
+    {
+        if (!session->sinking && header->msglen > (int)strlen(BULK_OFFER) && memcmp (message, BULK_OFFER, strlen(BULK_OFFER)) == 0)
+            return session_take_bulk (session, message, header->msglen);
+        if (session->sinking && header->msglen == (int)strlen(BULK_END) && memcmp (message, BULK_END, header->msglen) == 0)
+            return session_end_bulk (session);
+    }
+    if (session->sinking)
+    {
+        // (a large message is released by the next receive, and one in the receive buffer is overwritten)
+        session->bulk.msgs++;
+        session->bulk.bytes += header->msglen;
+        session->bulk.calls  = session->rbuf.reads - session->sink_reads;
+        if (bulk_meter_due (&session->bulk))
+            bulk_meter_show (&session->bulk, false);
+        return true;
+    }
+
+    // success - echo response back to the client (the start of it is displayed)
+    session->recv_count++;
+    logmsg(PRINT_SENT, "%s %d [port %u msg %u] : %.*s\n", session->owner, session->owner_id,
+            session->client_port, session->recv_count, log_peek(header->msglen), message);
+
+    // place the whole response in send queue (with the message index of the client, so the
+    // client can match the response to the message it sent)
+    int retcode = rbuf ? add_message_ref (&session->sendq, rbuf, header, message)
+                       : add_message (&session->sendq, header->msgix, message, header->msglen);
+    if (retcode != 0)
+        return false;
+
+    // if we are trying to slow down the response of the server, let's insert a short delay here
+    if (recv_delay) sleep(1);
+    return true;
+}
+
+/*
+ * Description:
+ * Echoes the byte stream received on the session socket with splice(): the bytes are moved
+ * from the socket to the session pipe and from the pipe back to the socket inside the kernel,
+ * so they never enter user space. The messages are not parsed (the stream is echoed as is,
+ * which echoes each message with its header, and declines any offer of the client). While
+ * bytes are waiting in the pipe (the socket can't take them), write readiness is monitored
+ * instead of read readiness: the pipe may be full, and a client that sends without reading
+ * would otherwise keep the socket readable while nothing can be moved.
+ *
+ * Inputs:
+ *   session    - the session the events are for
+ *
+ * *Returns:
+ *   true if the session is still running, false if the connection terminated or failed
+ */
+static bool session_splice_echo ( tSessionStc * session )
+{
+    bool moved = true;
+    while (moved)
+    {
+        moved = false;
+        tcp_syscall_count++;
+        ssize_t n = splice (session->sockfd, NULL, session->pipefd[1], NULL, SESSION_PIPE_SIZE,
+                            SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == 0)
+        {
+            logmsg(PRINT_SOCKET, "socket splice (port %u) %s %d terminated connection\n",
+                    session->client_port, session->owner, session->owner_id);
+            return false;
+        }
+        else if (n > 0)
+        {
+            session->piped += n;
+            moved = true;
+        }
+        else if (errno != EAGAIN && errno != EINTR) // (no bytes received, or the pipe is full)
+        {
+            logmsg(PRINT_ERROR, "socket splice (port %u): %s\n", session->client_port, strerror(errno));
+            return false;
+        }
+
+        if (session->piped == 0)
+            continue;
+        tcp_syscall_count++;
+        n = splice (session->pipefd[0], NULL, session->sockfd, NULL, session->piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0)
+        {
+            session->piped   -= n;
+            session->spliced += n;
+            moved = true;
+        }
+        else if (n < 0 && errno != EAGAIN && errno != EINTR) // (the socket can't take any more)
+        {
+            logmsg(PRINT_ERROR, "socket splice (port %u): %s\n", session->client_port, strerror(errno));
+            return false;
+        }
+    }
+
+    bool want_write = (session->piped != 0);
+    if (want_write != session->wr_armed)
+    {
+        if (evloop_mod (session->loop, session->sockfd, want_write ? EVLOOP_WRITE : EVLOOP_READ, session) == 0)
+            session->wr_armed = want_write;
+    }
+    return true;
+}
+
+/*
+ * Description:
+ * Handles the events reported for the session socket (or the doorbell of its shared memory
+ * link): reads all the messages available and queues each of them to be echoed back to the
+ * client, then sends as many of the queued responses as the socket (or link) allows. Write
+ * readiness is only monitored while responses are waiting in the queue.
+ *
+ * Inputs:
+ *   session    - the session the events are for
+ *   events     - the epoll events reported for the socket (0 if the link doorbell was rung)
+ *   recv_delay - true if the read process is to be slowed down
+ *
+ * *Returns:
+ *   true if the session is still running, false if the connection terminated or failed
+ *   (the caller closes the session)
+ */
+bool session_handle ( tSessionStc * session, uint32_t events, bool recv_delay )
+{
+    MessageHeaderStc header;
+    char * message;
+
+    if (session->pipefd[0] >= 0)
+        return session_splice_echo (session);
+
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+    {
+        // read all the messages available from the client (required when edge-triggered)
+        while (true)
+        {
+            tRecvMsgTyp recv_error = tcp_recv_frame (session->sockfd, &session->rbuf, &header, &message);
+            if (recv_error == RECV_TERMINATED)
+            {
+                logmsg(PRINT_SOCKET, "socket recvmsg (port %u) %s %d terminated connection\n",
+                        session->client_port, session->owner, session->owner_id);
+                return false;
+            }
+            else if (recv_error == RECV_BLOCKED)
+            {
+                break; // nothing more to read
+            }
+            else if (recv_error == RECV_FAILURE)
+            {
+                logmsg(PRINT_ERROR, "socket recvmsg (port %u): %s\n", session->client_port, strerror(errno));
+                return false;
+            }
+
+            if (!session_echo (session, &header, message, &session->rbuf, recv_delay))
+                return false;
+        }
+    }
+
+    // read all the messages on the shared memory link
+    if (session->shm.state == SHM_ACTIVE)
+    {
+        if (events == 0)
+            shm_link_drain (&session->shm);
+        while (true)
+        {
+            tRecvMsgTyp recv_error = shm_recv_frame (&session->shm, &header, &message);
+            if (recv_error == RECV_BLOCKED)
+                break;
+            if (recv_error != RECV_COMPLETE)
+                return false;
+            if (!session_echo (session, &header, message, NULL, recv_delay))
+                return false;
+        }
+    }
+
+    // attempt to send messages from queue (new responses are sent right away, without
+    // waiting for a write event, and anything left over is sent when the socket is writable,
+    // or the link doorbell is rung when the client makes room)
+    unsigned long sent = session->send_stats.msgs;
+    bool shm = (session->shm.state == SHM_ACTIVE);
+    tSendMsgTyp send_error = shm ? shm_send_queue (&session->shm, &session->sendq, &session->send_stats)
+                                 : send_queue (session->sockfd, &session->sendq, &session->send_stats);
+    session->send_count += session->send_stats.msgs - sent;
+    if (send_error == SEND_BLOCKED)
+    {
+        logmsg(PRINT_ERROR, "%s (port %u): blocked\n", shm ? "shared memory send" : "socket sendmsg", session->client_port);
+    }
+    else if (send_error == SEND_FAILURE)
+    {
+        logmsg(PRINT_ERROR, "socket sendmsg (port %u): %s\n", session->client_port, strerror(errno));
+        return false;
+    }
+
+    // only monitor write readiness while responses are waiting in the queue for the socket
+    bool want_write = !shm && (msgqueue_depth(&session->sendq) != 0);
+    if (want_write != session->wr_armed)
+    {
+        if (evloop_mod (session->loop, session->sockfd, EVLOOP_READ | (want_write ? EVLOOP_WRITE : 0), session) == 0)
+            session->wr_armed = want_write;
+    }
+
+    return true;
+}
+
+/*
+ * Description:
+ * Takes the connections handed off by the main thread and opens a session for each.
+ *
+ * Inputs:
+ *   reactor - the reactor the connections were handed to
+ *
+ * *Returns:
+ *   true if a session could not be opened (its slot was reported as closed)
+ */
+static bool reactor_take_handoffs ( tReactorStc * reactor )
+{
+    bool closed = false;
+    unsigned tail = __atomic_load_n(&reactor->handoff_tail, __ATOMIC_ACQUIRE);
+    while (reactor->handoff_head != tail)
+    {
+        tHandoffStc * handoff = &reactor->handoff[reactor->handoff_head & (REACTOR_MAX_SESSIONS - 1)];
+        reactor->sessions[handoff->slot] = session_open (&reactor->loop, handoff->sockfd, handoff->client_port,
+                                                         "thread", reactor->thread, handoff->slot);
+        if (reactor->sessions[handoff->slot] == NULL)
+        {
+            // report the slot as closed, so the main thread releases it
+            reactor->closed[reactor->closed_tail & (REACTOR_MAX_SESSIONS - 1)] = handoff->slot;
+            __atomic_store_n(&reactor->closed_tail, reactor->closed_tail + 1, __ATOMIC_RELEASE);
+            closed = true;
+        }
+        __atomic_store_n(&reactor->handoff_head, reactor->handoff_head + 1, __ATOMIC_RELEASE);
+    }
+
+    return closed;
+}
+
+/*
+ * Description:
+ * Accepts all the pending connections on the reactor's own listen socket and opens a
+ * session for each. A failed accept only drops that connection (out of descriptors, the
+ * spare descriptor is used to take it off the backlog).
+ *
+ * Inputs:
+ *   reactor - the reactor the listen socket belongs to
+ *
+ * *Returns:
+ *   <none>
+ */
+static void reactor_accept ( tReactorStc * reactor )
+{
+    while (true)
+    {
+        int client_port;
+        int clientsock = tcp_accept_connection (reactor->listenfd, &client_port);
+        if (clientsock < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break; // no more pending connections
+            __atomic_add_fetch(&reactor->accept_errors, 1, __ATOMIC_RELAXED);
+            if (errno == ECONNABORTED || errno == EPROTO || errno == EINTR) continue;
+            if ((errno == EMFILE || errno == ENFILE) && tcp_shed_connection (reactor->listenfd, &reactor->sparefd)) continue;
+            if ((errno == EMFILE || errno == ENFILE) && evloop_del (&reactor->loop, reactor->listenfd) == 0)
+            {
+                // no spare descriptor: stop monitoring the listen socket for a while
+                // (the loop would spin on it, or never hear of it again if edge-triggered)
+                clock_gettime (CLOCK_MONOTONIC, &reactor->accept_resume);
+                reactor->accept_resume.tv_nsec += TCP_ACCEPT_BACKOFF_MSEC * 1000000L;
+                if (reactor->accept_resume.tv_nsec >= 1000000000L)
+                {
+                    reactor->accept_resume.tv_sec++;
+                    reactor->accept_resume.tv_nsec -= 1000000000L;
+                }
+            }
+            break; // retry on the next event
+        }
+        __atomic_add_fetch(&reactor->accepts, 1, __ATOMIC_RELAXED);
+
+        if (reactor->free_count == 0)
+        {
+            logmsg(PRINT_ERROR, "no session available for port %u [thread %d]\n", client_port, reactor->thread);
+            close (clientsock);
+            continue;
+        }
+        int slot = reactor->free_slots[--reactor->free_count];
+        reactor->sessions[slot] = session_open (&reactor->loop, clientsock, client_port, "thread", reactor->thread, slot);
+        if (reactor->sessions[slot] == NULL)
+        {
+            reactor->free_slots[reactor->free_count++] = slot;
+            continue;
+        }
+        __atomic_add_fetch(&reactor->load, 1, __ATOMIC_RELAXED);
+        logmsg(PRINT_OTHER, "thread %d slot %d handling port %u\n", reactor->thread, slot, client_port);
+    }
+}
+
+/*
+ * Description:
+ * Monitors the reactor's listen socket again once its accept backoff is over (a new spare
+ * descriptor is opened first, if it was lost).
+ *
+ * Inputs:
+ *   reactor - the reactor the listen socket belongs to
+ *
+ * *Returns:
+ *   <none>
+ */
+static void reactor_accept_resume ( tReactorStc * reactor )
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    if (now.tv_sec < reactor->accept_resume.tv_sec ||
+        (now.tv_sec == reactor->accept_resume.tv_sec && now.tv_nsec < reactor->accept_resume.tv_nsec))
+        return;
+
+    if (reactor->sparefd < 0)
+        reactor->sparefd = tcp_spare_open ();
+    if (evloop_add (&reactor->loop, reactor->listenfd, EVLOOP_READ, &reactor->listenfd) == 0)
+        reactor->accept_resume.tv_sec = reactor->accept_resume.tv_nsec = 0;
+}
+
+static tReactorPoolStc * reactor_thread_pool; // the pool shared by all reactor threads
+
+/*
+ * Description:
+ * This is the reactor thread. It waits for events on the sessions it serves and on its
+ * wakeup descriptor, which signals that connections were handed off or the pool is stopping.
+ *
+ * Inputs:
+ *   arg - ptr to the reactor
+ *
+ * *Returns:
+ *   NULL
+ */
+static void * reactor_thread ( void * arg )
+{
+    tReactorStc * reactor = (tReactorStc *)arg;
+    tReactorPoolStc * pool = reactor_thread_pool;
+
+    while (reactor->running)
+    {
+        bool backoff = (reactor->accept_resume.tv_sec != 0);
+        int retcode = evloop_wait (&reactor->loop, session_busy_poll ? 0 : backoff ? TCP_ACCEPT_BACKOFF_MSEC : 1000);
+        if (retcode < 0)
+        {
+            if (errno == EINTR) continue;
+            logmsg(PRINT_ERROR, "epoll_wait [thread %d]: %s\n", reactor->thread, strerror(errno));
+            break;
+        }
+        if (backoff)
+            reactor_accept_resume (reactor);
+
+        bool closed = false;
+        int evix;
+        for (evix = 0; evix < retcode; evix++)
+        {
+            tSessionStc * session = (tSessionStc *)reactor->loop.events[evix].data.ptr;
+            uint32_t events = reactor->loop.events[evix].events;
+            if (session == (tSessionStc *)&evloop_forgotten)
+                continue; // (the session was closed)
+            if (session == NULL)
+            {
+                // woken by the main thread
+                uint64_t count;
+                if (read (reactor->wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                    logmsg(PRINT_ERROR, "eventfd read [thread %d]: %s\n", reactor->thread, strerror(errno));
+                if (reactor_take_handoffs (reactor))
+                    closed = true;
+                continue;
+            }
+            if (session == (tSessionStc *)&reactor->listenfd)
+            {
+                reactor_accept (reactor);
+                continue;
+            }
+
+            if (SHM_IS_DOORBELL(session))
+            {
+                session = (tSessionStc *)SHM_DOORBELL_OWNER(session);
+                events = 0;
+            }
+
+            int sent = session->send_count;
+            int depth = msgqueue_depth(&session->sendq);
+            bool running = session_handle (session, events, pool->recv_delay);
+            __atomic_add_fetch(&reactor->msgs, session->send_count - sent, __ATOMIC_RELAXED);
+
+            // track the responses waiting for slow clients (the queue is discarded if the session closes)
+            int new_depth = running ? (int)msgqueue_depth(&session->sendq) : 0;
+            __atomic_add_fetch(&reactor->queued, new_depth - depth, __ATOMIC_RELAXED);
+            if (session->sendq.high_water > reactor->queue_high)
+                __atomic_store_n(&reactor->queue_high, session->sendq.high_water, __ATOMIC_RELAXED);
+            if (!running && reactor->listenfd >= 0)
+            {
+                // the reactor owns its slots
+                reactor->sessions[session->slot] = NULL;
+                reactor->free_slots[reactor->free_count++] = session->slot;
+                __atomic_sub_fetch(&reactor->load, 1, __ATOMIC_RELAXED);
+                session_close (session);
+            }
+            else if (!running)
+            {
+                // report the closed slot to the main thread
+                reactor->sessions[session->slot] = NULL;
+                reactor->closed[reactor->closed_tail & (REACTOR_MAX_SESSIONS - 1)] = session->slot;
+                __atomic_store_n(&reactor->closed_tail, reactor->closed_tail + 1, __ATOMIC_RELEASE);
+                session_close (session);
+                closed = true;
+            }
+        }
+
+        if (closed)
+        {
+            uint64_t count = 1;
+            if (write (pool->notify_fd, &count, sizeof(count)) < 0)
+                logmsg(PRINT_ERROR, "eventfd write [thread %d]: %s\n", reactor->thread, strerror(errno));
+        }
+    }
+
+    // close all the sessions still open
+    int slot;
+    for (slot = 0; slot < REACTOR_MAX_SESSIONS; slot++)
+    {
+        if (reactor->sessions[slot])
+        {
+            session_close (reactor->sessions[slot]);
+            reactor->sessions[slot] = NULL;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Description:
+ * Creates the pool of reactor threads.
+ *
+ * Inputs:
+ *   pool       - ptr to the pool to initialize
+ *   count      - the number of reactor threads (0 for one per core)
+ *   least_load - true to assign connections to the reactor with the fewest connections,
+ *                false to assign them round robin
+ *   edge       - true if the reactors register their sockets edge-triggered
+ *   listen_port - if not 0, each reactor accepts connections on its own SO_REUSEPORT listen
+ *                socket on this port (instead of having them handed off by the main thread)
+ *   backlog    - the max number of pending connections on each reactor listen socket
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+int reactor_pool_init ( tReactorPoolStc * pool, int count, bool least_load, bool edge, int listen_port, int backlog )
+{
+    if (count <= 0)
+        count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count <= 0)
+        count = 1;
+    if (count > REACTOR_MAX_THREADS)
+        count = REACTOR_MAX_THREADS;
+
+    pool->count      = 0;
+    pool->next       = 0;
+    pool->least_load = least_load;
+    pool->recv_delay = false;
+    pool->reuseport  = (listen_port > 0);
+    pool->shown_accepts = 0;
+    clock_gettime (CLOCK_MONOTONIC, &pool->shown_time);
+    pool->reactors   = (tReactorStc *)calloc (count, sizeof(tReactorStc));
+    pool->notify_fd  = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pool->reactors == NULL || pool->notify_fd < 0)
+    {
+        logmsg(PRINT_ERROR, "reactor pool allocation: %s\n", strerror(errno));
+        reactor_pool_fini (pool);
+        return -1;
+    }
+    reactor_thread_pool = pool;
+
+    int ix;
+    for (ix = 0; ix < count; ix++)
+    {
+        tReactorStc * reactor = &pool->reactors[ix];
+        reactor->thread  = ix;
+        reactor->running = true;
+        reactor->listenfd = -1;
+        reactor->sparefd = -1;
+        reactor->wakefd  = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (reactor->wakefd < 0)
+        {
+            logmsg(PRINT_ERROR, "eventfd: %s\n", strerror(errno));
+            reactor_pool_fini (pool);
+            return -1;
+        }
+        if (evloop_init (&reactor->loop, edge) < 0 ||
+            evloop_add (&reactor->loop, reactor->wakefd, EVLOOP_READ, NULL) < 0)
+        {
+            close (reactor->wakefd);
+            reactor_pool_fini (pool);
+            return -1;
+        }
+        if (listen_port > 0)
+        {
+            // the listen socket is identified in the events by the address of its descriptor
+            reactor->listenfd = tcp_create_socket (listen_port, backlog, true);
+            if (reactor->listenfd < 0 ||
+                evloop_add (&reactor->loop, reactor->listenfd, EVLOOP_READ, &reactor->listenfd) < 0)
+            {
+                if (reactor->listenfd >= 0) close (reactor->listenfd);
+                evloop_fini (&reactor->loop);
+                close (reactor->wakefd);
+                reactor_pool_fini (pool);
+                return -1;
+            }
+            reactor->sparefd = tcp_spare_open ();
+        }
+
+        // all the slots are free
+        reactor->free_count = REACTOR_MAX_SESSIONS;
+        int slot;
+        for (slot = 0; slot < REACTOR_MAX_SESSIONS; slot++)
+            reactor->free_slots[slot] = REACTOR_MAX_SESSIONS - 1 - slot;
+
+        int retcode = pthread_create (&reactor->tid, NULL, reactor_thread, reactor);
+        if (retcode != 0)
+        {
+            logmsg(PRINT_ERROR, "pthread_create: %s\n", strerror(retcode));
+            if (reactor->listenfd >= 0) close (reactor->listenfd);
+            if (reactor->sparefd >= 0) close (reactor->sparefd);
+            evloop_fini (&reactor->loop);
+            close (reactor->wakefd);
+            reactor_pool_fini (pool);
+            return -1;
+        }
+        pool->count++;
+    }
+
+    logmsg(PRINT_OTHER, "started %d reactor threads (%s)\n", pool->count,
+            pool->reuseport ? "reuseport listeners" : least_load ? "least load" : "round robin");
+    return 0;
+}
+
+/*
+ * Description:
+ * Stops all the reactor threads, closing the connections they serve, and frees the pool.
+ *
+ * Inputs:
+ *   pool - ptr to the pool
+ *
+ * *Returns:
+ *   <none>
+ */
+void reactor_pool_fini ( tReactorPoolStc * pool )
+{
+    int ix;
+    for (ix = 0; ix < pool->count; ix++)
+    {
+        tReactorStc * reactor = &pool->reactors[ix];
+        uint64_t count = 1;
+        reactor->running = false;
+        if (write (reactor->wakefd, &count, sizeof(count)) < 0)
+            logmsg(PRINT_ERROR, "eventfd write: %s\n", strerror(errno));
+        pthread_join (reactor->tid, NULL);
+        if (reactor->listenfd >= 0) close (reactor->listenfd);
+        if (reactor->sparefd >= 0) close (reactor->sparefd);
+        evloop_fini (&reactor->loop);
+        close (reactor->wakefd);
+    }
+
+    if (pool->notify_fd >= 0)
+        close (pool->notify_fd);
+    free (pool->reactors);
+    pool->reactors  = NULL;
+    pool->notify_fd = -1;
+    pool->count     = 0;
+}
+
+/*
+ * Description:
+ * Hands an accepted connection off to one of the reactors. The reactor is selected round
+ * robin, or the one with the fewest connections if least load was selected.
+ *
+ * Inputs:
+ *   pool        - ptr to the pool
+ *   sockfd      - the data socket of the accepted connection
+ *   client_port - the port of the client
+ *   slot        - ptr to location to return the session index within the reactor
+ *
+ * *Returns:
+ *   the index of the reactor thread serving the connection, -1 if error (the socket is closed)
+ */
+int reactor_pool_assign ( tReactorPoolStc * pool, int sockfd, int client_port, int * slot )
+{
+    tReactorStc * reactor = NULL;
+    int ix;
+
+    if (pool->least_load)
+    {
+        for (ix = 0; ix < pool->count; ix++)
+            if (reactor == NULL || pool->reactors[ix].load < reactor->load)
+                reactor = &pool->reactors[ix];
+    }
+    else
+    {
+        reactor = &pool->reactors[pool->next];
+        pool->next = (pool->next + 1) % pool->count;
+    }
+
+    if (reactor == NULL || reactor->free_count == 0)
+    {
+        logmsg(PRINT_ERROR, "no reactor session available for port %u\n", client_port);
+        close (sockfd);
+        return -1;
+    }
+
+    // allocate the slot and queue the connection to the reactor
+    // (there is always room in the queue, since it holds as many entries as there are slots)
+    *slot = reactor->free_slots[--reactor->free_count];
+    reactor->load++;
+    reactor->accepts++;
+    tHandoffStc * handoff = &reactor->handoff[reactor->handoff_tail & (REACTOR_MAX_SESSIONS - 1)];
+    handoff->sockfd      = sockfd;
+    handoff->client_port = client_port;
+    handoff->slot        = *slot;
+    __atomic_store_n(&reactor->handoff_tail, reactor->handoff_tail + 1, __ATOMIC_RELEASE);
+
+    // wake the reactor
+    uint64_t count = 1;
+    if (write (reactor->wakefd, &count, sizeof(count)) < 0)
+        logmsg(PRINT_ERROR, "eventfd write [thread %d]: %s\n", reactor->thread, strerror(errno));
+
+    return reactor->thread;
+}
+
+/*
+ * Description:
+ * Returns the next session closed by a reactor and releases its slot. Called by the main
+ * thread (until it returns false) when the pool's notify descriptor is signalled.
+ *
+ * Inputs:
+ *   pool   - ptr to the pool
+ *   thread - ptr to location to return the index of the reactor thread
+ *   slot   - ptr to location to return the session index within the reactor
+ *
+ * *Returns:
+ *   true if a closed session was returned, false if there are no more
+ */
+bool reactor_pool_closed ( tReactorPoolStc * pool, int * thread, int * slot )
+{
+    int ix;
+    for (ix = 0; ix < pool->count; ix++)
+    {
+        tReactorStc * reactor = &pool->reactors[ix];
+        unsigned tail = __atomic_load_n(&reactor->closed_tail, __ATOMIC_ACQUIRE);
+        if (reactor->closed_head != tail)
+        {
+            *thread = ix;
+            *slot   = reactor->closed[reactor->closed_head & (REACTOR_MAX_SESSIONS - 1)];
+            __atomic_store_n(&reactor->closed_head, reactor->closed_head + 1, __ATOMIC_RELEASE);
+
+            reactor->free_slots[reactor->free_count++] = *slot;
+            reactor->load--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Description:
+ * Displays the number of connections, accepts, messages echoed and queued responses of each reactor thread,
+ * and the rate connections were accepted at since the last display.
+ *
+ * Inputs:
+ *   pool - ptr to the pool
+ *
+ * *Returns:
+ *   <none>
+ */
+void reactor_pool_show ( tReactorPoolStc * pool )
+{
+    unsigned long accepts = 0;
+    int ix;
+    for (ix = 0; ix < pool->count; ix++)
+    {
+        tReactorStc * reactor = &pool->reactors[ix];
+        unsigned long thread_accepts = __atomic_load_n(&reactor->accepts, __ATOMIC_RELAXED);
+        logmsg(PRINT_QUERY, "  thread %d: connections %d, accepts %lu (%lu failed), msgs %lu, queued %d (high %u)\n", ix,
+                __atomic_load_n(&reactor->load, __ATOMIC_RELAXED), thread_accepts,
+                __atomic_load_n(&reactor->accept_errors, __ATOMIC_RELAXED),
+                __atomic_load_n(&reactor->msgs, __ATOMIC_RELAXED),
+                __atomic_load_n(&reactor->queued, __ATOMIC_RELAXED),
+                __atomic_load_n(&reactor->queue_high, __ATOMIC_RELAXED));
+        accepts += thread_accepts;
+    }
+
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - pool->shown_time.tv_sec) + (now.tv_nsec - pool->shown_time.tv_nsec) / 1e9;
+    if (elapsed > 0)
+        logmsg(PRINT_QUERY, "  accepted %lu connections in %.1f sec (%.0f connects/sec)\n",
+                accepts - pool->shown_accepts, elapsed, (accepts - pool->shown_accepts) / elapsed);
+    pool->shown_accepts = accepts;
+    pool->shown_time    = now;
+}
@@ -0,0 +1,116 @@
+//=============================================================================
+//
+// This contains the definitions, structures and function prototypes defined by the
+// server reactor module of the Interactive Endpoint project.
+//
+//=============================================================================
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+
+#define REACTOR_MAX_THREADS     ( 64 )      // max number of reactor threads in the pool
+#define REACTOR_MAX_SESSIONS    ( 4096 )    // max number of client connections per reactor (power of 2)
+#define SESSION_PIPE_SIZE       ( 256 * 1024 ) // the pipe capacity asked for when the byte stream is spliced
+#define SESSION_SPIN_POLLS      ( 64 )      // with busy-polling, a forked child reads its socket this many times between checks of its event loop
+
+// this holds the state of a client connection being served (echoed) by this server
+typedef struct t_SessionStc
+{
+    int  sockfd;        // the data socket of the client connection
+    int  client_port;   // the port of the client
+    int  slot;          // the index of the session in its reactor (-1 if served by a forked child)
+    const char * owner; // "pid" or "thread", for log messages
+    int  owner_id;      // the process id or the reactor thread index serving the session
+    int  recv_count;    // the number of messages received
+    int  send_count;    // the number of messages echoed
+    bool wr_armed;      // true if the event loop is reporting write readiness for the socket
+    tSendStatsStc send_stats; // the messages echoed and the sendmsg calls used
+    tEvLoopStc * loop;  // the event loop the socket is registered with
+    tRecvBufStc rbuf;   // the messages received from the client
+    tMsgQueueStc sendq; // the responses waiting to be sent
+    tShmLinkStc shm;    // the shared memory link the client offered (if taken, the messages go on it)
+    int  pipefd[2];     // the pipe the byte stream is spliced through (-1 if the messages are echoed one by one)
+    int  piped;         // the number of bytes in the pipe, waiting to be spliced to the socket
+    unsigned long spliced; // the number of bytes echoed by splice
+    bool sinking;       // true while the messages of a bulk test are sunk (not echoed)
+    unsigned long sink_reads; // rbuf.reads when the bulk test started
+    tBulkMeterStc bulk; // the throughput of the bulk test
+
+} tSessionStc;
+
+// this is an accepted connection handed from the main thread to a reactor
+typedef struct
+{
+    int  sockfd;        // the data socket of the client connection
+    int  client_port;   // the port of the client
+    int  slot;          // the session index assigned by the main thread
+
+} tHandoffStc;
+
+// this holds a reactor thread and the shard of client connections it serves
+// (the handoff and closed queues are single producer/single consumer rings).
+// When the reactor has its own listen socket, it accepts its connections itself and
+// owns the slot allocation - the handoff and closed queues are then not used.
+typedef struct
+{
+    int        thread;          // index of this reactor in the pool
+    pthread_t  tid;             // the thread running the reactor
+    tEvLoopStc loop;            // the event loop for the wakeup descriptor and the sessions
+    int        wakefd;          // eventfd signalled when connections are handed off or on stop
+    int        listenfd;        // SO_REUSEPORT listen socket of this reactor (-1 if connections are handed off)
+    int        sparefd;         // held in reserve to drop the pending connections when out of descriptors (-1 if none)
+    struct timespec accept_resume; // when the listen socket is monitored again (0 unless it was taken out of the event loop)
+    volatile bool running;      // cleared to stop the reactor
+    tSessionStc * sessions[REACTOR_MAX_SESSIONS]; // the sessions being served, by slot (reactor only)
+    // handoff queue of accepted connections (main thread -> reactor)
+    tHandoffStc handoff[REACTOR_MAX_SESSIONS];
+    unsigned   handoff_head;    // next entry to remove (reactor)
+    unsigned   handoff_tail;    // next entry to add (main thread)
+    // queue of the slots of closed sessions (reactor -> main thread)
+    int        closed[REACTOR_MAX_SESSIONS];
+    unsigned   closed_head;     // next entry to remove (main thread)
+    unsigned   closed_tail;     // next entry to add (reactor)
+    // slot allocation (main thread, or reactor if it has its own listen socket)
+    int        free_slots[REACTOR_MAX_SESSIONS];
+    int        free_count;      // number of entries in free_slots
+    int        load;            // number of slots in use
+    unsigned long msgs;         // number of messages echoed (updated by reactor)
+    unsigned long accepts;      // number of connections accepted for this reactor
+    unsigned long accept_errors; // number of failed accepts (other than no pending connection)
+    int        queued;          // number of responses waiting in the session send queues (updated by reactor)
+    unsigned   queue_high;      // the largest session send queue depth seen (updated by reactor)
+
+} tReactorStc;
+
+// this holds the pool of reactor threads
+typedef struct
+{
+    int  count;                 // number of reactors in the pool
+    int  next;                  // next reactor to assign to (round robin)
+    bool least_load;            // true to assign connections to the reactor with the fewest connections
+    volatile bool recv_delay;   // true if the read process is to be slowed down
+    int  notify_fd;             // eventfd signalled by the reactors when sessions close
+    bool reuseport;             // true if each reactor accepts on its own SO_REUSEPORT listen socket
+    unsigned long shown_accepts; // total accepts at the last display (for the connection rate)
+    struct timespec shown_time; // time of the last display
+    tReactorStc * reactors;     // array of count reactors
+
+} tReactorPoolStc;
+
+// true to echo the byte stream of the sessions opened with splice(), without parsing the messages
+extern bool session_splice;
+
+// true to busy-poll the sockets of the sessions instead of sleeping in the event loop
+extern bool session_busy_poll;
+
+// function prototypes:
+tSessionStc * session_open ( tEvLoopStc * loop, int sockfd, int client_port, const char * owner, int owner_id, int slot );
+bool session_handle ( tSessionStc * session, uint32_t events, bool recv_delay ); // (events 0 for the link doorbell)
+void session_close ( tSessionStc * session );
+
+int  reactor_pool_init ( tReactorPoolStc * pool, int count, bool least_load, bool edge, int listen_port, int backlog );
+void reactor_pool_fini ( tReactorPoolStc * pool );
+int  reactor_pool_assign ( tReactorPoolStc * pool, int sockfd, int client_port, int * slot );
+bool reactor_pool_closed ( tReactorPoolStc * pool, int * thread, int * slot );
+void reactor_pool_show ( tReactorPoolStc * pool );
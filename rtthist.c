@@ -0,0 +1,276 @@
+//=============================================================================
+//
+// This is the round-trip time module of the Interactive Endpoint project.
+// It matches the responses received on an endpoint connection to the times their messages
+// were sent (by the message index, which the server echoes back), and records the round-trip
+// times in a log-linear histogram, so the percentiles can be displayed.
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "userio.h"     // for logmsg
+#include "rtthist.h"
+
+/*
+ * Description:
+ * Returns the current time, for the send and receive times of the messages.
+ *
+ * Inputs:
+ *   <none>
+ *
+ * *Returns:
+ *   the CLOCK_MONOTONIC time in nsec
+ */
+uint64_t rtthist_now ( void )
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * Description:
+ * Returns the histogram bucket a round-trip time is counted in. The values below
+ * RTT_SUB_COUNT each have a bucket, and each power of 2 above that is split into
+ * RTT_SUB_COUNT buckets.
+ *
+ * Inputs:
+ *   value - the round-trip time (nsec)
+ *
+ * *Returns:
+ *   the index of the bucket
+ */
+static unsigned rtthist_bucket ( uint64_t value )
+{
+    if (value < RTT_SUB_COUNT)
+        return (unsigned)value;
+
+    int shift = (63 - __builtin_clzll (value)) - RTT_SUB_BITS;
+    if (shift > RTT_MAX_SHIFT)
+        return RTT_BUCKETS - 1;
+    return (shift + 1) * RTT_SUB_COUNT + (unsigned)(value >> shift) - RTT_SUB_COUNT;
+}
+
+/*
+ * Description:
+ * Returns the largest round-trip time counted in a histogram bucket.
+ *
+ * Inputs:
+ *   bucket - the index of the bucket
+ *
+ * *Returns:
+ *   the largest value of the bucket (nsec)
+ */
+static uint64_t rtthist_bucket_max ( unsigned bucket )
+{
+    if (bucket < RTT_SUB_COUNT)
+        return bucket;
+
+    int shift = bucket / RTT_SUB_COUNT - 1;
+    uint64_t low = (uint64_t)(bucket % RTT_SUB_COUNT + RTT_SUB_COUNT) << shift;
+    return low + (1ULL << shift) - 1;
+}
+
+/*
+ * Description:
+ * Initializes an empty round-trip time histogram. Nothing is allocated until a message is
+ * sent.
+ *
+ * Inputs:
+ *   hist - ptr to the histogram
+ *
+ * *Returns:
+ *   <none>
+ */
+void rtthist_init ( tRttHistStc * hist )
+{
+    memset (hist, 0, sizeof(tRttHistStc));
+}
+
+/*
+ * Description:
+ * Frees the send time log and the histogram.
+ *
+ * Inputs:
+ *   hist - ptr to the histogram
+ *
+ * *Returns:
+ *   <none>
+ */
+void rtthist_fini ( tRttHistStc * hist )
+{
+    free (hist->sends);
+    free (hist->counts);
+    memset (hist, 0, sizeof(tRttHistStc));
+}
+
+/*
+ * Description:
+ * Logs the time a message was sent, to be matched with its response. The log is enlarged
+ * as needed to hold all the messages waiting for a response.
+ *
+ * Inputs:
+ *   hist  - ptr to the histogram
+ *   msgix - the message index of the message
+ *   nsec  - the time the message counts as sent (for an open-loop load test, the time it was
+ *           scheduled for, so the delays of the sender are part of the round-trip time)
+ *
+ * *Returns:
+ *   <none>
+ */
+void rtthist_sent ( tRttHistStc * hist, int msgix, uint64_t nsec )
+{
+    if (hist->count == hist->size)
+    {
+        unsigned size = hist->size ? hist->size * 2 : RTT_LOG_MIN;
+        tRttSendStc * sends = (tRttSendStc *)malloc (size * sizeof(tRttSendStc));
+        if (sends == NULL)
+        {
+            logmsg(PRINT_ERROR, "memory allocation for round-trip time log\n");
+            return; // the response is counted as unmatched
+        }
+        unsigned ix;
+        for (ix = 0; ix < hist->count; ix++)
+            sends[ix] = hist->sends[(hist->head + ix) & (hist->size - 1)];
+        free (hist->sends);
+        hist->sends = sends;
+        hist->size  = size;
+        hist->head  = 0;
+    }
+
+    tRttSendStc * send = &hist->sends[(hist->head + hist->count) & (hist->size - 1)];
+    send->msgix = msgix;
+    send->nsec  = nsec;
+    hist->count++;
+}
+
+/*
+ * Description:
+ * Records the round-trip time of a message when its response is received. Any older send
+ * times still in the log (messages that will not get a response) are discarded.
+ *
+ * Inputs:
+ *   hist  - ptr to the histogram
+ *   msgix - the message index echoed back in the response
+ *   nsec  - the time the response was received
+ *
+ * *Returns:
+ *   <none>
+ */
+void rtthist_reply ( tRttHistStc * hist, int msgix, uint64_t nsec )
+{
+    while (hist->count)
+    {
+        tRttSendStc * send = &hist->sends[hist->head];
+        if (msgix - send->msgix < 0)
+            break; // older than all the messages waiting
+
+        hist->head = (hist->head + 1) & (hist->size - 1);
+        hist->count--;
+        if (send->msgix != msgix)
+            continue;
+
+        if (hist->counts == NULL)
+        {
+            hist->counts = (unsigned long *)calloc (RTT_BUCKETS, sizeof(unsigned long));
+            if (hist->counts == NULL)
+            {
+                logmsg(PRINT_ERROR, "memory allocation for round-trip time histogram\n");
+                return;
+            }
+        }
+        uint64_t rtt = (nsec > send->nsec) ? nsec - send->nsec : 0;
+        hist->counts[rtthist_bucket (rtt)]++;
+        if (hist->samples == 0 || rtt < hist->min) hist->min = rtt;
+        if (rtt > hist->max) hist->max = rtt;
+        hist->samples++;
+        return;
+    }
+
+    hist->unmatched++;
+}
+
+/*
+ * Description:
+ * Clears the round-trip times recorded (the messages waiting for a response are kept).
+ *
+ * Inputs:
+ *   hist - ptr to the histogram
+ *
+ * *Returns:
+ *   <none>
+ */
+void rtthist_reset ( tRttHistStc * hist )
+{
+    if (hist->counts)
+        memset (hist->counts, 0, RTT_BUCKETS * sizeof(unsigned long));
+    hist->samples   = 0;
+    hist->min       = 0;
+    hist->max       = 0;
+    hist->unmatched = 0;
+}
+
+/*
+ * Description:
+ * Returns the round-trip time that the given percentage of the recorded times are at or
+ * below (to the precision of the histogram buckets).
+ *
+ * Inputs:
+ *   hist    - ptr to the histogram
+ *   percent - the percentile (0 - 100)
+ *
+ * *Returns:
+ *   the round-trip time (nsec), 0 if none were recorded
+ */
+uint64_t rtthist_percentile ( tRttHistStc * hist, double percent )
+{
+    if (hist->samples == 0)
+        return 0;
+
+    double rank = hist->samples * percent / 100.0;
+    unsigned long target = (unsigned long)rank;
+    if (target < rank || target < 1) target++; // (rounded up)
+    if (target > hist->samples) target = hist->samples;
+
+    unsigned long total = 0;
+    unsigned bucket;
+    for (bucket = 0; bucket < RTT_BUCKETS; bucket++)
+    {
+        total += hist->counts[bucket];
+        if (total >= target)
+            break;
+    }
+
+    uint64_t value = rtthist_bucket_max (bucket);
+    return (value < hist->max) ? value : hist->max;
+}
+
+/*
+ * Description:
+ * Displays the round-trip time percentiles.
+ *
+ * Inputs:
+ *   hist - ptr to the histogram
+ *
+ * *Returns:
+ *   <none>
+ */
+void rtthist_show ( tRttHistStc * hist )
+{
+    if (hist->samples == 0)
+    {
+        logmsg(PRINT_QUERY, "    rtt: no responses (%u waiting, %lu unmatched)\n", hist->count, hist->unmatched);
+        return;
+    }
+
+    logmsg(PRINT_QUERY, "    rtt usec: p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f (min %.1f, %lu samples, %u waiting, %lu unmatched)\n",
+            rtthist_percentile (hist, 50.0) / 1000.0, rtthist_percentile (hist, 90.0) / 1000.0,
+            rtthist_percentile (hist, 99.0) / 1000.0, rtthist_percentile (hist, 99.9) / 1000.0,
+            hist->max / 1000.0, hist->min / 1000.0, hist->samples, hist->count, hist->unmatched);
+}
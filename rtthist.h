@@ -0,0 +1,50 @@
+//=============================================================================
+//
+// This contains the definitions, structures and function prototypes defined by the
+// round-trip time module of the Interactive Endpoint project.
+//
+//=============================================================================
+
+#include <stdint.h>
+
+// the histogram is log-linear: each power of 2 range of values is split into RTT_SUB_COUNT
+// equal buckets, so every value is recorded with under 1/RTT_SUB_COUNT relative error
+#define RTT_SUB_BITS    ( 6 )
+#define RTT_SUB_COUNT   ( 1 << RTT_SUB_BITS )
+#define RTT_MAX_SHIFT   ( 31 )          // values up to 2^38 nsec (275 sec), larger ones go in the last bucket
+#define RTT_BUCKETS     ( (RTT_MAX_SHIFT + 2) * RTT_SUB_COUNT )
+#define RTT_LOG_MIN     ( 1024 )        // initial number of entries in the send time log (doubled as needed)
+
+// this is the send time of a message waiting for its response
+typedef struct
+{
+    int      msgix;     // the message index sent in the header (echoed back in the response)
+    uint64_t nsec;      // the time it was sent (CLOCK_MONOTONIC nsec)
+
+} tRttSendStc;
+
+// this holds the round-trip times of the messages sent on a connection. the responses come
+// back in the order the messages were sent, so the send times are kept in a FIFO ring.
+typedef struct
+{
+    tRttSendStc * sends;    // the send times of the messages waiting for a response (NULL until the first send)
+    unsigned size;          // number of entries in sends (a power of 2)
+    unsigned head;          // the entry of the oldest send time
+    unsigned count;         // number of send times in the ring
+    unsigned long * counts; // the histogram buckets (NULL until the first response)
+    unsigned long samples;  // number of round-trip times recorded
+    uint64_t min;           // the shortest and longest round-trip times recorded (nsec)
+    uint64_t max;
+    unsigned long unmatched; // number of responses with no send time for their message index
+
+} tRttHistStc;
+
+// function prototypes:
+uint64_t rtthist_now    ( void );
+void     rtthist_init   ( tRttHistStc * hist );
+void     rtthist_fini   ( tRttHistStc * hist );
+void     rtthist_sent   ( tRttHistStc * hist, int msgix, uint64_t nsec );
+void     rtthist_reply  ( tRttHistStc * hist, int msgix, uint64_t nsec );
+void     rtthist_reset  ( tRttHistStc * hist );
+uint64_t rtthist_percentile ( tRttHistStc * hist, double percent );
+void     rtthist_show   ( tRttHistStc * hist );
@@ -0,0 +1,446 @@
+//=============================================================================
+//
+// This is the shared memory link benchmark of the Interactive Endpoint project.
+// It measures the round-trip time of a message echoed by another process on the same host,
+// over a loopback TCP connection and over a shared memory link, using the same framing,
+// send queue and receive functions as the endpoint. One message is in flight at a time, so
+// the times are the latency of the transport (and of waking the other process), not of
+// queueing.
+//
+// The command is issued as: "shmbench [-n <count>] [-s <size>]"
+//  -n  the number of messages to echo over each transport (default 100000)
+//  -s  the size of the messages (default 100, up to TCP_MSG_LIMIT)
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "userio.h"
+#include "netio.h"
+#include "msgqueue.h"
+#include "shmlink.h"
+#include "rtthist.h"
+
+#define BENCH_WARMUP    ( 1000 )    // messages echoed before the round-trip times are recorded
+
+// this is one end of the transport being measured
+typedef struct
+{
+    int  sockfd;        // the TCP connection (-1 if measuring the shared memory link)
+    tShmLinkStc * link; // the shared memory link (NULL if measuring TCP)
+    tRecvBufStc rbuf;   // the messages received on the TCP connection
+    tMsgQueueStc sendq; // the message being sent
+    tSendStatsStc send_stats;
+
+} tBenchEndStc;
+
+/*
+ * Description:
+ * Waits for the descriptor that signals the transport is ready.
+ *
+ * Inputs:
+ *   end    - ptr to the end of the transport
+ *   events - the poll events to wait for (the doorbell of a link is always read)
+ *
+ * *Returns:
+ *   0 if ready, -1 if error
+ */
+static int bench_wait ( tBenchEndStc * end, short events )
+{
+    struct pollfd pfd;
+    pfd.fd      = end->link ? end->link->wakefd : end->sockfd;
+    pfd.events  = end->link ? POLLIN : events;
+    pfd.revents = 0;
+    while (poll (&pfd, 1, -1) < 0)
+    {
+        if (errno != EINTR)
+            return -1;
+    }
+    if (end->link)
+        shm_link_drain (end->link);
+    return 0;
+}
+
+/*
+ * Description:
+ * Sends a message on the transport, waiting until all of it is sent.
+ *
+ * Inputs:
+ *   end    - ptr to the end of the transport
+ *   msgix  - the message index
+ *   data   - the message
+ *   msglen - the length of the message
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+static int bench_send ( tBenchEndStc * end, int msgix, const char * data, int msglen )
+{
+    if (add_message (&end->sendq, msgix, data, msglen) != 0)
+        return -1;
+    while (true)
+    {
+        tSendMsgTyp send_error = end->link ? shm_send_queue (end->link, &end->sendq, &end->send_stats)
+                                           : send_queue (end->sockfd, &end->sendq, &end->send_stats);
+        if (send_error == SEND_COMPLETE)
+            return 0;
+        if (send_error != SEND_BLOCKED || bench_wait (end, POLLOUT) < 0)
+            return -1;
+    }
+}
+
+/*
+ * Description:
+ * Receives the next message from the transport, waiting until one arrives.
+ *
+ * Inputs:
+ *   end     - ptr to the end of the transport
+ *   header  - ptr to location to return the message header
+ *   message - ptr to location to return the ptr to the message (valid until the next receive)
+ *
+ * *Returns:
+ *   0 if successful, -1 if error or the connection terminated
+ */
+static int bench_recv ( tBenchEndStc * end, MessageHeaderStc * header, char ** message )
+{
+    while (true)
+    {
+        tRecvMsgTyp recv_error = end->link ? shm_recv_frame (end->link, header, message)
+                                           : tcp_recv_frame (end->sockfd, &end->rbuf, header, message);
+        if (recv_error == RECV_COMPLETE)
+            return 0;
+        if (recv_error != RECV_BLOCKED || bench_wait (end, POLLIN) < 0)
+            return -1;
+    }
+}
+
+/*
+ * Description:
+ * Echoes the messages back to the other process (this is the child process).
+ *
+ * Inputs:
+ *   end   - ptr to the end of the transport
+ *   count - the number of messages to echo
+ *
+ * *Returns:
+ *   the exit status of the child
+ */
+static int bench_echo ( tBenchEndStc * end, int count )
+{
+    int ix;
+    for (ix = 0; ix < count; ix++)
+    {
+        MessageHeaderStc header;
+        char * message;
+        if (bench_recv (end, &header, &message) < 0 ||
+            bench_send (end, header.msgix, message, header.msglen) < 0)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Description:
+ * Sends the messages one at a time, records the round-trip time of each, and displays the
+ * percentiles (this is the parent process).
+ *
+ * Inputs:
+ *   name    - the name of the transport
+ *   end     - ptr to the end of the transport
+ *   count   - the number of messages to send (after the warm-up)
+ *   payload - the message to send
+ *   size    - the length of the message
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+static int bench_ping ( const char * name, tBenchEndStc * end, int count, const char * payload, int size )
+{
+    tRttHistStc hist;
+    rtthist_init (&hist);
+    unsigned long syscalls = tcp_syscall_count;
+    uint64_t start = 0;
+
+    int ix;
+    for (ix = 0; ix < BENCH_WARMUP + count; ix++)
+    {
+        if (ix == BENCH_WARMUP)
+        {
+            rtthist_reset (&hist);
+            syscalls = tcp_syscall_count;
+            start = rtthist_now ();
+        }
+
+        MessageHeaderStc header;
+        char * message;
+        rtthist_sent (&hist, ix, rtthist_now ());
+        if (bench_send (end, ix, payload, size) < 0 || bench_recv (end, &header, &message) < 0)
+        {
+            fprintf (stderr, " ! ERROR, %s: message %d failed: %s\n", name, ix, strerror(errno));
+            rtthist_fini (&hist);
+            return -1;
+        }
+        rtthist_reply (&hist, header.msgix, rtthist_now ());
+    }
+
+    double secs = (rtthist_now () - start) / 1e9;
+    printf ("%-14s p50 %7.2f  p90 %7.2f  p99 %7.2f  p99.9 %7.2f  max %8.2f usec   %8.0f msgs/sec",
+            name, rtthist_percentile (&hist, 50.0) / 1000.0, rtthist_percentile (&hist, 90.0) / 1000.0,
+            rtthist_percentile (&hist, 99.0) / 1000.0, rtthist_percentile (&hist, 99.9) / 1000.0,
+            hist.max / 1000.0, count / secs);
+    if (end->link)
+        printf ("   %.2f wakeups/msg\n", (double)end->link->wakeups / (BENCH_WARMUP + count));
+    else
+        printf ("   %.2f syscalls/msg\n", (double)(tcp_syscall_count - syscalls) / count);
+    fflush (stdout); // (before the next child is forked)
+    rtthist_fini (&hist);
+    return 0;
+}
+
+/*
+ * Description:
+ * Initializes an end of the transport.
+ *
+ * Inputs:
+ *   end    - ptr to the end of the transport
+ *   sockfd - the TCP connection (-1 if none)
+ *   link   - the shared memory link (NULL if none)
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+static int bench_init ( tBenchEndStc * end, int sockfd, tShmLinkStc * link )
+{
+    memset (end, 0, sizeof(tBenchEndStc));
+    end->sockfd = sockfd;
+    end->link   = link;
+    msgqueue_init (&end->sendq);
+    return tcp_recvbuf_init (&end->rbuf, TCP_RECV_BUFSIZE);
+}
+
+/*
+ * Description:
+ * Frees an end of the transport (the descriptors are closed by the caller).
+ *
+ * Inputs:
+ *   end - ptr to the end of the transport
+ *
+ * *Returns:
+ *   <none>
+ */
+static void bench_fini ( tBenchEndStc * end )
+{
+    msgqueue_fini (&end->sendq);
+    tcp_recvbuf_fini (&end->rbuf);
+}
+
+/*
+ * Description:
+ * Waits for the child process and returns whether it succeeded.
+ *
+ * Inputs:
+ *   pid - the process id of the child
+ *
+ * *Returns:
+ *   0 if the child succeeded, -1 if not
+ */
+static int bench_reap ( pid_t pid )
+{
+    int status;
+    if (waitpid (pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        fprintf (stderr, " ! ERROR, echo process failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Description:
+ * Measures the round-trip times over a loopback TCP connection.
+ *
+ * Inputs:
+ *   count   - the number of messages to send (after the warm-up)
+ *   payload - the message to send
+ *   size    - the length of the message
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+static int bench_tcp ( int count, const char * payload, int size )
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    memset (&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int listenfd = socket (AF_INET, SOCK_STREAM, 0);
+    if (listenfd < 0 || bind (listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen (listenfd, 1) < 0 || getsockname (listenfd, (struct sockaddr *)&addr, &addr_len) < 0)
+    {
+        fprintf (stderr, " ! ERROR, loopback listen socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    pid_t pid = fork ();
+    if (pid < 0)
+    {
+        fprintf (stderr, " ! ERROR, fork: %s\n", strerror(errno));
+        close (listenfd);
+        return -1;
+    }
+    if (pid == 0)
+    {
+        // the child connects and echoes the messages
+        close (listenfd);
+        tBenchEndStc end;
+        int sockfd = socket (AF_INET, SOCK_STREAM, 0);
+        if (sockfd < 0 || connect (sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+            fcntl (sockfd, F_SETFL, O_NONBLOCK) < 0 || bench_init (&end, sockfd, NULL) < 0)
+            exit (1);
+        exit (bench_echo (&end, BENCH_WARMUP + count));
+    }
+
+    tBenchEndStc end;
+    int sockfd = accept4 (listenfd, NULL, NULL, SOCK_NONBLOCK);
+    close (listenfd);
+    int result = -1;
+    if (sockfd >= 0 && bench_init (&end, sockfd, NULL) == 0)
+    {
+        result = bench_ping ("loopback TCP", &end, count, payload, size);
+        bench_fini (&end);
+    }
+    if (sockfd >= 0) close (sockfd);
+    if (bench_reap (pid) < 0) result = -1;
+    return result;
+}
+
+/*
+ * Description:
+ * Measures the round-trip times over a shared memory link. The link is passed to the child
+ * the same way an endpoint passes it to a server (over the UNIX socket of this process).
+ *
+ * Inputs:
+ *   count   - the number of messages to send (after the warm-up)
+ *   payload - the message to send
+ *   size    - the length of the message
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+static int bench_shm ( int count, const char * payload, int size )
+{
+    tShmLinkStc link;
+    shm_link_init (&link);
+    int listenfd = shm_listen ();
+    if (listenfd < 0 || shm_link_create (&link) < 0)
+    {
+        fprintf (stderr, " ! ERROR, shared memory link: %s\n", strerror(errno));
+        if (listenfd >= 0) close (listenfd);
+        return -1;
+    }
+
+    char offer[64];
+    snprintf (offer, sizeof(offer), "%s %d", SHM_OFFER, (int)getpid());
+    pid_t pid = fork ();
+    if (pid < 0)
+    {
+        fprintf (stderr, " ! ERROR, fork: %s\n", strerror(errno));
+        shm_link_close (&link);
+        close (listenfd);
+        return -1;
+    }
+    if (pid == 0)
+    {
+        // the child takes the link (as its own copy) and echoes the messages
+        tShmLinkStc peer;
+        tBenchEndStc end;
+        close (listenfd);
+        shm_link_close (&link);
+        shm_link_init (&peer);
+        if (shm_take (&peer, offer, strlen(offer), 0) < 0 || bench_init (&end, -1, &peer) < 0)
+            exit (1);
+        exit (bench_echo (&end, BENCH_WARMUP + count));
+    }
+
+    // give the link to the child
+    int result = -1;
+    struct pollfd pfd;
+    pfd.fd = listenfd;
+    pfd.events = POLLIN;
+    int sockfd = -1, client_port;
+    if (poll (&pfd, 1, SHM_TIMEOUT_MSEC) == 1)
+        sockfd = shm_serve (listenfd, &client_port);
+    close (listenfd);
+    if (sockfd >= 0)
+    {
+        int given = shm_give (sockfd, &link);
+        close (sockfd);
+        tBenchEndStc end;
+        if (given == 0 && bench_init (&end, -1, &link) == 0)
+        {
+            link.state = SHM_ACTIVE;
+            result = bench_ping ("shared memory", &end, count, payload, size);
+            bench_fini (&end);
+        }
+    }
+    else
+    {
+        fprintf (stderr, " ! ERROR, the echo process did not take the link\n");
+    }
+    shm_link_close (&link);
+    if (bench_reap (pid) < 0) result = -1;
+    return result;
+}
+
+int main ( int argc, char * argv[] )
+{
+    int count = 100000;
+    int size  = 100;
+    int option;
+    while ((option = getopt(argc, argv, "n:s:")) != -1)
+    {
+        switch (option)
+        {
+            case 'n' : count = atoi(optarg); break;
+            case 's' : size  = atoi(optarg); break;
+            default :
+                fprintf(stderr," ! ERROR, usage: %s [-n <count>] [-s <size>]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (count <= 0 || size <= 0 || size > tcp_msg_limit)
+    {
+        fprintf(stderr," ! ERROR, invalid count or size (up to %d bytes)\n", tcp_msg_limit);
+        exit(1);
+    }
+
+    char * payload = (char *)malloc (size);
+    if (payload == NULL)
+    {
+        fprintf(stderr," ! ERROR, memory allocation for the message\n");
+        exit(1);
+    }
+    memset (payload, 'x', size);
+
+    printf ("round-trip times of %d messages of %d bytes (one in flight, after %d warm-up messages):\n",
+            count, size, BENCH_WARMUP);
+    fflush (stdout);
+    int result = bench_tcp (count, payload, size);
+    if (bench_shm (count, payload, size) < 0)
+        result = -1;
+    free (payload);
+    return (result < 0) ? 1 : 0;
+}
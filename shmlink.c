@@ -0,0 +1,661 @@
+//=============================================================================
+//
+// This is the shared memory link module of the Interactive Endpoint project.
+// Endpoints on the same host can move their messages through shared memory instead of the
+// loopback TCP connection: the client offers a link on the TCP connection, the server takes
+// the memfd and doorbells of the link from the client process over a UNIX socket, and from
+// then on the messages are copied straight into the rings of the link, without any system
+// calls unless the other side is waiting. The TCP connection stays open, to negotiate the
+// link and to detect when the other endpoint goes away.
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include "userio.h"     // for logmsg
+#include "netio.h"
+#include "msgqueue.h"
+#include "bufpool.h"
+#include "shmlink.h"
+
+#define SHM_MAP_SIZE    ( SHM_RING_OFFSET + 2 * SHM_RING_SIZE )
+#define SHM_RING_MASK   ( SHM_RING_SIZE - 1 )
+
+/*
+ * Description:
+ * Initializes a link that is not in use.
+ *
+ * Inputs:
+ *   link - ptr to the link
+ *
+ * *Returns:
+ *   <none>
+ */
+void shm_link_init ( tShmLinkStc * link )
+{
+    memset (link, 0, sizeof(tShmLinkStc));
+    link->state  = SHM_NONE;
+    link->memfd  = -1;
+    link->wakefd = -1;
+    link->peerfd = -1;
+}
+
+/*
+ * Description:
+ * Maps the shared memory of a link and sets up the rings for one side of it.
+ *
+ * Inputs:
+ *   link   - ptr to the link (memfd is set)
+ *   client - true for the client side (which sends on the first ring)
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+static int shm_link_map ( tShmLinkStc * link, bool client )
+{
+    void * base = mmap (NULL, SHM_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, link->memfd, 0);
+    if (base == MAP_FAILED)
+    {
+        logmsg(PRINT_ERROR, "shared memory mmap: %s\n", strerror(errno));
+        return -1;
+    }
+
+    link->base = (char *)base;
+    tShmRingStc * c2s = (tShmRingStc *)link->base;
+    tShmRingStc * s2c = c2s + 1;
+    char * c2s_data = link->base + SHM_RING_OFFSET;
+    char * s2c_data = c2s_data + SHM_RING_SIZE;
+    link->tx      = client ? c2s : s2c;
+    link->tx_data = client ? c2s_data : s2c_data;
+    link->rx      = client ? s2c : c2s;
+    link->rx_data = client ? s2c_data : c2s_data;
+    link->rx_head = link->rx->head;
+    link->rx_taken = 0;
+    return 0;
+}
+
+/*
+ * Description:
+ * Creates the shared memory and doorbells of a new link (client side). The link is not used
+ * until the server takes it.
+ *
+ * Inputs:
+ *   link - ptr to the link (initialized)
+ *
+ * *Returns:
+ *   0 if successful, -1 if error (the link is left unused)
+ */
+int shm_link_create ( tShmLinkStc * link )
+{
+    link->memfd  = memfd_create ("endpoint-shm", MFD_CLOEXEC);
+    link->wakefd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    link->peerfd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (link->memfd < 0 || link->wakefd < 0 || link->peerfd < 0 ||
+        ftruncate (link->memfd, SHM_MAP_SIZE) < 0)
+    {
+        logmsg(PRINT_ERROR, "shared memory link creation: %s\n", strerror(errno));
+        shm_link_close (link);
+        return -1;
+    }
+    if (shm_link_map (link, true) < 0)
+    {
+        shm_link_close (link);
+        return -1;
+    }
+
+    // both consumers start out waiting, so the first frame on each ring rings the doorbell
+    tShmRingStc * ring;
+    for (ring = (tShmRingStc *)link->base; ring < (tShmRingStc *)link->base + 2; ring++)
+    {
+        ring->tail = ring->head = 0;
+        ring->space_wait = 0;
+        ring->data_wait  = 1;
+    }
+    return 0;
+}
+
+/*
+ * Description:
+ * Unmaps the shared memory and closes the descriptors of a link (and frees the buffer of a
+ * large message being received), leaving it unused.
+ *
+ * Inputs:
+ *   link - ptr to the link
+ *
+ * *Returns:
+ *   <none>
+ */
+void shm_link_close ( tShmLinkStc * link )
+{
+    if (link->base)        munmap (link->base, SHM_MAP_SIZE);
+    if (link->memfd >= 0)  close (link->memfd);
+    if (link->wakefd >= 0) close (link->wakefd);
+    if (link->peerfd >= 0) close (link->peerfd);
+    bufpool_put (link->rx_large, link->rx_large_header.msglen);
+    unsigned long wakeups = link->wakeups;
+    shm_link_init (link);
+    link->wakeups = wakeups; // (kept for the statistics)
+}
+
+/*
+ * Description:
+ * Clears the doorbell of this side, when the event loop reports it.
+ *
+ * Inputs:
+ *   link - ptr to the link
+ *
+ * *Returns:
+ *   <none>
+ */
+void shm_link_drain ( tShmLinkStc * link )
+{
+    uint64_t count;
+    if (read (link->wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        logmsg(PRINT_ERROR, "shared memory doorbell read: %s\n", strerror(errno));
+}
+
+/*
+ * Description:
+ * Rings the doorbell of the other side.
+ *
+ * Inputs:
+ *   link  - ptr to the link
+ *
+ * *Returns:
+ *   <none>
+ */
+static void shm_link_wake ( tShmLinkStc * link )
+{
+    uint64_t count = 1;
+    link->wakeups++;
+    if (write (link->peerfd, &count, sizeof(count)) < 0)
+        logmsg(PRINT_ERROR, "shared memory doorbell write: %s\n", strerror(errno));
+}
+
+/*
+ * Description:
+ * Fills in the address of the UNIX socket a client process passes its links on.
+ * It is in the abstract namespace, so nothing is left behind in the file system.
+ *
+ * Inputs:
+ *   pid  - the process id of the client
+ *   addr - ptr to location to return the address in
+ *
+ * *Returns:
+ *   the length of the address
+ */
+static socklen_t shm_address ( int pid, struct sockaddr_un * addr )
+{
+    memset (addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    int len = snprintf (&addr->sun_path[1], sizeof(addr->sun_path) - 1, "endpoint-shm-%d", pid);
+    return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+/*
+ * Description:
+ * Sets the send and receive timeouts of a socket used to pass a link.
+ *
+ * Inputs:
+ *   sockfd - the socket
+ *
+ * *Returns:
+ *   <none>
+ */
+static void shm_set_timeout ( int sockfd )
+{
+    struct timeval timeout;
+    timeout.tv_sec  = SHM_TIMEOUT_MSEC / 1000;
+    timeout.tv_usec = (SHM_TIMEOUT_MSEC % 1000) * 1000;
+    setsockopt (sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt (sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+/*
+ * Description:
+ * Creates the (non-blocking) UNIX socket the servers connect to, to take the links this
+ * client process offers them.
+ *
+ * Inputs:
+ *   <none>
+ *
+ * *Returns:
+ *   the listen socket, -1 if error
+ */
+int shm_listen ( void )
+{
+    struct sockaddr_un addr;
+    socklen_t addr_len = shm_address ((int)getpid(), &addr);
+
+    int listenfd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenfd < 0 ||
+        bind (listenfd, (struct sockaddr *)&addr, addr_len) < 0 ||
+        listen (listenfd, TCP_LISTEN_BACKLOG) < 0)
+    {
+        logmsg(PRINT_ERROR, "shared memory listen socket: %s\n", strerror(errno));
+        if (listenfd >= 0) close (listenfd);
+        return -1;
+    }
+
+    return listenfd;
+}
+
+/*
+ * Description:
+ * Sends the offer of a link on a TCP connection (client side). It is sent directly, ahead of
+ * any queued messages, which are held until the server answers.
+ *
+ * Inputs:
+ *   sockfd - the connected TCP socket (nothing sent on it yet)
+ *
+ * *Returns:
+ *   0 if successful, -1 if it could not be sent, -2 if only part of it was sent (the
+ *   connection can't be used)
+ */
+int shm_offer ( int sockfd )
+{
+    char offer[64];
+    int  offer_len = snprintf (offer, sizeof(offer), "%s %d", SHM_OFFER, (int)getpid());
+
+    int retcode = tcp_send_frame (sockfd, SHM_MSGIX, offer, offer_len);
+    if (retcode == -1)
+        logmsg(PRINT_ERROR, "shared memory offer: %s\n", strerror(errno));
+    else if (retcode == -2)
+        logmsg(PRINT_ERROR, "shared memory offer: only part of it was sent\n");
+    return retcode;
+}
+
+/*
+ * Description:
+ * Accepts the next server connecting to the UNIX listen socket to take a link (client side),
+ * and reads which TCP connection it is for.
+ *
+ * Inputs:
+ *   listenfd    - the UNIX listen socket
+ *   client_port - ptr to location to return the client port of the TCP connection in
+ *
+ * *Returns:
+ *   the connected socket to pass the link on (the caller closes it), -1 if no server is
+ *   waiting (errno is EAGAIN) or error
+ */
+int shm_serve ( int listenfd, int * client_port )
+{
+    int sockfd = accept4 (listenfd, NULL, NULL, SOCK_CLOEXEC);
+    if (sockfd < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            logmsg(PRINT_ERROR, "shared memory accept: %s\n", strerror(errno));
+        return -1;
+    }
+
+    shm_set_timeout (sockfd);
+    int port;
+    if (recv (sockfd, &port, sizeof(port), MSG_WAITALL) != (ssize_t)sizeof(port))
+    {
+        logmsg(PRINT_ERROR, "shared memory request: %s\n", strerror(errno));
+        close (sockfd);
+        errno = EPROTO;
+        return -1;
+    }
+
+    *client_port = port;
+    return sockfd;
+}
+
+/*
+ * Description:
+ * Passes the memfd and the doorbells of a link to the server (client side).
+ *
+ * Inputs:
+ *   sockfd - the socket returned by shm_serve
+ *   link   - ptr to the link that was offered
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+int shm_give ( int sockfd, tShmLinkStc * link )
+{
+    int fds[3] = { link->memfd, link->wakefd, link->peerfd };
+    char control[CMSG_SPACE(sizeof(fds))];
+    char byte = 0;
+    struct iovec iov;
+    struct msghdr msg;
+
+    iov.iov_base = &byte;
+    iov.iov_len  = 1;
+    memset (&msg, 0, sizeof(msg));
+    memset (control, 0, sizeof(control));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(fds));
+    memcpy (CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg (sockfd, &msg, MSG_NOSIGNAL) != 1)
+    {
+        logmsg(PRINT_ERROR, "shared memory link send: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Description:
+ * Takes the link offered on a TCP connection from the client process (server side): connects
+ * to its UNIX socket, identifies the connection by its client port and receives the memfd and
+ * doorbells of the link. This blocks for up to SHM_TIMEOUT_MSEC if the client does not answer.
+ *
+ * Inputs:
+ *   link        - ptr to the link (initialized)
+ *   offer       - the offer message received (not NULL-terminated)
+ *   offer_len   - the length of the offer message
+ *   client_port - the client port of the TCP connection
+ *
+ * *Returns:
+ *   0 if successful (the link is active), -1 if error (the link is left unused)
+ */
+int shm_take ( tShmLinkStc * link, const char * offer, int offer_len, int client_port )
+{
+    char text[64];
+    int  pid;
+    if (offer_len >= (int)sizeof(text)) offer_len = sizeof(text) - 1;
+    memcpy (text, offer, offer_len);
+    text[offer_len] = 0;
+    if (sscanf (text, SHM_OFFER " %d", &pid) != 1)
+    {
+        logmsg(PRINT_ERROR, "invalid shared memory offer: %s\n", text);
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    socklen_t addr_len = shm_address (pid, &addr);
+    int sockfd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0)
+    {
+        logmsg(PRINT_ERROR, "shared memory socket: %s\n", strerror(errno));
+        return -1;
+    }
+    shm_set_timeout (sockfd);
+
+    int fds[3];
+    char control[CMSG_SPACE(sizeof(fds))];
+    char byte;
+    struct iovec iov;
+    struct msghdr msg;
+
+    iov.iov_base = &byte;
+    iov.iov_len  = 1;
+    memset (&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    errno = 0;
+    if (connect (sockfd, (struct sockaddr *)&addr, addr_len) < 0 ||
+        send (sockfd, &client_port, sizeof(client_port), MSG_NOSIGNAL) != (ssize_t)sizeof(client_port) ||
+        recvmsg (sockfd, &msg, MSG_CMSG_CLOEXEC) != 1)
+    {
+        logmsg(PRINT_ERROR, "shared memory link from pid %d (port %u): %s\n", pid, client_port,
+                errno ? strerror(errno) : "refused");
+        close (sockfd);
+        return -1;
+    }
+    close (sockfd);
+
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+    {
+        logmsg(PRINT_ERROR, "shared memory link from pid %d (port %u): no descriptors\n", pid, client_port);
+        return -1;
+    }
+    memcpy (fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    // the client's doorbell is ours to ring, and the other one is ours to wait on
+    link->memfd  = fds[0];
+    link->peerfd = fds[1];
+    link->wakefd = fds[2];
+    if (shm_link_map (link, false) < 0)
+    {
+        shm_link_close (link);
+        return -1;
+    }
+    link->state = SHM_ACTIVE;
+    return 0;
+}
+
+/*
+ * Description:
+ * Sends the messages in the send queue on a link: each message is copied into the tx ring as
+ * a frame (or as several, if it is larger than SHM_FRAME_MAX), and the frames are published
+ * together. A frame never wraps around the end of the ring (the end is filled with a pad
+ * instead), so the other side reads it in place. The doorbell is only rung if the other side
+ * is waiting for frames. A large message that only partly fits is continued from where it
+ * stopped on the next call (like a short write on a socket).
+ *
+ * Inputs:
+ *   link   - ptr to the link
+ *   queue  - ptr to the queue
+ *   stats  - ptr to the send statistics of the connection, which are updated (the calls are
+ *            the doorbell rings)
+ *
+ * *Returns:
+ *   SEND_COMPLETE if the queue was emptied, SEND_BLOCKED if the ring is full (the other side
+ *   rings the doorbell when it makes room)
+ */
+tSendMsgTyp shm_send_queue ( tShmLinkStc * link, tMsgQueueStc * queue, tSendStatsStc * stats )
+{
+    tShmRingStc * ring = link->tx;
+    unsigned tail = ring->tail; // (only written by this side)
+    unsigned head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    tSendMsgTyp result = SEND_COMPLETE;
+    int headlen = sizeof(MessageHeaderStc);
+    tMsgDescStc * desc;
+
+    while ((desc = get_message (queue, 0)) != NULL)
+    {
+        // the next part of the message (queue->sent counts its header and the bytes already sent)
+        int done  = queue->sent ? queue->sent - headlen : 0;
+        int chunk = desc->msglen - done;
+        if (chunk > SHM_FRAME_MAX) chunk = SHM_FRAME_MAX;
+
+        unsigned frame  = headlen + chunk;
+        unsigned to_end = SHM_RING_SIZE - (tail & SHM_RING_MASK);
+        unsigned need   = (to_end < frame) ? to_end + frame : frame;
+        if (SHM_RING_SIZE - (tail - head) < need)
+        {
+            // full: ask for the doorbell, then check again in case the consumer just made room
+            __atomic_store_n(&ring->space_wait, 1, __ATOMIC_SEQ_CST);
+            head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+            if (SHM_RING_SIZE - (tail - head) < need)
+            {
+                result = SEND_BLOCKED;
+                break;
+            }
+            __atomic_store_n(&ring->space_wait, 0, __ATOMIC_RELAXED);
+        }
+
+        if (to_end < frame)
+        {
+            if (to_end >= (unsigned)headlen)
+            {
+                MessageHeaderStc pad;
+                pad.msglen = SHM_PAD;
+                pad.msgix  = 0;
+                memcpy (&link->tx_data[tail & SHM_RING_MASK], &pad, headlen);
+            }
+            tail += to_end;
+        }
+
+        MessageHeaderStc header;
+        header.msglen = queue->sent ? SHM_MORE : desc->msglen;
+        header.msgix  = queue->sent ? chunk : desc->msgix;
+        char * dest = &link->tx_data[tail & SHM_RING_MASK];
+        memcpy (dest, &header, headlen);
+        memcpy (dest + headlen, msgqueue_data (queue, desc) + done, chunk);
+        tail += frame;
+        stats->msgs += msgqueue_consume (queue, queue->sent ? chunk : frame);
+    }
+
+    // publish the frames, then wake the consumer if it is waiting for them
+    if (tail != ring->tail)
+    {
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->data_wait, __ATOMIC_SEQ_CST) &&
+            __atomic_exchange_n(&ring->data_wait, 0, __ATOMIC_SEQ_CST))
+        {
+            stats->calls++;
+            shm_link_wake (link);
+        }
+    }
+
+    return result;
+}
+
+/*
+ * Description:
+ * Publishes the frames consumed from the rx ring, and wakes the producer if it is waiting
+ * for room.
+ *
+ * Inputs:
+ *   link - ptr to the link
+ *
+ * *Returns:
+ *   <none>
+ */
+static void shm_release ( tShmLinkStc * link )
+{
+    tShmRingStc * ring = link->rx;
+    __atomic_store_n(&ring->head, link->rx_head, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->space_wait, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&ring->space_wait, 0, __ATOMIC_SEQ_CST))
+        shm_link_wake (link);
+}
+
+/*
+ * Description:
+ * Receives the next message from the rx ring of a link. Like tcp_recv_frame, the message is
+ * not copied: it is returned as a pointer into the ring, which is only valid until the next
+ * call for this link. The consumed frames are handed back to the producer in batches (when
+ * the ring runs empty, or a quarter of it was consumed). A message larger than SHM_FRAME_MAX
+ * is collected from its frames into a pooled buffer, which is returned to the pool on the
+ * next call.
+ *
+ * Inputs:
+ *   link    - ptr to the link
+ *   header  - ptr to location to return the message header
+ *   message - ptr to location to return the ptr to the message (header->msglen chars, not NULL-terminated)
+ *
+ * *Returns:
+ *   RECV_COMPLETE, RECV_BLOCKED if the ring is empty (the doorbell is rung when frames are
+ *   added), RECV_FAILURE if the ring holds an invalid frame
+ */
+tRecvMsgTyp shm_recv_frame ( tShmLinkStc * link, MessageHeaderStc * header, char ** message )
+{
+    tShmRingStc * ring = link->rx;
+    int headlen = sizeof(MessageHeaderStc);
+
+    link->rx_head += link->rx_taken;
+    link->rx_taken = 0;
+    if (link->rx_head - ring->head >= SHM_RING_SIZE / 4)
+        shm_release (link);
+    if (link->rx_large && link->rx_large_count == link->rx_large_header.msglen)
+    {
+        bufpool_put (link->rx_large, link->rx_large_header.msglen);
+        link->rx_large = NULL;
+    }
+
+    while (true)
+    {
+        unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (tail == link->rx_head)
+        {
+            // empty: hand back the frames consumed and ask for the doorbell, then check again
+            // in case the producer just added a frame
+            shm_release (link);
+            __atomic_store_n(&ring->data_wait, 1, __ATOMIC_SEQ_CST);
+            tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+            if (tail == link->rx_head)
+                return RECV_BLOCKED;
+            __atomic_store_n(&ring->data_wait, 0, __ATOMIC_RELAXED);
+        }
+
+        unsigned pos    = link->rx_head & SHM_RING_MASK;
+        unsigned to_end = SHM_RING_SIZE - pos;
+        if (to_end < (unsigned)headlen)
+        {
+            link->rx_head += to_end; // (too small for a pad header)
+            continue;
+        }
+        memcpy (header, &link->rx_data[pos], headlen);
+        if (header->msglen == SHM_PAD)
+        {
+            link->rx_head += to_end;
+            continue;
+        }
+
+        // the length of the frame: a whole message, the start of a large one, or the next part of it
+        int chunk = header->msglen;
+        if (chunk == SHM_MORE)
+            chunk = (link->rx_large != NULL) ? header->msgix : -1;
+        else if (link->rx_large != NULL || chunk > tcp_msg_limit)
+            chunk = -1;
+        else if (chunk > SHM_FRAME_MAX)
+            chunk = SHM_FRAME_MAX;
+        if (chunk < 0 || (unsigned)(headlen + chunk) > to_end ||
+            (unsigned)(headlen + chunk) > tail - link->rx_head ||
+            (link->rx_large && chunk > link->rx_large_header.msglen - link->rx_large_count))
+        {
+            logmsg(PRINT_ERROR, "invalid message header: len = %d, ix = %d\n", header->msglen, header->msgix);
+            errno = EBADMSG;
+            return RECV_FAILURE;
+        }
+
+        char * data = &link->rx_data[pos + headlen];
+        if (header->msglen > SHM_FRAME_MAX)
+        {
+            link->rx_large = bufpool_get (header->msglen);
+            if (link->rx_large == NULL)
+            {
+                errno = ENOMEM;
+                return RECV_FAILURE;
+            }
+            link->rx_large_header = *header;
+            link->rx_large_count  = 0;
+        }
+        if (link->rx_large == NULL)
+        {
+            *message = data;
+            link->rx_taken = headlen + chunk;
+            return RECV_COMPLETE;
+        }
+
+        // collect the part of the large message
+        memcpy (&link->rx_large[link->rx_large_count], data, chunk);
+        link->rx_large_count += chunk;
+        link->rx_head += headlen + chunk;
+        if (link->rx_head - ring->head >= SHM_RING_SIZE / 4)
+            shm_release (link); // (the producer may be waiting for room for the rest)
+        if (link->rx_large_count == link->rx_large_header.msglen)
+        {
+            *header  = link->rx_large_header;
+            *message = link->rx_large;
+            return RECV_COMPLETE;
+        }
+    }
+}
@@ -0,0 +1,90 @@
+//=============================================================================
+//
+// This contains the definitions, structures and function prototypes defined by the
+// shared memory link module of the Interactive Endpoint project.
+//
+//=============================================================================
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SHM_RING_SIZE       ( 1 << 20 )     // size of the ring in each direction (a power of 2)
+#define SHM_RING_OFFSET     ( 4096 )        // offset of the rings in the shared memory (after the ring headers)
+#define SHM_TIMEOUT_MSEC    ( 1000 )        // max time to wait for the other endpoint while passing the link
+
+// the negotiation messages, sent on the TCP connection with msgix SHM_MSGIX
+#define SHM_MSGIX           ( -1 )
+#define SHM_OFFER           "shm offer"     // client: "shm offer <pid>", the link can be taken from that process
+#define SHM_ACCEPT          "shm ok"        // server: the link was taken, the messages now go on the link
+#define SHM_DECLINE         "shm no"        // server: the link could not be taken, stay on TCP
+                                            // (a server that does not know the offer echoes it, which also declines it)
+
+// a frame header with this length fills the end of a ring (the next frame is at the start)
+#define SHM_PAD             ( -1 )
+
+// a message larger than SHM_FRAME_MAX is split into frames: the first has the message header
+// and the first SHM_FRAME_MAX bytes, and each of the rest has a header with length SHM_MORE
+// and the number of bytes it holds in place of the message index
+#define SHM_FRAME_MAX       ( SHM_RING_SIZE / 4 )
+#define SHM_MORE            ( -2 )
+
+// link states
+#define SHM_NONE            ( 0 )   // not in use (the messages go on the TCP connection)
+#define SHM_OFFERED         ( 1 )   // offered to the server, waiting for its answer (messages are held)
+#define SHM_ACTIVE          ( 2 )   // the messages go on the link
+
+// the event loop data of the doorbell of a link is the ptr to the connection or session that
+// owns it, with the low bit set (so both of its descriptors can be told apart by the same ptr).
+// the owners are allocated, so their ptrs are even, but other event data must be tested first.
+#define SHM_DOORBELL_TAG(owner)     ( (void *)((char *)(owner) + 1) )
+#define SHM_IS_DOORBELL(data)       ( ((uintptr_t)(data) & 1) != 0 )
+#define SHM_DOORBELL_OWNER(data)    ( (void *)((char *)(data) - 1) )
+
+// this is the header of a ring in the shared memory. the producer and consumer fields are on
+// separate cache lines, so each side only writes its own line (except to clear a wait flag).
+typedef struct
+{
+    unsigned tail;          // free-running position where the producer adds the next frame
+    int      space_wait;    // set by the producer when the ring is full (it waits for the doorbell)
+    char     pad1[56];
+    unsigned head;          // free-running position of the next frame for the consumer
+    int      data_wait;     // set by the consumer when the ring is empty (it waits for the doorbell)
+    char     pad2[56];
+
+} tShmRingStc;
+
+// this is one side of a shared memory link: a pair of single producer/single consumer rings
+// holding the message frames (MessageHeaderStc followed by the message, as on the TCP
+// connection), and an eventfd doorbell for each side, signalled only when that side waits.
+typedef struct
+{
+    int    state;           // SHM_xxx
+    int    memfd;           // the shared memory (-1 if none)
+    int    wakefd;          // the doorbell of this side (its rx ring has frames, or its tx ring has room)
+    int    peerfd;          // the doorbell of the other side
+    char * base;            // the mapping of the shared memory (NULL if none)
+    tShmRingStc * tx;       // the ring this side sends on
+    tShmRingStc * rx;       // the ring this side receives on
+    char * tx_data;
+    char * rx_data;
+    unsigned rx_head;       // position of the next frame to receive (published to rx->head in batches)
+    unsigned rx_taken;      // length of the frame last returned (released on the next receive)
+    MessageHeaderStc rx_large_header; // the header of the large message being received
+    char * rx_large;        // pooled buffer the large message is collected in (NULL if none)
+    int    rx_large_count;  // number of bytes of the large message collected so far
+    unsigned long wakeups;  // number of times the other side was signalled
+
+} tShmLinkStc;
+
+// function prototypes:
+void shm_link_init   ( tShmLinkStc * link );
+int  shm_link_create ( tShmLinkStc * link );
+void shm_link_close  ( tShmLinkStc * link );
+void shm_link_drain  ( tShmLinkStc * link );
+int  shm_listen      ( void );
+int  shm_offer       ( int sockfd );
+int  shm_serve       ( int listenfd, int * client_port );
+int  shm_give        ( int sockfd, tShmLinkStc * link );
+int  shm_take        ( tShmLinkStc * link, const char * offer, int offer_len, int client_port );
+tSendMsgTyp shm_send_queue ( tShmLinkStc * link, tMsgQueueStc * queue, tSendStatsStc * stats );
+tRecvMsgTyp shm_recv_frame ( tShmLinkStc * link, MessageHeaderStc * header, char ** message );
@@ -0,0 +1,483 @@
+//=============================================================================
+//
+// This is the io_uring interface module of the Interactive Endpoint project.
+// It drives the kernel io_uring interface directly (no liburing): it maps the submission
+// and completion queues, registers a sparse file table and a provided receive buffer ring,
+// and prepares the multishot accept/recv and batched sendmsg operations used by the
+// io_uring I/O backend.
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+#include "userio.h"     // for logmsg
+#include "uring.h"
+
+/*
+ * Description:
+ * System call wrappers (not provided by glibc).
+ */
+static int sys_io_uring_setup ( unsigned entries, struct io_uring_params * params )
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter ( int ringfd, unsigned to_submit, unsigned min_complete, unsigned flags )
+{
+    return (int)syscall(__NR_io_uring_enter, ringfd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register ( int ringfd, unsigned opcode, void * arg, unsigned nr_args )
+{
+    return (int)syscall(__NR_io_uring_register, ringfd, opcode, arg, nr_args);
+}
+
+/*
+ * Description:
+ * Returns the next free submission queue entry, cleared. If the queue is full, the prepared
+ * entries are submitted first to make room.
+ *
+ * Inputs:
+ *   ring - the io_uring instance
+ *
+ * *Returns:
+ *   ptr to the entry (NULL if error)
+ */
+static struct io_uring_sqe * uring_get_sqe ( tUringStc * ring )
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head >= ring->sq_entries)
+    {
+        if (uring_submit(ring, 0) < 0)
+            return NULL;
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (ring->sq_local_tail - head >= ring->sq_entries)
+            return NULL;
+    }
+
+    unsigned index = ring->sq_local_tail & ring->sq_mask;
+    struct io_uring_sqe * sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    return sqe;
+}
+
+/*
+ * Description:
+ * Creates an io_uring instance, maps its queues, registers an empty (sparse) file table
+ * and registers the provided receive buffer ring filled with all of its buffers.
+ *
+ * Inputs:
+ *   ring - ptr to the io_uring instance to initialize
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+int uring_init ( tUringStc * ring )
+{
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    ring->ringfd = sys_io_uring_setup(URING_ENTRIES, &params);
+    if (ring->ringfd < 0)
+    {
+        logmsg(PRINT_ERROR, "io_uring_setup: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // map the submission and completion queues (a single mapping holds both on newer kernels)
+    ring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_len = params.cq_off.cqes  + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_map_len > ring->sq_map_len) ring->sq_map_len = ring->cq_map_len;
+        ring->cq_map_len = 0;
+    }
+    ring->sq_map = mmap(0, ring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->ringfd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED)
+    {
+        logmsg(PRINT_ERROR, "io_uring mmap sq: %s\n", strerror(errno));
+        close(ring->ringfd);
+        return -1;
+    }
+    if (ring->cq_map_len)
+    {
+        ring->cq_map = mmap(0, ring->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->ringfd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED)
+        {
+            logmsg(PRINT_ERROR, "io_uring mmap cq: %s\n", strerror(errno));
+            munmap(ring->sq_map, ring->sq_map_len);
+            close(ring->ringfd);
+            return -1;
+        }
+    }
+    else
+    {
+        ring->cq_map = ring->sq_map;
+    }
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(0, ring->sqes_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->ringfd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        logmsg(PRINT_ERROR, "io_uring mmap sqes: %s\n", strerror(errno));
+        ring->sqes = NULL;
+        uring_fini(ring);
+        return -1;
+    }
+
+    char * sq = (char *)ring->sq_map;
+    char * cq = (char *)ring->cq_map;
+    ring->sq_head    = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail    = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_array   = (unsigned *)(sq + params.sq_off.array);
+    ring->sq_mask    = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->cq_head    = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail    = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask    = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes       = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // register an empty file table, sockets are added to it as they are opened
+    struct io_uring_rsrc_register files;
+    memset(&files, 0, sizeof(files));
+    files.nr    = URING_MAX_FILES;
+    files.flags = IORING_RSRC_REGISTER_SPARSE;
+    if (sys_io_uring_register(ring->ringfd, IORING_REGISTER_FILES2, &files, sizeof(files)) < 0)
+    {
+        logmsg(PRINT_ERROR, "io_uring register files: %s\n", strerror(errno));
+        uring_fini(ring);
+        return -1;
+    }
+
+    // setup the provided buffer ring, the kernel picks a buffer from it for each receive
+    size_t ring_len = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+    void * ring_mem = mmap(0, ring_len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    ring->buf_base  = (char *)malloc(URING_BUF_COUNT * URING_BUF_SIZE);
+    if (ring_mem == MAP_FAILED || ring->buf_base == NULL)
+    {
+        logmsg(PRINT_ERROR, "io_uring buffer ring allocation: %s\n", strerror(errno));
+        if (ring_mem != MAP_FAILED) munmap(ring_mem, ring_len);
+        uring_fini(ring);
+        return -1;
+    }
+    ring->buf_ring = (struct io_uring_buf_ring *)ring_mem;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = (__u64)(unsigned long)ring->buf_ring;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid         = URING_BUF_GROUP;
+    if (sys_io_uring_register(ring->ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        logmsg(PRINT_ERROR, "io_uring register buffer ring: %s\n", strerror(errno));
+        uring_fini(ring);
+        return -1;
+    }
+
+    // (NOTE: the entries are addressed through a cast, since in C++ the flexible array member
+    // of io_uring_buf_ring is not placed at offset 0)
+    int bid;
+    for (bid = 0; bid < URING_BUF_COUNT; bid++)
+    {
+        struct io_uring_buf * buf = &((struct io_uring_buf *)ring->buf_ring)[bid];
+        buf->addr = (__u64)(unsigned long)&ring->buf_base[bid * URING_BUF_SIZE];
+        buf->len  = URING_BUF_SIZE;
+        buf->bid  = bid;
+    }
+    __atomic_store_n(&ring->buf_ring->tail, URING_BUF_COUNT, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/*
+ * Description:
+ * Closes the io_uring instance (cancelling any operations still outstanding) and frees
+ * all of its mappings and buffers.
+ * (NOTE: a forked child must call this for any instance it inherited, since the queue
+ * mappings are shared with the parent)
+ *
+ * Inputs:
+ *   ring - ptr to the io_uring instance to close
+ *
+ * *Returns:
+ *   <none>
+ */
+void uring_fini ( tUringStc * ring )
+{
+    if (ring->ringfd >= 0)
+        close(ring->ringfd);
+    if (ring->buf_ring)
+        munmap(ring->buf_ring, URING_BUF_COUNT * sizeof(struct io_uring_buf));
+    if (ring->buf_base)
+        free(ring->buf_base);
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_map && ring->cq_map != ring->sq_map)
+        munmap(ring->cq_map, ring->cq_map_len);
+    if (ring->sq_map)
+        munmap(ring->sq_map, ring->sq_map_len);
+
+    memset(ring, 0, sizeof(*ring));
+    ring->ringfd = -1;
+}
+
+/*
+ * Description:
+ * Adds a descriptor to the registered file table. The slot used is the descriptor value.
+ *
+ * Inputs:
+ *   ring - the io_uring instance
+ *   fd   - the descriptor to register
+ *
+ * *Returns:
+ *   the file slot to use in submissions, -1 if error
+ */
+int uring_register_file ( tUringStc * ring, int fd )
+{
+    struct io_uring_files_update update;
+
+    if (fd < 0 || fd >= URING_MAX_FILES)
+    {
+        logmsg(PRINT_ERROR, "io_uring register file: descriptor %d exceeds file table\n", fd);
+        return -1;
+    }
+
+    memset(&update, 0, sizeof(update));
+    update.offset = fd;
+    update.fds    = (__u64)(unsigned long)&fd;
+    if (sys_io_uring_register(ring->ringfd, IORING_REGISTER_FILES_UPDATE, &update, 1) < 0)
+    {
+        logmsg(PRINT_ERROR, "io_uring register file %d: %s\n", fd, strerror(errno));
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Description:
+ * Removes a descriptor from the registered file table. Must be done before it is closed.
+ *
+ * Inputs:
+ *   ring - the io_uring instance
+ *   slot - the file slot returned by uring_register_file
+ *
+ * *Returns:
+ *   <none>
+ */
+void uring_unregister_file ( tUringStc * ring, int slot )
+{
+    struct io_uring_files_update update;
+    int fd = -1;
+
+    memset(&update, 0, sizeof(update));
+    update.offset = slot;
+    update.fds    = (__u64)(unsigned long)&fd;
+    if (sys_io_uring_register(ring->ringfd, IORING_REGISTER_FILES_UPDATE, &update, 1) < 0)
+        logmsg(PRINT_ERROR, "io_uring unregister file %d: %s\n", slot, strerror(errno));
+}
+
+/*
+ * Description:
+ * Prepares a multishot accept on the server listen socket. One completion is posted for each
+ * accepted connection (res is the new non-blocking descriptor) for as long as the
+ * IORING_CQE_F_MORE flag is set in the completion.
+ *
+ * Inputs:
+ *   ring       - the io_uring instance
+ *   serversock - the listen socket (from tcp_create_socket)
+ *   user_data  - value returned in the completions
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+int uring_accept_multishot ( tUringStc * ring, int serversock, __u64 user_data )
+{
+    struct io_uring_sqe * sqe = uring_get_sqe(ring);
+    if (sqe == NULL) return -1;
+
+    sqe->opcode       = IORING_OP_ACCEPT;
+    sqe->fd           = serversock;
+    sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data    = user_data;
+    return 0;
+}
+
+/*
+ * Description:
+ * Prepares a multishot receive on a registered socket. The kernel selects a buffer from the
+ * provided buffer ring for each completion (see uring_buffer), and keeps the receive armed
+ * for as long as the IORING_CQE_F_MORE flag is set in the completion.
+ *
+ * Inputs:
+ *   ring      - the io_uring instance
+ *   slot      - the file slot of the socket
+ *   user_data - value returned in the completions
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+int uring_recv_multishot ( tUringStc * ring, int slot, __u64 user_data )
+{
+    struct io_uring_sqe * sqe = uring_get_sqe(ring);
+    if (sqe == NULL) return -1;
+
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = slot;
+    sqe->flags     = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+/*
+ * Description:
+ * Prepares a sendmsg on a registered socket. The message header, its iovec array and the
+ * data must remain valid until the completion is received.
+ *
+ * Inputs:
+ *   ring      - the io_uring instance
+ *   slot      - the file slot of the socket
+ *   msg       - the message to send
+ *   user_data - value returned in the completion
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+int uring_sendmsg ( tUringStc * ring, int slot, struct msghdr * msg, __u64 user_data )
+{
+    struct io_uring_sqe * sqe = uring_get_sqe(ring);
+    if (sqe == NULL) return -1;
+
+    sqe->opcode    = IORING_OP_SENDMSG;
+    sqe->fd        = slot;
+    sqe->flags     = IOSQE_FIXED_FILE;
+    sqe->addr      = (__u64)(unsigned long)msg;
+    sqe->len       = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;  // if connection broken, don't issue signal
+    sqe->user_data = user_data;
+    return 0;
+}
+
+/*
+ * Description:
+ * Submits all prepared operations and optionally waits for completions, using a single
+ * io_uring_enter system call.
+ *
+ * Inputs:
+ *   ring    - the io_uring instance
+ *   wait_nr - the number of completions to wait for (0 to return immediately)
+ *
+ * *Returns:
+ *   the number of operations submitted, -1 if error (errno is set)
+ */
+int uring_submit ( tUringStc * ring, int wait_nr )
+{
+    unsigned to_submit = ring->sq_local_tail - *ring->sq_tail;
+    if (to_submit == 0 && wait_nr == 0)
+        return 0;
+
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+    ring->enters++;
+    int retcode = sys_io_uring_enter(ring->ringfd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    if (retcode > 0)
+        ring->submitted += retcode;
+    return retcode;
+}
+
+/*
+ * Description:
+ * Returns the next completion, without removing it from the completion queue.
+ *
+ * Inputs:
+ *   ring - the io_uring instance
+ *
+ * *Returns:
+ *   ptr to the completion (NULL if none are available)
+ */
+struct io_uring_cqe * uring_peek_cqe ( tUringStc * ring )
+{
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail)
+        return NULL;
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+/*
+ * Description:
+ * Removes the completion returned by uring_peek_cqe from the completion queue.
+ *
+ * Inputs:
+ *   ring - the io_uring instance
+ *
+ * *Returns:
+ *   <none>
+ */
+void uring_cqe_seen ( tUringStc * ring )
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Description:
+ * Returns the provided buffer the kernel selected for a receive completion.
+ *
+ * Inputs:
+ *   ring - the io_uring instance
+ *   cqe  - the receive completion
+ *
+ * *Returns:
+ *   ptr to the received data (NULL if no buffer was selected)
+ */
+char * uring_buffer ( tUringStc * ring, struct io_uring_cqe * cqe )
+{
+    if (!(cqe->flags & IORING_CQE_F_BUFFER))
+        return NULL;
+    int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    return &ring->buf_base[bid * URING_BUF_SIZE];
+}
+
+/*
+ * Description:
+ * Returns the provided buffer used by a receive completion to the buffer ring, once the
+ * data in it has been consumed.
+ *
+ * Inputs:
+ *   ring - the io_uring instance
+ *   cqe  - the receive completion
+ *
+ * *Returns:
+ *   <none>
+ */
+void uring_recycle_buffer ( tUringStc * ring, struct io_uring_cqe * cqe )
+{
+    if (!(cqe->flags & IORING_CQE_F_BUFFER))
+        return;
+
+    int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    unsigned short tail = ring->buf_ring->tail;
+    struct io_uring_buf * buf = &((struct io_uring_buf *)ring->buf_ring)[tail & (URING_BUF_COUNT - 1)];
+    buf->addr = (__u64)(unsigned long)&ring->buf_base[bid * URING_BUF_SIZE];
+    buf->len  = URING_BUF_SIZE;
+    buf->bid  = bid;
+    __atomic_store_n(&ring->buf_ring->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
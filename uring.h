@@ -0,0 +1,76 @@
+//=============================================================================
+//
+// This contains the definitions, structures and function prototypes defined by the
+// io_uring interface module of the Interactive Endpoint project.
+//
+//=============================================================================
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+
+#define URING_ENTRIES       ( 256 )     // size of the submission queue
+#define URING_BUF_COUNT     ( 256 )     // number of provided receive buffers (must be a power of 2)
+#define URING_BUF_SIZE      ( 4096 )    // size of each provided receive buffer
+#define URING_BUF_GROUP     ( 1 )       // buffer group id of the provided buffer ring
+#define URING_MAX_FILES     ( 4096 )    // size of the registered file table (slot = descriptor value)
+#define URING_SEND_BATCH    ( 64 )      // max number of queued messages gathered into one sendmsg
+
+// the operation types, kept in the upper half of the submission user_data
+typedef enum
+{
+    URING_OP_ACCEPT = 1,
+    URING_OP_RECV,
+    URING_OP_SEND
+
+} tUringOpTyp;
+
+// these build and decode the user_data of a submission: operation type and file slot
+#define URING_USER_DATA(op, slot)   ( ((__u64)(op) << 32) | (__u32)(slot) )
+#define URING_USER_OP(data)         ( (int)((data) >> 32) )
+#define URING_USER_SLOT(data)       ( (int)((data) & 0xFFFFFFFF) )
+
+// this holds an io_uring instance, its mapped queues and the provided receive buffer ring
+typedef struct
+{
+    int      ringfd;            // the io_uring descriptor
+    // submission queue
+    unsigned * sq_head;
+    unsigned * sq_tail;
+    unsigned * sq_array;
+    unsigned   sq_mask;
+    unsigned   sq_entries;
+    unsigned   sq_local_tail;   // tail of the sqes prepared, but not yet made visible to the kernel
+    struct io_uring_sqe * sqes;
+    // completion queue
+    unsigned * cq_head;
+    unsigned * cq_tail;
+    unsigned   cq_mask;
+    struct io_uring_cqe * cqes;
+    // provided buffer ring
+    struct io_uring_buf_ring * buf_ring;
+    char     * buf_base;        // URING_BUF_COUNT buffers of URING_BUF_SIZE bytes
+    // mappings (to unmap on exit)
+    void     * sq_map;
+    void     * cq_map;
+    size_t     sq_map_len;
+    size_t     cq_map_len;
+    size_t     sqes_len;
+    // statistics
+    unsigned long enters;       // number of io_uring_enter system calls
+    unsigned long submitted;    // number of operations submitted
+
+} tUringStc;
+
+// function prototypes:
+int    uring_init ( tUringStc * ring );
+void   uring_fini ( tUringStc * ring );
+int    uring_register_file ( tUringStc * ring, int fd );
+void   uring_unregister_file ( tUringStc * ring, int slot );
+int    uring_accept_multishot ( tUringStc * ring, int serversock, __u64 user_data );
+int    uring_recv_multishot ( tUringStc * ring, int slot, __u64 user_data );
+int    uring_sendmsg ( tUringStc * ring, int slot, struct msghdr * msg, __u64 user_data );
+int    uring_submit ( tUringStc * ring, int wait_nr );
+struct io_uring_cqe * uring_peek_cqe ( tUringStc * ring );
+void   uring_cqe_seen ( tUringStc * ring );
+char * uring_buffer ( tUringStc * ring, struct io_uring_cqe * cqe );
+void   uring_recycle_buffer ( tUringStc * ring, struct io_uring_cqe * cqe );
@@ -14,6 +14,15 @@
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/eventfd.h>
 
 #include "userio.h"
 
@@ -22,62 +31,387 @@ WINDOW * win_input  = NULL;  // this holds the window structure for the user com
 WINDOW * win_msgs   = NULL;  // this holds the window structure for displaying messages sent & received on sockets (PRINT_RCVD, _ECHO)
 WINDOW * win_error  = NULL;  // this holds the window structure for displaying error and informational messages (PRINT_ERROR, _SOCKET, _OTHER)
 WINDOW * win_status = NULL;  // this holds the window structure for displaying communication status (PRINT_STATUS)
+
+// this is the scrollback of a window: the last lines logged to it, drawn at the next frame
+typedef struct
+{
+    WINDOW *      window;       // the window the lines are drawn in
+    char          lines[LOG_SCROLLBACK][LOG_LINE_MAX];
+    unsigned long count;        // number of lines added (the last LOG_SCROLLBACK are kept)
+    bool          open;         // true if the last line is not ended yet (the next text continues it)
+    bool          dirty;        // true if lines were added since the last frame
+
+} tLogPaneStc;
+
+// the scrollbacks of the input, message and error windows, and the text of the status window
+// (all accessed with log_mutex held)
+static tLogPaneStc     pane_input, pane_msgs, pane_error;
+static char            status_text[STATUS_TEXT_MAX];
+static bool            status_dirty;
+static struct timespec log_frame_time;  // when the last frame was drawn
+static bool            log_ui;          // true while the windows are displayed (not headless)
 #endif
 
+int print_flag = PRINT_ALL;   // this holds the log message selections for printing to the user
+
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER; // serializes ncurses output with the user input
+static FILE *          log_out = stdout; // where the messages are written without the windows
+
+// these are the length modifiers of a printf conversion, as captured by logmsg
+enum
+{
+    LOG_LEN_NONE, LOG_LEN_HH, LOG_LEN_H, LOG_LEN_L, LOG_LEN_LL, LOG_LEN_J, LOG_LEN_Z, LOG_LEN_T, LOG_LEN_LD
+};
+
+// this is a printf conversion specification parsed from a log message format
+typedef struct
+{
+    const char * flags;     // the flag chars
+    int  flags_len;         // number of flag chars
+    bool width_arg;         // true if the width is an argument ('*')
+    int  width;             // the width (-1 if none)
+    bool prec_arg;          // true if the precision is an argument ('.*')
+    int  prec;              // the precision (-1 if none)
+    int  length;            // the LOG_LEN_xxx length modifier
+    char conv;              // the conversion char
+
+} tLogSpecStc;
+
+// this is an argument of a log message, as captured by logmsg
+typedef union
+{
+    long long          i;   // signed integer conversions, '%c' and '*' widths/precisions
+    unsigned long long u;   // unsigned integer conversions
+    double             d;   // floating point conversions
+    const void *       p;   // '%p'
+    int                s;   // '%s': the offset of the copy of the string in the record's string area
+
+} tLogArgUnn;
+
+// this is a log message waiting in the log ring to be formatted and displayed
+typedef struct
+{
+    volatile unsigned long seq; // position of the record in the ring + 1 when it is ready to display
+    int    category;            // the message category
+    struct timespec time;       // when the message was logged (CLOCK_MONOTONIC)
+    const char * fmt;           // the printf format (a string literal)
+    int    nargs;               // number of arguments captured (the rest of fmt is displayed as is)
+    int    strused;             // number of bytes used in strings
+    tLogArgUnn args[LOG_MAX_ARGS];
+    char   strings[LOG_STR_SPACE]; // copies of the '%s' arguments (the last byte is always 0)
+
+} tLogRecStc;
+
+// the log ring: producers claim records by advancing log_tail, the display thread consumes
+// them in order from log_head (a bounded MPSC queue with a sequence number per record)
+static tLogRecStc log_ring[LOG_RING_SIZE];
+static unsigned long log_head;              // next record to display (display thread)
+static unsigned long log_tail;              // next record to claim (producers)
+static unsigned long log_dropped;           // number of messages dropped because the ring was full
+static unsigned long log_reported;          // number of dropped messages already reported (display thread)
+static unsigned long log_records;           // number of messages displayed (display thread)
+static long long     log_max_lag;           // longest time a message waited in the ring, in ns (display thread)
+static volatile bool log_running;           // true while the display thread is running
+static volatile bool log_stopping;          // set to stop the display thread once the ring is empty
+static int           log_waiting;           // true while the display thread is waiting for messages
+static pthread_t       log_tid;
+static pthread_mutex_t log_wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  log_wait_cond  = PTHREAD_COND_INITIALIZER;
+
+// the input ring: the input thread reads the command lines from the terminal and adds them,
+// and the main thread takes them (a single producer/single consumer queue, so neither side
+// takes a lock, and the main thread never waits for the user to finish typing a line)
+static char          input_ring[INPUT_RING_SIZE][INPUT_LINE_MAX];
+static unsigned long input_head;            // next line to take (main thread)
+static unsigned long input_tail;            // next line to add (input thread)
+static int           input_fd = -1;         // eventfd signalled when lines are added
+static pthread_t     input_tid;
+static FILE *        input_file;            // the command file read in place of the terminal (headless)
+static volatile bool input_ended;           // set when the command file has been read to its end
+static bool          input_end_taken;       // true once the end of the command file was returned
+
 /*
  * Description:
- * Handles the outputting of all messages. Categorizes them to allow selective enabling.
+ * Replaces the control chars in the text of a displayed message with '.' (the newline ending
+ * the text is kept). The messages are opaque bytes, so the start of one shown in a log
+ * message may hold any values; this is only done for the messages actually displayed.
  *
  * Inputs:
- *   category - the message category
- *   fmt      - the printf format arguments
+ *   text - the formatted message
  *
  * *Returns:
  *   <none>
  */
-void logmsg ( int category, const char * fmt, ... )
+static void log_printable ( char * text )
 {
-    va_list args;
-    char disp_array[121], * dptr;
-    dptr = disp_array;
+    for (; *text; text++)
+        if ((unsigned char)*text < ' ' && !(text[0] == '\n' && text[1] == 0))
+            *text = '.';
+}
+
+#ifdef NCURSES_BOOL
+/*
+ * Description:
+ * Adds a formatted log message to the scrollback of a window. The message is split into lines
+ * at its newlines, and a message not ending with one is continued by the next message.
+ *
+ * Inputs:
+ *   pane   - the scrollback of the window
+ *   prefix - the prefix of the message
+ *   text   - the formatted message
+ *
+ * *Returns:
+ *   <none>
+ */
+static void log_pane_add ( tLogPaneStc * pane, const char * prefix, const char * text )
+{
+    char message[LOG_LINE_MAX];
+    snprintf (message, sizeof(message), "%s%s", prefix, text);
+
+    const char * part = message;
+    while (*part)
+    {
+        if (!pane->open)
+        {
+            pane->lines[pane->count & (LOG_SCROLLBACK - 1)][0] = 0;
+            pane->count++;
+        }
+        char * line = pane->lines[(pane->count - 1) & (LOG_SCROLLBACK - 1)];
+        const char * end = strchr (part, '\n');
+        int len = end ? (int)(end - part) : (int)strlen (part);
+        int used = strlen (line);
+        snprintf (&line[used], LOG_LINE_MAX - used, "%.*s", len, part);
+        pane->open = (end == NULL);
+        part += end ? len + 1 : len;
+    }
+    pane->dirty = true;
+}
+
+/*
+ * Description:
+ * Draws the last lines of a scrollback in its window, inside the border (the newest line at
+ * the bottom, and the lines longer than the window wrapped), to be displayed by doupdate.
+ *
+ * Inputs:
+ *   pane - the scrollback of the window
+ *
+ * *Returns:
+ *   <none>
+ */
+static void log_pane_draw ( tLogPaneStc * pane )
+{
+    int rows, cols;
+    getmaxyx (pane->window, rows, cols);
+    int height = rows - 2, width = cols - 2;
+    if (height <= 0 || width <= 0)
+        return;
+
+    // find the oldest line that still fits
+    unsigned long kept = (pane->count < LOG_SCROLLBACK) ? pane->count : LOG_SCROLLBACK;
+    unsigned long first = pane->count;
+    int used = 0;
+    while (first > pane->count - kept)
+    {
+        int len = strlen (pane->lines[(first - 1) & (LOG_SCROLLBACK - 1)]);
+        int need = len ? (len + width - 1) / width : 1;
+        if (used + need > height)
+            break;
+        used += need;
+        first--;
+    }
+
+    werase (pane->window);
+    box (pane->window, 0, 0);
+    int row = 1;
+    for (; first != pane->count; first++)
+    {
+        const char * line = pane->lines[first & (LOG_SCROLLBACK - 1)];
+        int len = strlen (line), off = 0;
+        do
+        {
+            mvwaddnstr (pane->window, row++, 1, &line[off], width);
+            off += width;
+        } while (off < len);
+    }
+    wnoutrefresh (pane->window);
+}
+
+/*
+ * Description:
+ * Draws the status window: the lines of the status text, cut to the width of the window.
+ *
+ * Inputs:
+ *   <none>
+ *
+ * *Returns:
+ *   <none>
+ */
+static void log_status_draw ( void )
+{
+    int rows, cols;
+    getmaxyx (win_status, rows, cols);
+    int height = rows - 2, width = cols - 2;
+    if (height <= 0 || width <= 0)
+        return;
+
+    werase (win_status);
+    box (win_status, 0, 0);
+    const char * line = status_text;
+    int row;
+    for (row = 1; row <= height && *line; row++)
+    {
+        const char * end = strchr (line, '\n');
+        int len = end ? (int)(end - line) : (int)strlen (line);
+        mvwaddnstr (win_status, row, 1, line, (len < width) ? len : width);
+        line += end ? len + 1 : len;
+    }
+    wnoutrefresh (win_status);
+}
+
+/*
+ * Description:
+ * Draws the next frame: the windows changed since the last frame are redrawn, and the
+ * terminal is updated once for all of them. Unless forced, nothing is drawn until LOG_FRAME_NSEC
+ * after the last frame, so the cost of the display does not grow with the message rate.
+ * Called with log_mutex held.
+ *
+ * Inputs:
+ *   force - true to draw the changes now
+ *
+ * *Returns:
+ *   <none>
+ */
+static void log_render ( bool force )
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    long long since = (now.tv_sec - log_frame_time.tv_sec) * 1000000000LL + (now.tv_nsec - log_frame_time.tv_nsec);
+    if (!force && since < LOG_FRAME_NSEC)
+        return;
+
+    bool drawn = false;
+    tLogPaneStc * panes[] = { &pane_input, &pane_msgs, &pane_error };
+    for (unsigned ix = 0; ix < sizeof(panes) / sizeof(panes[0]); ix++)
+    {
+        if (panes[ix]->dirty && panes[ix]->window)
+        {
+            log_pane_draw (panes[ix]);
+            panes[ix]->dirty = false;
+            drawn = true;
+        }
+    }
+    if (status_dirty && win_status)
+    {
+        log_status_draw ();
+        status_dirty = false;
+        drawn = true;
+    }
+    if (drawn)
+        doupdate ();
+    log_frame_time = now;
+}
+#endif
+
+/*
+ * Description:
+ * Replaces the text of the status window (shown at the next frame). Without ncurses (or
+ * headless), the status is not displayed.
+ *
+ * Inputs:
+ *   text - the status text (lines ended by newlines)
+ *
+ * *Returns:
+ *   <none>
+ */
+void userio_set_status ( const char * text )
+{
+#ifdef NCURSES_BOOL
+    pthread_mutex_lock (&log_mutex);
+    snprintf (status_text, sizeof(status_text), "%s", text);
+    status_dirty = true;
+    pthread_mutex_unlock (&log_mutex);
+#else
+    (void)text;
+#endif
+}
 
 #ifdef NCURSES_BOOL
+/*
+ * Description:
+ * Adds a formatted log message to the window for its category (drawn at the next frame).
+ *
+ * Inputs:
+ *   category - the message category
+ *   text     - the formatted message
+ *
+ * *Returns:
+ *   <none>
+ */
+static void log_display_window ( int category, const char * text )
+{
     // always print all messages
-    WINDOW * window;
+    tLogPaneStc * pane = NULL;
+    const char * prefix = "";
 
-    // prepend a prefix to the message dependent on the message type and get the window to display msg in
+    // get the prefix dependent on the message type and the window to display msg in
+    // (the status window is only drawn from the status text, see userio_set_status)
     switch (category)
     {
         default :
             break;
-        case PRINT_STATUS  : window = win_status; break;
-        case PRINT_QUERY   : window = win_input;  break;
-        case PRINT_ERROR   : window = win_error;  sprintf (dptr, "ERROR : ");  break;
-        case PRINT_WARNING : window = win_error;  sprintf (dptr, "WARN  : ");  break;
-        case PRINT_SOCKET  : window = win_error;  sprintf (dptr, "SOCK  : ");  break;
-        case PRINT_OTHER   : window = win_error;  sprintf (dptr, "INFO  : ");  break;
-        case PRINT_RCVD    : window = win_msgs;   sprintf (dptr, "< ");  break;
-        case PRINT_SENT    : window = win_msgs;   sprintf (dptr, "> ");  break;
+        case PRINT_STATUS  : break;
+        case PRINT_QUERY   : pane = &pane_input; break;
+        case PRINT_ERROR   : pane = &pane_error; prefix = "ERROR : ";  break;
+        case PRINT_WARNING : pane = &pane_error; prefix = "WARN  : ";  break;
+        case PRINT_SOCKET  : pane = &pane_error; prefix = "SOCK  : ";  break;
+        case PRINT_OTHER   : pane = &pane_error; prefix = "INFO  : ";  break;
+        case PRINT_RCVD    : pane = &pane_msgs;  prefix = "< ";  break;
+        case PRINT_SENT    : pane = &pane_msgs;  prefix = "> ";  break;
     }
 
-    if (window)
+    if (pane)
     {
-        dptr += strlen(dptr);
+        // add the message to the scrollback of its window, which is drawn at the next frame
+        // (by the display thread, or now if there is none). ncurses is not thread safe.
+        pthread_mutex_lock (&log_mutex);
+        log_pane_add (pane, prefix, text);
+        if (!log_running)
+            log_render (true);
+        pthread_mutex_unlock (&log_mutex);
+    }
+}
+#endif
 
-        // now add the log message
-        va_start(args, fmt);
-        vsprintf(dptr, fmt, args);
-        va_end(args);
+/*
+ * Description:
+ * Displays a formatted log message in the window (or on the terminal) for its category.
+ * Headless, the messages are written to stderr (stdout is left for the command results).
+ *
+ * Inputs:
+ *   category - the message category
+ *   text     - the formatted message
+ *
+ * *Returns:
+ *   <none>
+ */
+static void log_display ( int category, char * text )
+{
+    if (category & (PRINT_SENT | PRINT_RCVD))
+        log_printable (text);
 
-        // display message in selected window
-        wprintw (window, "%s", disp_array);
-        wrefresh(window);
+#ifdef NCURSES_BOOL
+    if (log_ui)
+    {
+        log_display_window (category, text);
+        return;
     }
-#else
-    // always print errors, warnings and command response messages
-    int allowed = print_flag | PRINT_ERROR | PRINT_WARNING | PRINT_QUERY;
+#endif
+
+    const char * prefix = "";
 
-    if (category & allowed)
+    // (the messages not selected by print_flag were already rejected by logmsg, and status
+    // information is only displayed by the GUI)
+    if (category != PRINT_STATUS)
     {
         // prepend a prefix to the message dependent on the message type
         switch (category)
@@ -86,45 +420,731 @@ void logmsg ( int category, const char * fmt, ... )
                 break;
             case PRINT_STATUS  : break;
             case PRINT_QUERY   : break;
-            case PRINT_ERROR   : sprintf (dptr, " ! ERROR : ");  break;
-            case PRINT_WARNING : sprintf (dptr, " ! WARN  : ");  break;
-            case PRINT_SOCKET  : sprintf (dptr, " ! ");  break;
-            case PRINT_OTHER   : sprintf (dptr, " ! ");  break;
-            case PRINT_RCVD    : sprintf (dptr, " < ");  break;
-            case PRINT_SENT    : sprintf (dptr, " > ");  break;
+            case PRINT_ERROR   : prefix = " ! ERROR : ";  break;
+            case PRINT_WARNING : prefix = " ! WARN  : ";  break;
+            case PRINT_SOCKET  : prefix = " ! ";  break;
+            case PRINT_OTHER   : prefix = " ! ";  break;
+            case PRINT_RCVD    : prefix = " < ";  break;
+            case PRINT_SENT    : prefix = " > ";  break;
+        }
+
+        fprintf (log_out, "%s%s", prefix, text);
+    }
+}
+
+/*
+ * Description:
+ * Parses a printf conversion specification.
+ *
+ * Inputs:
+ *   fmt  - ptr to the char following the '%'
+ *   spec - ptr to location to return the specification in
+ *
+ * *Returns:
+ *   ptr to the char following the specification
+ */
+static const char * log_parse_spec ( const char * fmt, tLogSpecStc * spec )
+{
+    memset (spec, 0, sizeof(tLogSpecStc));
+    spec->width = -1;
+    spec->prec  = -1;
+
+    spec->flags = fmt;
+    while (*fmt && strchr ("-+ #0'", *fmt)) fmt++;
+    spec->flags_len = fmt - spec->flags;
+
+    if (*fmt == '*')
+    {
+        spec->width_arg = true;
+        fmt++;
+    }
+    else if (*fmt >= '0' && *fmt <= '9')
+    {
+        spec->width = strtol (fmt, (char **)&fmt, 10);
+    }
+
+    if (*fmt == '.')
+    {
+        fmt++;
+        if (*fmt == '*')
+        {
+            spec->prec_arg = true;
+            fmt++;
+        }
+        else
+        {
+            spec->prec = strtol (fmt, (char **)&fmt, 10); // (no digits is a precision of 0)
+        }
+    }
+
+    switch (*fmt)
+    {
+        case 'h': spec->length = (fmt[1] == 'h') ? LOG_LEN_HH : LOG_LEN_H;  fmt += (fmt[1] == 'h') ? 2 : 1;  break;
+        case 'l': spec->length = (fmt[1] == 'l') ? LOG_LEN_LL : LOG_LEN_L;  fmt += (fmt[1] == 'l') ? 2 : 1;  break;
+        case 'q': spec->length = LOG_LEN_LL;  fmt++;  break;
+        case 'j': spec->length = LOG_LEN_J;   fmt++;  break;
+        case 'z': spec->length = LOG_LEN_Z;   fmt++;  break;
+        case 't': spec->length = LOG_LEN_T;   fmt++;  break;
+        case 'L': spec->length = LOG_LEN_LD;  fmt++;  break;
+        default : break;
+    }
+
+    spec->conv = *fmt;
+    if (*fmt) fmt++;
+    return fmt;
+}
+
+/*
+ * Description:
+ * Captures the arguments of a log message in a log record, as the format consumes them.
+ * The strings are copied, since they may not exist by the time the message is displayed.
+ *
+ * Inputs:
+ *   rec  - the log record (with the format set)
+ *   args - the arguments of the message
+ *
+ * *Returns:
+ *   <none>
+ */
+static void log_capture ( tLogRecStc * rec, va_list args )
+{
+    const char * fmt = rec->fmt;
+    tLogSpecStc spec;
+
+    rec->nargs   = 0;
+    rec->strused = 0;
+    rec->strings[LOG_STR_SPACE - 1] = 0;
+
+    while ((fmt = strchr (fmt, '%')) != NULL)
+    {
+        if (fmt[1] == '%')
+        {
+            fmt += 2;
+            continue;
+        }
+        fmt = log_parse_spec (fmt + 1, &spec);
+
+        // the width, precision and value of the conversion
+        if (rec->nargs + (spec.width_arg ? 1 : 0) + (spec.prec_arg ? 1 : 0) + 1 > LOG_MAX_ARGS)
+            return;
+
+        tLogArgUnn * arg;
+        if (spec.width_arg)
+            rec->args[rec->nargs++].i = va_arg (args, int);
+        if (spec.prec_arg)
+        {
+            spec.prec = va_arg (args, int);
+            rec->args[rec->nargs++].i = spec.prec;
+        }
+
+        arg = &rec->args[rec->nargs];
+        switch (spec.conv)
+        {
+            case 'd':
+            case 'i':
+                switch (spec.length)
+                {
+                    case LOG_LEN_HH: arg->i = (signed char)va_arg (args, int);  break;
+                    case LOG_LEN_H:  arg->i = (short)va_arg (args, int);        break;
+                    case LOG_LEN_L:  arg->i = va_arg (args, long);              break;
+                    case LOG_LEN_LL: arg->i = va_arg (args, long long);         break;
+                    case LOG_LEN_J:  arg->i = va_arg (args, intmax_t);          break;
+                    case LOG_LEN_Z:  arg->i = va_arg (args, ssize_t);           break;
+                    case LOG_LEN_T:  arg->i = va_arg (args, ptrdiff_t);         break;
+                    default:         arg->i = va_arg (args, int);               break;
+                }
+                break;
+
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                switch (spec.length)
+                {
+                    case LOG_LEN_HH: arg->u = (unsigned char)va_arg (args, unsigned);   break;
+                    case LOG_LEN_H:  arg->u = (unsigned short)va_arg (args, unsigned);  break;
+                    case LOG_LEN_L:  arg->u = va_arg (args, unsigned long);             break;
+                    case LOG_LEN_LL: arg->u = va_arg (args, unsigned long long);        break;
+                    case LOG_LEN_J:  arg->u = va_arg (args, uintmax_t);                 break;
+                    case LOG_LEN_Z:  arg->u = va_arg (args, size_t);                    break;
+                    case LOG_LEN_T:  arg->u = (unsigned long)va_arg (args, ptrdiff_t);  break;
+                    default:         arg->u = va_arg (args, unsigned);                  break;
+                }
+                break;
+
+            case 'c':
+                arg->i = va_arg (args, int);
+                break;
+
+            case 'f': case 'F': case 'e': case 'E':
+            case 'g': case 'G': case 'a': case 'A':
+                if (spec.length == LOG_LEN_LD)
+                    arg->d = (double)va_arg (args, long double);
+                else
+                    arg->d = va_arg (args, double);
+                break;
+
+            case 'p':
+                arg->p = va_arg (args, void *);
+                break;
+
+            case 's':
+            {
+                const char * str = va_arg (args, const char *);
+                if (str == NULL) str = "(null)";
+                int room = LOG_STR_SPACE - 1 - rec->strused; // room for the string and its NULL term
+                int len  = (spec.prec >= 0) ? (int)strnlen (str, spec.prec) : (int)strlen (str);
+                if (room < 1)
+                {
+                    arg->s = LOG_STR_SPACE - 1; // no room: display an empty string
+                    break;
+                }
+                if (len > room - 1) len = room - 1;
+                arg->s = rec->strused;
+                memcpy (&rec->strings[rec->strused], str, len);
+                rec->strings[rec->strused + len] = 0;
+                rec->strused += len + 1;
+                break;
+            }
+
+            default: // not supported (the rest of the format is displayed as is)
+                return;
         }
+        rec->nargs++;
+    }
+}
 
-        dptr += strlen(dptr);
+/*
+ * Description:
+ * Formats a log message from a log record.
+ *
+ * Inputs:
+ *   rec  - the log record
+ *   text - ptr to the buffer to format the message in
+ *   size - the size of the buffer
+ *
+ * *Returns:
+ *   <none>
+ */
+static void log_format ( tLogRecStc * rec, char * text, int size )
+{
+    const char * fmt = rec->fmt;
+    int used = 0, argix = 0;
+    tLogSpecStc spec;
 
-        // now add the log message and output to the terminal
+    while (*fmt && used < size - 1)
+    {
+        // copy the text up to the next conversion
+        const char * next = strchr (fmt, '%');
+        int len = next ? (int)(next - fmt) : (int)strlen (fmt);
+        if (len > size - 1 - used) len = size - 1 - used;
+        memcpy (&text[used], fmt, len);
+        used += len;
+        fmt  += len;
+        if (*fmt != '%' || used >= size - 1) break;
+
+        if (fmt[1] == '%')
+        {
+            text[used++] = '%';
+            fmt += 2;
+            continue;
+        }
+
+        // rebuild the conversion with the width and precision filled in and the value widened
+        const char * start = fmt;
+        const char * after = log_parse_spec (fmt + 1, &spec);
+        int needed = (spec.width_arg ? 1 : 0) + (spec.prec_arg ? 1 : 0) + 1;
+        if (argix + needed > rec->nargs)
+        {
+            // the argument was not captured: display the rest of the format as is
+            len = strlen (start);
+            if (len > size - 1 - used) len = size - 1 - used;
+            memcpy (&text[used], start, len);
+            used += len;
+            break;
+        }
+        if (spec.width_arg) spec.width = (int)rec->args[argix++].i;
+        if (spec.prec_arg)  spec.prec  = (int)rec->args[argix++].i;
+        tLogArgUnn * arg = &rec->args[argix++];
+        fmt = after;
+
+        char conv[32];
+        int  cix = snprintf (conv, sizeof(conv), "%%%.*s", spec.flags_len, spec.flags);
+        if (spec.width >= 0) cix += snprintf (&conv[cix], sizeof(conv) - cix, "%d", spec.width);
+        if (spec.prec  >= 0) cix += snprintf (&conv[cix], sizeof(conv) - cix, ".%d", spec.prec);
+
+        int room = size - used;
+        switch (spec.conv)
+        {
+            case 'd': case 'i':
+                snprintf (&conv[cix], sizeof(conv) - cix, "ll%c", spec.conv);
+                len = snprintf (&text[used], room, conv, arg->i);
+                break;
+            case 'o': case 'u': case 'x': case 'X':
+                snprintf (&conv[cix], sizeof(conv) - cix, "ll%c", spec.conv);
+                len = snprintf (&text[used], room, conv, arg->u);
+                break;
+            case 'c':
+                snprintf (&conv[cix], sizeof(conv) - cix, "c");
+                len = snprintf (&text[used], room, conv, (int)arg->i);
+                break;
+            case 'p':
+                snprintf (&conv[cix], sizeof(conv) - cix, "p");
+                len = snprintf (&text[used], room, conv, arg->p);
+                break;
+            case 's':
+                snprintf (&conv[cix], sizeof(conv) - cix, "s");
+                len = snprintf (&text[used], room, conv, &rec->strings[arg->s]);
+                break;
+            default: // floating point
+                snprintf (&conv[cix], sizeof(conv) - cix, "%c", spec.conv);
+                len = snprintf (&text[used], room, conv, arg->d);
+                break;
+        }
+        used += (len < room) ? len : room - 1;
+    }
+
+    text[used] = 0;
+}
+
+/*
+ * Description:
+ * This is the log display thread. It formats and displays the log messages in the order they
+ * were logged, so the threads logging them never wait on the terminal.
+ *
+ * Inputs:
+ *   arg - <unused>
+ *
+ * *Returns:
+ *   NULL
+ */
+static void * log_thread ( void * arg )
+{
+    char text[LOG_LINE_MAX];
+    (void)arg;
+
+    while (true)
+    {
+        tLogRecStc * rec = &log_ring[log_head & (LOG_RING_SIZE - 1)];
+        if (__atomic_load_n (&rec->seq, __ATOMIC_ACQUIRE) == log_head + 1)
+        {
+            struct timespec now;
+            clock_gettime (CLOCK_MONOTONIC, &now);
+            long long lag = (now.tv_sec - rec->time.tv_sec) * 1000000000LL + (now.tv_nsec - rec->time.tv_nsec);
+            if (lag > log_max_lag) log_max_lag = lag;
+
+            log_format (rec, text, sizeof(text));
+            int category = rec->category;
+
+            // release the record to the producers for its next pass around the ring
+            __atomic_store_n (&rec->seq, log_head + LOG_RING_SIZE, __ATOMIC_RELEASE);
+            __atomic_store_n (&log_head, log_head + 1, __ATOMIC_RELAXED);
+            log_display (category, text);
+            __atomic_store_n (&log_records, log_records + 1, __ATOMIC_RELAXED);
+#ifdef NCURSES_BOOL
+            pthread_mutex_lock (&log_mutex);
+            log_render (false);
+            pthread_mutex_unlock (&log_mutex);
+#endif
+            continue;
+        }
+
+        // the ring is empty (or the next message is still being captured)
+        unsigned long dropped = __atomic_load_n (&log_dropped, __ATOMIC_RELAXED);
+        if (dropped != log_reported)
+        {
+            snprintf (text, sizeof(text), "%lu log messages dropped (log ring full)\n", dropped - log_reported);
+            log_display (PRINT_WARNING, text);
+            log_reported = dropped;
+        }
+#ifdef NCURSES_BOOL
+        pthread_mutex_lock (&log_mutex);
+        log_render (log_stopping);
+        pthread_mutex_unlock (&log_mutex);
+#endif
+        if (log_stopping && __atomic_load_n (&log_tail, __ATOMIC_ACQUIRE) == log_head)
+            break;
+
+        // wait to be signalled that a message was logged (or 10 msec, in case the signal was missed)
+        struct timespec until;
+        clock_gettime (CLOCK_REALTIME, &until);
+        until.tv_nsec += 10000000;
+        if (until.tv_nsec >= 1000000000)
+        {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        pthread_mutex_lock (&log_wait_mutex);
+        __atomic_store_n (&log_waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n (&rec->seq, __ATOMIC_SEQ_CST) != log_head + 1 && !log_stopping)
+            pthread_cond_timedwait (&log_wait_cond, &log_wait_mutex, &until);
+        __atomic_store_n (&log_waiting, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock (&log_wait_mutex);
+    }
+
+    return NULL;
+}
+
+/*
+ * Description:
+ * Starts the log display thread. Until it is started (and after it is stopped), log messages
+ * are displayed directly by the thread logging them.
+ *
+ * Inputs:
+ *   <none>
+ *
+ * *Returns:
+ *   <none>
+ */
+static void log_start ( void )
+{
+    log_stopping = false;
+    if (pthread_create (&log_tid, NULL, log_thread, NULL) == 0)
+        log_running = true;
+}
+
+/*
+ * Description:
+ * Stops the log display thread, once it has displayed the messages already logged.
+ *
+ * Inputs:
+ *   <none>
+ *
+ * *Returns:
+ *   <none>
+ */
+static void log_stop ( void )
+{
+    if (!log_running) return;
+
+    log_stopping = true;
+    pthread_cond_signal (&log_wait_cond);
+    pthread_join (log_tid, NULL);
+    log_running = false;
+}
+
+/*
+ * Description:
+ * Restarts the log display in a forked child. The child has only the forking thread, so it
+ * needs its own display thread, and it drops the messages the parent had not displayed yet
+ * (the parent displays them), including any that other threads were still capturing.
+ *
+ * Inputs:
+ *   <none>
+ *
+ * *Returns:
+ *   <none>
+ */
+static void log_atfork_child ( void )
+{
+    if (!log_running) return;
+
+    unsigned long pos;
+    for (pos = log_head; pos != log_tail; pos++)
+        log_ring[pos & (LOG_RING_SIZE - 1)].seq = pos + LOG_RING_SIZE;
+    log_head     = log_tail;
+    log_dropped  = 0;
+    log_reported = 0;
+    log_records  = 0;
+    log_max_lag  = 0;
+    log_waiting  = 0;
+    pthread_mutex_init (&log_mutex, NULL);
+    pthread_mutex_init (&log_wait_mutex, NULL);
+    pthread_cond_init (&log_wait_cond, NULL);
+    log_running = false;
+    log_start ();
+}
+
+/*
+ * Description:
+ * Handles the outputting of all messages (called by logmsg for the messages that are selected).
+ * The message is captured (its format, arguments and the time) in the log ring and displayed
+ * by the log display thread, so logging never waits on the terminal. If the ring is full, the
+ * message is dropped and counted.
+ *
+ * Inputs:
+ *   category - the message category
+ *   fmt      - the printf format arguments
+ *
+ * *Returns:
+ *   <none>
+ */
+void log_write ( int category, const char * fmt, ... )
+{
+    va_list args;
+
+    if (!log_running)
+    {
+        // no display thread: display the message now
+        char text[LOG_LINE_MAX];
         va_start(args, fmt);
-        vsprintf(dptr, fmt, args);
+        vsnprintf(text, sizeof(text), fmt, args);
         va_end(args);
-        printf ("%s", disp_array);
+        log_display (category, text);
+        return;
     }
-#endif
+
+    // claim the next record in the ring. the last part of the ring is kept for the messages
+    // that are always displayed, so a flood of selectable messages can't crowd them out.
+    unsigned long pos = __atomic_load_n (&log_tail, __ATOMIC_RELAXED);
+    unsigned long limit = (category & PRINT_ALWAYS) ? LOG_RING_SIZE : LOG_RING_SIZE - LOG_RING_RESERVE;
+    tLogRecStc * rec;
+    while (true)
+    {
+        if (pos - __atomic_load_n (&log_head, __ATOMIC_RELAXED) >= limit)
+        {
+            __atomic_fetch_add (&log_dropped, 1, __ATOMIC_RELAXED); // the ring is (nearly) full
+            return;
+        }
+        rec = &log_ring[pos & (LOG_RING_SIZE - 1)];
+        long diff = (long)(__atomic_load_n (&rec->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n (&log_tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+        {
+            __atomic_fetch_add (&log_dropped, 1, __ATOMIC_RELAXED); // the ring is full
+            return;
+        }
+        else
+        {
+            pos = __atomic_load_n (&log_tail, __ATOMIC_RELAXED); // another thread claimed it
+        }
+    }
+
+    // capture the message and hand it to the display thread
+    rec->category = category;
+    rec->fmt      = fmt;
+    clock_gettime (CLOCK_MONOTONIC, &rec->time);
+    va_start(args, fmt);
+    log_capture (rec, args);
+    va_end(args);
+    __atomic_store_n (&rec->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n (&log_waiting, __ATOMIC_SEQ_CST))
+        pthread_cond_signal (&log_wait_cond);
 }
 
-int userio_get_command ( int * value, char * buffer, int size )
+/*
+ * Description:
+ * Returns the statistics of the log display.
+ *
+ * Inputs:
+ *   stats - ptr to location to return the statistics in
+ *
+ * *Returns:
+ *   <none>
+ */
+void logmsg_stats ( tLogStatsStc * stats )
 {
-    int command = ACTION_INVALID;
+    stats->records = __atomic_load_n (&log_records, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n (&log_dropped, __ATOMIC_RELAXED);
+    stats->max_lag = __atomic_load_n (&log_max_lag, __ATOMIC_RELAXED) / 1000000.0;
+}
 
-    if ((value == 0) || (buffer == 0) || (size == 0))
-        return ACTION_INVALID;
+#ifdef NCURSES_BOOL
+/*
+ * Description:
+ * Reads a command line typed in. ncurses is not thread safe, so the keys are only read with
+ * log_mutex held (the display thread draws the windows meanwhile), without waiting (nodelay):
+ * the input thread waits for them on the terminal, with the mutex released. The keys already
+ * taken in by ncurses (typed ahead of the line) are read before waiting.
+ *
+ * Inputs:
+ *   line - ptr to location to return the line in
+ *   size - the size of line (longer lines are cut)
+ *
+ * *Returns:
+ *   0 if a line was read, -1 if the input ended
+ */
+static int input_read_line ( char * line, int size )
+{
+    int len = 0;
+    while (true)
+    {
+        bool done = false;
+        int key;
+        pthread_mutex_lock (&log_mutex);
+        while (!done && (key = wgetch (stdscr)) != ERR)
+        {
+            if (key == '\n' || key == '\r' || key == KEY_ENTER)
+                done = true;
+            else if (key == KEY_BACKSPACE || key == 127 || key == '\b')
+                len -= (len > 0);
+            else if (key >= ' ' && key < 127 && len < size - 1)
+                line[len++] = key;
+        }
+        pthread_mutex_unlock (&log_mutex);
+        if (done)
+        {
+            line[len] = 0;
+            return 0;
+        }
 
-    // read the user input
+        struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+        if (poll (&pfd, 1, -1) < 0 && errno != EINTR)
+            return -1;
+        if ((pfd.revents & (POLLHUP | POLLERR | POLLNVAL)) && !(pfd.revents & POLLIN))
+            return -1;
+    }
+}
+#endif
+
+/*
+ * Description:
+ * This is the input thread. It reads the command lines typed in (blocking until each line is
+ * complete) and adds them to the input ring for the main thread, signalling the input
+ * eventfd. If the main thread is a full ring of lines behind, it waits for room.
+ * Headless, it reads the lines of the command file instead (skipping the empty ones), as fast
+ * as the main thread takes them, and signals the end of the file once they are all added.
+ *
+ * Inputs:
+ *   arg - <unused>
+ *
+ * *Returns:
+ *   NULL (when the input ends)
+ */
+static void * input_thread ( void * arg )
+{
+    char line[INPUT_LINE_MAX];
+    (void)arg;
+
+    // the signals are handled by the other threads (so they don't interrupt the read)
+    sigset_t mask;
+    sigfillset (&mask);
+    pthread_sigmask (SIG_BLOCK, &mask, NULL);
+
+    while (true)
+    {
+        memset (line, 0, sizeof(line));
+        if (input_file)
+        {
+            if (fgets (line, sizeof(line), input_file) == NULL)
+            {
+                __atomic_store_n (&input_ended, true, __ATOMIC_RELEASE); // (signalled below, after the lines)
+                break;
+            }
+            line[strcspn (line, "\r\n")] = 0;
+            if (line[0] == 0)
+                continue;
+        }
+        else
+        {
 #ifdef NCURSES_BOOL
-    getstr(buffer);
-    wprintw (win_input, "%s", buffer);
+            if (input_read_line (line, sizeof(line)) < 0)
+                break;
+            logmsg(PRINT_QUERY, "%s\n", line);
 #else
-    fgets(buffer, size - 1, stdin);
+            if (fgets (line, sizeof(line), stdin) == NULL)
+                break; // (end of the input)
 #endif
+        }
+
+        while (input_tail - __atomic_load_n (&input_head, __ATOMIC_ACQUIRE) == INPUT_RING_SIZE)
+            usleep (1000);
+        memcpy (input_ring[input_tail & (INPUT_RING_SIZE - 1)], line, sizeof(line));
+        __atomic_store_n (&input_tail, input_tail + 1, __ATOMIC_RELEASE);
+
+        uint64_t count = 1;
+        if (write (input_fd, &count, sizeof(count)) < 0)
+            logmsg(PRINT_ERROR, "eventfd write [input]: %s\n", strerror(errno));
+    }
+
+    if (input_ended)
+    {
+        uint64_t count = 1;
+        if (write (input_fd, &count, sizeof(count)) < 0)
+            logmsg(PRINT_ERROR, "eventfd write [input]: %s\n", strerror(errno));
+    }
+    return NULL;
+}
+
+/*
+ * Description:
+ * Returns the descriptor that is readable while command lines are waiting for the main thread
+ * (to be monitored by its event loop, level-triggered).
+ *
+ * Inputs:
+ *   <none>
+ *
+ * *Returns:
+ *   the input eventfd
+ */
+int userio_input_fd ( void )
+{
+    return input_fd;
+}
+
+/*
+ * Description:
+ * Takes the next command line typed in from the input ring and parses it. It never waits:
+ * the lines are read by the input thread, so the main thread only calls this when the input
+ * eventfd is readable, and takes all the lines waiting.
+ *
+ * Inputs:
+ *   value  - ptr to location to return the value of the command in (see ACTION_xxx)
+ *   buffer - ptr to location to return the command line in
+ *   size   - the size of buffer
+ *
+ * *Returns:
+ *   the command (ACTION_xxx), ACTION_NONE if no more lines are waiting, ACTION_END_INPUT (once)
+ *   when all the lines of the command file have been taken
+ */
+int userio_get_command ( int * value, char * buffer, int size )
+{
+    if ((value == 0) || (buffer == 0) || (size == 0))
+        return ACTION_INVALID;
+
+    // take the next line (the eventfd is cleared before the ring is found empty, so a line
+    // added after that signals it again). the end of the command file is set after its last
+    // line is added, so it is only taken once that line has been.
+    unsigned long head = input_head;
+    bool ended = __atomic_load_n (&input_ended, __ATOMIC_ACQUIRE);
+    if (head == __atomic_load_n (&input_tail, __ATOMIC_ACQUIRE))
+    {
+        uint64_t count;
+        if (read (input_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            logmsg(PRINT_ERROR, "eventfd read [input]: %s\n", strerror(errno));
+        if (head == __atomic_load_n (&input_tail, __ATOMIC_ACQUIRE))
+        {
+            if (ended && !input_end_taken)
+            {
+                input_end_taken = true;
+                return ACTION_END_INPUT;
+            }
+            return ACTION_NONE;
+        }
+    }
+    strncpy (buffer, input_ring[head & (INPUT_RING_SIZE - 1)], size - 1);
+    buffer[size - 1] = 0;
+    __atomic_store_n (&input_head, head + 1, __ATOMIC_RELEASE);
+
+    return userio_parse_command (value, buffer);
+}
+
+/*
+ * Description:
+ * Parses a command line (typed in, read from the command file or received on the control
+ * socket).
+ *
+ * Inputs:
+ *   value  - ptr to location to return the value of the command in (see ACTION_xxx)
+ *   buffer - the command line
+ *
+ * *Returns:
+ *   the command (ACTION_xxx)
+ */
+int userio_parse_command ( int * value, const char * buffer )
+{
+    int command = ACTION_INVALID;
 
     // check if we received a command
     if (buffer[0] == '#')
     {
         char invalid_char = 0;
-        char * flag = &buffer[2];
+        const char * flag = &buffer[2];
 
         switch (buffer[1])
         {
@@ -134,8 +1154,12 @@ int userio_get_command ( int * value, char * buffer, int size )
         case 's':   command = ACTION_SEL_ENDPOINT;      *value = atoi(&buffer[2]);      break;
         case 'z':   command = ACTION_DELAY;             break;
         case 't':   command = ACTION_TEST;              *value = atoi(&buffer[2]);      break;
+        case 'l':   command = ACTION_SHOW_LATENCY;      *value = (buffer[2] == '0');    break;
+        case 'w':   command = ACTION_WAIT;              *value = atoi(&buffer[2]);      break;
+        case 'j':   command = ACTION_SHOW_STATS;        break;
+        case 'b':   command = ACTION_BULK;              break;
+        case 'r':   command = ACTION_PINGPONG;          break;
 
-#ifndef NCURSES_BOOL // these are only used if gui not running
         case 'p':   command = ACTION_SET_PRINT_FLAG;    *value = 0;
             while (!invalid_char && *flag > ' ')
             {
@@ -159,10 +1183,16 @@ int userio_get_command ( int * value, char * buffer, int size )
             }
             break;
 
-        case 'd':
+        case 'd':   // (only used if the gui is not running)
+#ifdef NCURSES_BOOL
+            if (log_ui)
+            {
+                logmsg(PRINT_ERROR, "Invalid command\n");
+                break;
+            }
+#endif
             command = ACTION_SHOW_CONNECTIONS;
             break;
-#endif
 
         default:
             logmsg(PRINT_ERROR, "Invalid command\n");
@@ -242,37 +1272,101 @@ void create_box ( WIN *p_win, bool flag )
 }
 #endif
 
-void userio_init ( void )
+/*
+ * Description:
+ * Starts the user interface: the ncurses windows (unless headless), the log display thread and
+ * the input thread. Headless, the log messages are written to stderr, and the command lines
+ * are read from the command file (if any) rather than typed in.
+ *
+ * Inputs:
+ *   headless     - true to run without the windows
+ *   command_path - the command file to read the command lines from when headless ("-" for
+ *                  stdin), NULL for none (the commands only come from the control socket)
+ *
+ * *Returns:
+ *   <none>
+ */
+void userio_init ( bool headless, const char * command_path )
 {
+    if (headless)
+    {
+        log_out = stderr;
+        if (command_path != NULL)
+        {
+            input_file = strcmp (command_path, "-") ? fopen (command_path, "r") : stdin;
+            if (input_file == NULL)
+            {
+                fprintf (stderr, " ! ERROR, command file %s: %s\n", command_path, strerror(errno));
+                exit(1);
+            }
+        }
+    }
+
 #ifdef NCURSES_BOOL
-//    WIN  win;
-    initscr();      // start ncurses
-    cbreak();       // allow control chars to act. (use raw() to prevent use of signals from keyboard)
-    noecho();       // echo keyboard input (use noecho() to allow better presentation of key input)
-    keypad(stdscr, true);  // enable ability to get function and arrow keys from user input
-    // setup windows for GUI: newwin params are: line height, column width, start line(y), start column(x)
-    const int w_inp = 20,  h_inp = 10;              // input   window is  20 chars wide and 10 lines in height
-    const int w_msg = 100, h_msg = 40;              // message window is 100 chars wide and 40 lines in height
-    // these are derrived from the above
-    const int w_sta = w_inp, h_sta = h_msg;         // status window is width of input   and height of message
-    const int w_err = w_msg, h_err = h_inp;         // error  window is width of message and height of command
-    const int l_sta = 1        , c_sta = 1;         // status  window is top left
-    const int l_inp = h_msg + 1, c_inp = 1;         // input   window is bottom left
-    const int l_msg = 1        , c_msg = w_inp + 1; // message window is top right
-    const int l_err = h_msg + 1, c_err = w_inp + 1; // error   window is bottom right
-    win_status = newwin(h_sta, w_sta, l_sta, c_sta);    box (win_status, 0, 0);   wrefresh(win_status);
-    win_msgs   = newwin(h_msg, w_msg, l_msg, c_msg);    box (win_msgs  , 0, 0);   wrefresh(win_msgs);
-    win_input  = newwin(h_inp, w_inp, l_inp, c_inp);    box (win_input , 0, 0);   wrefresh(win_input);
-    win_error  = newwin(h_err, w_err, l_err, c_err);    box (win_error , 0, 0);   wrefresh(win_error);
-//    init_win_params (&win);  // init window parameters
-//    create_box(&win, true);  // display the window borders
+    if (!headless)
+    {
+//        WIN  win;
+        log_ui = true;
+        initscr();      // start ncurses
+        cbreak();       // allow control chars to act. (use raw() to prevent use of signals from keyboard)
+        noecho();       // echo keyboard input (use noecho() to allow better presentation of key input)
+        keypad(stdscr, true);  // enable ability to get function and arrow keys from user input
+        nodelay(stdscr, true); // the keys are read without waiting (see input_read_line)
+        // setup windows for GUI: newwin params are: line height, column width, start line(y), start column(x)
+        const int w_inp = 20,  h_inp = 10;              // input   window is  20 chars wide and 10 lines in height
+        const int w_msg = 100, h_msg = 40;              // message window is 100 chars wide and 40 lines in height
+        // these are derrived from the above
+        const int w_sta = w_inp, h_sta = h_msg;         // status window is width of input   and height of message
+        const int w_err = w_msg, h_err = h_inp;         // error  window is width of message and height of command
+        const int l_sta = 1        , c_sta = 1;         // status  window is top left
+        const int l_inp = h_msg + 1, c_inp = 1;         // input   window is bottom left
+        const int l_msg = 1        , c_msg = w_inp + 1; // message window is top right
+        const int l_err = h_msg + 1, c_err = w_inp + 1; // error   window is bottom right
+        win_status = newwin(h_sta, w_sta, l_sta, c_sta);    box (win_status, 0, 0);   wrefresh(win_status);
+        win_msgs   = newwin(h_msg, w_msg, l_msg, c_msg);    box (win_msgs  , 0, 0);   wrefresh(win_msgs);
+        win_input  = newwin(h_inp, w_inp, l_inp, c_inp);    box (win_input , 0, 0);   wrefresh(win_input);
+        win_error  = newwin(h_err, w_err, l_err, c_err);    box (win_error , 0, 0);   wrefresh(win_error);
+        pane_input.window = win_input;
+        pane_msgs.window  = win_msgs;
+        pane_error.window = win_error;
+//        init_win_params (&win);  // init window parameters
+//        create_box(&win, true);  // display the window borders
+    }
 #endif
+
+    // display the log messages from a separate thread (a forked child starts its own, and
+    // the messages still in the ring are displayed when the process exits)
+    for (unsigned long pos = 0; pos < LOG_RING_SIZE; pos++)
+        log_ring[pos].seq = pos;
+    pthread_atfork (NULL, NULL, log_atfork_child);
+    atexit (log_stop);
+    log_start ();
+
+    // read the command lines from a separate thread (the main thread is signalled by the
+    // eventfd, so it keeps serving the sockets while a line is being typed)
+    input_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (input_fd < 0)
+    {
+        logmsg(PRINT_ERROR, "eventfd [input]: %s\n", strerror(errno));
+        exit(1);
+    }
+    // (headless without a command file, there are no lines to read)
+    if (headless && input_file == NULL)
+        return;
+    if (pthread_create (&input_tid, NULL, input_thread, NULL) != 0)
+    {
+        logmsg(PRINT_ERROR, "input thread could not be created\n");
+        exit(1);
+    }
+    pthread_detach (input_tid);
 }
 
 void userio_exit ( void )
 {
+    log_stop ();    // display the messages still waiting
 #ifdef NCURSES_BOOL
-    endwin();      // exit ncurses
+    if (log_ui)
+        endwin();  // exit ncurses
 #endif
 }
 
@@ -18,8 +18,68 @@
 #define PRINT_OTHER     0x0080      // other messages
 #define PRINT_ALL       (PRINT_SENT | PRINT_RCVD | PRINT_SOCKET | PRINT_OTHER)
 // always displayed are error messages and the messages received by the endpoint from the server
+#define PRINT_ALWAYS    (PRINT_ERROR | PRINT_WARNING | PRINT_QUERY | PRINT_STATUS)
+
+// these are the categories compiled in, selected by the build profile. logmsg calls for the
+// other categories compile to nothing (their arguments are not even evaluated).
+//  LOG_PROFILE_QUIET  - no per-message logs (sent and received messages)
+//  LOG_PROFILE_SILENT - only the messages that are always displayed
+#ifndef LOG_COMPILED
+#if defined(LOG_PROFILE_SILENT)
+#define LOG_COMPILED    ( PRINT_ALWAYS )
+#elif defined(LOG_PROFILE_QUIET)
+#define LOG_COMPILED    ( PRINT_ALWAYS | PRINT_SOCKET | PRINT_OTHER )
+#else
+#define LOG_COMPILED    ( PRINT_ALWAYS | PRINT_ALL )
+#endif
+#endif
+
+// the log message selections for display (set at run time by the #p command)
+extern int print_flag;
+
+// this logs a message if its category is compiled in and selected for display. a category
+// that is compiled out is a constant false condition, and a category that is not selected
+// is rejected by a single test before any argument is evaluated.
+#define logmsg(category, ...) \
+    do { \
+        if (((category) & LOG_COMPILED) && ((category) & (print_flag | PRINT_ALWAYS))) \
+            log_write ((category), __VA_ARGS__); \
+    } while (0)
+
+// the number of bytes shown of a message sent or received (the start of it, with "%.*s")
+#define LOG_MSG_PEEK        ( 30 )
+#define log_peek(msglen)    ( ((msglen) < LOG_MSG_PEEK) ? (msglen) : LOG_MSG_PEEK )
+
+// the log ring holding the messages waiting to be displayed by the log display thread
+#define LOG_RING_SIZE       ( 4096 )    // number of messages (must be a power of 2)
+#define LOG_RING_RESERVE    ( LOG_RING_SIZE / 4 ) // messages kept for the PRINT_ALWAYS categories
+#define LOG_MAX_ARGS        ( 16 )      // max number of arguments captured for a message
+#define LOG_STR_SPACE       ( 320 )     // space for copies of the string arguments of a message
+#define LOG_LINE_MAX        ( 512 )     // max length of a displayed message
+
+// the windows are redrawn at a fixed frame rate (not for each message), from the last
+// lines logged to each of them
+#define LOG_FRAME_NSEC      ( 50000000 ) // the time between frames (20 Hz)
+#define LOG_SCROLLBACK      ( 256 )     // number of lines kept for each window (must be a power of 2)
+#define STATUS_TEXT_MAX     ( 4096 )    // max length of the text of the status window
+
+// the input ring holding the command lines typed in (or read from the command file), waiting
+// for the main thread
+#define INPUT_RING_SIZE     ( 256 )     // number of lines (must be a power of 2)
+#define INPUT_LINE_MAX      ( 256 )     // max length of a line (longer lines are cut)
+
+// this holds the statistics of the log display
+typedef struct
+{
+    unsigned long records;  // number of messages displayed
+    unsigned long dropped;  // number of messages dropped because the log ring was full
+    double        max_lag;  // the longest a message waited to be displayed (msec)
+
+} tLogStatsStc;
 
 // these are the command return values from userio_get_command()
+#define ACTION_END_INPUT        ( -3 )  // all the lines of the command file have been taken
+#define ACTION_NONE             ( -2 )  // no more command lines waiting
 #define ACTION_INVALID          ( -1 )
 #define ACTION_QUIT             ( 0 )   // specify: <none>
 #define ACTION_SEND_MESSAGE     ( 1 )   // specify: char * message
@@ -30,11 +90,20 @@
 #define ACTION_TEST             ( 6 )   // specify: int count
 #define ACTION_SET_PRINT_FLAG   ( 7 )   // specify: int value
 #define ACTION_SHOW_CONNECTIONS ( 8 )   // specify: <none>
+#define ACTION_SHOW_LATENCY     ( 9 )   // specify: int clear (1 to clear the round-trip times after showing them)
+#define ACTION_WAIT             ( 10 )  // specify: int msec (0 to wait until the load, bulk or ping-pong test is done)
+#define ACTION_SHOW_STATS       ( 11 )  // specify: <none>
+#define ACTION_BULK             ( 12 )  // specify: <none> (the parameters are in the command line)
+#define ACTION_PINGPONG         ( 13 )  // specify: <none> (the parameters are in the command line)
 
 // function prototypes:
-void userio_init ( void );
+void userio_init ( bool headless, const char * command_path );
 void userio_exit ( void );
+int  userio_input_fd ( void );
+void userio_set_status ( const char * text );
 int  userio_get_command ( int * value, char * buffer, int size );
-void logmsg ( int type, const char * fmt, ... );
+int  userio_parse_command ( int * value, const char * buffer );
+void log_write ( int type, const char * fmt, ... );
+void logmsg_stats ( tLogStatsStc * stats );
 
 
@@ -0,0 +1,514 @@
+//=============================================================================
+//
+// This is the worker process pool module of the Interactive Endpoint project.
+// The workers are forked once, at startup, and each runs an event loop serving many client
+// connections as sessions (like a reactor thread, but in its own process). The main thread
+// accepts the connections and passes each one to the worker with the fewest connections over
+// a UNIX-domain socketpair, the socket itself going as SCM_RIGHTS ancillary data. The workers
+// report back on the same socketpair as their sessions open and close, with their load.
+//
+//=============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "userio.h"     // for logmsg
+#include "netio.h"
+#include "msgqueue.h"
+#include "evloop.h"
+#include "shmlink.h"
+#include "bulk.h"
+#include "reactor.h"
+#include "workers.h"
+
+// this holds the state of a worker process, in the worker
+typedef struct
+{
+    int    index;           // index of the worker in the pool
+    int    chanfd;          // the worker's end of the socketpair to the main thread
+    tEvLoopStc loop;        // the event loop for the channel and the sessions
+    tSessionStc ** sessions; // the sessions being served, by slot
+    int    count;           // number of sessions being served
+    unsigned long msgs;     // number of messages echoed
+    unsigned long reported; // msgs at the last report
+    struct timespec report_time; // time of the last report
+    bool   recv_delay;      // true if the read process is to be slowed down
+
+} tWorkerProcStc;
+
+/*
+ * Description:
+ * Reports a session of the worker opening or closing to the main thread, with the load of
+ * the worker.
+ *
+ * Inputs:
+ *   proc   - the worker
+ *   slot   - the session index (-1 to only report the load)
+ *   closed - true if the session was closed (or could not be opened)
+ *
+ * *Returns:
+ *   <none>
+ */
+static void worker_report ( tWorkerProcStc * proc, int slot, bool closed )
+{
+    tWorkerReportStc report;
+    memset (&report, 0, sizeof(report));
+    report.slot     = slot;
+    report.closed   = closed;
+    report.sessions = proc->count;
+    report.msgs     = proc->msgs;
+    while (send (proc->chanfd, &report, sizeof(report), MSG_NOSIGNAL) < 0)
+    {
+        if (errno == EINTR) continue;
+        logmsg(PRINT_ERROR, "worker %d report: %s\n", proc->index, strerror(errno));
+        break;
+    }
+    proc->reported = proc->msgs;
+    clock_gettime (CLOCK_MONOTONIC_COARSE, &proc->report_time);
+}
+
+/*
+ * Description:
+ * Takes the connections handed off by the main thread and opens a session for each. Each is
+ * reported back, opened or not.
+ *
+ * Inputs:
+ *   proc - the worker
+ *
+ * *Returns:
+ *   true if the worker is to go on, false if the main thread has gone
+ */
+static bool worker_take_handoffs ( tWorkerProcStc * proc )
+{
+    while (true)
+    {
+        tWorkerHandoffStc handoff;
+        char   control[CMSG_SPACE(sizeof(int))];
+        struct iovec  iov = { &handoff, sizeof(handoff) };
+        struct msghdr msg;
+        memset (&msg, 0, sizeof(msg));
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t len = recvmsg (proc->chanfd, &msg, MSG_DONTWAIT);
+        if (len < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            logmsg(PRINT_ERROR, "worker %d handoff recvmsg: %s\n", proc->index, strerror(errno));
+            return false;
+        }
+        if (len == 0)
+            return false; // (the main thread has exited)
+
+        struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        {
+            logmsg(PRINT_ERROR, "worker %d: handoff without a socket\n", proc->index);
+            continue;
+        }
+        int sockfd;
+        memcpy (&sockfd, CMSG_DATA(cmsg), sizeof(int));
+        if (len != sizeof(handoff) || handoff.slot < 0 || handoff.slot >= WORKER_MAX_SESSIONS ||
+            proc->sessions[handoff.slot] != NULL)
+        {
+            logmsg(PRINT_ERROR, "worker %d: invalid handoff\n", proc->index);
+            close (sockfd);
+            continue;
+        }
+
+        if (handoff.recv_delay)
+            proc->recv_delay = true;
+        tSessionStc * session = session_open (&proc->loop, sockfd, handoff.client_port, "worker", proc->index, handoff.slot);
+        if (session != NULL)
+        {
+            proc->sessions[handoff.slot] = session;
+            proc->count++;
+            logmsg(PRINT_OTHER, "worker %d slot %d handling port %u\n", proc->index, handoff.slot, handoff.client_port);
+        }
+        worker_report (proc, handoff.slot, session == NULL);
+    }
+}
+
+/*
+ * Description:
+ * This is the worker process. It waits for events on the sessions it serves and on its
+ * channel to the main thread, which hands it connections. It runs until the main thread
+ * closes the channel (or exits), then closes its sessions.
+ *
+ * Inputs:
+ *   index  - index of the worker in the pool
+ *   chanfd - the worker's end of the socketpair to the main thread
+ *   edge   - true if the sockets are to be registered edge-triggered
+ *
+ * *Returns:
+ *   <none>
+ */
+static void worker_run ( int index, int chanfd, bool edge )
+{
+    tWorkerProcStc proc;
+    memset (&proc, 0, sizeof(proc));
+    proc.index  = index;
+    proc.chanfd = chanfd;
+    proc.sessions = (tSessionStc **)calloc (WORKER_MAX_SESSIONS, sizeof(tSessionStc *));
+    if (proc.sessions == NULL)
+    {
+        logmsg(PRINT_ERROR, "worker %d session table allocation\n", index);
+        return;
+    }
+    if (evloop_init (&proc.loop, edge) < 0)
+    {
+        free (proc.sessions);
+        return;
+    }
+    if (evloop_add (&proc.loop, chanfd, EVLOOP_READ | EVLOOP_LEVEL, NULL) < 0)
+    {
+        evloop_fini (&proc.loop);
+        free (proc.sessions);
+        return;
+    }
+
+    bool running = true;
+    while (running)
+    {
+        int retcode = evloop_wait (&proc.loop, session_busy_poll ? 0 : 1000);
+        if (retcode < 0)
+        {
+            if (errno == EINTR) continue;
+            logmsg(PRINT_ERROR, "epoll_wait [worker %d]: %s\n", index, strerror(errno));
+            break;
+        }
+
+        int evix;
+        for (evix = 0; running && evix < retcode; evix++)
+        {
+            tSessionStc * session = (tSessionStc *)proc.loop.events[evix].data.ptr;
+            uint32_t events = proc.loop.events[evix].events;
+            if (session == (tSessionStc *)&evloop_forgotten)
+                continue; // (the session was closed)
+            if (session == NULL)
+            {
+                // connections handed off by the main thread
+                running = worker_take_handoffs (&proc);
+                continue;
+            }
+            if (SHM_IS_DOORBELL(session))
+            {
+                session = (tSessionStc *)SHM_DOORBELL_OWNER(session);
+                events = 0;
+            }
+
+            int sent = session->send_count;
+            bool open = session_handle (session, events, proc.recv_delay);
+            proc.msgs += session->send_count - sent;
+            if (!open)
+            {
+                int slot = session->slot;
+                proc.sessions[slot] = NULL;
+                proc.count--;
+                session_close (session);
+                worker_report (&proc, slot, true);
+            }
+        }
+
+        // report the messages echoed since the last report, now and then
+        if (proc.msgs != proc.reported)
+        {
+            struct timespec now;
+            clock_gettime (CLOCK_MONOTONIC_COARSE, &now);
+            if ((now.tv_sec - proc.report_time.tv_sec) * 1000 + (now.tv_nsec - proc.report_time.tv_nsec) / 1000000 >= WORKER_REPORT_MSEC)
+                worker_report (&proc, -1, false);
+        }
+    }
+
+    // close all the sessions still open
+    int slot;
+    for (slot = 0; slot < WORKER_MAX_SESSIONS; slot++)
+        if (proc.sessions[slot])
+            session_close (proc.sessions[slot]);
+    free (proc.sessions);
+    evloop_fini (&proc.loop);
+    close (chanfd);
+    logmsg(PRINT_OTHER, "worker %d (pid %d) terminating (%lu msgs, %lu syscalls)\n", index, (int)getpid(),
+            proc.msgs, proc.loop.calls + tcp_syscall_count);
+}
+
+/*
+ * Description:
+ * Creates the pool of worker processes. This is to be done before the main thread opens its
+ * other descriptors, since the workers inherit whatever is open (each closes the channels
+ * of the workers forked before it).
+ *
+ * Inputs:
+ *   pool  - ptr to the pool to initialize
+ *   count - the number of workers
+ *   edge  - true if the workers register their sockets edge-triggered
+ *
+ * *Returns:
+ *   0 if successful, -1 if error
+ */
+int worker_pool_init ( tWorkerPoolStc * pool, int count, bool edge )
+{
+    if (count > WORKER_MAX_PROCS)
+        count = WORKER_MAX_PROCS;
+
+    pool->count   = 0;
+    pool->workers = (tWorkerStc *)calloc (count, sizeof(tWorkerStc));
+    if (pool->workers == NULL)
+    {
+        logmsg(PRINT_ERROR, "worker pool allocation\n");
+        return -1;
+    }
+
+    int ix;
+    for (ix = 0; ix < count; ix++)
+    {
+        tWorkerStc * worker = &pool->workers[ix];
+        worker->index  = ix;
+        worker->chanfd = -1;
+
+        // the channel keeps the message boundaries, so each handoff and report is read whole
+        int sv[2];
+        if (socketpair (AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0)
+        {
+            logmsg(PRINT_ERROR, "worker socketpair: %s\n", strerror(errno));
+            worker_pool_fini (pool);
+            return -1;
+        }
+
+        pid_t pid = fork ();
+        if (pid < 0)
+        {
+            logmsg(PRINT_ERROR, "fork: %s\n", strerror(errno));
+            close (sv[0]);
+            close (sv[1]);
+            worker_pool_fini (pool);
+            return -1;
+        }
+        if (pid == 0)
+        {
+            // the worker keeps only its own end of its own channel
+            close (sv[0]);
+            int jx;
+            for (jx = 0; jx < ix; jx++)
+                close (pool->workers[jx].chanfd);
+            worker_run (ix, sv[1], edge);
+            exit (0);
+        }
+
+        close (sv[1]);
+        fcntl (sv[0], F_SETFL, O_NONBLOCK);
+        worker->pid    = pid;
+        worker->chanfd = sv[0];
+
+        // all the slots are free
+        worker->free_count = WORKER_MAX_SESSIONS;
+        int slot;
+        for (slot = 0; slot < WORKER_MAX_SESSIONS; slot++)
+            worker->free_slots[slot] = WORKER_MAX_SESSIONS - 1 - slot;
+        pool->count++;
+    }
+
+    logmsg(PRINT_OTHER, "pre-forked %d worker processes\n", pool->count);
+    return 0;
+}
+
+/*
+ * Description:
+ * Stops all the worker processes and frees the pool. Closing its channel has a worker close
+ * the connections it serves and exit. The channels must have been removed from the event loop.
+ *
+ * Inputs:
+ *   pool - ptr to the pool
+ *
+ * *Returns:
+ *   <none>
+ */
+void worker_pool_fini ( tWorkerPoolStc * pool )
+{
+    int ix;
+    for (ix = 0; ix < pool->count; ix++)
+        if (pool->workers[ix].chanfd >= 0)
+            close (pool->workers[ix].chanfd);
+
+    free (pool->workers);
+    pool->workers = NULL;
+    pool->count   = 0;
+}
+
+/*
+ * Description:
+ * Hands an accepted connection off to the worker with the fewest connections. The socket is
+ * passed to the worker and closed here.
+ *
+ * Inputs:
+ *   pool        - ptr to the pool
+ *   sockfd      - the data socket of the accepted connection
+ *   client_port - the port of the client
+ *   recv_delay  - true if the worker is to slow down its reads
+ *   slot        - ptr to location to return the session index within the worker
+ *
+ * *Returns:
+ *   the index of the worker serving the connection, -1 if error (the connection is dropped)
+ */
+int worker_pool_assign ( tWorkerPoolStc * pool, int sockfd, int client_port, bool recv_delay, int * slot )
+{
+    tWorkerStc * worker = NULL;
+    int ix;
+    for (ix = 0; ix < pool->count; ix++)
+    {
+        tWorkerStc * candidate = &pool->workers[ix];
+        if (!candidate->lost && candidate->free_count > 0 && (worker == NULL || candidate->load < worker->load))
+            worker = candidate;
+    }
+    if (worker == NULL)
+    {
+        logmsg(PRINT_ERROR, "no worker session available for port %u\n", client_port);
+        close (sockfd);
+        return -1;
+    }
+
+    tWorkerHandoffStc handoff;
+    memset (&handoff, 0, sizeof(handoff));
+    handoff.client_port = client_port;
+    handoff.slot        = worker->free_slots[worker->free_count - 1];
+    handoff.recv_delay  = recv_delay;
+
+    char   control[CMSG_SPACE(sizeof(int))];
+    struct iovec  iov = { &handoff, sizeof(handoff) };
+    struct msghdr msg;
+    memset (control, 0, sizeof(control));
+    memset (&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+    memcpy (CMSG_DATA(cmsg), &sockfd, sizeof(int));
+
+    ssize_t len;
+    do
+        len = sendmsg (worker->chanfd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    while (len < 0 && errno == EINTR);
+    close (sockfd); // (the worker has its own descriptor for it now)
+    if (len < 0)
+    {
+        logmsg(PRINT_ERROR, "handoff to worker %d (port %u): %s\n", worker->index, client_port, strerror(errno));
+        return -1;
+    }
+
+    *slot = worker->free_slots[--worker->free_count];
+    worker->in_use[*slot] = true;
+    worker->load++;
+    worker->accepts++;
+    return worker->index;
+}
+
+/*
+ * Description:
+ * Returns the next session a worker reports closed and releases its slot. Called by the main
+ * thread (until it returns false) when the channel of the worker is readable. If the worker
+ * has gone, it is marked lost, and all its slots are returned as closed; its channel is then
+ * to be removed from the event loop and dropped (see worker_pool_drop).
+ *
+ * Inputs:
+ *   worker - the worker whose channel is readable
+ *   slot   - ptr to location to return the session index within the worker
+ *
+ * *Returns:
+ *   true if a closed session was returned, false if there are no more
+ */
+bool worker_pool_closed ( tWorkerStc * worker, int * slot )
+{
+    while (!worker->lost)
+    {
+        tWorkerReportStc report;
+        ssize_t len = recv (worker->chanfd, &report, sizeof(report), MSG_DONTWAIT);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return false;
+        if (len == sizeof(report))
+        {
+            worker->sessions = report.sessions;
+            worker->msgs     = report.msgs;
+            if (report.closed && report.slot >= 0 && report.slot < WORKER_MAX_SESSIONS && worker->in_use[report.slot])
+            {
+                *slot = report.slot;
+                break;
+            }
+            continue;
+        }
+
+        // the worker has gone, and the connections it served with it
+        logmsg(PRINT_ERROR, "worker %d (pid %d) lost: %s\n", worker->index, (int)worker->pid,
+                (len < 0) ? strerror(errno) : "channel closed");
+        worker->lost     = true;
+        worker->sessions = 0;
+    }
+
+    if (worker->lost)
+    {
+        for (*slot = 0; *slot < WORKER_MAX_SESSIONS && !worker->in_use[*slot]; (*slot)++)
+            ;
+        if (*slot == WORKER_MAX_SESSIONS)
+            return false;
+    }
+
+    worker->in_use[*slot] = false;
+    worker->free_slots[worker->free_count++] = *slot;
+    worker->load--;
+    return true;
+}
+
+/*
+ * Description:
+ * Closes the channel of a lost worker, once it has been removed from the event loop.
+ *
+ * Inputs:
+ *   worker - the lost worker
+ *
+ * *Returns:
+ *   <none>
+ */
+void worker_pool_drop ( tWorkerStc * worker )
+{
+    if (worker->chanfd >= 0)
+        close (worker->chanfd);
+    worker->chanfd = -1;
+}
+
+/*
+ * Description:
+ * Displays the connections of each worker (as counted by the main thread and as last
+ * reported by the worker), the connections handed to it and the messages it has echoed.
+ *
+ * Inputs:
+ *   pool - ptr to the pool
+ *
+ * *Returns:
+ *   <none>
+ */
+void worker_pool_show ( tWorkerPoolStc * pool )
+{
+    int ix;
+    for (ix = 0; ix < pool->count; ix++)
+    {
+        tWorkerStc * worker = &pool->workers[ix];
+        logmsg(PRINT_QUERY, "  worker %d (pid %d)%s: connections %d (%d reported), accepts %lu, msgs %lu\n", ix,
+                (int)worker->pid, worker->lost ? " lost" : "", worker->load, worker->sessions, worker->accepts, worker->msgs);
+    }
+}
@@ -0,0 +1,74 @@
+//=============================================================================
+//
+// This contains the definitions, structures and function prototypes defined by the
+// worker process pool module of the Interactive Endpoint project.
+//
+//=============================================================================
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define WORKER_MAX_PROCS        ( 64 )      // max number of worker processes in the pool
+#define WORKER_MAX_SESSIONS     ( 4096 )    // max number of client connections per worker
+#define WORKER_REPORT_MSEC      ( 500 )     // a busy worker reports its load at least this often
+
+// this is an accepted connection handed from the main thread to a worker (the data socket
+// itself goes with it, as SCM_RIGHTS ancillary data)
+typedef struct
+{
+    int  client_port;   // the port of the client
+    int  slot;          // the session index assigned by the main thread
+    bool recv_delay;    // true if the read process is to be slowed down
+
+} tWorkerHandoffStc;
+
+// this is the report a worker sends back for each connection handed to it: once its session
+// is opened (or could not be), and once it is closed, with the load of the worker. a worker
+// echoing messages also reports its load every WORKER_REPORT_MSEC (with no slot).
+typedef struct
+{
+    int  slot;          // the session index of the connection (-1 for a load report)
+    bool closed;        // true if the session was closed (or could not be opened)
+    int  sessions;      // the number of sessions the worker is serving
+    unsigned long msgs; // the number of messages the worker has echoed
+
+} tWorkerReportStc;
+
+// this holds a worker process, as seen by the main thread. the main thread allocates the
+// session slots of the worker, so a connection is known by its worker and slot from the
+// moment it is handed off.
+typedef struct
+{
+    int    index;           // index of this worker in the pool
+    pid_t  pid;             // the worker process
+    int    chanfd;          // the main thread's end of the socketpair to the worker (-1 once lost)
+    bool   lost;            // true once the worker has gone (its slots are reported closed)
+    int    free_slots[WORKER_MAX_SESSIONS];
+    int    free_count;      // number of entries in free_slots
+    bool   in_use[WORKER_MAX_SESSIONS]; // the slots handed off and not reported closed yet
+    int    load;            // number of slots in use
+    int    sessions;        // number of sessions the worker last reported serving
+    unsigned long accepts;  // number of connections handed to the worker
+    unsigned long msgs;     // number of messages the worker last reported echoing
+
+} tWorkerStc;
+
+// this holds the pool of worker processes
+typedef struct
+{
+    int  count;                 // number of workers in the pool
+    tWorkerStc * workers;       // array of count workers
+
+} tWorkerPoolStc;
+
+// true if the event loop data is one of the workers (its channel is readable)
+#define WORKER_IS_CHANNEL(pool, data) \
+    ( (pool)->workers != NULL && (char *)(data) >= (char *)&(pool)->workers[0] && (char *)(data) < (char *)&(pool)->workers[(pool)->count] )
+
+// function prototypes:
+int  worker_pool_init   ( tWorkerPoolStc * pool, int count, bool edge );
+void worker_pool_fini   ( tWorkerPoolStc * pool );
+int  worker_pool_assign ( tWorkerPoolStc * pool, int sockfd, int client_port, bool recv_delay, int * slot );
+bool worker_pool_closed ( tWorkerStc * worker, int * slot );
+void worker_pool_drop   ( tWorkerStc * worker );
+void worker_pool_show   ( tWorkerPoolStc * pool );